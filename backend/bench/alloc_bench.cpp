@@ -0,0 +1,213 @@
+// Heap allocations per feed request: the old way (std::to_string parameters,
+// std::vector bookkeeping, an nlohmann::json document per row, a copied
+// body) against RequestArena bookkeeping, a column-packed WeiboList rendered
+// by render_weibos, and a moved body.
+//
+//   yuyu_bench_alloc [rows] [shards] [requests]
+//
+// Rows stand in for what libpq returns (its own allocations for PGresult are
+// the same either way and are left out). Each line reports allocations and
+// ns per request for one stage of GET /api/weibos and for the whole route.
+#include "arena.h"
+#include "render.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using json = nlohmann::json;
+using namespace YUYU;
+
+static std::atomic<uint64_t> g_allocs{0};
+
+void *operator new(size_t n) {
+    g_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace {
+
+struct Row {
+    long long weibo_id, user_id, created_ms, likes, comments;
+    std::string username, avatar, content, media;
+};
+
+// One shard's newest-first page.
+using Page = std::vector<Row>;
+
+std::vector<Page> make_pages(size_t rows, size_t shards) {
+    std::vector<Page> pages(shards);
+    long long id = 1157968624020483LL;
+    for (size_t i = 0; i < rows * shards; ++i) {
+        id -= 131072;
+        Row r{id, 10000 + static_cast<long long>(i % 97), 1760000000000LL - static_cast<long long>(i) * 1000,
+              static_cast<long long>(i % 13), static_cast<long long>(i % 5), "user_" + std::to_string(i % 97),
+              "/media/avatars/3f9a8c1e2b7d4a6f.jpg", std::string(120, 'x') + "\n\"quoted\"", ""};
+        pages[i % shards].push_back(std::move(r));
+    }
+    return pages;
+}
+
+struct Stage {
+    uint64_t allocs = 0;
+    double ns = 0;
+};
+
+template <typename F>
+Stage measure(size_t requests, F fn) {
+    uint64_t a0 = g_allocs.load();
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < requests; ++i) fn();
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - t0).count();
+    return Stage{g_allocs.load() - a0, ns};
+}
+
+std::string g_sink;
+
+// --- before -------------------------------------------------------------
+
+void params_before(long long before_id, int limit) {
+    std::string s_limit = std::to_string(limit);
+    std::string s_before = std::to_string(before_id);
+    g_sink.assign(1, s_limit[0] ^ s_before[0]);
+}
+
+void render_before(const std::vector<Page> &pages, int limit, std::string &out) {
+    std::vector<const Page *> parts;
+    std::vector<bool> sent(pages.size(), true);
+    for (const Page &p : pages) parts.push_back(&p);
+    struct Head { long long id; size_t shard; size_t row; };
+    auto older = [](const Head &a, const Head &b) { return a.id < b.id; };
+    std::vector<Head> heap;
+    for (size_t k = 0; k < parts.size(); ++k) {
+        if (!parts[k]->empty()) { heap.push_back({(*parts[k])[0].weibo_id, k, 0}); std::push_heap(heap.begin(), heap.end(), older); }
+    }
+    json arr = json::array();
+    while (!heap.empty() && static_cast<int>(arr.size()) < limit) {
+        std::pop_heap(heap.begin(), heap.end(), older);
+        Head h = heap.back();
+        heap.pop_back();
+        const Row &r = (*parts[h.shard])[h.row];
+        json item;
+        item["weibo_id"] = r.weibo_id;
+        item["user_id"] = r.user_id;
+        item["username"] = std::string(r.username.c_str());
+        item["avatar"] = std::string(r.avatar.c_str());
+        item["content"] = std::string(r.content.c_str());
+        item["media"] = std::string(r.media.c_str());
+        item["created_at"] = r.created_ms;
+        item["like_count"] = r.likes;
+        item["comment_count"] = r.comments;
+        item["media_full"] = std::string(r.media.c_str());
+        arr.push_back(std::move(item));
+        if (h.row + 1 < parts[h.shard]->size()) {
+            heap.push_back({(*parts[h.shard])[h.row + 1].weibo_id, h.shard, h.row + 1});
+            std::push_heap(heap.begin(), heap.end(), older);
+        }
+    }
+    json o;
+    o["weibos"] = std::move(arr);
+    out = o.dump();
+}
+
+// --- after --------------------------------------------------------------
+
+void params_after(long long before_id, int limit) {
+    char s_limit[24], s_before[24];
+    *std::to_chars(s_limit, s_limit + 23, limit).ptr = '\0';
+    *std::to_chars(s_before, s_before + 23, before_id).ptr = '\0';
+    g_sink.assign(1, s_limit[0] ^ s_before[0]);
+}
+
+void render_after(const std::vector<Page> &pages, int limit, std::string &out) {
+    std::pmr::memory_resource *arena = RequestArena::resource();
+    std::pmr::vector<const Page *> parts(arena);
+    std::pmr::vector<char> sent(pages.size(), 1, arena);
+    for (const Page &p : pages) parts.push_back(&p);
+    struct Head { long long id; size_t shard; size_t row; };
+    auto older = [](const Head &a, const Head &b) { return a.id < b.id; };
+    std::pmr::vector<Head> heap(arena);
+    heap.reserve(parts.size());
+    for (size_t k = 0; k < parts.size(); ++k) {
+        if (!parts[k]->empty()) { heap.push_back({(*parts[k])[0].weibo_id, k, 0}); std::push_heap(heap.begin(), heap.end(), older); }
+    }
+    WeiboList list;
+    list.reserve(static_cast<size_t>(limit));
+    for (int n = 0; !heap.empty() && n < limit; ++n) {
+        std::pop_heap(heap.begin(), heap.end(), older);
+        Head h = heap.back();
+        heap.pop_back();
+        const Row &r = (*parts[h.shard])[h.row];
+        list.weibo_id.push_back(r.weibo_id);
+        list.user_id.push_back(r.user_id);
+        list.username.push_back(r.username);
+        list.avatar.push_back(r.avatar);
+        list.content.push_back(r.content);
+        list.media.push_back(r.media);
+        list.created_ms.push_back(r.created_ms);
+        list.like_count.push_back(r.likes);
+        list.comment_count.push_back(r.comments);
+        list.media_full.push_back(r.media);
+        if (h.row + 1 < parts[h.shard]->size()) {
+            heap.push_back({(*parts[h.shard])[h.row + 1].weibo_id, h.shard, h.row + 1});
+            std::push_heap(heap.begin(), heap.end(), older);
+        }
+    }
+    render_weibos(list, out);
+}
+
+void report(const char *name, const Stage &before, const Stage &after, size_t requests) {
+    std::printf("%-8s: %8.1f -> %6.1f allocs/request, %9.0f -> %8.0f ns/request\n", name,
+                double(before.allocs) / requests, double(after.allocs) / requests, before.ns / requests,
+                after.ns / requests);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    int rows = argc > 1 ? std::atoi(argv[1]) : 50;
+    size_t shards = argc > 2 ? static_cast<size_t>(std::atoi(argv[2])) : 2;
+    size_t requests = argc > 3 ? static_cast<size_t>(std::atoll(argv[3])) : 20000;
+    if (rows < 1 || shards < 1 || requests < 1) {
+        std::fprintf(stderr, "usage: yuyu_bench_alloc [rows] [shards] [requests]\n");
+        return 1;
+    }
+    std::vector<Page> pages = make_pages(static_cast<size_t>(rows), shards);
+    const long long before_id = 1157968624020483LL;
+    std::printf("feed page of %d rows merged from %zu shards, %zu requests\n", rows, shards, requests);
+
+    Stage p0 = measure(requests, [&] { params_before(before_id, rows); });
+    Stage p1 = measure(requests, [&] { params_after(before_id, rows); });
+    report("params", p0, p1, requests);
+
+    std::string body;
+    Stage r0 = measure(requests, [&] { std::string out; render_before(pages, rows, out); body = out; });
+    RequestArena::begin();
+    render_after(pages, rows, body);   // warm the arena to its working size
+    RequestArena::end();
+    Stage r1 = measure(requests, [&] {
+        RequestArena::begin();
+        std::string out;
+        render_after(pages, rows, out);
+        body = std::move(out);
+        RequestArena::end();
+    });
+    report("render", r0, r1, requests);
+    report("route", Stage{p0.allocs + r0.allocs, p0.ns + r0.ns}, Stage{p1.allocs + r1.allocs, p1.ns + r1.ns},
+           requests);
+
+    RequestArena::Stats st = RequestArena::stats();
+    std::printf("arena   : %zu KiB per thread, body %zu bytes\n", st.capacity >> 10, body.size());
+    return 0;
+}
@@ -0,0 +1,181 @@
+// Search and hot ranking over a generated dataset, in process: reads a
+// snapshot written by `yuyu_bulk generate --out`, decodes its PGCOPY tuples,
+// indexes every weibo and replays every like and comment, then times queries.
+//
+//   yuyu_bench_dataset <file.ds> [queries]
+//
+// Queries are two-character slices of sampled weibos, so every one has hits.
+// Timestamps are moved so that the dataset ends now; the ranking would
+// otherwise drop events that are already too old.
+// No database is involved; the numbers are the in-memory side of
+// /api/search and /api/weibos/hot at the dataset's size.
+#include "bulk.h"
+#include "datagen.h"
+#include "hot_rank.h"
+#include "search_index.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using namespace YUYU;
+
+namespace {
+
+double ms_since(Clock::time_point t0) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+// Hands each whole tuple of table `t` to `row`; pieces of the section may
+// end inside a tuple, which waits for the next piece.
+bool for_each_row(SnapshotFileReader &reader, const SnapshotTable &t,
+                  const std::function<void(CopyRowDecoder &)> &row, std::string &err) {
+    std::string carry;
+    bool ok = reader.read_table(t, [&](const char *p, size_t n) {
+        carry.append(p, n);
+        CopyRowDecoder dec(carry.data(), carry.size());
+        size_t done = 0;
+        for (;;) {
+            CopyRowDecoder probe = dec;
+            int fields = probe.next_row();
+            if (fields == 0) break;
+            for (int i = 0; i < fields; ++i) probe.skip();
+            if (probe.truncated()) break;
+            CopyRowDecoder one(carry.data() + done, probe.offset() - done);
+            one.next_row();
+            row(one);
+            done = probe.offset();
+            dec = probe;
+        }
+        carry.erase(0, done);
+        return true;
+    }, err);
+    if (ok && !carry.empty()) {
+        err = "truncated tuple in " + t.name;
+        return false;
+    }
+    return ok;
+}
+
+// The first two characters of `s`, or "" if it has fewer.
+std::string two_chars(const std::string &s) {
+    size_t i = 0;
+    for (int k = 0; k < 2; ++k) {
+        if (i >= s.size()) return "";
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        i += c < 0x80 ? 1 : c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+    }
+    return i <= s.size() ? s.substr(0, i) : "";
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: yuyu_bench_dataset <file.ds> [queries]\n");
+        return 2;
+    }
+    size_t queries = argc > 2 ? static_cast<size_t>(std::atol(argv[2])) : 10000;
+
+    SnapshotFileReader reader(argv[1]);
+    uint64_t seed = 0;
+    int64_t end_ms = 0;
+    std::string err;
+    if (!reader.open(seed, end_ms, err)) {
+        std::fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+
+    const int64_t shift = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count() - end_ms;
+    SearchIndex search;
+    HotRanker hot;
+    std::vector<std::string> samples;
+    size_t weibos = 0, events = 0;
+    double index_ms = 0, rank_ms = 0;
+    SnapshotTable t;
+    while (reader.next_table(t, err)) {
+        auto t0 = Clock::now();
+        bool ok = true;
+        if (t.name == "weibos") {
+            // weibo_id, user_id, content, media, created_at
+            ok = for_each_row(reader, t, [&](CopyRowDecoder &d) {
+                int64_t id = 0, user = 0, at = end_ms;
+                std::string content;
+                d.get_int8(id);
+                d.get_int8(user);
+                d.get_text(content);
+                d.skip();
+                d.get_timestamp_ms(at);
+                search.add(id, content);
+                hot.record(id, HotRanker::Post, at + shift);
+                if (weibos++ % 97 == 0 && samples.size() < 4096) {
+                    std::string q = two_chars(content);
+                    if (!q.empty()) samples.push_back(std::move(q));
+                }
+            }, err);
+            index_ms = ms_since(t0);
+        } else if (t.name == "likes" || t.name == "comments") {
+            // like_id, weibo_id, user_id, created_at
+            // comment_id, weibo_id, user_id, content, parent_id, created_at
+            const bool like = t.name == "likes";
+            ok = for_each_row(reader, t, [&](CopyRowDecoder &d) {
+                int64_t id = 0, weibo = 0, at = end_ms;
+                d.get_int8(id);
+                d.get_int8(weibo);
+                d.skip();
+                if (!like) {
+                    d.skip();
+                    d.skip();
+                }
+                d.get_timestamp_ms(at);
+                hot.record(weibo, like ? HotRanker::Like : HotRanker::Comment, at + shift);
+                ++events;
+            }, err);
+            rank_ms += ms_since(t0);
+        } else {
+            ok = reader.read_table(t, [](const char *, size_t) { return true; }, err);
+        }
+        if (!ok) {
+            std::fprintf(stderr, "%s: %s\n", t.name.c_str(), err.c_str());
+            return 1;
+        }
+    }
+    if (!err.empty()) {
+        std::fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+
+    std::printf("dataset seed %llu: %zu weibos, %zu likes and comments\n",
+                static_cast<unsigned long long>(seed), weibos, events);
+    std::printf("search index: %zu docs, %zu terms, %.1f MiB, built in %.0f ms\n", search.doc_count(),
+                search.token_count(), search.memory_bytes() / 1048576.0, index_ms);
+
+    auto t0 = Clock::now();
+    hot.refresh();
+    std::printf("hot ranking: %zu tracked, replay %.0f ms (posts counted with the index), refresh %.2f ms\n",
+                hot.tracked(), rank_ms, ms_since(t0));
+
+    if (samples.empty() || queries == 0) return 0;
+    std::vector<double> lat;
+    lat.reserve(queries);
+    size_t hits = 0;
+    for (size_t i = 0; i < queries; ++i) {
+        auto q0 = Clock::now();
+        hits += search.search(samples[i % samples.size()], 20).size();
+        lat.push_back(std::chrono::duration<double, std::micro>(Clock::now() - q0).count());
+    }
+    std::sort(lat.begin(), lat.end());
+    std::printf("search top-20: %zu queries, %.1f hits avg, p50 %.1f us, p99 %.1f us, max %.1f us\n", queries,
+                static_cast<double>(hits) / queries, lat[lat.size() / 2], lat[lat.size() * 99 / 100], lat.back());
+
+    t0 = Clock::now();
+    size_t n = 0;
+    for (size_t i = 0; i < queries; ++i) n += hot.top(50).size();
+    std::printf("hot top-50: %.3f us per call (%zu ids)\n", ms_since(t0) * 1000 / queries, n / queries);
+    return 0;
+}
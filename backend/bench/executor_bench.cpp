@@ -0,0 +1,116 @@
+// Scheduling overhead of WorkStealingExecutor against httplib's ThreadPool.
+//
+//   yuyu_bench_executor [threads] [tasks]
+//
+// Each scenario runs `tasks` near-empty tasks and reports ns per task:
+//   external  - one thread submits everything (the server's accept loop)
+//   producers - every worker-count thread submits its share concurrently
+//   fork-join - tasks spawn two children down to a fixed depth, so most
+//               submissions come from inside the pool
+#include "executor.h"
+#include <httplib.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using namespace YUYU;
+
+namespace {
+
+std::atomic<uint64_t> g_done{0};
+std::atomic<uint64_t> g_sink{0};
+
+void wait_for(uint64_t n) {
+    while (g_done.load(std::memory_order_acquire) < n) std::this_thread::yield();
+}
+
+inline void tiny_work(uint64_t i) { g_sink.fetch_add(i & 1, std::memory_order_relaxed); }
+
+template <typename Submit>
+double external(Submit submit, uint64_t tasks) {
+    g_done = 0;
+    auto t0 = Clock::now();
+    for (uint64_t i = 0; i < tasks; ++i) {
+        submit([i] { tiny_work(i); g_done.fetch_add(1, std::memory_order_release); });
+    }
+    wait_for(tasks);
+    return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / tasks;
+}
+
+template <typename Submit>
+double producers(Submit submit, uint64_t tasks, size_t threads) {
+    g_done = 0;
+    uint64_t per = tasks / threads;
+    auto t0 = Clock::now();
+    std::vector<std::thread> ps;
+    for (size_t p = 0; p < threads; ++p) {
+        ps.emplace_back([&submit, per] {
+            for (uint64_t i = 0; i < per; ++i) {
+                submit([i] { tiny_work(i); g_done.fetch_add(1, std::memory_order_release); });
+            }
+        });
+    }
+    for (auto &t : ps) t.join();
+    wait_for(per * threads);
+    return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / (per * threads);
+}
+
+template <typename Submit>
+void spawn(Submit &submit, int depth) {
+    tiny_work(static_cast<uint64_t>(depth));
+    g_done.fetch_add(1, std::memory_order_release);
+    if (depth == 0) return;
+    submit([&submit, depth] { spawn(submit, depth - 1); });
+    submit([&submit, depth] { spawn(submit, depth - 1); });
+}
+
+template <typename Submit>
+double fork_join(Submit submit, int depth) {
+    g_done = 0;
+    uint64_t total = (uint64_t(1) << (depth + 1)) - 1;
+    auto t0 = Clock::now();
+    submit([&submit, depth] { spawn(submit, depth); });
+    wait_for(total);
+    return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / total;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    size_t threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : std::thread::hardware_concurrency();
+    uint64_t tasks = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 1000000;
+    if (threads == 0) threads = 4;
+    int depth = 1;
+    while ((uint64_t(1) << (depth + 2)) - 1 <= tasks) ++depth;
+
+    std::printf("threads=%zu tasks=%llu fork-join depth=%d\n", threads, static_cast<unsigned long long>(tasks), depth);
+    std::printf("%-22s %12s %12s %12s\n", "pool", "external", "producers", "fork-join");
+
+    {
+        httplib::ThreadPool pool(threads);
+        auto submit = [&pool](std::function<void()> fn) { pool.enqueue(std::move(fn)); };
+        double a = external(submit, tasks);
+        double b = producers(submit, tasks, threads);
+        double c = fork_join(submit, depth);
+        pool.shutdown();
+        std::printf("%-22s %9.1f ns %9.1f ns %9.1f ns\n", "httplib::ThreadPool", a, b, c);
+    }
+    for (int pin = 0; pin < 2; ++pin) {
+        WorkStealingExecutor::Options opt;
+        opt.threads = threads;
+        opt.pin_threads = pin != 0;
+        WorkStealingExecutor ex(opt);
+        auto submit = [&ex](std::function<void()> fn) { ex.submit(std::move(fn)); };
+        double a = external(submit, tasks);
+        double b = producers(submit, tasks, threads);
+        double c = fork_join(submit, depth);
+        ex.shutdown();
+        std::printf("%-22s %9.1f ns %9.1f ns %9.1f ns\n", pin ? "work-stealing (pinned)" : "work-stealing", a, b, c);
+    }
+    return 0;
+}
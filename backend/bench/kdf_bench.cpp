@@ -0,0 +1,101 @@
+// Password hashing throughput and KdfPool admission.
+//
+//   yuyu_bench_kdf [log_n] [r] [p] [seconds]
+//
+//   single    - hashes/sec on one thread (= per core)
+//   all cores - one hashing thread per hardware thread; hashes/sec total and
+//               per core, which drops below `single` once memory bandwidth
+//               rather than the cores is the limit
+//   storm     - 4x the pool's admission limit of concurrent logins against a
+//               KdfPool with default options: how many got a hash, how many
+//               were turned away (Busy), and the latency of the admitted ones
+#include "kdf.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+using namespace YUYU;
+
+namespace {
+
+double hashes_per_sec(const KdfParams &params, size_t threads, double seconds) {
+    std::atomic<uint64_t> done{0};
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> ts;
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < threads; ++i) {
+        ts.emplace_back([&] {
+            std::string out;
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (!hash_password("correct horse battery staple", params, out)) {
+                    std::fprintf(stderr, "scrypt failed\n");
+                    std::exit(1);
+                }
+                done.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (auto &t : ts) t.join();
+    return done.load() / std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+void storm(const KdfParams &params) {
+    KdfPool::Options opt;
+    opt.params = params;
+    KdfPool pool(opt);
+    std::string stored;
+    hash_password("secret", params, stored);
+
+    size_t clients = (pool.options().threads + pool.options().capacity) * 4;
+    std::vector<double> latencies(clients, -1);
+    std::vector<std::thread> ts;
+    for (size_t i = 0; i < clients; ++i) {
+        ts.emplace_back([&, i] {
+            bool match = false;
+            std::string upgraded;
+            auto t0 = Clock::now();
+            if (pool.verify("secret", stored, match, upgraded) == KdfPool::Ok && match) {
+                latencies[i] = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+            }
+        });
+    }
+    for (auto &t : ts) t.join();
+
+    std::vector<double> ok;
+    for (double l : latencies) if (l >= 0) ok.push_back(l);
+    std::sort(ok.begin(), ok.end());
+    auto st = pool.stats();
+    std::printf("storm     : %zu clients, pool %zu threads + %zu queued -> %zu hashed, %llu busy, %llu expired",
+                clients, pool.options().threads, pool.options().capacity, ok.size(),
+                static_cast<unsigned long long>(st.rejected), static_cast<unsigned long long>(st.expired));
+    if (!ok.empty()) std::printf(", p50 %.1f ms, max %.1f ms", ok[ok.size() / 2], ok.back());
+    std::printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    KdfParams params;
+    if (argc > 1) params.log_n = std::atoi(argv[1]);
+    if (argc > 2) params.r = static_cast<uint32_t>(std::atoi(argv[2]));
+    if (argc > 3) params.p = static_cast<uint32_t>(std::atoi(argv[3]));
+    double seconds = argc > 4 ? std::atof(argv[4]) : 3.0;
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::printf("scrypt N=2^%d r=%u p=%u, %.0f MiB per hash, %zu hardware threads\n", params.log_n, params.r,
+                params.p, 128.0 * params.r * (1ull << params.log_n) / (1 << 20), cores);
+    double one = hashes_per_sec(params, 1, seconds);
+    std::printf("single    : %8.1f hashes/s (%.1f ms each)\n", one, 1000.0 / one);
+    double all = hashes_per_sec(params, cores, seconds);
+    std::printf("all cores : %8.1f hashes/s, %.1f per core\n", all, all / cores);
+    storm(params);
+    return 0;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace YUYU {
+
+// Scratch memory for the request a thread is serving.
+//
+// Each thread keeps one buffer; between begin() and end() resource() hands
+// out pieces of it with a bump pointer (std::pmr::monotonic_buffer_resource)
+// and end() takes it all back at once, so the temporaries of a request (id
+// lists, merge heaps, per-shard results) cost no malloc/free pairs. A request
+// that outgrows the buffer spills to the heap, and the buffer is enlarged for
+// the next one, up to kMaxBytes.
+//
+// Only for locals of the request: nothing allocated here may outlive end().
+// Outside a request (startup, background tasks) resource() is the heap.
+class RequestArena {
+public:
+    static const size_t kInitialBytes = 16 << 10;
+    static const size_t kMaxBytes = 1 << 20;
+
+    struct Stats {
+        size_t capacity;   // this thread's buffer
+        size_t spilled;    // bytes taken from the heap since begin()
+    };
+
+    static void begin();
+    static void end();
+    static std::pmr::memory_resource *resource();
+    static Stats stats();
+};
+
+} // namespace YUYU
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+
+typedef struct pg_conn PGconn;
+
+namespace YUYU {
+
+enum class ColumnType { Int8, Text, TimestampMs };
+
+struct ColumnSpec {
+    const char *name;
+    ColumnType type;
+    bool nullable;
+};
+
+// Column layout shared by import, export and the generators. CSV files use the
+// same column names; timestamps are carried as epoch milliseconds (the same
+// unit the HTTP API exposes as created_at).
+struct TableSpec {
+    const char *table;
+    const char *id_column;
+    std::vector<ColumnSpec> columns;
+};
+
+// Tables in foreign-key order (users first, follows last).
+const std::vector<TableSpec> &bulk_tables();
+const TableSpec *find_table(const std::string &name);
+
+// Appends tuples in the PGCOPY binary layout (field count, then length-prefixed
+// big-endian values) to a caller-owned buffer. Used directly by generators that
+// pre-encode rows off the connection thread.
+class CopyRowEncoder {
+public:
+    explicit CopyRowEncoder(std::string &out) : out_(out) {}
+    void start_row(int16_t nfields) { put_be16(static_cast<uint16_t>(nfields)); }
+    void put_int8(int64_t v) { put_be32(8); put_be64(static_cast<uint64_t>(v)); }
+    void put_text(const std::string &s) { put_be32(static_cast<uint32_t>(s.size())); out_.append(s); }
+    void put_timestamp_ms(int64_t unix_ms);
+    void put_null() { put_be32(0xFFFFFFFFu); }
+    void put_trailer() { put_be16(0xFFFF); }
+
+private:
+    void put_be16(uint16_t v) { char b[2] = { char(v >> 8), char(v) }; out_.append(b, 2); }
+    void put_be32(uint32_t v) { char b[4] = { char(v >> 24), char(v >> 16), char(v >> 8), char(v) }; out_.append(b, 4); }
+    void put_be64(uint64_t v) { put_be32(static_cast<uint32_t>(v >> 32)); put_be32(static_cast<uint32_t>(v)); }
+    std::string &out_;
+};
+
+// Walks tuples produced by CopyRowEncoder, e.g. a table of a dataset snapshot
+// read back in process. Field accessors return false on a NULL or truncated
+// field.
+class CopyRowDecoder {
+public:
+    CopyRowDecoder(const char *data, size_t len) : begin_(data), p_(data), end_(data + len) {}
+    // Returns the field count of the next tuple, 0 at the end of data.
+    int next_row();
+    bool get_int8(int64_t &v);
+    bool get_text(std::string &s);
+    bool get_timestamp_ms(int64_t &unix_ms);
+    bool skip();
+    // Bytes consumed so far.
+    size_t offset() const { return static_cast<size_t>(p_ - begin_); }
+    // The data ended inside a tuple; reading pieces of a stream, the rest of
+    // it is in the next piece.
+    bool truncated() const { return truncated_; }
+
+private:
+    bool field(const char *&data, uint32_t &len);
+    const char *begin_;
+    const char *p_;
+    const char *end_;
+    bool truncated_ = false;
+};
+
+// Streams rows into `COPY ... FROM STDIN (FORMAT binary)`. Encoded rows are
+// staged in a buffer that is handed to libpq once it reaches flush_bytes, so
+// memory stays bounded no matter how many rows are written. Each table is
+// one transaction (begin() to finish()) with yuyu.bulk set, so the change
+// triggers skip its rows.
+class CopyWriter {
+public:
+    explicit CopyWriter(PGconn *conn, size_t flush_bytes = 1 << 20);
+    bool begin(const TableSpec &spec, std::string &err);
+    void start_row() { enc_.start_row(nfields_); }
+    void put_int8(int64_t v) { enc_.put_int8(v); }
+    void put_text(const std::string &s) { enc_.put_text(s); }
+    void put_timestamp_ms(int64_t unix_ms) { enc_.put_timestamp_ms(unix_ms); }
+    void put_null() { enc_.put_null(); }
+    bool end_row(std::string &err);
+    // Appends tuples already encoded with CopyRowEncoder for the same columns.
+    bool put_encoded(const char *data, size_t len, std::string &err);
+    bool finish(long &rows_out, std::string &err);
+    void abort(const std::string &reason);
+
+private:
+    bool flush(std::string &err);
+
+    PGconn *conn_;
+    size_t flush_bytes_;
+    int16_t nfields_ = 0;
+    std::string buf_;
+    CopyRowEncoder enc_{buf_};
+    bool active_ = false;
+};
+
+// Minimal RFC 4180 reader: quoted fields, doubled quotes and embedded newlines.
+// Reads one record at a time from the stream.
+class CsvReader {
+public:
+    explicit CsvReader(std::istream &in) : in_(in) {}
+    bool next(std::vector<std::string> &fields, std::vector<bool> &quoted);
+    long line() const { return line_; }
+
+private:
+    std::istream &in_;
+    long line_ = 0;
+};
+
+bool import_csv(PGconn *conn, const TableSpec &spec, std::istream &in, long &rows_out, std::string &err);
+bool export_csv(PGconn *conn, const TableSpec &spec, std::ostream &out, long &rows_out, std::string &err);
+
+// Rows were loaded without change notifications: running backends that
+// follow changes (YUYU_CDC) drop their caches and ETags.
+bool announce_reload(PGconn *conn, std::string &err);
+
+// Moves the BIGSERIAL sequence of spec.id_column past the largest id present,
+// required after loading rows with explicit ids.
+bool sync_sequence(PGconn *conn, const TableSpec &spec, std::string &err);
+bool max_id(PGconn *conn, const TableSpec &spec, long &out, std::string &err);
+// True when the database is one shard of several, as set up by the backend
+// (its id sequences are spread over the shards, see Database::init).
+bool is_sharded(PGconn *conn, bool &out, std::string &err);
+
+} // namespace YUYU
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace YUYU {
+
+// A committed row change, as NOTIFYed by the triggers in db/schema.sql.
+// Columns a and b depend on the table:
+//
+//   weibos    id = weibo_id    a = user_id
+//   likes     id = like_id     a = weibo_id     b = user_id
+//   comments  id = comment_id  a = weibo_id     b = user_id
+//   follows   id = follow_id   a = follower_id  b = followee_id
+//   users     id = user_id
+//
+// Resync stands for changes that were missed (a listener reconnected, a
+// lane overflowed): whatever depends on the tables must be dropped.
+struct RowChange {
+    enum Op : uint8_t { Insert, Update, Delete, Resync };
+    enum Table : uint8_t { Weibos, Likes, Comments, Follows, Users, None };
+
+    Op op = Resync;
+    Table table = None;
+    long long id = 0;
+    long long a = 0;
+    long long b = 0;
+    int node = -1;        // writing backend's YUYU_NODE_ID, -1 if not ours
+    size_t shard = 0;
+
+    // Changes with the same key are applied in commit order: a weibo's own
+    // row, likes and comments share the weibo's key, a follow the follower's.
+    long long key() const {
+        switch (table) {
+        case Likes:
+        case Comments:
+        case Follows: return a;
+        default: return id;
+        }
+    }
+};
+
+// In-process fan-out of row changes to the caches and counters that mirror
+// the tables. Changes are spread over lanes by key, each lane a thread that
+// hands subscribers what queued up since its last round as one batch: per
+// key, order is kept; across keys, lanes run in parallel.
+class ChangeBus {
+public:
+    struct Options {
+        size_t lanes = 4;
+        size_t max_batch = 256;
+        size_t capacity = 65536;    // per lane; beyond it changes turn into a Resync
+    };
+    using Handler = std::function<void(const std::vector<RowChange> &batch)>;
+
+    struct Stats {
+        uint64_t published;
+        uint64_t batches;
+        uint64_t overflows;
+    };
+
+    ChangeBus();
+    explicit ChangeBus(const Options &opt);
+    ~ChangeBus();
+
+    ChangeBus(const ChangeBus &) = delete;
+    ChangeBus &operator=(const ChangeBus &) = delete;
+
+    // Before start(); handlers run on lane threads, possibly concurrently.
+    void subscribe(Handler h);
+    void start();
+    void stop();
+
+    void publish(const RowChange &c);
+    // Delivered on every lane.
+    void publish_resync();
+
+    Stats stats() const;
+
+private:
+    struct Lane {
+        std::mutex mu;
+        std::condition_variable cv;
+        std::deque<RowChange> queue;
+        bool overflowed = false;
+        std::thread worker;
+    };
+    void run(Lane &lane);
+
+    Options opt_;
+    std::vector<Handler> handlers_;
+    std::vector<std::unique_ptr<Lane>> lanes_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<uint64_t> published_{0};
+    std::atomic<uint64_t> batches_{0};
+    std::atomic<uint64_t> overflows_{0};
+};
+
+} // namespace YUYU
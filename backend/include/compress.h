@@ -0,0 +1,45 @@
+#pragma once
+
+#include <httplib.h>
+#include <memory>
+#include <string>
+
+namespace YUYU {
+
+// Response compression for API payloads.
+//
+// gzip always (zlib); zstd when built with YUYU_WITH_ZSTD. Each thread keeps
+// one deflate stream and one zstd context and resets them between bodies, so
+// compressing a response allocates nothing but the output string.
+enum class ContentEncoding { Identity, Gzip, Zstd };
+
+// Best encoding the client accepts, per Accept-Encoding q-values; zstd wins
+// ties when available.
+ContentEncoding negotiate_encoding(const std::string &accept_encoding);
+const char *encoding_name(ContentEncoding enc);
+bool compress_body(ContentEncoding enc, const std::string &in, std::string &out);
+
+// For a post-routing handler: compresses a 200 JSON/text body of at least
+// min_bytes in place, unless the handler already chose an encoding.
+void compress_response(const httplib::Request &req, httplib::Response &res, size_t min_bytes);
+
+// A body compressed once, ahead of time, for every supported encoding, and
+// then served to any number of requests.
+class PrecompressedBody {
+public:
+    PrecompressedBody(std::string body, size_t min_bytes);
+
+    // Serves the variant the request accepts, with Content-Encoding and Vary;
+    // the response keeps `self` alive until it has been written.
+    static void send(const std::shared_ptr<const PrecompressedBody> &self, const httplib::Request &req,
+                     httplib::Response &res, const char *content_type);
+
+    const std::string &identity() const { return identity_; }
+
+private:
+    std::string identity_;
+    std::string gzip_;     // empty if below the threshold or not smaller
+    std::string zstd_;
+};
+
+} // namespace YUYU
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <cstdio>
+
+namespace YUYU {
+
+// Shape of a synthetic social-network dataset. Every value that decides the
+// output is here, so (config, seed) fully determines the rows produced,
+// independent of the thread count.
+struct DatasetConfig {
+    long users = 100000;
+    double weibos_per_user = 20;      // mean; authors are Zipf-distributed by activity
+    double activity_skew = 1.1;       // Zipf exponent for who posts, likes and comments
+    double follows_per_user = 30;     // mean out-degree, Pareto-distributed
+    double follow_alpha = 2.0;        // Pareto shape of the out-degree
+    double popularity_skew = 1.0;     // Zipf exponent for who gets followed
+    long max_follows = 5000;
+    double like_skew = 2.0;           // Zipf exponent of per-weibo like counts
+    long max_likes = 20000;
+    double comment_skew = 2.3;        // Zipf exponent of per-weibo comment counts
+    long max_comments = 2000;
+    double reply_ratio = 0.6;         // share of comments that reply to an earlier one
+    double media_ratio = 0.2;         // share of weibos carrying a media reference
+    double avatar_ratio = 0.5;
+    int64_t end_ms = 1767225600000LL; // newest timestamp (2026-01-01T00:00:00Z)
+    int64_t window_ms = 90LL * 24 * 3600 * 1000;
+    uint64_t seed = 42;
+    int threads = 0;                  // 0 = hardware concurrency
+    // Existing max ids when appending to a populated database.
+    long user_base = 0, weibo_base = 0, comment_base = 0, like_base = 0, follow_base = 0;
+    // Appending to a database the backends write too: weibo, comment, like
+    // and follow ids are made in the IdGenerator layout (node kBulkNode,
+    // shard 0) instead of counting up from the bases. A weibo's id carries
+    // its created_at; the other tables take consecutive ids in row order
+    // from the ticks just before end_ms - window_ms.
+    bool generator_ids = false;
+};
+
+// Receives one table at a time. Chunks arrive in id order as PGCOPY-encoded
+// tuples (see CopyRowEncoder) so the same bytes can go to COPY or to a file.
+class DatasetSink {
+public:
+    virtual ~DatasetSink() = default;
+    virtual bool begin_table(const std::string &table, std::string &err) = 0;
+    virtual bool write_chunk(const std::string &rows, long row_count, std::string &err) = 0;
+    virtual bool end_table(std::string &err) = 0;
+};
+
+// Generates users, weibos, comments, likes and follows (in foreign-key order).
+// Rows are produced in fixed-size chunks by a worker pool; every chunk draws
+// from its own seeded stream and is delivered in order, with at most a few
+// chunks per worker held in memory.
+bool generate_dataset(const DatasetConfig &cfg, DatasetSink &sink, std::string &err);
+
+// Local binary snapshot of a generated dataset:
+//   "YUYUDS1\n", u64 seed, i64 end_ms, u32 table_count,
+//   per table: u32 name_len, name, u64 row_count, u64 byte_len, PGCOPY tuples
+// Integers are little-endian. The tuples can be replayed into COPY unchanged.
+class SnapshotFileSink : public DatasetSink {
+public:
+    SnapshotFileSink(const std::string &path, const DatasetConfig &cfg) : path_(path), cfg_(cfg) {}
+    ~SnapshotFileSink() override;
+    bool open(std::string &err);
+    bool begin_table(const std::string &table, std::string &err) override;
+    bool write_chunk(const std::string &rows, long row_count, std::string &err) override;
+    bool end_table(std::string &err) override;
+    bool close(std::string &err);
+
+private:
+    std::string path_;
+    DatasetConfig cfg_;
+    FILE *f_ = nullptr;
+    uint32_t tables_ = 0;
+    int64_t section_pos_ = 0;
+    uint64_t rows_ = 0, bytes_ = 0;
+};
+
+struct SnapshotTable {
+    std::string name;
+    uint64_t row_count = 0;
+    uint64_t byte_len = 0;
+};
+
+// Sequential reader for SnapshotFileSink output. read_table streams the bytes
+// of the current section in pieces of at most max_piece bytes; a piece may end
+// in the middle of a tuple.
+class SnapshotFileReader {
+public:
+    explicit SnapshotFileReader(const std::string &path) : path_(path) {}
+    ~SnapshotFileReader();
+    bool open(uint64_t &seed, int64_t &end_ms, std::string &err);
+    bool next_table(SnapshotTable &t, std::string &err);
+    bool read_table(const SnapshotTable &t, const std::function<bool(const char*, size_t)> &fn,
+                    std::string &err, size_t max_piece = 1 << 20);
+
+private:
+    std::string path_;
+    FILE *f_ = nullptr;
+    uint32_t remaining_ = 0;
+};
+
+} // namespace YUYU
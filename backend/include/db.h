@@ -1,30 +1,124 @@
 #pragma once
 
+#include "models.h"
+#include "change_bus.h"
+#include <chrono>
 #include <string>
 #include <optional>
+#include <vector>
+#include <functional>
 
+struct DatabaseOptions {
+    // Read-only queries go to these, to the one with the fewest outstanding
+    // requests among those passing health checks; the primary takes them
+    // when no replica qualifies.
+    std::vector<std::string> replicas;
+    // More shards after the init() conninfo (shard 0), each with its own
+    // replicas. Weibos and follows are placed by user on a consistent-hash
+    // ring, likes and comments follow their weibo; row ids end in their shard
+    // number. Up to 32 shards.
+    struct Shard {
+        std::string primary;
+        std::vector<std::string> replicas;
+    };
+    std::vector<Shard> shards;
+    // Weibo, comment, like and follow ids are made in process (IdGenerator);
+    // every backend writing the same database needs its own node, 0-15.
+    unsigned node_id = 0;
+    // Profiles (name, avatar) cached in process for feed and comment authors;
+    // 0 bytes disables keeping them. Other processes' profile changes show
+    // after at most the TTL.
+    size_t user_cache_bytes = 32 << 20;
+    int user_cache_ttl_ms = 60000;
+    size_t pool_size = 16;                    // connections per server
+    int acquire_timeout_ms = 5000;
+    int health_interval_ms = 1000;
+    long long max_replica_lag_bytes = 16ll << 20;
+    // After a user writes, replicas that have not replayed the write are
+    // skipped for that user's reads, for at most this long.
+    int sticky_ms = 5000;
+    // Installs the change triggers (db/schema.sql) on every shard; off, they
+    // are dropped. Backends that follow changes (YUYU_CDC) need them.
+    bool cdc = false;
+};
+
+// Pooled libpq connections: every method borrows one for its duration, so
+// concurrent request threads never share a PGconn. Writes (and logins) use
+// a shard's primary, other reads go through replica routing; reads that span
+// shards (the global feed, followers, a user's likes) query all of them at
+// once and merge.
 class Database {
 public:
     Database();
     ~Database();
     bool init(const std::string &conninfo, std::string &err);
-    bool create_user(const std::string &username, const std::string &email, const std::string &password_hash, long &out_user_id, std::string &err);
-    bool check_user(const std::string &email, const std::string &password_hash, long &out_user_id);
-    bool create_weibo(long user_id, const std::string &content, const std::string &media, long &out_weibo_id, std::string &err);
-    bool get_weibos(int limit, std::string &json_out, std::string &err);
-    bool create_comment(long user_id, long weibo_id, const std::string &content, long parent_id, long &out_comment_id, std::string &err);
-    bool delete_comment(long user_id, long comment_id, std::string &err);
-    bool get_comments(long weibo_id, std::string &json_out, std::string &err);
-    bool update_user_profile(long user_id, const std::string &username, const std::string &avatar, std::string &err);
-    bool add_like(long user_id, long weibo_id, long &out_like_id, std::string &err);
-    bool remove_like(long user_id, long weibo_id, std::string &err);
-    bool get_user_likes(long user_id, std::string &json_out, std::string &err);
-    bool create_follow(long follower_id, long followee_id, long &out_follow_id, std::string &err);
-    bool remove_follow(long follower_id, long followee_id, std::string &err);
-    bool delete_weibo(long user_id, long weibo_id, std::string &err);
-    bool get_followers(long user_id, std::string &json_out, std::string &err);
-    bool get_following(long user_id, std::string &json_out, std::string &err);
-    bool get_user_info(long user_id, std::string &json_out, std::string &err);
+    bool init(const std::string &conninfo, const DatabaseOptions &opt, std::string &err);
+    // Reads made on this thread from now on are on behalf of `user_id` (0 =
+    // anonymous), for read-your-writes routing.
+    static void read_as(long long user_id);
+    // Reads made on this thread go to the primaries, e.g. when following
+    // change notifications, which can arrive before replicas have replayed
+    // the change. Returns the previous setting.
+    static bool read_primary(bool on);
+    // Reads made on this thread need every write committed before `t`: a
+    // replica takes them once the health check has seen it replay past the
+    // primary's WAL position at `t`, else the primary does. For cache fills
+    // after a version bump. Returns the previous setting; time_point::min()
+    // (the default) asks for nothing.
+    static std::chrono::steady_clock::time_point read_since(std::chrono::steady_clock::time_point t);
+    bool create_user(const std::string &username, const std::string &email, const std::string &password_hash, long long &out_user_id, std::string &err);
+    // False with empty err when there is no account for the email.
+    bool find_login(const std::string &email, long long &out_user_id, std::string &out_password_hash, std::string &err);
+    bool set_password_hash(long long user_id, const std::string &password_hash, std::string &err);
+    bool create_weibo(long long user_id, const std::string &content, const std::string &media, long long &out_weibo_id, std::string &err);
+    // Newest first; with `before_id` set, the page of weibos older than it
+    // (ids are time-ordered, so the last id of a page is the next cursor).
+    bool get_weibos(int limit, long long before_id, WeiboList &out, std::string &err);
+    // Rows come back in the order of `ids`; unknown ids are skipped.
+    bool get_weibos_by_ids(const std::vector<long long> &ids, WeiboList &out, std::string &err);
+    // Streams (weibo_id, content) of every weibo after `after_id` in id order
+    // (merged across shards), in bounded batches.
+    bool scan_weibo_contents(long long after_id, const std::function<void(long long, const std::string &)> &fn, std::string &err);
+    // Streams (weibo_id, kind, created_ms) for posts (0), likes (1) and
+    // comments (2) created since `since_ms` whose own id is below `before_id`,
+    // in no particular order.
+    bool scan_engagement(long long since_ms, long long before_id, const std::function<void(long long, int, long long)> &fn, std::string &err);
+    // out_author_id: the weibo's author, to be notified.
+    bool create_comment(long long user_id, long long weibo_id, const std::string &content, long long parent_id, long long &out_comment_id, long long &out_author_id, std::string &err);
+    bool delete_comment(long long user_id, long long comment_id, long long &out_weibo_id, std::string &err);
+    // Oldest first.
+    bool get_comments(long long weibo_id, std::vector<Comment> &out, std::string &err);
+    bool update_user_profile(long long user_id, const std::string &username, const std::string &avatar, std::string &err);
+    // Feed-size variant of a weibo's image; feed queries prefer it over the original.
+    bool set_weibo_media_thumb(long long weibo_id, const std::string &url, std::string &err);
+    // Sets avatar to `to` only if it is still `from` (the user may have changed it since).
+    bool replace_user_avatar(long long user_id, const std::string &from, const std::string &to, std::string &err);
+    bool add_like(long long user_id, long long weibo_id, long long &out_like_id, long long &out_author_id, std::string &err);
+    bool remove_like(long long user_id, long long weibo_id, std::string &err);
+    bool get_user_likes(long long user_id, std::vector<long long> &weibo_ids, std::string &err);
+    bool create_follow(long long follower_id, long long followee_id, long long &out_follow_id, std::string &err);
+    bool remove_follow(long long follower_id, long long followee_id, std::string &err);
+    bool delete_weibo(long long user_id, long long weibo_id, std::string &err);
+    // Followers and followees come without avatars.
+    bool get_followers(long long user_id, std::vector<User> &out, std::string &err);
+    bool get_following(long long user_id, std::vector<User> &out, std::string &err);
+    // False with err "user not found" for an unknown id.
+    bool get_user_info(long long user_id, User &out, std::string &err);
+    // Row changes committed by other backend nodes (NOTIFYed by the triggers
+    // in db/schema.sql), delivered to `fn` on a listener thread holding one
+    // LISTEN connection per shard primary. The profile cache drops changed
+    // users itself. After a listener reconnects, fn gets a Resync, as
+    // changes made meanwhile are lost. Call once, after init().
+    bool watch_changes(const std::function<void(const YUYU::RowChange &)> &fn, std::string &err);
+    // Notification inboxes (YUYU::Notifications), on the recipient's shard.
+    // Saving skips ids already stored.
+    bool save_notifications(const std::vector<Notification> &events, std::string &err);
+    // The newest `limit` events, newest first, and the read watermark.
+    bool load_notifications(long long user_id, size_t limit, std::vector<Notification> &out, long long &read_id, std::string &err);
+    bool set_notifications_read(long long user_id, long long read_id, std::string &err);
+    // Through the profile cache, in the order of `ids`; unknown ids are
+    // skipped. Misses are one query, shared with concurrent callers.
+    bool get_users(const std::vector<long long> &ids, std::vector<User> &out, std::string &err);
 
 private:
     struct Impl;
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace YUYU {
+
+// In-process pub/sub for the /api/stream SSE endpoint.
+//
+// publish() fans a small JSON delta out to every subscriber's queue. Queues
+// are bounded: a subscriber that falls more than queue_capacity events behind
+// is marked overflowed and dropped, and its client is told to resync instead
+// of the hub buffering for it. The last `history` events are kept so a
+// reconnecting EventSource can resume from Last-Event-ID.
+class EventHub {
+public:
+    struct Options {
+        size_t queue_capacity = 256;
+        size_t max_subscribers = 4096;
+        size_t history = 1024;
+    };
+
+    struct Event {
+        uint64_t id;
+        std::string type;
+        std::string data;
+    };
+
+    class Subscription {
+    public:
+        enum Status { Ready, Timeout, Overflow, Closed };
+        // Waits up to `timeout` and moves pending events into `out`.
+        Status wait(std::vector<Event> &out, std::chrono::milliseconds timeout);
+
+    private:
+        friend class EventHub;
+        std::mutex mu;
+        std::condition_variable cv;
+        std::deque<Event> queue;
+        bool overflow = false;
+        bool closed = false;
+    };
+
+    EventHub();
+    explicit EventHub(const Options &opt);
+    ~EventHub();
+
+    // Returns nullptr when max_subscribers are already connected. Events
+    // after last_event_id are replayed; if they are no longer in history the
+    // subscription starts out overflowed.
+    std::shared_ptr<Subscription> subscribe(uint64_t last_event_id = 0);
+    void unsubscribe(const std::shared_ptr<Subscription> &sub);
+    uint64_t publish(const std::string &type, const std::string &data);
+    void close_all();
+    // Called after each publish() outside the hub's lock, for subscribers
+    // that are polled rather than waited on; set before anything is
+    // published.
+    void set_on_publish(std::function<void()> f) { on_publish_ = std::move(f); }
+
+    size_t subscriber_count() const;
+
+private:
+    Options opt_;
+    mutable std::mutex mu_;
+    uint64_t next_id_ = 1;
+    std::deque<Event> history_;
+    std::list<std::shared_ptr<Subscription>> subs_;
+    std::function<void()> on_publish_;
+};
+
+} // namespace YUYU
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <memory>
+#include <httplib.h>
+
+namespace YUYU {
+
+class MappedFile;
+struct Conn;
+
+// httplib::Server whose routing can be driven from a request that has
+// already been read into memory, so a different network front end can reuse
+// every registered handler, pre-routing hook and error handler unchanged.
+class DispatchServer : public httplib::Server {
+public:
+    bool dispatch(httplib::Stream &strm, const std::string &remote_addr, int remote_port,
+                  const std::string &local_addr, int local_port, bool &connection_closed) {
+        return process_request(strm, remote_addr, remote_port, local_addr, local_port,
+                               false, connection_closed, nullptr);
+    }
+
+    // Streaming responses stop once httplib thinks its listening socket is
+    // gone; the front end lends it one of its own listeners while it runs.
+    void set_listening(socket_t sock) { svr_sock_ = sock; }
+};
+
+// While alive, bytes a handler on this thread writes out of `file`'s mapping
+// are queued on an EventLoopServer connection as a file region and sent with
+// sendfile() by the reactor instead of being copied into the output buffer,
+// so they count nothing against max_pending_output. Under httplib's own
+// listener it changes nothing: send() already reads straight from the mapping.
+class ZeroCopyScope {
+public:
+    explicit ZeroCopyScope(std::shared_ptr<const MappedFile> file);
+    ~ZeroCopyScope();
+
+    ZeroCopyScope(const ZeroCopyScope &) = delete;
+    ZeroCopyScope &operator=(const ZeroCopyScope &) = delete;
+
+    static const MappedFile *current();
+    static std::shared_ptr<const MappedFile> current_shared();
+
+private:
+    std::shared_ptr<const MappedFile> prev_;
+};
+
+// A chunked response body that outlives its handler. Handlers that would
+// otherwise wait inside a content provider (event streams, long polls) call
+// detach() instead: under EventLoopServer the headers go out when the
+// handler returns, its compute thread goes back to the pool, and the
+// connection stays with its reactor until close(), after which it serves
+// the next request. write() and close() may be called from any thread and
+// never block; write() fails once the peer has gone or the body is more than
+// max_pending_output behind (the connection is then dropped). Under
+// httplib's own listener there is no reactor to hand the connection to:
+// detach() returns nullptr and the handler streams as before.
+class DetachedResponse {
+public:
+    static std::shared_ptr<DetachedResponse> detach(httplib::Response &res, const char *content_type);
+
+    bool write(const std::string &data);
+    void close();
+    bool alive() const;
+
+private:
+    struct Guard;
+    explicit DetachedResponse(std::shared_ptr<Conn> conn);
+    bool attach(httplib::DataSink &sink);
+    void wake_locked();
+
+    std::shared_ptr<Conn> conn_;
+    // guarded by conn_->mu
+    std::string early_;          // written before the headers went out
+    bool attached_ = false;
+    bool ended_ = false;
+};
+
+// Edge-triggered epoll front end (Linux only).
+//
+// Each reactor thread owns an SO_REUSEPORT listener and an epoll set, and
+// does all accept/read/write work with non-blocking sockets. Once a complete
+// request (headers plus Content-Length or chunked body) is buffered it is
+// handed to a compute pool created by the server's new_task_queue, which runs
+// it through DispatchServer. Responses are written into the connection's
+// output buffer and flushed by the reactor, so an idle keep-alive connection
+// costs its buffers rather than a thread. A handler that streams or waits
+// hands its connection back with DetachedResponse; one that streams from a
+// content provider instead occupies a compute thread while it runs, its
+// output bounded by max_pending_output and the write timeout.
+class EventLoopServer {
+public:
+    struct Options {
+        int loops = 0;                            // 0 = one per hardware thread
+        size_t max_header_bytes = 64 * 1024;
+        size_t max_request_bytes = 64 * 1024 * 1024;
+        size_t max_pending_output = 1024 * 1024;  // per connection, before a handler blocks
+        int idle_timeout_sec = 60;
+        int write_timeout_sec = 5;
+    };
+
+    EventLoopServer(DispatchServer &svr, const Options &opt);
+    ~EventLoopServer();
+
+    static bool supported();
+    // Blocks until stop(); false if the listeners could not be set up.
+    bool listen(const std::string &host, int port);
+    void stop();
+
+private:
+    struct Impl;
+    Impl *pimpl = nullptr;
+};
+
+} // namespace YUYU
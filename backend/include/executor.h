@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace YUYU {
+
+// Chase-Lev work-stealing deque ("Correct and Efficient Work-Stealing for
+// Weak Memory Models", Le et al. 2013). The owning thread pushes and pops at
+// the bottom; any thread may steal from the top. T must be trivially
+// copyable (the executor stores job pointers). Arrays replaced on growth are
+// kept until destruction, as thieves may still be reading them.
+template <typename T>
+class ChaseLevDeque {
+public:
+    explicit ChaseLevDeque(int64_t capacity = 256) {
+        auto a = std::make_unique<Array>(capacity);
+        array_.store(a.get(), std::memory_order_relaxed);
+        arrays_.push_back(std::move(a));
+    }
+
+    ChaseLevDeque(const ChaseLevDeque &) = delete;
+    ChaseLevDeque &operator=(const ChaseLevDeque &) = delete;
+
+    // Owner only.
+    void push(T x) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        Array *a = array_.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) a = grow(a, t, b);
+        a->put(b, x);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only.
+    bool pop(T &out) {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        Array *a = array_.load(std::memory_order_relaxed);
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        out = a->get(b);
+        if (t == b) {
+            // last element: race against thieves for it
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread.
+    bool steal(T &out) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) return false;
+        Array *a = array_.load(std::memory_order_acquire);
+        T x = a->get(t);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return false;
+        out = x;
+        return true;
+    }
+
+    bool empty() const {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Array {
+        int64_t capacity;
+        int64_t mask;
+        std::unique_ptr<std::atomic<T>[]> slots;
+        explicit Array(int64_t c) : capacity(c), mask(c - 1), slots(new std::atomic<T>[static_cast<size_t>(c)]) {}
+        T get(int64_t i) const { return slots[static_cast<size_t>(i & mask)].load(std::memory_order_relaxed); }
+        void put(int64_t i, T x) { slots[static_cast<size_t>(i & mask)].store(x, std::memory_order_relaxed); }
+    };
+
+    Array *grow(Array *old, int64_t t, int64_t b) {
+        auto a = std::make_unique<Array>(old->capacity * 2);
+        for (int64_t i = t; i < b; ++i) a->put(i, old->get(i));
+        Array *raw = a.get();
+        arrays_.push_back(std::move(a));
+        array_.store(raw, std::memory_order_release);
+        return raw;
+    }
+
+    alignas(64) std::atomic<int64_t> top_{0};
+    alignas(64) std::atomic<int64_t> bottom_{0};
+    std::atomic<Array *> array_{nullptr};
+    std::vector<std::unique_ptr<Array>> arrays_;   // owner only
+};
+
+// Work-stealing thread pool for request handlers and background jobs.
+//
+// Each worker owns a Chase-Lev deque; tasks submitted from a worker go to its
+// own deque, tasks from other threads go round-robin to per-worker inboxes
+// (each with its own small lock) instead of one shared queue. An idle worker
+// checks its deque, its inbox, then steals, trying victims on its own NUMA
+// node first. Workers are optionally pinned to the CPUs the process may run
+// on (Linux and Windows).
+class WorkStealingExecutor {
+public:
+    struct Options {
+        size_t threads = 0;          // 0 = hardware threads
+        bool pin_threads = true;
+    };
+
+    WorkStealingExecutor();
+    explicit WorkStealingExecutor(const Options &opt);
+    ~WorkStealingExecutor();
+
+    void submit(std::function<void()> fn);
+
+    // Runs fn on the pool every `interval` (never two runs at once) until
+    // cancel() or shutdown(). For flushers, cache refreshers and the like.
+    uint64_t every(std::chrono::milliseconds interval, std::function<void()> fn);
+    void cancel(uint64_t id);
+
+    // Runs everything already submitted, then stops the workers.
+    void shutdown();
+
+    size_t size() const { return workers_.size(); }
+    size_t pending() const { return pending_.load(std::memory_order_relaxed); }
+
+private:
+    struct Job {
+        std::function<void()> fn;
+    };
+
+    struct Worker {
+        ChaseLevDeque<Job *> deque;
+        std::mutex inbox_mu;
+        std::deque<Job *> inbox;
+        std::vector<size_t> victims;   // same node first
+        int cpu = -1;
+        int node = 0;
+        std::thread th;
+    };
+
+    struct Periodic {
+        std::chrono::milliseconds interval;
+        std::function<void()> fn;
+        std::shared_ptr<std::atomic<bool>> running;
+    };
+
+    void run(size_t index);
+    bool find_job(size_t index, Job *&job);
+    void timer_loop();
+
+    Options opt_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::atomic<size_t> next_inbox_{0};
+    std::atomic<size_t> pending_{0};
+    std::atomic<size_t> sleepers_{0};
+    std::atomic<bool> stopping_{false};
+    std::mutex park_mu_;
+    std::condition_variable park_cv_;
+
+    std::mutex timer_mu_;
+    std::condition_variable timer_cv_;
+    std::map<uint64_t, Periodic> periodic_;
+    std::multimap<std::chrono::steady_clock::time_point, uint64_t> due_;
+    uint64_t next_timer_id_ = 1;
+    bool timer_stop_ = false;
+    std::thread timer_;
+};
+
+} // namespace YUYU
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <vector>
+#include <set>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <string>
+
+namespace YUYU {
+
+// Incremental "hot" ranking over weibo engagement.
+//
+// A weibo's score is the sum of its events weighted by exp(-lambda * age).
+// Using forward decay, each event contributes weight * exp(lambda * (t - L))
+// for a fixed landmark L, so stored scores never need to be decayed: the
+// relative order at any later time is the order of the stored sums. When the
+// exponent grows large every score is rescaled and L moves forward.
+//
+// Only the `capacity` best-scored weibos are tracked (ordered set + index);
+// the lowest entry is evicted on overflow. A background thread republishes
+// the top `published` ids every refresh_ms, and top() reads that snapshot
+// without taking the lock.
+class HotRanker {
+public:
+    enum Kind { Post = 0, Like = 1, Comment = 2 };
+
+    struct Options {
+        double half_life_hours = 6.0;
+        size_t capacity = 20000;
+        size_t published = 500;
+        int refresh_ms = 1000;
+        double post_weight = 1.0;
+        double like_weight = 1.0;
+        double comment_weight = 2.0;
+    };
+
+    HotRanker();
+    explicit HotRanker(const Options &opt);
+    ~HotRanker();
+
+    // sign = -1 retracts an event (unlike); its age is taken as "now".
+    void record(long long weibo_id, Kind kind, int64_t at_ms, int sign = 1);
+    void remove(long long weibo_id);
+
+    // Hottest first, at most k ids (k is capped by Options::published).
+    std::vector<long long> top(size_t k) const;
+
+    void refresh();
+    void start();
+    void stop();
+
+    // Events older than this contribute < 1/1000 of a fresh one; startup
+    // rebuilds only need to replay this window.
+    int64_t window_ms() const;
+    size_t tracked() const;
+
+    // Scores and landmark as a snapshot section, and back; load() replaces
+    // the tracked set, or returns false (and changes nothing) on bad input.
+    void save(std::string &out) const;
+    bool load(const char *data, size_t size);
+
+private:
+    double weight(Kind kind) const;
+    void rebase_locked(int64_t now_ms);
+
+    Options opt_;
+    double lambda_;                 // per millisecond
+    mutable std::mutex mu_;
+    int64_t landmark_ms_ = 0;
+    std::unordered_map<long long, double> scores_;
+    std::set<std::pair<double, long long>> order_;
+    bool dirty_ = false;
+    std::shared_ptr<const std::vector<long long>> published_;
+
+    std::thread refresher_;
+    std::mutex stop_mu_;
+    std::condition_variable stop_cv_;
+    bool stopping_ = false;
+};
+
+} // namespace YUYU
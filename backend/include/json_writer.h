@@ -0,0 +1,96 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace YUYU {
+
+// Appends JSON text to a string as it goes, with no document in between:
+// rows read from the database are written straight into the response body
+// instead of becoming nlohmann::json objects (a map node and a string per
+// field) that are then dumped. Keys are trusted literals; string values are
+// escaped like json::dump() does.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string &out) : out_(out) {}
+
+    JsonWriter &begin_object() { open('{'); return *this; }
+    JsonWriter &end_object() { close('}'); return *this; }
+    JsonWriter &begin_array() { open('['); return *this; }
+    JsonWriter &end_array() { close(']'); return *this; }
+
+    JsonWriter &key(const char *k) {
+        if (comma_) out_ += ',';
+        out_ += '"';
+        out_ += k;
+        out_ += "\":";
+        comma_ = false;
+        return *this;
+    }
+
+    JsonWriter &value(bool v) {
+        if (comma_) out_ += ',';
+        out_ += v ? "true" : "false";
+        comma_ = true;
+        return *this;
+    }
+
+    JsonWriter &value(long long v) {
+        if (comma_) out_ += ',';
+        char buf[24];
+        auto r = std::to_chars(buf, buf + sizeof(buf), v);
+        out_.append(buf, r.ptr);
+        comma_ = true;
+        return *this;
+    }
+
+    JsonWriter &value(const char *s, size_t n) {
+        if (comma_) out_ += ',';
+        out_ += '"';
+        static const char hex[] = "0123456789abcdef";
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char c = static_cast<unsigned char>(s[i]);
+            switch (c) {
+            case '"': out_ += "\\\""; break;
+            case '\\': out_ += "\\\\"; break;
+            case '\b': out_ += "\\b"; break;
+            case '\f': out_ += "\\f"; break;
+            case '\n': out_ += "\\n"; break;
+            case '\r': out_ += "\\r"; break;
+            case '\t': out_ += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    out_ += "\\u00";
+                    out_ += hex[c >> 4];
+                    out_ += hex[c & 0xF];
+                } else {
+                    out_ += static_cast<char>(c);
+                }
+            }
+        }
+        out_ += '"';
+        comma_ = true;
+        return *this;
+    }
+    JsonWriter &value(const char *s) { return value(s, std::strlen(s)); }
+    JsonWriter &value(std::string_view s) { return value(s.data(), s.size()); }
+
+private:
+    void open(char c) {
+        if (comma_) out_ += ',';
+        out_ += c;
+        comma_ = false;
+    }
+    void close(char c) {
+        out_ += c;
+        comma_ = true;
+    }
+
+    std::string &out_;
+    bool comma_ = false;
+};
+
+} // namespace YUYU
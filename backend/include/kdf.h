@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace YUYU {
+
+// scrypt cost: N = 2^log_n, block size r, parallelism p. Memory per hash is
+// about 128 * r * N bytes (32 MiB for the defaults).
+struct KdfParams {
+    int log_n = 15;
+    uint32_t r = 8;
+    uint32_t p = 1;
+};
+
+// Salted scrypt (OpenSSL EVP_PBE_scrypt), stored as
+//   $scrypt$ln=15,r=8,p=1$<salt hex>$<hash hex>
+// which fits the users.password_hash column.
+bool hash_password(const std::string &password, const KdfParams &params, std::string &out);
+
+// Checks a password against a stored hash: the format above, or the legacy
+// unsalted sha256 hex. `needs_rehash` is set on a match whose hash is legacy
+// or made with parameters other than `current`.
+bool verify_password(const std::string &password, const std::string &stored, const KdfParams &current,
+                     bool &needs_rehash);
+
+// Dedicated threads for password hashing.
+//
+// A hash costs tens of milliseconds of CPU and tens of MiB of memory, so
+// login and register run it here rather than on the request worker: at most
+// `threads` hashes run at once whatever the request concurrency, and request
+// workers waiting for a result sleep instead of competing with feed reads for
+// cores. Admission is bounded: a call that finds `capacity` hashes already
+// waiting returns Busy at once, and one that waited longer than
+// `max_wait_ms` is dropped unstarted (Busy too), so a login storm turns into
+// quick 503s instead of a growing queue.
+class KdfPool {
+public:
+    struct Options {
+        size_t threads = 0;          // 0 = a quarter of the cores, at least one
+        size_t capacity = 4;
+        int max_wait_ms = 1000;
+        KdfParams params;
+    };
+
+    enum Status { Ok, Busy, Failed };
+
+    struct Stats {
+        size_t queued;
+        uint64_t hashed;
+        uint64_t rejected;           // queue full on arrival
+        uint64_t expired;            // waited longer than max_wait_ms
+    };
+
+    explicit KdfPool(const Options &opt);
+    ~KdfPool();
+
+    KdfPool(const KdfPool &) = delete;
+    KdfPool &operator=(const KdfPool &) = delete;
+
+    Status hash(const std::string &password, std::string &out);
+    // An empty `stored` (no such account) still costs one hash against a
+    // decoy, so response time does not tell which accounts exist. On a match
+    // that needs rehashing, `upgraded` gets the new hash (same job).
+    Status verify(const std::string &password, const std::string &stored, bool &match, std::string &upgraded);
+
+    Stats stats() const;
+    const Options &options() const { return opt_; }
+
+private:
+    struct Waiter {
+        std::mutex mu;
+        std::condition_variable cv;
+        int state = 0;               // 1 ran, 2 dropped
+    };
+    struct Job {
+        std::function<void()> fn;
+        std::chrono::steady_clock::time_point enqueued;
+        Waiter *waiter;
+    };
+
+    // Runs fn on a pool thread and waits for it; false if it was not admitted
+    // or expired in the queue.
+    bool run(std::function<void()> fn);
+    void work();
+
+    Options opt_;
+    std::string decoy_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    bool stopping_ = false;
+    std::vector<std::thread> threads_;
+    std::atomic<uint64_t> hashed_{0}, rejected_{0}, expired_{0};
+};
+
+} // namespace YUYU
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <ctime>
+#include <memory>
+#include <string>
+
+namespace YUYU {
+
+// A read-only file mapped into memory. Shared between concurrent downloads
+// of the same file; the mapping (and descriptor) live until the last holder
+// lets go. Pages come from the page cache, so serving from it costs no heap
+// memory however large the file is.
+class MappedFile {
+public:
+    // nullptr if the path is not a regular, readable file.
+    static std::shared_ptr<const MappedFile> open(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    const char *data() const { return data_; }
+    size_t size() const { return size_; }
+    time_t mtime() const { return mtime_; }
+    // Descriptor for sendfile(); -1 where there is none (Windows).
+    int fd() const { return fd_; }
+
+private:
+    MappedFile() = default;
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    time_t mtime_ = 0;
+    int fd_ = -1;
+#ifdef _WIN32
+    void *file_ = nullptr;
+    void *mapping_ = nullptr;
+#endif
+};
+
+} // namespace YUYU
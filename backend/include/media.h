@@ -0,0 +1,102 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace YUYU {
+
+class MappedFile;
+
+// 8-bit RGB, rows packed (stride = width * 3).
+struct Image {
+    int width = 0;
+    int height = 0;
+    std::vector<uint8_t> rgb;
+};
+
+// JPEG and PNG (alpha composited onto white). Refuses images over
+// max_pixels so a small file cannot expand into a huge buffer.
+bool decode_image(const std::string &bytes, Image &out, std::string &err, size_t max_pixels = 40u * 1000 * 1000);
+bool encode_jpeg(const Image &img, int quality, std::string &out, std::string &err);
+
+// Area-averaging downscale to fit within max_w x max_h, keeping the aspect
+// ratio; never upscales. Separable fixed-point filter whose vertical pass
+// runs 8 pixels per step with SSE2 where available.
+Image fit_within(const Image &src, int max_w, int max_h);
+// Center square crop scaled to size x size.
+Image square_thumbnail(const Image &src, int size);
+
+// Uploaded images and their resized variants.
+//
+// Uploads arrive as data: URLs and are written once, content-addressed, as
+// <dir>/<h0h1>/<sha256>.<ext>; the database then stores the URL instead of
+// the image. Resizing happens off the request path: submit() queues a job for
+// a small worker pool, which decodes the original, writes the variant next to
+// it (<sha256>_feed.jpg, <sha256>_avatar.jpg) and reports the variant URL
+// through the `done` callback. GIF and WebP are stored but not resized.
+class MediaPipeline {
+public:
+    enum Variant { Feed, Avatar };
+
+    struct Options {
+        std::string dir = "media";
+        std::string url_prefix = "/media";
+        size_t threads = 2;
+        size_t queue_capacity = 1024;
+        size_t max_upload_bytes = 8 * 1024 * 1024;
+        int feed_max = 720;        // longest side of the feed variant
+        int avatar_size = 128;
+        int quality = 82;
+    };
+
+    struct Job {
+        Variant variant;
+        long long owner_id;        // weibo_id (Feed) or user_id (Avatar)
+        std::string url;           // original, as returned by store()
+    };
+
+    using Done = std::function<void(const Job &job, const std::string &variant_url)>;
+
+    MediaPipeline();
+    explicit MediaPipeline(const Options &opt);
+    ~MediaPipeline();
+
+    // Creates the storage directory and starts the workers.
+    bool start(Done done, std::string &err);
+    void stop();
+
+    // Decodes and stores a data: URL; `resizable` tells whether submit()
+    // can make variants of it.
+    bool store(const std::string &data_url, std::string &url, bool &resizable, std::string &err);
+    // False when the queue is full; the original is still served.
+    bool submit(Job job);
+
+    bool owns(const std::string &url) const;
+    // The stored file behind a URL this pipeline owns, mapped for serving;
+    // nullptr if there is none.
+    std::shared_ptr<const MappedFile> open(const std::string &url) const;
+    static const char *content_type(const std::string &url);
+    const Options &options() const { return opt_; }
+
+private:
+    void work();
+    void process(const Job &job);
+    std::string path_of(const std::string &url) const;
+
+    Options opt_;
+    Done done_;
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    bool stopping_ = false;
+    std::vector<std::thread> workers_;
+};
+
+} // namespace YUYU
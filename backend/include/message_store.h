@@ -0,0 +1,205 @@
+#pragma once
+
+#include "models.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace YUYU {
+
+// Private messages, kept out of Postgres in an append-only log on local disk.
+//
+// Conversations (the pair of users) are hashed onto partitions; each
+// partition is a directory of numbered segment files that are only ever
+// appended to, and is written by one thread. Senders queue their record and
+// wait; the writer takes everything queued within commit_window_us, writes
+// it with one write and one fsync, then acknowledges the whole batch (group
+// commit), so the disk sees one flush per batch instead of one per message.
+//
+// Record: u32 payload size, u32 crc32 of the payload, then u8 kind, i64
+// message_id, i64 sender_id, i64 recipient_id, i64 created_ms and the text.
+// Read marks go through the same log (kind 2, sender = reader, recipient =
+// peer, message_id = the newest message the reader had), so unread state
+// comes back with the messages; a mark leaves messages that arrived after it
+// unread. open() replays every segment, cutting a torn tail off the newest
+// one; damage inside an older segment is skipped, keeping the records behind
+// it. Texts are at most 64 KiB and segments stay below 4 GiB.
+//
+// The log is on this node's disk and the mailboxes in its memory: every
+// request of a deployment with messaging has to reach this one node.
+//
+// In memory: per conversation the position of each message, for cursor
+// pages of history read straight from the segments; per user the
+// conversation list with unread counts, and the last `recent` deliveries
+// with a sequence number, from which poll() answers long-polls and streams
+// without touching the disk.
+class MessageStore {
+public:
+    struct Options {
+        std::string dir = "messages";
+        size_t partitions = 8;
+        uint64_t segment_bytes = 64u << 20;
+        int commit_window_us = 500;
+        size_t max_batch = 1024;
+        bool fsync = true;
+        size_t recent = 256;    // deliveries kept per user for poll()
+        // Called for both users of each new message once poll() can return
+        // it, outside the store's locks (for waiters that are polled).
+        std::function<void(long long user_id)> on_delivery;
+    };
+
+    struct Conversation {
+        long long peer_id = 0;
+        long long last_message_id = 0;
+        uint32_t unread = 0;
+    };
+
+    struct Delivery {
+        uint64_t seq;
+        std::shared_ptr<const Message> message;
+    };
+
+    enum PollStatus { Ready, Timeout, Resync, Closed };
+
+    struct Stats {
+        uint64_t messages;
+        uint64_t commits;       // batches written (one fsync each)
+        uint64_t bytes;
+    };
+
+    explicit MessageStore(const Options &opt);
+    ~MessageStore();
+
+    MessageStore(const MessageStore &) = delete;
+    MessageStore &operator=(const MessageStore &) = delete;
+
+    // Replays the log and starts the writers.
+    bool open(std::string &err);
+    // Writes what is queued and stops the writers.
+    void close();
+    // Ends every poll() in progress (Closed); for shutdown.
+    void interrupt();
+
+    // Returns once the message is on disk; `out` gets its id and time.
+    bool send(long long from, long long to, const std::string &text, Message &out, std::string &err);
+    // Newest first: up to `limit` messages between a and b older than
+    // `before` (0 = newest).
+    bool history(long long a, long long b, long long before, size_t limit, std::vector<Message> &out,
+                 std::string &err);
+    // Most recent first, with the total unread count.
+    void conversations(long long user_id, std::vector<Conversation> &out, uint32_t &unread);
+    bool mark_read(long long user_id, long long peer_id, std::string &err);
+    // Deliveries to or from `user_id` after `since` (sent and received), as
+    // soon as there are any or after `timeout`. `seq` is the cursor for the
+    // next call. since = 0 returns the current cursor at once; Resync means
+    // deliveries were missed (too far behind, or a cursor from before a
+    // restart) and the client should reload its conversations.
+    PollStatus poll(long long user_id, uint64_t since, std::chrono::milliseconds timeout,
+                    std::vector<Delivery> &out, uint64_t &seq);
+
+    Stats stats() const;
+
+private:
+    enum Kind : uint8_t { kMessage = 1, kRead = 2 };
+    struct Record {
+        Kind kind = kMessage;
+        Message m;
+    };
+    struct Segment {
+        uint64_t number = 0;
+        std::string path;
+        std::mutex read_mu;
+        std::FILE *reader = nullptr;
+        ~Segment();
+        bool read(uint64_t offset, uint32_t size, std::string &out);
+    };
+    // Where a message is: 24 bytes per message kept in memory.
+    struct Ref {
+        long long message_id;
+        Segment *segment;
+        uint32_t offset;
+        uint32_t size;
+    };
+    using ConvKey = std::pair<long long, long long>;   // lower user id first
+    struct ConvHash {
+        size_t operator()(const ConvKey &k) const {
+            return static_cast<size_t>((static_cast<uint64_t>(k.first) * 0x9E3779B97F4A7C15ull) ^
+                                       static_cast<uint64_t>(k.second));
+        }
+    };
+    struct Waiter {
+        bool done = false;
+        bool ok = false;
+        std::string err;
+    };
+    struct Pending {
+        Record rec;
+        Waiter *waiter;
+    };
+    struct Partition {
+        std::string dir;
+        std::mutex mu;
+        std::condition_variable wake;    // the writer
+        std::condition_variable done;    // senders waiting for their batch
+        std::vector<Pending> queue;
+        std::vector<std::unique_ptr<Segment>> segments;
+        std::FILE *active = nullptr;     // last segment, written by the writer only
+        uint64_t active_size = 0;
+        uint64_t next_segment = 0;
+        std::unordered_map<ConvKey, std::vector<Ref>, ConvHash> index;
+        std::thread writer;
+    };
+    struct Mailbox {
+        uint64_t seq = 0;
+        std::deque<Delivery> recent;
+        std::unordered_map<long long, Conversation> conversations;
+        // per peer, the ids a read mark has not covered yet
+        std::unordered_map<long long, std::vector<long long>> unread_ids;
+        uint32_t unread = 0;
+    };
+    struct MailShard {
+        std::mutex mu;
+        std::condition_variable cv;
+        std::unordered_map<long long, Mailbox> boxes;
+    };
+
+    static ConvKey conversation_key(long long a, long long b) { return a < b ? ConvKey(a, b) : ConvKey(b, a); }
+    Partition &partition_of(long long a, long long b);
+    MailShard &mail_of(long long user_id) { return mail_[static_cast<uint64_t>(user_id) % mail_.size()]; }
+    Mailbox &box_locked(MailShard &sh, long long user_id);
+    long long next_id(long long now);
+
+    bool replay(Partition &p, std::string &err);
+    bool roll(Partition &p, std::string &err);
+    bool commit(Record &rec, std::string &err);
+    void run(Partition &p);
+    bool write(Partition &p, const std::vector<Pending> &batch, std::vector<Ref> &refs, std::string &err);
+    // Applies a committed record to the mailboxes; `live` ones are also
+    // handed to poll().
+    void deliver(const Record &rec, bool live);
+
+    Options opt_;
+    std::vector<std::unique_ptr<Partition>> parts_;
+    std::vector<MailShard> mail_;
+    uint64_t base_seq_ = 0;         // first cursor value of this run
+    std::atomic<long long> last_id_{0};
+    std::atomic<bool> closing_{false};
+    std::atomic<bool> interrupted_{false};
+
+    std::atomic<uint64_t> messages_{0};
+    std::atomic<uint64_t> commits_{0};
+    std::atomic<uint64_t> bytes_{0};
+};
+
+} // namespace YUYU
@@ -1,42 +1,130 @@
 #pragma once
 
+#include <cstddef>
 #include <string>
-#include <ctime>
+#include <string_view>
+#include <vector>
 
 struct User {
-    long user_id;
+    long long user_id = 0;
     std::string username;
-    std::string email;
-    std::string password_hash;
-    std::time_t created_at;
+    std::string avatar;
 };
 
-struct Weibo {
-    long weibo_id;
-    long user_id;
-    std::string content;
-    std::string media;
-    std::time_t created_at;
+// One text column of a result set, values packed end to end in one buffer:
+// a page of rows costs two allocations per column instead of one per value.
+class TextColumn {
+public:
+    void push_back(std::string_view s) {
+        data_.append(s.data(), s.size());
+        ends_.push_back(data_.size());
+    }
+    std::string_view operator[](size_t i) const {
+        size_t begin = i ? ends_[i - 1] : 0;
+        return std::string_view(data_.data() + begin, ends_[i] - begin);
+    }
+    size_t size() const { return ends_.size(); }
+    size_t bytes() const { return data_.size(); }
+    void reserve(size_t rows, size_t bytes) {
+        ends_.reserve(rows);
+        data_.reserve(bytes);
+    }
+    void clear() {
+        data_.clear();
+        ends_.clear();
+    }
+
+private:
+    std::string data_;
+    std::vector<size_t> ends_;
+};
+
+// Rows of a feed query, column by column. Merging, ranking and filtering
+// read only the integer columns, which stay contiguous; text is packed per
+// column.
+struct WeiboList {
+    std::vector<long long> weibo_id;
+    std::vector<long long> user_id;
+    std::vector<long long> created_ms;
+    std::vector<long long> like_count;
+    std::vector<long long> comment_count;
+    TextColumn content;
+    TextColumn media;
+    TextColumn media_full;
+    TextColumn username;
+    TextColumn avatar;
+
+    size_t size() const { return weibo_id.size(); }
+    bool empty() const { return weibo_id.empty(); }
+
+    void reserve(size_t rows) {
+        weibo_id.reserve(rows);
+        user_id.reserve(rows);
+        created_ms.reserve(rows);
+        like_count.reserve(rows);
+        comment_count.reserve(rows);
+        content.reserve(rows, rows * 160);
+        media.reserve(rows, rows * 48);
+        media_full.reserve(rows, rows * 48);
+        username.reserve(rows, rows * 16);
+        avatar.reserve(rows, rows * 48);
+    }
+
+    void clear() {
+        weibo_id.clear();
+        user_id.clear();
+        created_ms.clear();
+        like_count.clear();
+        comment_count.clear();
+        content.clear();
+        media.clear();
+        media_full.clear();
+        username.clear();
+        avatar.clear();
+    }
 };
 
 struct Comment {
-    long comment_id;
-    long weibo_id;
-    long user_id;
+    long long comment_id = 0;
+    long long weibo_id = 0;
+    long long user_id = 0;
+    long long parent_id = 0;    // 0 for a top-level comment
+    long long created_ms = 0;
     std::string content;
-    std::time_t created_at;
+    std::string username;
+    std::string avatar;
 };
 
 struct Like {
-    long like_id;
-    long weibo_id;
-    long user_id;
-    std::time_t created_at;
+    long long like_id = 0;
+    long long weibo_id = 0;
+    long long user_id = 0;
+    long long created_ms = 0;
 };
 
 struct Follow {
-    long follow_id;
-    long follower_id;
-    long followee_id;
-    std::time_t created_at;
+    long long follow_id = 0;
+    long long follower_id = 0;
+    long long followee_id = 0;
+    long long created_ms = 0;
+};
+
+// An event in a user's notification inbox; its id is that of the like,
+// comment or follow row it reports.
+struct Notification {
+    enum Kind : int { Like = 1, Comment = 2, Follow = 3 };
+    long long notification_id = 0;
+    long long user_id = 0;      // recipient
+    long long actor_id = 0;
+    long long weibo_id = 0;     // 0 for a follow
+    int kind = Like;
+};
+
+// A private message; stored in the message log, not in Postgres.
+struct Message {
+    long long message_id = 0;
+    long long sender_id = 0;
+    long long recipient_id = 0;
+    long long created_ms = 0;
+    std::string text;
 };
@@ -0,0 +1,141 @@
+#pragma once
+
+#include "models.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace YUYU {
+
+// Per-user notification inboxes (likes and comments on one's weibos, new
+// followers), kept in memory and written behind to the notifications table.
+//
+// An inbox is a capped list of items, newest first. Events of the same kind
+// on the same weibo (or follows) fold into the newest such item while it is
+// still unread, so a popular weibo shows "X, Y and 12 others liked it" once
+// instead of fourteen times. Unread is the number of unread items, kept as
+// a counter; marking read moves the user's watermark to their newest event.
+//
+// Inboxes are loaded from the database the first time they are read and
+// evicted least recently used once there are more than max_users, but only
+// after all of their events have been saved. Events for a user whose inbox
+// is not loaded wait beside it and are merged at the load. Events are saved
+// in batches by a flusher thread; up to flush_interval_ms of them are lost
+// if the process dies.
+class Notifications {
+public:
+    struct Options {
+        size_t shards = 16;
+        size_t max_users = 100000;    // inboxes in memory
+        size_t per_user = 200;        // items per inbox
+        size_t load_events = 1000;    // newest events replayed into a loaded inbox
+        int flush_interval_ms = 100;
+        size_t max_batch = 1000;
+        size_t max_pending = 100000;  // unsaved events beyond this are dropped
+    };
+
+    // Newest first, up to `limit`, with the user's read watermark.
+    using Loader = std::function<bool(long long user_id, size_t limit, std::vector<Notification> &events,
+                                      long long &read_id, std::string &err)>;
+    using Saver = std::function<bool(const std::vector<Notification> &events, std::string &err)>;
+
+    static const size_t kActors = 3;
+
+    struct Item {
+        long long id = 0;             // newest event folded in; pages are cut by it
+        int kind = Notification::Like;
+        long long weibo_id = 0;
+        long long actors[kActors] = {};   // newest first
+        uint32_t actor_count = 0;     // distinct as far as the newest kActors tell
+        bool unread = false;
+    };
+
+    struct Page {
+        std::vector<Item> items;
+        uint32_t unread = 0;
+        long long next_before = 0;    // 0 when there is nothing older
+    };
+
+    struct Stats {
+        uint64_t users;
+        uint64_t loads;
+        uint64_t saved;
+        uint64_t dropped;
+    };
+
+    Notifications(const Options &opt, Loader loader, Saver saver);
+    ~Notifications();
+
+    Notifications(const Notifications &) = delete;
+    Notifications &operator=(const Notifications &) = delete;
+
+    void start();
+    // Saves what is pending and stops the flusher.
+    void stop();
+
+    // Adds an event to its recipient's inbox; one's own actions are ignored.
+    // `persist` is false for events another backend has saved already.
+    void push(const Notification &n, bool persist = true);
+    // Items older than `before` (0 = newest), at most `limit`.
+    bool page(long long user_id, long long before, size_t limit, Page &out, std::string &err);
+    bool unread(long long user_id, uint32_t &count, std::string &err);
+    // Marks everything up to the newest event read; `read_id` is the new
+    // watermark, for the caller to store.
+    bool mark_read(long long user_id, long long &read_id, std::string &err);
+
+    Stats stats() const;
+
+private:
+    struct Inbox {
+        std::list<Item> items;
+        // newest item per (kind, weibo), the one new events fold into
+        std::unordered_map<long long, std::list<Item>::iterator> open;
+        long long read_id = 0;
+        long long newest = 0;
+        uint32_t unread = 0;
+        bool loaded = false;
+        std::vector<Notification> early;   // pushed before the inbox was loaded
+        size_t unsaved = 0;
+        std::list<long long>::iterator lru;
+    };
+    struct Shard {
+        mutable std::mutex mu;
+        std::unordered_map<long long, Inbox> inboxes;
+        std::list<long long> lru;   // most recently used first
+    };
+
+    Shard &shard_of(long long user_id) { return shards_[static_cast<uint64_t>(user_id) % shards_.size()]; }
+    // The user's inbox, created if missing; touches it. Shard lock held.
+    Inbox &inbox_locked(Shard &sh, long long user_id);
+    void evict_locked(Shard &sh);
+    void fold(Inbox &in, const Notification &n);
+    // Runs f on the loaded inbox, under its shard's lock.
+    bool with_inbox(long long user_id, const std::function<void(Inbox &)> &f, std::string &err);
+    void run();
+    void flush(std::vector<Notification> &batch);
+
+    Options opt_;
+    Loader loader_;
+    Saver saver_;
+    std::vector<Shard> shards_;
+    size_t shard_users_;
+
+    std::mutex pending_mu_;
+    std::condition_variable pending_cv_;
+    std::vector<Notification> pending_;
+    bool stopping_ = false;
+    std::thread flusher_;
+
+    std::atomic<uint64_t> loads_{0};
+    std::atomic<uint64_t> saved_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+} // namespace YUYU
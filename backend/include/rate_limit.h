@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace YUYU {
+
+// Token-bucket rate limiter over a fixed-size, open-addressed table.
+//
+// Each slot is a 64-bit key (hash of policy + subject, 0 = empty) and a 64-bit
+// state word packing the last refill time (40 bits of ms) and the remaining
+// tokens (24 bits, in thousandths). acquire() probes a short window of slots
+// and refills/spends with a CAS on the state word: no locks, no allocation.
+//
+// The table never grows. When a probe window is full the slot refilled
+// longest ago is taken over; such a bucket has usually refilled completely,
+// so eviction only forgets subjects that were not being limited anyway. The
+// handover itself is not atomic across both words, so a racing request may
+// briefly see the evicted bucket; limits are approximate by design, and a
+// lost race lets the request through rather than blocking it.
+class RateLimiter {
+public:
+    struct Policy {
+        uint32_t id;        // distinguishes buckets of different policies
+        double per_sec;     // refill rate
+        uint32_t burst;     // bucket size, at most 16000
+    };
+
+    explicit RateLimiter(size_t slots = 65536);
+
+    // Spends one token from the subject's bucket. Returns 0 if allowed,
+    // otherwise the number of seconds (>= 1) until a token is available.
+    int acquire(const Policy &p, uint64_t subject);
+
+    static uint64_t subject_of(long long user_id);
+    static uint64_t subject_of(const std::string &remote_addr);
+
+private:
+    struct alignas(16) Slot {
+        std::atomic<uint64_t> key{0};
+        std::atomic<uint64_t> state{0};
+    };
+
+    uint64_t now_ms() const;
+
+    size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+    std::chrono::steady_clock::time_point epoch_;
+};
+
+} // namespace YUYU
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "models.h"
+#include "message_store.h"
+#include "notifications.h"
+#include <string>
+#include <vector>
+
+namespace YUYU {
+
+// JSON bodies of the read endpoints, written from typed results with
+// JsonWriter. Each replaces `out`.
+
+// {"weibos":[...]}
+void render_weibos(const WeiboList &list, std::string &out);
+// {"comments":[...]}
+void render_comments(const std::vector<Comment> &comments, std::string &out);
+// {"users":[{"user_id","username"}...]}
+void render_users(const std::vector<User> &users, std::string &out);
+// {"ok":true,"data":{"user_id","username","avatar"}}
+void render_user_info(const User &user, std::string &out);
+// {"weibo_ids":[...]}
+void render_weibo_ids(const std::vector<long long> &ids, std::string &out);
+// {"ok":true,"unread","next_before","notifications":[{"id","type","weibo_id",
+// "count","unread","actors":[{"user_id","username","avatar"}...]}...]};
+// actors not in `users` are left out.
+void render_notifications(const Notifications::Page &page, const std::vector<User> &users, std::string &out);
+// {"message_id","from","to","text","created_ms"}
+void render_message(const Message &m, std::string &out);
+// {"ok":true,"next_before","messages":[...]}
+void render_messages(const std::vector<Message> &messages, long long next_before, std::string &out);
+// {"ok":true,"unread","conversations":[{"user_id","username","avatar",
+// "last_message_id","unread"}...]}; peers not in `users` are left out.
+void render_conversations(const std::vector<MessageStore::Conversation> &convs, uint32_t unread,
+                          const std::vector<User> &users, std::string &out);
+// {"ok":true,"seq","resync","messages":[...]}
+void render_deliveries(const std::vector<MessageStore::Delivery> &deliveries, uint64_t seq, bool resync,
+                       std::string &out);
+
+} // namespace YUYU
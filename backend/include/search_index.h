@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <shared_mutex>
+#include <cstdint>
+
+namespace YUYU {
+
+// In-memory inverted index over weibo content. Text is split into runs of
+// letters/digits/CJK characters and indexed as character unigrams and
+// bigrams, which works for Chinese without a word segmenter. A query matches
+// a weibo when every query bigram (or the single character) occurs in it.
+//
+// Posting lists hold weibo ids in ascending order, delta + varint encoded in
+// blocks of BLOCK ids with a skip entry per block. Since ids grow with
+// creation time, newly created weibos append to the end of each list, and
+// top-k by recency is a descending leapfrog intersection that stops after k
+// hits. Deletions are tombstoned and purged by compaction. One extra list
+// holds every indexed id, so doc_count() counts each weibo once.
+class SearchIndex {
+public:
+    static const int BLOCK = 128;
+
+    void add(long long weibo_id, const std::string &content);
+    void remove(long long weibo_id);
+    // Newest first; at most `limit` ids.
+    std::vector<long long> search(const std::string &query, size_t limit) const;
+
+    size_t doc_count() const;
+    size_t token_count() const;
+    size_t memory_bytes() const;
+    // Newest id ever added, 0 if none.
+    long long last_id() const;
+
+    // The whole index as a snapshot section, and back. load() replaces the
+    // contents, or leaves them alone and returns false if `data` does not
+    // parse.
+    void save(std::string &out) const;
+    bool load(const char *data, size_t size);
+
+    // Splits text into index keys; exposed for the query side and for tests of
+    // tokenization. `query` mode drops unigrams from runs that have bigrams.
+    static void tokenize(const std::string &text, bool query, std::vector<uint64_t> &keys);
+
+    struct Skip {
+        long long first;   // first id of the block
+        long long last;    // last id of the block
+        uint32_t offset;   // byte offset of the block in data
+        uint32_t count;
+    };
+
+    struct PostingList {
+        std::vector<uint8_t> data;
+        std::vector<Skip> skips;
+        std::vector<long long> pending;   // out-of-order ids not yet merged, kept sorted
+        uint32_t count = 0;
+
+        void append(long long id);
+        // Any order; false for an id already in the list.
+        bool insert(long long id);
+        bool contains(long long id) const;
+        void decode_block(size_t b, std::vector<long long> &out) const;
+        void rebuild(const std::vector<long long> &ids);
+        void all(std::vector<long long> &out) const;
+    };
+
+private:
+    void compact_locked();
+
+    mutable std::shared_mutex mu_;
+    std::unordered_map<uint64_t, PostingList> lists_;
+    std::unordered_set<long long> deleted_;
+    size_t docs_ = 0;
+    long long last_id_ = 0;
+};
+
+} // namespace YUYU
@@ -2,15 +2,81 @@
 
 #include <string>
 #include <httplib.h>
+#include "kdf.h"
+#include "db.h"
 
 namespace YUYU {
+  struct ServerOptions {
+    // Serve through the epoll front end with this many reactor threads (0 =
+    // one per core); < 0 keeps httplib's thread-per-connection listener.
+    // Ignored where the front end is unsupported (non-Linux).
+    int event_loops = -1;
+    // Request worker pool: 0 threads = httplib's default count. Requests that
+    // find `queue_capacity` already waiting, or that waited longer than
+    // `queue_deadline_ms`, get 503 with Retry-After: `retry_after_sec`.
+    // Without the epoll front end a keep-alive connection holds its worker,
+    // so its later requests are answered with Connection: close while others
+    // wait, and get 503 themselves once the queue is full.
+    size_t worker_threads = 0;
+    size_t queue_capacity = 256;
+    int queue_deadline_ms = 10000;
+    int retry_after_sec = 1;
+    // Run request handlers and background jobs on a work-stealing executor
+    // (per-worker Chase-Lev deques) instead of a single locked job queue;
+    // workers are pinned to cores when pin_threads is set.
+    bool work_stealing = false;
+    bool pin_threads = true;
+    // Per-user / per-address token buckets on register, login, weibo and
+    // like; requests over the limit get 429 with Retry-After.
+    bool rate_limit = true;
+    // gzip/zstd (per Accept-Encoding) for JSON bodies of at least this many
+    // bytes; 0 turns compression off.
+    size_t compress_min_bytes = 1024;
+    // Salted scrypt for passwords, on `kdf_threads` dedicated threads (0 = a
+    // quarter of the cores). Register/login get 503 when `kdf_queue` hashes
+    // are already waiting or theirs waited over `kdf_max_wait_ms`; request
+    // workers block while their hash is queued or running, so threads plus
+    // queue should stay well below worker_threads. Older hashes are replaced
+    // with these parameters on the next login.
+    size_t kdf_threads = 0;
+    size_t kdf_queue = 4;
+    int kdf_max_wait_ms = 1000;
+    KdfParams kdf_params;
+    // Warm restart: the search index and hot ranking are written here every
+    // snapshot_interval_s and at shutdown. init() starts from the file when
+    // it is intact and reads back from Postgres only what came after it.
+    // Empty = rebuild from Postgres on every start.
+    std::string snapshot_path;
+    int snapshot_interval_s = 300;
+    // Several backends on one database: apply the other nodes' writes
+    // (Database::watch_changes) to search, hot ranking, ETags and live
+    // streams. Each node needs its own DatabaseOptions::node_id.
+    bool cdc = false;
+    // Notification inboxes kept in memory; older ones are reloaded from the
+    // notifications table when read.
+    size_t notification_users = 100000;
+    // Private messages: an append-only log under this directory (see
+    // MessageStore), local to this node like the media files, so messaging
+    // needs every one of its requests on this node. Off (empty) unless set;
+    // the log is never compacted and is replayed in full at startup.
+    // messages_fsync = false acknowledges a batch once it is written, before
+    // it is flushed to disk.
+    std::string messages_dir;
+    bool messages_fsync = true;
+  };
+
   class Server {
   public:
     Server();
     ~Server();
-    bool init(const std::string &conninfo);
+    bool init(const std::string &conninfo, const DatabaseOptions &db = DatabaseOptions());
+    // Serves until stop(), then writes a last snapshot.
     void run(int port);
-    long auth_user(const httplib::Request &req) const;
+    // Makes run() return; callable from any thread.
+    void stop();
+    // Call before init().
+    void configure(const ServerOptions &opt);
+    long long auth_user(const httplib::Request &req) const;
   private:
     struct Impl;
     Impl *pimpl = nullptr;
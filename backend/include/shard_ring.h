@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace YUYU {
+
+// Consistent-hash ring placing keys (user ids) on shards. Each shard owns
+// `vnodes` points on a 64-bit ring and a key belongs to the first point at or
+// after its hash, so adding a shard moves only about 1/N of the keys and
+// shards are loaded evenly within a few percent.
+class ShardRing {
+public:
+    explicit ShardRing(size_t shards = 1, size_t vnodes = 128);
+
+    size_t locate(uint64_t key) const;
+    size_t shards() const { return shards_; }
+
+private:
+    size_t shards_;
+    std::vector<std::pair<uint64_t, uint32_t>> points_;   // sorted by hash
+};
+
+// Row ids carry their shard in the low bits, so a weibo, comment, like or
+// follow id alone says where the row lives.
+const int kShardBits = 5;
+const size_t kMaxShards = size_t(1) << kShardBits;
+
+inline size_t shard_of_id(long long id, size_t shards) {
+    return shards > 1 ? static_cast<size_t>(static_cast<uint64_t>(id) & (kMaxShards - 1)) % shards : 0;
+}
+
+} // namespace YUYU
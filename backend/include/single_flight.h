@@ -0,0 +1,74 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace YUYU {
+
+// Collapses identical concurrent calls: the first caller for a key runs the
+// work, callers arriving while it runs wait on the same shared future and
+// get the same T (typically a shared_ptr to one result buffer). Nothing is
+// kept afterwards; the next call for the key runs again, so a key must name
+// everything the result depends on, resource versions included.
+template <typename T>
+class SingleFlight {
+public:
+    struct Stats {
+        uint64_t runs;      // calls that did the work
+        uint64_t joined;    // calls that waited on another's
+    };
+
+    // fn() is run by the leader only; an exception it throws reaches every
+    // caller of the flight.
+    template <typename F>
+    T run(const std::string &key, F &&fn) {
+        std::promise<T> promise;
+        std::shared_future<T> running;
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            auto it = inflight_.find(key);
+            if (it != inflight_.end()) running = it->second;
+            else inflight_.emplace(key, promise.get_future().share());
+        }
+        if (running.valid()) {
+            joined_.fetch_add(1, std::memory_order_relaxed);
+            return running.get();
+        }
+        runs_.fetch_add(1, std::memory_order_relaxed);
+        T value;
+        std::exception_ptr error;
+        try {
+            value = fn();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // unpublish first: a caller arriving from now on starts a new flight
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            inflight_.erase(key);
+        }
+        if (error) {
+            promise.set_exception(error);
+            std::rethrow_exception(error);
+        }
+        promise.set_value(value);
+        return value;
+    }
+
+    Stats stats() const {
+        return Stats{runs_.load(std::memory_order_relaxed), joined_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    std::mutex mu_;
+    std::unordered_map<std::string, std::shared_future<T>> inflight_;
+    std::atomic<uint64_t> runs_{0};
+    std::atomic<uint64_t> joined_{0};
+};
+
+} // namespace YUYU
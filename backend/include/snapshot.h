@@ -0,0 +1,116 @@
+#pragma once
+
+#include "mapped_file.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace YUYU {
+
+// On-disk image of in-memory state (search index, hot ranking), written
+// periodically and at shutdown so a restart maps it and replays only what
+// happened after its watermark instead of rebuilding from Postgres.
+//
+// Layout, host byte order (the format version changes if it ever has to
+// travel between architectures):
+//
+//   header   "YUYUSNAP", u32 version, u32 section count,
+//            i64 taken_ms, i64 last_weibo_id, u32 crc32 of the above
+//   table    per section: u32 tag, u32 crc32, u64 offset, u64 size
+//   sections each starting on an 8-byte boundary
+//
+// A file that is short, of another version, or fails any checksum is
+// ignored and the caller rebuilds from scratch.
+struct SnapshotWatermark {
+    long long taken_ms = 0;        // state includes every event before this
+    long long last_weibo_id = 0;   // newest weibo in the search section
+};
+
+enum SnapshotSection : uint32_t {
+    SnapshotSearch = 1,
+    SnapshotHot = 2,
+};
+
+// Appends fixed-width values to a section.
+class SnapshotOut {
+public:
+    explicit SnapshotOut(std::string &buf) : buf_(buf) {}
+    void u32(uint32_t v) { raw(&v, sizeof(v)); }
+    void u64(uint64_t v) { raw(&v, sizeof(v)); }
+    void i64(int64_t v) { raw(&v, sizeof(v)); }
+    void f64(double v) { raw(&v, sizeof(v)); }
+    void bytes(const void *p, size_t n) { raw(p, n); }
+
+private:
+    void raw(const void *p, size_t n) { buf_.append(static_cast<const char *>(p), n); }
+    std::string &buf_;
+};
+
+// Reads a section back; once a read runs past the end every later read
+// returns zero and ok() is false.
+class SnapshotIn {
+public:
+    SnapshotIn(const char *data, size_t size) : p_(data), end_(data + size) {}
+    uint32_t u32() { return fixed<uint32_t>(); }
+    uint64_t u64() { return fixed<uint64_t>(); }
+    int64_t i64() { return fixed<int64_t>(); }
+    double f64() { return fixed<double>(); }
+    // n bytes in place (in the mapping), or nullptr.
+    const char *bytes(size_t n) {
+        if (!ok_ || static_cast<size_t>(end_ - p_) < n) { ok_ = false; return nullptr; }
+        const char *at = p_;
+        p_ += n;
+        return at;
+    }
+    bool ok() const { return ok_; }
+    bool done() const { return ok_ && p_ == end_; }
+
+private:
+    template <typename T>
+    T fixed() {
+        T v{};
+        if (const char *at = bytes(sizeof(T))) std::memcpy(&v, at, sizeof(T));
+        return v;
+    }
+    const char *p_;
+    const char *end_;
+    bool ok_ = true;
+};
+
+class SnapshotWriter {
+public:
+    // Bytes of section `tag`, to be filled through SnapshotOut.
+    std::string &section(uint32_t tag);
+    // Writes `path`.tmp, flushes it to disk and renames it over `path`, so a
+    // crash midway leaves the previous snapshot in place.
+    bool write(const std::string &path, const SnapshotWatermark &mark, std::string &err) const;
+
+private:
+    std::vector<std::pair<uint32_t, std::string>> sections_;
+};
+
+class Snapshot {
+public:
+    // Maps and verifies `path`; nullptr with err when it cannot be used.
+    static std::unique_ptr<Snapshot> open(const std::string &path, std::string &err);
+
+    const SnapshotWatermark &watermark() const { return mark_; }
+    size_t size() const { return file_->size(); }
+    // False if the snapshot has no such section.
+    bool section(uint32_t tag, const char *&data, size_t &size) const;
+
+private:
+    struct Entry {
+        uint32_t tag;
+        const char *data;
+        size_t size;
+    };
+    std::shared_ptr<const MappedFile> file_;
+    SnapshotWatermark mark_;
+    std::vector<Entry> sections_;
+};
+
+} // namespace YUYU
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace YUYU {
+
+// One thread that feeds detached responses (event streams, long polls), so
+// a client waiting for news holds a connection and its buffers rather than
+// a worker thread.
+//
+// Each stream is a step function registered under a key. A step runs once
+// when it is added, after kick() of its key (something for it was
+// published; kicks arriving while the thread is busy are merged), and at
+// least every `tick` for keepalives and deadlines. It returns false when
+// the stream is over and is then dropped; on stop() every step runs one
+// last time with `final` set and must end its stream.
+class StreamPump {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Step = std::function<bool(Clock::time_point now, bool final)>;
+
+    struct Options {
+        std::chrono::milliseconds tick{1000};
+    };
+
+    StreamPump();
+    explicit StreamPump(const Options &opt);
+    ~StreamPump();
+
+    StreamPump(const StreamPump &) = delete;
+    StreamPump &operator=(const StreamPump &) = delete;
+
+    void start();
+    // Ends every stream (final steps) and joins the thread. A step added
+    // afterwards runs at once as final.
+    void stop();
+
+    void add(uint64_t key, Step step);
+    void kick(uint64_t key);
+
+    size_t size() const;
+
+private:
+    void run();
+
+    Options opt_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_;
+    std::vector<std::pair<uint64_t, Step>> added_;
+    std::unordered_set<uint64_t> kicked_;
+    bool stop_ = false;
+    size_t count_ = 0;
+    std::thread th_;
+
+    // pump thread only
+    std::unordered_map<uint64_t, std::vector<Step>> steps_;
+};
+
+} // namespace YUYU
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <httplib.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+namespace YUYU {
+
+class WorkStealingExecutor;
+
+// Worker pool for svr.new_task_queue with a bounded backlog.
+//
+// Work beyond `capacity` queued tasks is not refused outright (httplib would
+// just drop the socket): it goes to a small shedding lane whose threads run it
+// with shedding() == true, and the server's pre-routing handler answers those
+// requests with 503 + Retry-After before touching any route. Tasks that sat in
+// the main queue longer than `deadline_ms` are shed the same way when they
+// are finally dequeued, since their client has most likely given up. Only
+// when the shedding lane is full too does enqueue() return false.
+//
+// Under httplib's own listener a task is a whole keep-alive connection, not a
+// request, so admission alone would let connections that already hold a
+// worker go on sending requests while new ones wait. admit() therefore also
+// judges each later request on the same task: it is answered and the
+// connection closed when other work is waiting, and shed outright when the
+// backlog is full. Under the epoll front end every task is one request.
+//
+// With Options::executor set, admitted tasks run on that work-stealing
+// executor instead of the queue's own threads; admission is unchanged.
+class BoundedTaskQueue : public httplib::TaskQueue {
+public:
+    struct Options {
+        size_t threads = 0;          // 0 = httplib's default pool size
+        size_t capacity = 256;
+        int deadline_ms = 10000;
+        size_t shed_threads = 0;     // 0 = a quarter of the pool, at least 2
+        size_t shed_capacity = 1024;
+        WorkStealingExecutor *executor = nullptr;   // not owned
+    };
+
+    struct Stats {
+        size_t queued;
+        uint64_t completed;
+        uint64_t shed_full;          // queue was full on arrival
+        uint64_t shed_deadline;      // waited longer than deadline_ms
+        uint64_t rejected;           // shedding lane full as well
+    };
+
+    explicit BoundedTaskQueue(const Options &opt);
+    ~BoundedTaskQueue() override;
+
+    bool enqueue(std::function<void()> fn) override;
+    void shutdown() override;
+
+    Stats stats() const;
+
+    enum class Verdict { Serve, ServeAndClose, Shed };
+
+    // Called once per request by the pre-routing handler on the thread that
+    // runs it: Shed when it must be answered with 503, ServeAndClose when the
+    // connection should give its worker back after this response.
+    static Verdict admit();
+
+private:
+    struct Task {
+        std::function<void()> fn;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+
+    void work();
+    void run_task(Task &task);
+    void shed_work();
+
+    Options opt_;
+    mutable std::mutex mu_;
+    std::condition_variable cv_, shed_cv_;
+    std::deque<Task> jobs_;
+    size_t submitted_ = 0;           // on the executor, not yet started
+    size_t outstanding_ = 0;         // on the executor, not yet finished
+    std::condition_variable idle_cv_;
+    std::deque<std::function<void()>> shed_jobs_;
+    std::atomic<size_t> waiting_{0};  // jobs_ + submitted_, read by admit()
+    bool shutdown_ = false;
+    std::vector<std::thread> threads_;
+
+    std::atomic<uint64_t> completed_{0}, shed_full_{0}, shed_deadline_{0}, rejected_{0};
+};
+
+} // namespace YUYU
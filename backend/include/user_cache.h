@@ -0,0 +1,118 @@
+#pragma once
+
+#include "models.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace YUYU {
+
+// In-process cache of user profiles (name and avatar), so feed and comment
+// queries fetch only their own rows and the authors come from memory.
+//
+// Entries live in independently locked shards, each bounded in bytes and
+// evicted with CLOCK (a reference bit per entry, cleared by the sweeping
+// hand; unreferenced entries go). Entries expire after ttl_ms as well, which
+// bounds staleness when another process changes a profile.
+//
+// Misses are collapsed: a miss joins the load already running for that id,
+// or the batch still being collected, and each batch is one loader call
+// (one `user_id = ANY($1)` query) however many requests are waiting on it.
+class UserCache {
+public:
+    struct Options {
+        size_t shards = 16;
+        size_t capacity_bytes = 32 << 20;   // 0 = no caching, loads are still collapsed
+        size_t max_entry_bytes = 4096;      // larger profiles are served but not kept
+        int ttl_ms = 60000;
+        int batch_window_us = 200;          // how long a batch waits for more misses
+        size_t max_batch = 1000;
+    };
+
+    using Entry = std::shared_ptr<const User>;
+    // Fetches the users that exist among `ids`, in any order.
+    using Loader = std::function<bool(const std::vector<long long> &ids, std::vector<User> &out, std::string &err)>;
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t loads;       // loader calls
+        size_t entries;
+        size_t bytes;
+    };
+
+    UserCache(const Options &opt, Loader loader);
+
+    UserCache(const UserCache &) = delete;
+    UserCache &operator=(const UserCache &) = delete;
+
+    // out[i] is the user ids[i], or null if there is none.
+    bool get(const std::vector<long long> &ids, std::vector<Entry> &out, std::string &err);
+    // After a write whose result is known (write-through).
+    void put(const User &user);
+    void invalidate(long long user_id);
+    // Everything, e.g. after missing change notifications.
+    void clear();
+
+    Stats stats() const;
+
+private:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    struct Slot {
+        long long id = 0;
+        Entry user;              // null = free
+        size_t bytes = 0;
+        TimePoint expires;
+        bool ref = false;
+    };
+
+    struct Shard {
+        mutable std::mutex mu;
+        std::vector<Slot> slots;
+        std::vector<size_t> free;
+        std::unordered_map<long long, size_t> index;
+        size_t hand = 0;
+        size_t bytes = 0;
+        uint64_t gen = 0;        // bumped by invalidate()
+    };
+
+    // One loader call and everyone waiting on it.
+    struct Flight {
+        std::vector<long long> ids;
+        bool done = false;
+        bool ok = false;
+        std::string err;
+        std::unordered_map<long long, Entry> found;
+    };
+
+    Shard &shard_of(long long id) { return shards_[static_cast<uint64_t>(id) % shards_.size()]; }
+    Entry lookup(long long id, TimePoint now);
+    // Stores `user` unless its shard was invalidated after generation `gen`.
+    void store(const Entry &user, const uint64_t *gen);
+    void evict_locked(Shard &sh, size_t need);
+    // Runs the loader for `f`; a batch still open first waits batch_window_us
+    // for more misses.
+    void run(const std::shared_ptr<Flight> &f, bool gather);
+
+    Options opt_;
+    Loader loader_;
+    std::vector<Shard> shards_;
+    size_t shard_capacity_;
+
+    std::mutex flight_mu_;
+    std::condition_variable flight_cv_;
+    std::unordered_map<long long, std::shared_ptr<Flight>> inflight_;
+    std::shared_ptr<Flight> open_;   // still collecting ids
+
+    mutable std::mutex stats_mu_;
+    uint64_t hits_ = 0, misses_ = 0, loads_ = 0;
+};
+
+} // namespace YUYU
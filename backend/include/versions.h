@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace YUYU {
+
+// Version counters for cacheable read resources, bumped by the writes that
+// change them, so a response's ETag can be built without hashing its body.
+//
+// Counters are striped: each kind has a fixed array and an id maps to one
+// slot by hash, so two ids can share a counter. A shared slot only ever
+// makes a client refetch something that did not change, never serves a
+// stale 304. The ETag also carries a per-process epoch, as counters restart
+// from zero with the server.
+class VersionTable {
+public:
+    enum Kind {
+        Feed = 0,        // latest feed (global)
+        Comments,        // comments of a weibo
+        Followers,       // followers of a user
+        Following,       // followees of a user
+        User,            // one user's profile
+        Profiles,        // any username/avatar (embedded in other lists)
+        KindCount
+    };
+
+    VersionTable();
+
+    uint64_t get(Kind kind, long long id = 0) const;
+    // When the counter last moved; a body built for its current version
+    // must not come from a replica that is behind that moment (see
+    // Database::read_since). time_point::min() before the first bump.
+    std::chrono::steady_clock::time_point changed(Kind kind, long long id = 0) const;
+    void bump(Kind kind, long long id = 0);
+    // Every resource, when it is unknown which ones changed.
+    void bump_all();
+
+    // Weak ETag over a resource's version(s).
+    std::string etag(Kind kind, long long id, uint64_t version, uint64_t extra = 0) const;
+
+private:
+    static constexpr size_t kStripes = 4096;
+    size_t slot(long long id) const;
+
+    std::unique_ptr<std::atomic<uint64_t>[]> counters_;
+    std::unique_ptr<std::atomic<std::chrono::steady_clock::rep>[]> changed_;
+    std::string epoch_;
+};
+
+} // namespace YUYU
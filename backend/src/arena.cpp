@@ -0,0 +1,74 @@
+#include "arena.h"
+#include <algorithm>
+#include <memory>
+#include <optional>
+
+namespace YUYU {
+
+namespace {
+
+// Upstream of the monotonic resource: the heap, counting what the buffer
+// could not hold.
+class Spill : public std::pmr::memory_resource {
+public:
+    size_t bytes = 0;
+
+private:
+    void *do_allocate(size_t n, size_t align) override {
+        bytes += n;
+        return std::pmr::new_delete_resource()->allocate(n, align);
+    }
+    void do_deallocate(void *p, size_t n, size_t align) override {
+        std::pmr::new_delete_resource()->deallocate(p, n, align);
+    }
+    bool do_is_equal(const std::pmr::memory_resource &o) const noexcept override { return this == &o; }
+};
+
+struct ThreadArena {
+    std::unique_ptr<std::byte[]> buf;
+    size_t capacity = 0;
+    Spill spill;
+    std::optional<std::pmr::monotonic_buffer_resource> mono;
+    bool active = false;
+
+    ThreadArena() { allocate(RequestArena::kInitialBytes); }
+
+    void allocate(size_t n) {
+        mono.reset();
+        buf.reset(new std::byte[n]);
+        capacity = n;
+        mono.emplace(buf.get(), capacity, &spill);
+    }
+
+    void reset() {
+        mono->release();
+        if (spill.bytes && capacity < RequestArena::kMaxBytes) {
+            allocate(std::min(RequestArena::kMaxBytes, std::max(capacity * 2, capacity + spill.bytes)));
+        }
+        spill.bytes = 0;
+    }
+};
+
+thread_local ThreadArena t_arena;
+
+} // namespace
+
+void RequestArena::begin() {
+    t_arena.reset();
+    t_arena.active = true;
+}
+
+void RequestArena::end() {
+    t_arena.active = false;
+    t_arena.reset();
+}
+
+std::pmr::memory_resource *RequestArena::resource() {
+    return t_arena.active ? &*t_arena.mono : std::pmr::new_delete_resource();
+}
+
+RequestArena::Stats RequestArena::stats() {
+    return Stats{t_arena.capacity, t_arena.spill.bytes};
+}
+
+} // namespace YUYU
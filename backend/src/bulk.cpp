@@ -0,0 +1,415 @@
+#include "bulk.h"
+#include <libpq-fe.h>
+#include <cstring>
+#include <cstdlib>
+
+namespace YUYU {
+
+// PostgreSQL binary timestamps count microseconds from 2000-01-01 00:00:00 UTC.
+static const int64_t PG_EPOCH_OFFSET_MS = 946684800000LL;
+
+const std::vector<TableSpec> &bulk_tables() {
+    static const std::vector<TableSpec> tables = {
+        {"users", "user_id", {
+            {"user_id", ColumnType::Int8, false},
+            {"username", ColumnType::Text, false},
+            {"email", ColumnType::Text, false},
+            {"password_hash", ColumnType::Text, false},
+            {"avatar", ColumnType::Text, true},
+            {"created_at", ColumnType::TimestampMs, true}}},
+        {"weibos", "weibo_id", {
+            {"weibo_id", ColumnType::Int8, false},
+            {"user_id", ColumnType::Int8, false},
+            {"content", ColumnType::Text, false},
+            {"media", ColumnType::Text, true},
+            {"created_at", ColumnType::TimestampMs, true}}},
+        {"comments", "comment_id", {
+            {"comment_id", ColumnType::Int8, false},
+            {"weibo_id", ColumnType::Int8, false},
+            {"user_id", ColumnType::Int8, false},
+            {"content", ColumnType::Text, false},
+            {"parent_id", ColumnType::Int8, true},
+            {"created_at", ColumnType::TimestampMs, true}}},
+        {"likes", "like_id", {
+            {"like_id", ColumnType::Int8, false},
+            {"weibo_id", ColumnType::Int8, false},
+            {"user_id", ColumnType::Int8, false},
+            {"created_at", ColumnType::TimestampMs, true}}},
+        {"follows", "follow_id", {
+            {"follow_id", ColumnType::Int8, false},
+            {"follower_id", ColumnType::Int8, false},
+            {"followee_id", ColumnType::Int8, false},
+            {"created_at", ColumnType::TimestampMs, true}}},
+    };
+    return tables;
+}
+
+const TableSpec *find_table(const std::string &name) {
+    for (auto &t : bulk_tables()) if (name == t.table) return &t;
+    return nullptr;
+}
+
+// ---------------- row encoding ----------------
+
+void CopyRowEncoder::put_timestamp_ms(int64_t unix_ms) {
+    put_be32(8);
+    put_be64(static_cast<uint64_t>((unix_ms - PG_EPOCH_OFFSET_MS) * 1000));
+}
+
+static uint32_t get_be32(const char *p) {
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | uint32_t(u[3]);
+}
+
+int CopyRowDecoder::next_row() {
+    if (end_ - p_ < 2) {
+        truncated_ = p_ != end_;
+        return 0;
+    }
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p_);
+    int16_t n = static_cast<int16_t>((u[0] << 8) | u[1]);
+    p_ += 2;
+    return n < 0 ? 0 : n;
+}
+
+bool CopyRowDecoder::field(const char *&data, uint32_t &len) {
+    if (end_ - p_ < 4) { p_ = end_; truncated_ = true; return false; }
+    len = get_be32(p_);
+    p_ += 4;
+    if (len == 0xFFFFFFFFu) return false;
+    if (static_cast<size_t>(end_ - p_) < len) { p_ = end_; truncated_ = true; return false; }
+    data = p_;
+    p_ += len;
+    return true;
+}
+
+bool CopyRowDecoder::get_int8(int64_t &v) {
+    const char *d; uint32_t len;
+    if (!field(d, len) || len != 8) return false;
+    v = static_cast<int64_t>((uint64_t(get_be32(d)) << 32) | get_be32(d + 4));
+    return true;
+}
+
+bool CopyRowDecoder::get_text(std::string &s) {
+    const char *d; uint32_t len;
+    if (!field(d, len)) return false;
+    s.assign(d, len);
+    return true;
+}
+
+bool CopyRowDecoder::get_timestamp_ms(int64_t &unix_ms) {
+    int64_t us = 0;
+    if (!get_int8(us)) return false;
+    unix_ms = us / 1000 + PG_EPOCH_OFFSET_MS;
+    return true;
+}
+
+bool CopyRowDecoder::skip() {
+    const char *d; uint32_t len;
+    return field(d, len);
+}
+
+// ---------------- CopyWriter ----------------
+
+static bool exec_command(PGconn *conn, const std::string &sql, std::string &err) {
+    PGresult *res = PQexec(conn, sql.c_str());
+    if (!res) { err = PQerrorMessage(conn); return false; }
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) err = PQresultErrorMessage(res);
+    PQclear(res);
+    return ok;
+}
+
+CopyWriter::CopyWriter(PGconn *conn, size_t flush_bytes) : conn_(conn), flush_bytes_(flush_bytes) {
+    buf_.reserve(flush_bytes_ + 4096);
+}
+
+bool CopyWriter::begin(const TableSpec &spec, std::string &err) {
+    // The change triggers (YUYU_CDC) would send one NOTIFY per row, all
+    // queued behind the commit. The table is loaded in one transaction with
+    // yuyu.bulk set, which yuyu_notify_change() skips; disabling the
+    // triggers instead would lock the table against live writes for the
+    // whole COPY and needs its owner.
+    if (!exec_command(conn_, "BEGIN; SET LOCAL yuyu.bulk = 'on';", err)) {
+        std::string ignored;
+        exec_command(conn_, "ROLLBACK;", ignored);
+        return false;
+    }
+    std::string sql = "COPY ";
+    sql += spec.table;
+    sql += "(";
+    for (size_t i = 0; i < spec.columns.size(); ++i) {
+        if (i) sql += ",";
+        sql += spec.columns[i].name;
+    }
+    sql += ") FROM STDIN WITH (FORMAT binary);";
+    PGresult *res = PQexec(conn_, sql.c_str());
+    bool copying = res && PQresultStatus(res) == PGRES_COPY_IN;
+    if (!copying) {
+        err = res ? PQresultErrorMessage(res) : PQerrorMessage(conn_);
+        PQclear(res);
+        std::string ignored;
+        exec_command(conn_, "ROLLBACK;", ignored);
+        return false;
+    }
+    PQclear(res);
+    active_ = true;
+    nfields_ = static_cast<int16_t>(spec.columns.size());
+    buf_.clear();
+    // signature, flags, header extension length
+    static const char sig[] = {'P','G','C','O','P','Y','\n','\377','\r','\n','\0'};
+    buf_.append(sig, sizeof(sig));
+    buf_.append(8, '\0');
+    return true;
+}
+
+bool CopyWriter::flush(std::string &err) {
+    if (buf_.empty()) return true;
+    if (PQputCopyData(conn_, buf_.data(), static_cast<int>(buf_.size())) != 1) {
+        err = PQerrorMessage(conn_);
+        return false;
+    }
+    buf_.clear();
+    return true;
+}
+
+bool CopyWriter::end_row(std::string &err) {
+    if (buf_.size() >= flush_bytes_) return flush(err);
+    return true;
+}
+
+bool CopyWriter::put_encoded(const char *data, size_t len, std::string &err) {
+    if (buf_.size() + len < flush_bytes_) { buf_.append(data, len); return true; }
+    if (!flush(err)) return false;
+    if (len < flush_bytes_) { buf_.append(data, len); return true; }
+    if (PQputCopyData(conn_, data, static_cast<int>(len)) != 1) { err = PQerrorMessage(conn_); return false; }
+    return true;
+}
+
+bool CopyWriter::finish(long &rows_out, std::string &err) {
+    if (!active_) { err = "copy not started"; return false; }
+    active_ = false;
+    enc_.put_trailer();
+    bool ok = flush(err);
+    if (ok && PQputCopyEnd(conn_, nullptr) != 1) { err = PQerrorMessage(conn_); ok = false; }
+    if (!ok) {
+        PQputCopyEnd(conn_, err.c_str());
+        while (PGresult *res = PQgetResult(conn_)) PQclear(res);
+        std::string ignored;
+        exec_command(conn_, "ROLLBACK;", ignored);
+        return false;
+    }
+    rows_out = 0;
+    while (PGresult *res = PQgetResult(conn_)) {
+        if (PQresultStatus(res) != PGRES_COMMAND_OK) {
+            err = PQresultErrorMessage(res);
+            ok = false;
+        } else {
+            const char *n = PQcmdTuples(res);
+            if (n && *n) rows_out = atol(n);
+        }
+        PQclear(res);
+    }
+    if (ok) return exec_command(conn_, "COMMIT;", err);
+    std::string ignored;
+    exec_command(conn_, "ROLLBACK;", ignored);
+    return false;
+}
+
+void CopyWriter::abort(const std::string &reason) {
+    if (!active_) return;
+    active_ = false;
+    PQputCopyEnd(conn_, reason.c_str());
+    while (PGresult *res = PQgetResult(conn_)) PQclear(res);
+    std::string ignored;
+    exec_command(conn_, "ROLLBACK;", ignored);
+}
+
+// ---------------- CsvReader ----------------
+
+bool CsvReader::next(std::vector<std::string> &fields, std::vector<bool> &quoted) {
+    fields.clear();
+    quoted.clear();
+    std::streambuf *sb = in_.rdbuf();
+    int c = sb->sgetc();
+    if (c == std::char_traits<char>::eof()) return false;
+    ++line_;
+    std::string cur;
+    bool in_quotes = false, was_quoted = false;
+    for (;;) {
+        c = sb->sbumpc();
+        if (c == std::char_traits<char>::eof()) break;
+        if (in_quotes) {
+            if (c == '"') {
+                if (sb->sgetc() == '"') { sb->sbumpc(); cur.push_back('"'); }
+                else in_quotes = false;
+            } else {
+                if (c == '\n') ++line_;
+                cur.push_back(static_cast<char>(c));
+            }
+            continue;
+        }
+        if (c == '"') { in_quotes = true; was_quoted = true; continue; }
+        if (c == ',') {
+            fields.push_back(std::move(cur)); quoted.push_back(was_quoted);
+            cur.clear(); was_quoted = false;
+            continue;
+        }
+        if (c == '\r') continue;
+        if (c == '\n') break;
+        cur.push_back(static_cast<char>(c));
+    }
+    fields.push_back(std::move(cur));
+    quoted.push_back(was_quoted);
+    return true;
+}
+
+// ---------------- import / export ----------------
+
+static bool parse_int8(const std::string &s, int64_t &out) {
+    if (s.empty()) return false;
+    char *end = nullptr;
+    out = strtoll(s.c_str(), &end, 10);
+    return end && *end == '\0';
+}
+
+bool import_csv(PGconn *conn, const TableSpec &spec, std::istream &in, long &rows_out, std::string &err) {
+    CsvReader reader(in);
+    std::vector<std::string> fields;
+    std::vector<bool> quoted;
+    if (!reader.next(fields, quoted)) { err = "empty csv"; return false; }
+    if (fields.size() != spec.columns.size()) { err = "csv header does not match table " + std::string(spec.table); return false; }
+    for (size_t i = 0; i < fields.size(); ++i) {
+        if (fields[i] != spec.columns[i].name) {
+            err = "csv header column " + fields[i] + " does not match " + spec.columns[i].name;
+            return false;
+        }
+    }
+
+    CopyWriter w(conn);
+    if (!w.begin(spec, err)) return false;
+    while (reader.next(fields, quoted)) {
+        if (fields.size() == 1 && fields[0].empty() && !quoted[0]) continue; // blank line
+        if (fields.size() != spec.columns.size()) {
+            err = "line " + std::to_string(reader.line()) + ": expected " + std::to_string(spec.columns.size()) + " fields";
+            w.abort(err);
+            return false;
+        }
+        w.start_row();
+        for (size_t i = 0; i < fields.size(); ++i) {
+            const ColumnSpec &col = spec.columns[i];
+            // COPY CSV convention: an unquoted empty field is NULL
+            if (fields[i].empty() && !quoted[i]) {
+                if (!col.nullable) {
+                    err = "line " + std::to_string(reader.line()) + ": column " + col.name + " is not nullable";
+                    w.abort(err);
+                    return false;
+                }
+                w.put_null();
+                continue;
+            }
+            if (col.type == ColumnType::Text) { w.put_text(fields[i]); continue; }
+            int64_t v = 0;
+            if (!parse_int8(fields[i], v)) {
+                err = "line " + std::to_string(reader.line()) + ": column " + col.name + " is not an integer";
+                w.abort(err);
+                return false;
+            }
+            if (col.type == ColumnType::Int8) w.put_int8(v); else w.put_timestamp_ms(v);
+        }
+        if (!w.end_row(err)) { w.abort(err); return false; }
+    }
+    return w.finish(rows_out, err);
+}
+
+bool export_csv(PGconn *conn, const TableSpec &spec, std::ostream &out, long &rows_out, std::string &err) {
+    std::string sql = "COPY (SELECT ";
+    for (size_t i = 0; i < spec.columns.size(); ++i) {
+        const ColumnSpec &col = spec.columns[i];
+        if (i) sql += ",";
+        if (col.type == ColumnType::TimestampMs) {
+            sql += "(EXTRACT(EPOCH FROM ";
+            sql += col.name;
+            sql += ")*1000)::bigint AS ";
+        }
+        sql += col.name;
+    }
+    sql += " FROM ";
+    sql += spec.table;
+    sql += " ORDER BY ";
+    sql += spec.id_column;
+    sql += ") TO STDOUT WITH (FORMAT csv, HEADER true);";
+
+    PGresult *res = PQexec(conn, sql.c_str());
+    if (!res) { err = PQerrorMessage(conn); return false; }
+    if (PQresultStatus(res) != PGRES_COPY_OUT) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+    PQclear(res);
+
+    rows_out = 0;
+    char *row = nullptr;
+    int n = 0;
+    bool header = true;
+    while ((n = PQgetCopyData(conn, &row, 0)) > 0) {
+        out.write(row, n);
+        PQfreemem(row);
+        if (header) header = false; else ++rows_out;
+    }
+    if (n == -2) { err = PQerrorMessage(conn); return false; }
+    bool ok = true;
+    while (PGresult *r = PQgetResult(conn)) {
+        if (PQresultStatus(r) != PGRES_COMMAND_OK) { err = PQresultErrorMessage(r); ok = false; }
+        PQclear(r);
+    }
+    if (!out) { err = "write failed"; return false; }
+    return ok;
+}
+
+bool announce_reload(PGconn *conn, std::string &err) {
+    // parsed like the triggers' payloads: op R, no table, no row
+    return exec_command(conn, "NOTIFY yuyu_changes, 'R - 0 0 0 -';", err);
+}
+
+bool sync_sequence(PGconn *conn, const TableSpec &spec, std::string &err) {
+    std::string sql = "SELECT setval(pg_get_serial_sequence('";
+    sql += spec.table;
+    sql += "','";
+    sql += spec.id_column;
+    sql += "'), GREATEST((SELECT COALESCE(MAX(";
+    sql += spec.id_column;
+    sql += "),0) FROM ";
+    sql += spec.table;
+    sql += "),1));";
+    PGresult *res = PQexec(conn, sql.c_str());
+    if (!res) { err = PQerrorMessage(conn); return false; }
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+    PQclear(res);
+    return true;
+}
+
+bool max_id(PGconn *conn, const TableSpec &spec, long &out, std::string &err) {
+    std::string sql = "SELECT COALESCE(MAX(";
+    sql += spec.id_column;
+    sql += "),0) FROM ";
+    sql += spec.table;
+    sql += ";";
+    PGresult *res = PQexec(conn, sql.c_str());
+    if (!res) { err = PQerrorMessage(conn); return false; }
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+    out = atol(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    return true;
+}
+
+bool is_sharded(PGconn *conn, bool &out, std::string &err) {
+    PGresult *res = PQexec(conn,
+        "SELECT COALESCE(column_default, '') FROM information_schema.columns "
+        "WHERE table_name = 'weibos' AND column_name = 'weibo_id';");
+    if (!res) { err = PQerrorMessage(conn); return false; }
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+    // sharded defaults read "nextval(...) * 32 + k"
+    out = PQntuples(res) > 0 && std::strchr(PQgetvalue(res, 0, 0), '*') != nullptr;
+    PQclear(res);
+    return true;
+}
+
+} // namespace YUYU
@@ -0,0 +1,264 @@
+// yuyu_bulk: bulk import / export / dataset generation over binary COPY.
+//
+//   yuyu_bulk [--conn <conninfo>] import <dir> [table...]
+//   yuyu_bulk [--conn <conninfo>] export <dir> [table...]
+//   yuyu_bulk [--conn <conninfo>] generate [options] [--out <file>]
+//   yuyu_bulk [--conn <conninfo>] load <file>
+//
+// CSV files are named <dir>/<table>.csv and use the columns of bulk_tables().
+// `generate` writes a synthetic dataset (see DatasetConfig) into the database,
+// next to the rows already there (unsharded databases only, with ids in the
+// backend's layout, see DatasetConfig::generator_ids), or into a local
+// snapshot file with --out;
+// `load` replays such a snapshot into an empty database (its ids start at 1).
+// The connection string falls back to $YUYU_DB_CONN.
+#include "bulk.h"
+#include "datagen.h"
+#include <libpq-fe.h>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+using namespace YUYU;
+
+static int usage() {
+    std::cerr <<
+        "usage: yuyu_bulk [--conn <conninfo>] import <dir> [table...]\n"
+        "       yuyu_bulk [--conn <conninfo>] export <dir> [table...]\n"
+        "       yuyu_bulk [--conn <conninfo>] generate [--users N] [--weibos-per-user X] [--follows-per-user X]\n"
+        "                 [--activity-skew X] [--popularity-skew X] [--follow-alpha X] [--like-skew X]\n"
+        "                 [--comment-skew X] [--reply-ratio X] [--media-ratio X] [--max-follows N]\n"
+        "                 [--max-likes N] [--max-comments N] [--seed S] [--end-ms MS] [--threads N] [--out <file>]\n"
+        "       yuyu_bulk [--conn <conninfo>] load <file>\n";
+    return 2;
+}
+
+static std::vector<const TableSpec*> select_tables(const std::vector<std::string> &names, std::string &err) {
+    std::vector<const TableSpec*> out;
+    if (names.empty()) {
+        for (auto &t : bulk_tables()) out.push_back(&t);
+        return out;
+    }
+    // keep foreign-key order regardless of argument order
+    for (auto &t : bulk_tables()) {
+        for (auto &n : names) if (n == t.table) { out.push_back(&t); break; }
+    }
+    for (auto &n : names) {
+        if (!find_table(n)) { err = "unknown table " + n; return {}; }
+    }
+    return out;
+}
+
+static int cmd_import(PGconn *conn, const std::string &dir, const std::vector<std::string> &names) {
+    std::string err;
+    auto tables = select_tables(names, err);
+    if (tables.empty()) { std::cerr << err << "\n"; return 1; }
+    for (auto *t : tables) {
+        std::string path = dir + "/" + t->table + ".csv";
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs) { std::cerr << "skip " << t->table << ": cannot open " << path << "\n"; continue; }
+        auto t0 = std::chrono::steady_clock::now();
+        long rows = 0;
+        if (!import_csv(conn, *t, ifs, rows, err) || !sync_sequence(conn, *t, err)) {
+            std::cerr << "import " << t->table << " failed: " << err << "\n";
+            return 1;
+        }
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        std::cout << "imported " << rows << " rows into " << t->table << " in " << ms << " ms\n";
+    }
+    if (!announce_reload(conn, err)) { std::cerr << "notify failed: " << err << "\n"; return 1; }
+    return 0;
+}
+
+static int cmd_export(PGconn *conn, const std::string &dir, const std::vector<std::string> &names) {
+    std::string err;
+    auto tables = select_tables(names, err);
+    if (tables.empty()) { std::cerr << err << "\n"; return 1; }
+    for (auto *t : tables) {
+        std::string path = dir + "/" + t->table + ".csv";
+        std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+        if (!ofs) { std::cerr << "cannot write " << path << "\n"; return 1; }
+        long rows = 0;
+        if (!export_csv(conn, *t, ofs, rows, err)) {
+            std::cerr << "export " << t->table << " failed: " << err << "\n";
+            return 1;
+        }
+        std::cout << "exported " << rows << " rows from " << t->table << " to " << path << "\n";
+    }
+    return 0;
+}
+
+// Sends generated chunks straight into COPY, one table at a time.
+class CopySink : public DatasetSink {
+public:
+    explicit CopySink(PGconn *conn) : conn_(conn), w_(conn) {}
+    bool begin_table(const std::string &table, std::string &err) override {
+        spec_ = find_table(table);
+        if (!spec_) { err = "unknown table " + table; return false; }
+        t0_ = std::chrono::steady_clock::now();
+        return w_.begin(*spec_, err);
+    }
+    bool write_chunk(const std::string &rows, long, std::string &err) override {
+        if (w_.put_encoded(rows.data(), rows.size(), err)) return true;
+        w_.abort(err);
+        return false;
+    }
+    bool end_table(std::string &err) override {
+        long rows = 0;
+        if (!w_.finish(rows, err) || !sync_sequence(conn_, *spec_, err)) return false;
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0_).count();
+        std::cout << "loaded " << rows << " rows into " << spec_->table << " in " << ms << " ms\n";
+        return true;
+    }
+
+private:
+    PGconn *conn_;
+    CopyWriter w_;
+    const TableSpec *spec_ = nullptr;
+    std::chrono::steady_clock::time_point t0_;
+};
+
+// Snapshot sink for --out that also prints per-table row counts.
+class ReportingFileSink : public SnapshotFileSink {
+public:
+    using SnapshotFileSink::SnapshotFileSink;
+    bool begin_table(const std::string &table, std::string &err) override {
+        table_ = table; rows_ = 0;
+        return SnapshotFileSink::begin_table(table, err);
+    }
+    bool write_chunk(const std::string &rows, long count, std::string &err) override {
+        rows_ += count;
+        return SnapshotFileSink::write_chunk(rows, count, err);
+    }
+    bool end_table(std::string &err) override {
+        std::cout << "wrote " << rows_ << " rows of " << table_ << "\n";
+        return SnapshotFileSink::end_table(err);
+    }
+
+private:
+    std::string table_;
+    long rows_ = 0;
+};
+
+static int cmd_generate(PGconn *conn, DatasetConfig cfg, const std::string &out_path) {
+    std::string err;
+    auto t0 = std::chrono::steady_clock::now();
+    bool ok;
+    if (!out_path.empty()) {
+        ReportingFileSink sink(out_path, cfg);
+        ok = sink.open(err) && generate_dataset(cfg, sink, err) && sink.close(err);
+    } else {
+        // Backends may be writing the same database: users follow the
+        // existing ones and the other tables get backend-style ids under the
+        // bulk node number, so they keep the time order of the id-keyed feed
+        // and never collide with ids issued meanwhile.
+        bool sharded = false;
+        if (!is_sharded(conn, sharded, err)) { std::cerr << err << "\n"; return 1; }
+        if (sharded) {
+            std::cerr << "this database is one of several shards; generate can only append to an unsharded database\n";
+            return 1;
+        }
+        if (!max_id(conn, *find_table("users"), cfg.user_base, err)) { std::cerr << err << "\n"; return 1; }
+        cfg.generator_ids = true;
+        CopySink sink(conn);
+        ok = generate_dataset(cfg, sink, err) && announce_reload(conn, err);
+    }
+    if (!ok) { std::cerr << "generate failed: " << err << "\n"; return 1; }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    std::cout << "generated dataset (seed " << cfg.seed << ", end_ms " << cfg.end_ms << ") in " << ms << " ms\n";
+    return 0;
+}
+
+static int cmd_load(PGconn *conn, const std::string &path) {
+    std::string err;
+    SnapshotFileReader reader(path);
+    uint64_t seed = 0;
+    int64_t end_ms = 0;
+    if (!reader.open(seed, end_ms, err)) { std::cerr << err << "\n"; return 1; }
+    // the snapshot's ids, names and emails were fixed when it was generated
+    for (auto &t : bulk_tables()) {
+        long max = 0;
+        if (!max_id(conn, t, max, err)) { std::cerr << err << "\n"; return 1; }
+        if (max > 0) {
+            std::cerr << "load needs an empty database, " << t.table << " has rows; "
+                      << "use generate without --out to add to existing data\n";
+            return 1;
+        }
+    }
+    CopySink sink(conn);
+    SnapshotTable t;
+    while (reader.next_table(t, err)) {
+        bool ok = sink.begin_table(t.name, err)
+            && reader.read_table(t, [&](const char *p, size_t n) { return sink.write_chunk(std::string(p, n), 0, err); }, err)
+            && sink.end_table(err);
+        if (!ok) { std::cerr << "load " << t.name << " failed: " << err << "\n"; return 1; }
+    }
+    if (!err.empty()) { std::cerr << err << "\n"; return 1; }
+    if (!announce_reload(conn, err)) { std::cerr << "notify failed: " << err << "\n"; return 1; }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    std::string conninfo;
+    if (const char *env = std::getenv("YUYU_DB_CONN")) conninfo = env;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--conn") == 0 && i + 1 < argc) conninfo = argv[++i];
+        else args.push_back(argv[i]);
+    }
+    if (args.empty()) return usage();
+
+    const std::string cmd = args[0];
+    DatasetConfig gen;
+    std::string out_path;
+    std::vector<std::string> rest(args.begin() + 1, args.end());
+    if (cmd == "generate") {
+        std::map<std::string, long*> longs = {
+            {"--users", &gen.users}, {"--max-follows", &gen.max_follows},
+            {"--max-likes", &gen.max_likes}, {"--max-comments", &gen.max_comments}};
+        std::map<std::string, double*> doubles = {
+            {"--weibos-per-user", &gen.weibos_per_user}, {"--activity-skew", &gen.activity_skew},
+            {"--follows-per-user", &gen.follows_per_user}, {"--follow-alpha", &gen.follow_alpha},
+            {"--popularity-skew", &gen.popularity_skew}, {"--like-skew", &gen.like_skew},
+            {"--comment-skew", &gen.comment_skew}, {"--reply-ratio", &gen.reply_ratio},
+            {"--media-ratio", &gen.media_ratio}};
+        for (size_t i = 0; i < rest.size(); ++i) {
+            if (i + 1 >= rest.size()) return usage();
+            const std::string &flag = rest[i];
+            const char *val = rest[++i].c_str();
+            if (flag == "--seed") gen.seed = std::strtoull(val, nullptr, 10);
+            else if (flag == "--end-ms") gen.end_ms = std::strtoll(val, nullptr, 10);
+            else if (flag == "--threads") gen.threads = std::atoi(val);
+            else if (flag == "--out") out_path = val;
+            else if (longs.count(flag)) *longs[flag] = std::atol(val);
+            else if (doubles.count(flag)) *doubles[flag] = std::atof(val);
+            else return usage();
+        }
+        // a snapshot needs no database
+        if (!out_path.empty()) return cmd_generate(nullptr, gen, out_path);
+    } else if ((cmd != "import" && cmd != "export" && cmd != "load") || rest.empty()) {
+        return usage();
+    }
+    if (conninfo.empty()) return usage();
+
+    PGconn *conn = PQconnectdb(conninfo.c_str());
+    if (PQstatus(conn) != CONNECTION_OK) {
+        std::cerr << "connect failed: " << PQerrorMessage(conn);
+        PQfinish(conn);
+        return 1;
+    }
+    int rc = 0;
+    if (cmd == "generate") {
+        rc = cmd_generate(conn, gen, out_path);
+    } else if (cmd == "load") {
+        rc = cmd_load(conn, rest[0]);
+    } else {
+        std::vector<std::string> names(rest.begin() + 1, rest.end());
+        rc = cmd == "import" ? cmd_import(conn, rest[0], names) : cmd_export(conn, rest[0], names);
+    }
+    PQfinish(conn);
+    return rc;
+}
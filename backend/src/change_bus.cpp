@@ -0,0 +1,95 @@
+#include "change_bus.h"
+
+namespace YUYU {
+
+ChangeBus::ChangeBus() : ChangeBus(Options()) {}
+
+ChangeBus::ChangeBus(const Options &opt) : opt_(opt) {
+    if (opt_.lanes == 0) opt_.lanes = 1;
+    if (opt_.max_batch == 0) opt_.max_batch = 1;
+    for (size_t i = 0; i < opt_.lanes; ++i) lanes_.emplace_back(new Lane());
+}
+
+ChangeBus::~ChangeBus() { stop(); }
+
+void ChangeBus::subscribe(Handler h) { handlers_.push_back(std::move(h)); }
+
+void ChangeBus::start() {
+    stopping_ = false;
+    for (auto &l : lanes_) {
+        if (l->worker.joinable()) continue;
+        Lane *lane = l.get();
+        l->worker = std::thread([this, lane] { run(*lane); });
+    }
+}
+
+void ChangeBus::stop() {
+    stopping_ = true;
+    for (auto &l : lanes_) {
+        {
+            std::lock_guard<std::mutex> lk(l->mu);
+        }
+        l->cv.notify_all();
+        if (l->worker.joinable()) l->worker.join();
+    }
+}
+
+void ChangeBus::publish(const RowChange &c) {
+    // splitmix-style mix so sequential ids spread over lanes
+    uint64_t h = static_cast<uint64_t>(c.key()) * 0x9E3779B97F4A7C15ull;
+    Lane &lane = *lanes_[(h >> 32) % lanes_.size()];
+    {
+        std::lock_guard<std::mutex> lk(lane.mu);
+        if (lane.queue.size() >= opt_.capacity) {
+            // the subscribers are behind; they will start over instead
+            lane.queue.clear();
+            lane.overflowed = true;
+            overflows_.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            lane.queue.push_back(c);
+        }
+    }
+    published_.fetch_add(1, std::memory_order_relaxed);
+    lane.cv.notify_one();
+}
+
+void ChangeBus::publish_resync() {
+    for (auto &l : lanes_) {
+        {
+            std::lock_guard<std::mutex> lk(l->mu);
+            l->queue.clear();
+            l->overflowed = true;
+        }
+        l->cv.notify_one();
+    }
+}
+
+void ChangeBus::run(Lane &lane) {
+    std::vector<RowChange> batch;
+    batch.reserve(opt_.max_batch);
+    std::unique_lock<std::mutex> lk(lane.mu);
+    for (;;) {
+        lane.cv.wait(lk, [&] { return stopping_ || lane.overflowed || !lane.queue.empty(); });
+        if (stopping_) return;
+        batch.clear();
+        if (lane.overflowed) {
+            lane.overflowed = false;
+            batch.push_back(RowChange());   // Resync
+        }
+        while (!lane.queue.empty() && batch.size() < opt_.max_batch) {
+            batch.push_back(lane.queue.front());
+            lane.queue.pop_front();
+        }
+        lk.unlock();
+        for (const Handler &h : handlers_) h(batch);
+        batches_.fetch_add(1, std::memory_order_relaxed);
+        lk.lock();
+    }
+}
+
+ChangeBus::Stats ChangeBus::stats() const {
+    return Stats{published_.load(std::memory_order_relaxed), batches_.load(std::memory_order_relaxed),
+                 overflows_.load(std::memory_order_relaxed)};
+}
+
+} // namespace YUYU
@@ -0,0 +1,158 @@
+#include "compress.h"
+#include <zlib.h>
+#include <cctype>
+#include <cstdlib>
+#ifdef YUYU_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace YUYU {
+
+namespace {
+
+constexpr int kGzipLevel = 6;
+constexpr int kZstdLevel = 3;
+
+// Per-thread deflate stream, reset rather than re-initialised per body.
+struct GzipContext {
+    z_stream zs{};
+    bool ok = false;
+    GzipContext() {
+        // windowBits 15 + 16: gzip wrapper instead of zlib
+        ok = deflateInit2(&zs, kGzipLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    ~GzipContext() { if (ok) deflateEnd(&zs); }
+};
+
+bool gzip(const std::string &in, std::string &out) {
+    thread_local GzipContext ctx;
+    if (!ctx.ok || deflateReset(&ctx.zs) != Z_OK) return false;
+    out.resize(deflateBound(&ctx.zs, static_cast<uLong>(in.size())));
+    ctx.zs.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    ctx.zs.avail_in = static_cast<uInt>(in.size());
+    ctx.zs.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    ctx.zs.avail_out = static_cast<uInt>(out.size());
+    if (deflate(&ctx.zs, Z_FINISH) != Z_STREAM_END) return false;
+    out.resize(ctx.zs.total_out);
+    return true;
+}
+
+#ifdef YUYU_WITH_ZSTD
+struct ZstdContext {
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    ZstdContext() { if (cctx) ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, kZstdLevel); }
+    ~ZstdContext() { ZSTD_freeCCtx(cctx); }
+};
+
+bool zstd(const std::string &in, std::string &out) {
+    thread_local ZstdContext ctx;
+    if (!ctx.cctx) return false;
+    out.resize(ZSTD_compressBound(in.size()));
+    size_t n = ZSTD_compress2(ctx.cctx, &out[0], out.size(), in.data(), in.size());
+    if (ZSTD_isError(n)) return false;
+    out.resize(n);
+    return true;
+}
+#endif
+
+bool compressible_type(const std::string &content_type) {
+    if (content_type.rfind("text/event-stream", 0) == 0) return false;
+    return content_type.rfind("application/json", 0) == 0 || content_type.rfind("text/", 0) == 0 ||
+           content_type.rfind("application/javascript", 0) == 0;
+}
+
+} // namespace
+
+ContentEncoding negotiate_encoding(const std::string &accept_encoding) {
+    double q_gzip = -1, q_zstd = -1, q_any = -1;
+    size_t pos = 0;
+    while (pos < accept_encoding.size()) {
+        size_t end = accept_encoding.find(',', pos);
+        if (end == std::string::npos) end = accept_encoding.size();
+        std::string item = accept_encoding.substr(pos, end - pos);
+        pos = end + 1;
+
+        double q = 1.0;
+        size_t semi = item.find(';');
+        std::string name = item.substr(0, semi);
+        if (semi != std::string::npos) {
+            size_t qp = item.find("q=", semi);
+            if (qp != std::string::npos) q = std::atof(item.c_str() + qp + 2);
+        }
+        std::string token;
+        for (char c : name) {
+            if (!std::isspace(static_cast<unsigned char>(c))) token.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        }
+        if (token == "gzip" || token == "x-gzip") q_gzip = q;
+        else if (token == "zstd") q_zstd = q;
+        else if (token == "*") q_any = q;
+    }
+    if (q_gzip < 0) q_gzip = q_any;
+    if (q_zstd < 0) q_zstd = q_any;
+#ifdef YUYU_WITH_ZSTD
+    if (q_zstd > 0 && q_zstd >= q_gzip) return ContentEncoding::Zstd;
+#endif
+    if (q_gzip > 0) return ContentEncoding::Gzip;
+    return ContentEncoding::Identity;
+}
+
+const char *encoding_name(ContentEncoding enc) {
+    switch (enc) {
+        case ContentEncoding::Gzip: return "gzip";
+        case ContentEncoding::Zstd: return "zstd";
+        default: return "identity";
+    }
+}
+
+bool compress_body(ContentEncoding enc, const std::string &in, std::string &out) {
+    switch (enc) {
+        case ContentEncoding::Gzip: return gzip(in, out);
+#ifdef YUYU_WITH_ZSTD
+        case ContentEncoding::Zstd: return zstd(in, out);
+#endif
+        default: return false;
+    }
+}
+
+void compress_response(const httplib::Request &req, httplib::Response &res, size_t min_bytes) {
+    if (min_bytes == 0 || res.status != 200 || res.body.size() < min_bytes) return;
+    if (res.has_header("Content-Encoding") || !compressible_type(res.get_header_value("Content-Type"))) return;
+    res.set_header("Vary", "Accept-Encoding");
+    ContentEncoding enc = negotiate_encoding(req.get_header_value("Accept-Encoding"));
+    if (enc == ContentEncoding::Identity) return;
+    std::string out;
+    if (!compress_body(enc, res.body, out) || out.size() >= res.body.size()) return;
+    // Content-Length was already set from the uncompressed body
+    res.body.swap(out);
+    res.headers.erase("Content-Length");
+    res.set_header("Content-Length", std::to_string(res.body.size()));
+    res.set_header("Content-Encoding", encoding_name(enc));
+}
+
+PrecompressedBody::PrecompressedBody(std::string body, size_t min_bytes) : identity_(std::move(body)) {
+    if (min_bytes == 0 || identity_.size() < min_bytes) return;
+    if (!gzip(identity_, gzip_) || gzip_.size() >= identity_.size()) gzip_.clear();
+#ifdef YUYU_WITH_ZSTD
+    if (!zstd(identity_, zstd_) || zstd_.size() >= identity_.size()) zstd_.clear();
+#endif
+}
+
+void PrecompressedBody::send(const std::shared_ptr<const PrecompressedBody> &self, const httplib::Request &req,
+                             httplib::Response &res, const char *content_type) {
+    const std::string *body = &self->identity_;
+    if (!self->gzip_.empty() || !self->zstd_.empty()) {
+        res.set_header("Vary", "Accept-Encoding");
+        ContentEncoding enc = negotiate_encoding(req.get_header_value("Accept-Encoding"));
+        if (enc == ContentEncoding::Zstd && !self->zstd_.empty()) body = &self->zstd_;
+        else if (enc == ContentEncoding::Gzip && !self->gzip_.empty()) body = &self->gzip_;
+        else enc = ContentEncoding::Identity;
+        if (enc != ContentEncoding::Identity) res.set_header("Content-Encoding", encoding_name(enc));
+    }
+    // stream straight from the shared buffer instead of copying it into res.body
+    res.set_content_provider(body->size(), content_type,
+        [self, body](size_t offset, size_t length, httplib::DataSink &sink) {
+            return sink.write(body->data() + offset, length);
+        });
+}
+
+} // namespace YUYU
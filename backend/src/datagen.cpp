@@ -0,0 +1,550 @@
+#include "datagen.h"
+#include "bulk.h"
+#include "id_gen.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+namespace YUYU {
+
+namespace {
+
+const long USER_CHUNK = 8192;
+const long WEIBO_CHUNK = 2048;
+
+// Independent random streams; a chunk's stream is derived from (seed, stream, chunk).
+enum Stream : uint64_t { S_USERS = 1, S_WEIBOS, S_ENGAGEMENT, S_COMMENTS, S_LIKES, S_FOLLOW_DEGREE, S_FOLLOWS, S_PERM };
+
+uint64_t splitmix64(uint64_t &x) {
+    uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// xoshiro256**
+class Rng {
+public:
+    Rng(uint64_t seed, uint64_t stream, uint64_t chunk) {
+        uint64_t x = seed ^ (stream * 0xD1B54A32D192ED03ULL) ^ (chunk * 0x8CB92BA72F3D8DD7ULL);
+        for (auto &v : s_) v = splitmix64(x);
+    }
+    uint64_t next() {
+        const uint64_t r = rotl(s_[1] * 5, 7) * 9;
+        const uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0]; s_[3] ^= s_[1]; s_[1] ^= s_[2]; s_[0] ^= s_[3];
+        s_[2] ^= t; s_[3] = rotl(s_[3], 45);
+        return r;
+    }
+    double uniform() { return (next() >> 11) * 0x1.0p-53; }
+    long below(long n) { return static_cast<long>(next() % static_cast<uint64_t>(n)); }
+    bool chance(double p) { return uniform() < p; }
+
+private:
+    static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+    uint64_t s_[4];
+};
+
+// Zipf over [1, n] with P(k) ~ k^-s, by rejection-inversion (Hormann & Derflinger);
+// O(1) per sample and no tables, so it works for millions of ranks.
+class Zipf {
+public:
+    Zipf(long n, double s) : n_(n), s_(s) {
+        h_x1_ = h_integral(1.5) - 1.0;
+        h_n_ = h_integral(n_ + 0.5);
+        sdiv_ = 2.0 - h_integral_inv(h_integral(2.5) - h(2.0));
+    }
+    long sample(Rng &rng) const {
+        for (;;) {
+            double u = h_n_ + rng.uniform() * (h_x1_ - h_n_);
+            double x = h_integral_inv(u);
+            long k = static_cast<long>(x + 0.5);
+            if (k < 1) k = 1; else if (k > n_) k = n_;
+            if (k - x <= sdiv_ || u >= h_integral(k + 0.5) - h(static_cast<double>(k))) return k;
+        }
+    }
+
+private:
+    static double helper1(double x) { return std::fabs(x) > 1e-8 ? std::log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x)); }
+    static double helper2(double x) { return std::fabs(x) > 1e-8 ? std::expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x / 3.0 * (1.0 + 0.25 * x)); }
+    double h(double x) const { return std::exp(-s_ * std::log(x)); }
+    double h_integral(double x) const { double lx = std::log(x); return helper2((1.0 - s_) * lx) * lx; }
+    double h_integral_inv(double x) const {
+        double t = x * (1.0 - s_);
+        if (t < -1.0) t = -1.0;
+        return std::exp(helper1(t) * x);
+    }
+    long n_;
+    double s_, h_x1_, h_n_, sdiv_;
+};
+
+long gcd(long a, long b) { while (b) { long t = a % b; a = b; b = t; } return a; }
+
+// Bijection rank -> user index so popular/active users are scattered over the id range.
+class Permutation {
+public:
+    Permutation(long n, uint64_t seed) : n_(n) {
+        Rng rng(seed, S_PERM, 0);
+        // a < 2^20 keeps a * rank within 64 bits for any realistic user count
+        long range = std::max(1L, std::min(n_ - 1, 1L << 20));
+        a_ = 1 + rng.below(range);
+        while (gcd(a_, n_) != 1) a_ = a_ % range + 1;
+        b_ = rng.below(n_);
+    }
+    long operator()(long rank) const {
+        return static_cast<long>((static_cast<uint64_t>(a_) * rank + b_) % n_);
+    }
+
+private:
+    long n_, a_ = 1, b_ = 0;
+};
+
+int worker_count(const DatasetConfig &cfg) {
+    if (cfg.threads > 0) return cfg.threads;
+    unsigned hc = std::thread::hardware_concurrency();
+    return hc ? static_cast<int>(hc) : 4;
+}
+
+template <class Fn>
+void parallel_for(long n, int threads, Fn fn) {
+    std::atomic<long> next{0};
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([&] { for (long i; (i = next.fetch_add(1)) < n;) fn(i); });
+    }
+    for (auto &th : pool) th.join();
+}
+
+struct Chunk {
+    std::string rows;
+    long count = 0;
+};
+
+// Produces chunks [0, n) on `threads` workers and hands them to the sink in
+// index order. Workers stay at most `window` chunks ahead of the sink.
+bool run_ordered(long n, int threads, const std::function<void(long, Chunk&)> &gen,
+                 DatasetSink &sink, std::string &err) {
+    const long window = threads * 2L;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::map<long, Chunk> ready;
+    long next_out = 0;
+    std::atomic<long> next_in{0};
+    bool failed = false;
+
+    std::vector<std::thread> pool;
+    for (int t = 0; t < threads; ++t) {
+        pool.emplace_back([&] {
+            for (;;) {
+                long i;
+                {
+                    std::unique_lock<std::mutex> lk(mu);
+                    cv.wait(lk, [&] { return failed || next_in.load() < next_out + window; });
+                    if (failed) return;
+                    i = next_in.fetch_add(1);
+                }
+                if (i >= n) return;
+                Chunk c;
+                gen(i, c);
+                std::lock_guard<std::mutex> lk(mu);
+                ready.emplace(i, std::move(c));
+                cv.notify_all();
+            }
+        });
+    }
+    bool ok = true;
+    while (next_out < n) {
+        Chunk c;
+        {
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait(lk, [&] { return ready.count(next_out) > 0; });
+            c = std::move(ready[next_out]);
+            ready.erase(next_out);
+        }
+        if (!sink.write_chunk(c.rows, c.count, err)) { ok = false; break; }
+        std::lock_guard<std::mutex> lk(mu);
+        ++next_out;
+        cv.notify_all();
+    }
+    if (!ok) {
+        std::lock_guard<std::mutex> lk(mu);
+        failed = true;
+        cv.notify_all();
+    }
+    for (auto &th : pool) th.join();
+    return ok;
+}
+
+const char *PHRASES[] = {
+    "今天天气真好", "刚刚看完一部电影", "周末一起去爬山吧", "这家店的咖啡很好喝", "数据库系统课程设计",
+    "终于写完作业了", "分享一张照片", "大家晚上好", "学习C++的第一百天", "推荐一本好书",
+    "下雨了记得带伞", "新年快乐", "地铁上人好多", "晚饭吃火锅", "考试周加油", "猫咪又在睡觉",
+    "跑步五公里打卡", "这首歌单曲循环", "春天的樱花开了", "加班到深夜", "周末去图书馆", "第一次做蛋糕",
+    "篮球比赛赢了", "旅行的意义", "早起看日出", "新手机到了", "今天的晚霞很美", "好久不见的朋友",
+};
+const long PHRASE_COUNT = sizeof(PHRASES) / sizeof(PHRASES[0]);
+
+std::string gen_text(Rng &rng, int max_phrases) {
+    int n = 1 + static_cast<int>(rng.below(max_phrases));
+    std::string s;
+    for (int i = 0; i < n; ++i) {
+        if (i) s += "，";
+        s += PHRASES[rng.below(PHRASE_COUNT)];
+    }
+    return s;
+}
+
+struct Engagement { long likes; long comments; };
+
+class Generator {
+public:
+    Generator(const DatasetConfig &cfg)
+        : cfg_(cfg), threads_(worker_count(cfg)),
+          total_weibos_(std::max(1L, static_cast<long>(cfg.users * cfg.weibos_per_user))),
+          perm_(cfg.users, cfg.seed),
+          activity_(cfg.users, cfg.activity_skew),
+          popularity_(cfg.users, cfg.popularity_skew),
+          likes_(std::max(1L, std::min(cfg.max_likes, cfg.users / 2)), cfg.like_skew),
+          comments_(std::max(1L, cfg.max_comments), cfg.comment_skew) {}
+
+    bool run(DatasetSink &sink, std::string &err) {
+        const long user_chunks = (cfg_.users + USER_CHUNK - 1) / USER_CHUNK;
+        const long weibo_chunks = (total_weibos_ + WEIBO_CHUNK - 1) / WEIBO_CHUNK;
+
+        // Counting pass: id ranges of per-weibo and per-user children must be
+        // known before chunks can be generated independently.
+        std::vector<long> like_base(weibo_chunks + 1, 0), comment_base(weibo_chunks + 1, 0), follow_base(user_chunks + 1, 0);
+        parallel_for(weibo_chunks, threads_, [&](long c) {
+            Rng rng(cfg_.seed, S_ENGAGEMENT, c);
+            long l = 0, m = 0;
+            for (long i = c * WEIBO_CHUNK, e = std::min(total_weibos_, i + WEIBO_CHUNK); i < e; ++i) {
+                Engagement g = engagement(rng);
+                l += g.likes; m += g.comments;
+            }
+            like_base[c + 1] = l; comment_base[c + 1] = m;
+        });
+        parallel_for(user_chunks, threads_, [&](long c) {
+            Rng rng(cfg_.seed, S_FOLLOW_DEGREE, c);
+            long f = 0;
+            for (long u = c * USER_CHUNK, e = std::min(cfg_.users, u + USER_CHUNK); u < e; ++u) f += follow_degree(rng);
+            follow_base[c + 1] = f;
+        });
+        for (long c = 0; c < weibo_chunks; ++c) { like_base[c + 1] += like_base[c]; comment_base[c + 1] += comment_base[c]; }
+        for (long c = 0; c < user_chunks; ++c) follow_base[c + 1] += follow_base[c];
+        if (cfg_.generator_ids) {
+            // weibos sharing a tick are consecutive, so i % 256 tells them apart
+            if (IdGenerator::kTickMs * (total_weibos_ + 1) / cfg_.window_ms + 2 > (1 << IdGenerator::kSeqBits)) {
+                err = "too many weibos per " + std::to_string(IdGenerator::kTickMs) + " ms for generator ids";
+                return false;
+            }
+            long most = std::max({like_base[weibo_chunks], comment_base[weibo_chunks], follow_base[user_chunks]});
+            row_ms_ = cfg_.end_ms - cfg_.window_ms - ((most >> IdGenerator::kSeqBits) + 1) * IdGenerator::kTickMs;
+            if (row_ms_ < IdGenerator::kEpochMs) {
+                err = "dataset starts before the id epoch";
+                return false;
+            }
+        }
+
+        return table(sink, "users", user_chunks, [&](long c, Chunk &out) { gen_users(c, out); }, err)
+            && table(sink, "weibos", weibo_chunks, [&](long c, Chunk &out) { gen_weibos(c, out); }, err)
+            && table(sink, "comments", weibo_chunks, [&](long c, Chunk &out) { gen_comments(c, comment_base[c], out); }, err)
+            && table(sink, "likes", weibo_chunks, [&](long c, Chunk &out) { gen_likes(c, like_base[c], out); }, err)
+            && table(sink, "follows", user_chunks, [&](long c, Chunk &out) { gen_follows(c, follow_base[c], out); }, err);
+    }
+
+private:
+    bool table(DatasetSink &sink, const char *name, long chunks, const std::function<void(long, Chunk&)> &gen, std::string &err) {
+        return sink.begin_table(name, err) && run_ordered(chunks, threads_, gen, sink, err) && sink.end_table(err);
+    }
+
+    Engagement engagement(Rng &rng) const {
+        return { likes_.sample(rng) - 1, comments_.sample(rng) - 1 };
+    }
+
+    long follow_degree(Rng &rng) const {
+        // Pareto with the configured mean: x_m = mean * (alpha - 1) / alpha
+        double alpha = cfg_.follow_alpha > 1.0 ? cfg_.follow_alpha : 1.01;
+        double xm = cfg_.follows_per_user * (alpha - 1.0) / alpha;
+        double d = xm / std::pow(1.0 - rng.uniform(), 1.0 / alpha);
+        long cap = std::min(cfg_.max_follows, cfg_.users - 1);
+        return std::max(0L, std::min(cap, static_cast<long>(d)));
+    }
+
+    long active_user(Rng &rng) const { return perm_(activity_.sample(rng) - 1); }
+    long weibo_time(long i) const { return cfg_.end_ms - cfg_.window_ms + cfg_.window_ms * (i + 1) / (total_weibos_ + 1); }
+    int64_t weibo_id(long i) const {
+        if (!cfg_.generator_ids) return cfg_.weibo_base + i + 1;
+        return IdGenerator::compose(weibo_time(i), IdGenerator::kBulkNode, static_cast<unsigned>(i), 0);
+    }
+    // Id of the n-th row (from 1) of a comments, likes or follows table.
+    int64_t row_id(long base, long n) const {
+        if (!cfg_.generator_ids) return base + n;
+        return IdGenerator::compose(row_ms_ + ((n - 1) >> IdGenerator::kSeqBits) * IdGenerator::kTickMs,
+                                    IdGenerator::kBulkNode, static_cast<unsigned>(n - 1), 0);
+    }
+
+    void gen_users(long c, Chunk &out) const {
+        Rng rng(cfg_.seed, S_USERS, c);
+        CopyRowEncoder enc(out.rows);
+        // sha256("password"): generated accounts can log in with that password
+        static const std::string pass_hash = "5e884898da28047151d0e56f8dc6292773603d0d6aabbdd62a11ef721d1542d8";
+        for (long u = c * USER_CHUNK, e = std::min(cfg_.users, u + USER_CHUNK); u < e; ++u) {
+            long id = cfg_.user_base + u + 1;
+            std::string name = "user" + std::to_string(id);
+            enc.start_row(6);
+            enc.put_int8(id);
+            enc.put_text(name);
+            enc.put_text(name + "@example.com");
+            enc.put_text(pass_hash);
+            if (rng.chance(cfg_.avatar_ratio)) enc.put_text("/media/avatars/" + std::to_string(id) + ".png"); else enc.put_null();
+            enc.put_timestamp_ms(cfg_.end_ms - cfg_.window_ms - rng.below(cfg_.window_ms));
+            ++out.count;
+        }
+    }
+
+    void gen_weibos(long c, Chunk &out) const {
+        Rng rng(cfg_.seed, S_WEIBOS, c);
+        CopyRowEncoder enc(out.rows);
+        for (long i = c * WEIBO_CHUNK, e = std::min(total_weibos_, i + WEIBO_CHUNK); i < e; ++i) {
+            int64_t id = weibo_id(i);
+            enc.start_row(5);
+            enc.put_int8(id);
+            enc.put_int8(cfg_.user_base + active_user(rng) + 1);
+            enc.put_text(gen_text(rng, 4));
+            if (rng.chance(cfg_.media_ratio)) enc.put_text("/media/weibos/" + std::to_string(id) + ".jpg"); else enc.put_text("");
+            // ids grow with created_at, as the backends' ids do
+            enc.put_timestamp_ms(weibo_time(i));
+            ++out.count;
+        }
+    }
+
+    void gen_comments(long c, long id_base, Chunk &out) const {
+        Rng counts(cfg_.seed, S_ENGAGEMENT, c);
+        Rng rng(cfg_.seed, S_COMMENTS, c);
+        CopyRowEncoder enc(out.rows);
+        long next_id = id_base;
+        for (long i = c * WEIBO_CHUNK, e = std::min(total_weibos_, i + WEIBO_CHUNK); i < e; ++i) {
+            long n = engagement(counts).comments;
+            long first = next_id + 1;
+            int64_t t = weibo_time(i);
+            for (long k = 0; k < n; ++k) {
+                long id = ++next_id;
+                enc.start_row(6);
+                enc.put_int8(row_id(cfg_.comment_base, id));
+                enc.put_int8(weibo_id(i));
+                enc.put_int8(cfg_.user_base + active_user(rng) + 1);
+                enc.put_text(gen_text(rng, 2));
+                // Replies mostly continue the latest comment, which builds deep
+                // chains; the rest attach to a random earlier comment.
+                if (k > 0 && rng.chance(cfg_.reply_ratio))
+                    enc.put_int8(row_id(cfg_.comment_base, rng.chance(0.7) ? id - 1 : first + rng.below(k)));
+                else enc.put_null();
+                t += 1000 + rng.below(600000);
+                enc.put_timestamp_ms(t);
+                ++out.count;
+            }
+        }
+    }
+
+    void gen_likes(long c, long id_base, Chunk &out) const {
+        Rng counts(cfg_.seed, S_ENGAGEMENT, c);
+        Rng rng(cfg_.seed, S_LIKES, c);
+        CopyRowEncoder enc(out.rows);
+        long next_id = id_base;
+        std::unordered_set<long> seen;
+        for (long i = c * WEIBO_CHUNK, e = std::min(total_weibos_, i + WEIBO_CHUNK); i < e; ++i) {
+            long n = engagement(counts).likes;
+            seen.clear();
+            int64_t t = weibo_time(i);
+            while (static_cast<long>(seen.size()) < n) {
+                // active users like more; fall back to uniform so large counts terminate
+                long u = rng.chance(0.5) ? active_user(rng) : rng.below(cfg_.users);
+                if (!seen.insert(u).second) continue;
+                enc.start_row(4);
+                enc.put_int8(row_id(cfg_.like_base, ++next_id));
+                enc.put_int8(weibo_id(i));
+                enc.put_int8(cfg_.user_base + u + 1);
+                enc.put_timestamp_ms(t + rng.below(7LL * 24 * 3600 * 1000));
+                ++out.count;
+            }
+        }
+    }
+
+    void gen_follows(long c, long id_base, Chunk &out) const {
+        Rng degrees(cfg_.seed, S_FOLLOW_DEGREE, c);
+        Rng rng(cfg_.seed, S_FOLLOWS, c);
+        CopyRowEncoder enc(out.rows);
+        long next_id = id_base;
+        std::unordered_set<long> seen;
+        for (long u = c * USER_CHUNK, e = std::min(cfg_.users, u + USER_CHUNK); u < e; ++u) {
+            long n = follow_degree(degrees);
+            seen.clear();
+            seen.insert(u);
+            while (static_cast<long>(seen.size()) < n + 1) {
+                // preferential: followees are drawn by popularity rank
+                long v = rng.chance(0.8) ? perm_(popularity_.sample(rng) - 1) : rng.below(cfg_.users);
+                if (!seen.insert(v).second) continue;
+                enc.start_row(4);
+                enc.put_int8(row_id(cfg_.follow_base, ++next_id));
+                enc.put_int8(cfg_.user_base + u + 1);
+                enc.put_int8(cfg_.user_base + v + 1);
+                enc.put_timestamp_ms(cfg_.end_ms - rng.below(cfg_.window_ms));
+                ++out.count;
+            }
+        }
+    }
+
+    const DatasetConfig &cfg_;
+    int threads_;
+    long total_weibos_;
+    int64_t row_ms_ = 0;   // generator_ids: time of the first comment, like and follow ids
+    Permutation perm_;
+    Zipf activity_, popularity_, likes_, comments_;
+};
+
+// Large-file aware seek/tell (long is 32-bit on Windows).
+int64_t file_tell(FILE *f) {
+#ifdef _WIN32
+    return _ftelli64(f);
+#else
+    return ftello(f);
+#endif
+}
+
+int file_seek(FILE *f, int64_t pos) {
+#ifdef _WIN32
+    return _fseeki64(f, pos, SEEK_SET);
+#else
+    return fseeko(f, pos, SEEK_SET);
+#endif
+}
+
+void put_le(std::string &out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out.push_back(static_cast<char>(v >> (8 * i)));
+}
+
+bool read_le(FILE *f, uint64_t &v, int bytes) {
+    unsigned char b[8];
+    if (fread(b, 1, bytes, f) != static_cast<size_t>(bytes)) return false;
+    v = 0;
+    for (int i = bytes - 1; i >= 0; --i) v = (v << 8) | b[i];
+    return true;
+}
+
+const char SNAPSHOT_MAGIC[8] = {'Y','U','Y','U','D','S','1','\n'};
+
+} // namespace
+
+bool generate_dataset(const DatasetConfig &cfg, DatasetSink &sink, std::string &err) {
+    if (cfg.users < 2) { err = "users must be at least 2"; return false; }
+    Generator gen(cfg);
+    return gen.run(sink, err);
+}
+
+// ---------------- SnapshotFileSink ----------------
+
+SnapshotFileSink::~SnapshotFileSink() { if (f_) fclose(f_); }
+
+bool SnapshotFileSink::open(std::string &err) {
+    f_ = fopen(path_.c_str(), "wb");
+    if (!f_) { err = "cannot open " + path_; return false; }
+    std::string h(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    put_le(h, cfg_.seed, 8);
+    put_le(h, static_cast<uint64_t>(cfg_.end_ms), 8);
+    put_le(h, 0, 4); // table count, patched by close()
+    if (fwrite(h.data(), 1, h.size(), f_) != h.size()) { err = "write failed"; return false; }
+    return true;
+}
+
+bool SnapshotFileSink::begin_table(const std::string &table, std::string &err) {
+    std::string h;
+    put_le(h, table.size(), 4);
+    h += table;
+    section_pos_ = file_tell(f_) + static_cast<int64_t>(h.size());
+    put_le(h, 0, 8);
+    put_le(h, 0, 8);
+    if (fwrite(h.data(), 1, h.size(), f_) != h.size()) { err = "write failed"; return false; }
+    rows_ = bytes_ = 0;
+    return true;
+}
+
+bool SnapshotFileSink::write_chunk(const std::string &rows, long row_count, std::string &err) {
+    if (fwrite(rows.data(), 1, rows.size(), f_) != rows.size()) { err = "write failed"; return false; }
+    rows_ += row_count;
+    bytes_ += rows.size();
+    return true;
+}
+
+bool SnapshotFileSink::end_table(std::string &err) {
+    int64_t end = file_tell(f_);
+    std::string h;
+    put_le(h, rows_, 8);
+    put_le(h, bytes_, 8);
+    if (file_seek(f_, section_pos_) != 0 || fwrite(h.data(), 1, h.size(), f_) != h.size() || file_seek(f_, end) != 0) {
+        err = "write failed"; return false;
+    }
+    ++tables_;
+    return true;
+}
+
+bool SnapshotFileSink::close(std::string &err) {
+    std::string h;
+    put_le(h, tables_, 4);
+    bool ok = file_seek(f_, sizeof(SNAPSHOT_MAGIC) + 16) == 0 && fwrite(h.data(), 1, h.size(), f_) == h.size();
+    ok = (fclose(f_) == 0) && ok;
+    f_ = nullptr;
+    if (!ok) err = "write failed";
+    return ok;
+}
+
+// ---------------- SnapshotFileReader ----------------
+
+SnapshotFileReader::~SnapshotFileReader() { if (f_) fclose(f_); }
+
+bool SnapshotFileReader::open(uint64_t &seed, int64_t &end_ms, std::string &err) {
+    f_ = fopen(path_.c_str(), "rb");
+    if (!f_) { err = "cannot open " + path_; return false; }
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    uint64_t e = 0, n = 0;
+    if (fread(magic, 1, sizeof(magic), f_) != sizeof(magic) || memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+        err = "not a dataset snapshot"; return false;
+    }
+    if (!read_le(f_, seed, 8) || !read_le(f_, e, 8) || !read_le(f_, n, 4)) { err = "truncated header"; return false; }
+    end_ms = static_cast<int64_t>(e);
+    remaining_ = static_cast<uint32_t>(n);
+    return true;
+}
+
+bool SnapshotFileReader::next_table(SnapshotTable &t, std::string &err) {
+    if (remaining_ == 0) return false;
+    --remaining_;
+    uint64_t len = 0;
+    if (!read_le(f_, len, 4) || len > 256) { err = "bad section header"; return false; }
+    t.name.resize(static_cast<size_t>(len));
+    if (fread(&t.name[0], 1, t.name.size(), f_) != t.name.size() ||
+        !read_le(f_, t.row_count, 8) || !read_le(f_, t.byte_len, 8)) {
+        err = "bad section header"; return false;
+    }
+    return true;
+}
+
+bool SnapshotFileReader::read_table(const SnapshotTable &t, const std::function<bool(const char*, size_t)> &fn,
+                                    std::string &err, size_t max_piece) {
+    std::vector<char> buf(max_piece);
+    uint64_t left = t.byte_len;
+    while (left > 0) {
+        size_t n = static_cast<size_t>(std::min<uint64_t>(left, buf.size()));
+        if (fread(buf.data(), 1, n, f_) != n) { err = "truncated section " + t.name; return false; }
+        if (!fn(buf.data(), n)) return false;
+        left -= n;
+    }
+    return true;
+}
+
+} // namespace YUYU
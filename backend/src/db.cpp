@@ -1,66 +1,537 @@
 #include "db.h"
+#include "arena.h"
+#include "id_gen.h"
+#include "shard_ring.h"
+#include "user_cache.h"
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/select.h>
+#endif
 #include <libpq-fe.h>
 #include <cstring>
+#include <deque>
 #include <memory>
-#include <nlohmann/json.hpp>
-using json = nlohmann::json;
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdlib>
+#include <condition_variable>
+#include <cstdio>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
 
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+thread_local long long t_read_as = 0;
+thread_local bool t_read_primary = false;
+thread_local Clock::time_point t_read_since = Clock::time_point::min();
+
+// "16/B374D848" -> 0x16B374D848; 0 if unparsable.
+uint64_t parse_lsn(const char *s) {
+    unsigned int hi = 0, lo = 0;
+    if (!s || std::sscanf(s, "%X/%X", &hi, &lo) != 2) return 0;
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+// An integer query parameter formatted in place: a 16-digit id is past the
+// small-string buffer, so std::to_string would allocate for every one.
+struct IntText {
+    char buf[24];
+    explicit IntText(long long v) { *std::to_chars(buf, buf + sizeof(buf) - 1, v).ptr = '\0'; }
+    const char *c_str() const { return buf; }
+};
+
+// Integer column value; 0 for NULL or garbage, like the old stoll fallbacks.
+long long int_at(const PGresult *res, int row, int col) {
+    return std::strtoll(PQgetvalue(res, row, col), nullptr, 10);
+}
+
+std::string_view text_at(const PGresult *res, int row, int col) {
+    return std::string_view(PQgetvalue(res, row, col), static_cast<size_t>(PQgetlength(res, row, col)));
+}
+
+// Runs a one-value query; false (and v untouched) on any error.
+bool query_value(PGconn *c, const char *sql, std::string &v) {
+    PGresult *r = PQexec(c, sql);
+    bool ok = r && PQresultStatus(r) == PGRES_TUPLES_OK && PQntuples(r) == 1 && !PQgetisnull(r, 0, 0);
+    if (ok) v = PQgetvalue(r, 0, 0);
+    if (r) PQclear(r);
+    return ok;
+}
+
+// One server, primary or replica, and its connection pool.
+struct Node {
+    std::string conninfo;
+    bool primary = false;
+    std::mutex mu;
+    std::condition_variable cv;
+    std::vector<PGconn *> idle;
+    size_t open = 0;                          // idle + leased
+    std::atomic<int> outstanding{0};          // leased or waiting for a lease
+    std::atomic<bool> healthy{true};
+    std::atomic<uint64_t> replay_lsn{0};      // replicas, as of the last health check
+    // Replicas: it has replayed every commit made before this moment
+    // (steady clock ticks), see Shard::heads.
+    std::atomic<Clock::rep> caught_up{Clock::time_point::min().time_since_epoch().count()};
+    PGconn *probe = nullptr;                  // health checker's own connection
+
+    ~Node() {
+        for (PGconn *c : idle) PQfinish(c);
+        if (probe) PQfinish(probe);
+    }
+};
+
+// A pooled connection, handed back when the lease goes away. Connections
+// that broke, or were left inside a transaction, are closed instead.
+class Lease {
+public:
+    Lease() = default;
+    Lease(Node *node, PGconn *conn) : node_(node), conn_(conn) {}
+    Lease(Lease &&o) noexcept : node_(o.node_), conn_(o.conn_) { o.node_ = nullptr; o.conn_ = nullptr; }
+    Lease(const Lease &) = delete;
+    Lease &operator=(const Lease &) = delete;
+    ~Lease() {
+        if (!node_) return;
+        if (conn_) {
+            bool broken = PQstatus(conn_) != CONNECTION_OK || PQtransactionStatus(conn_) != PQTRANS_IDLE;
+            std::lock_guard<std::mutex> lk(node_->mu);
+            if (broken) {
+                PQfinish(conn_);
+                --node_->open;
+                if (!node_->primary) node_->healthy = false;   // until the next health check
+            } else {
+                node_->idle.push_back(conn_);
+            }
+        }
+        node_->cv.notify_one();
+        node_->outstanding.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    operator PGconn *() const { return conn_; }
+
+private:
+    Node *node_ = nullptr;
+    PGconn *conn_ = nullptr;
+};
+
+// Read-your-writes: after a user writes to a shard, that primary's WAL
+// position at the time. Their reads on the shard skip replicas that have not
+// replayed that far until the token expires.
+struct Token {
+    uint64_t lsn;
+    Clock::time_point expires;
+};
+
+struct TokenStripe {
+    std::mutex mu;
+    std::unordered_map<long long, Token> tokens;
+};
+
+// A primary, its replicas and the tokens of users who wrote to it.
+struct Shard {
+    static const size_t kStripes = 64;
+    static const size_t kHeads = 64;
+    std::unique_ptr<Node> primary;
+    std::vector<std::unique_ptr<Node>> replicas;
+    std::atomic<uint64_t> rr{0};
+    TokenStripe stripes[kStripes];
+    // Recent (time, primary WAL position read after it) samples, oldest
+    // first: a replica that replayed past one has every commit made before
+    // its time. Taken by the health check and after writes.
+    std::mutex heads_mu;
+    std::deque<std::pair<Clock::time_point, uint64_t>> heads;
+
+    void sampled(Clock::time_point t, uint64_t lsn) {
+        std::lock_guard<std::mutex> lk(heads_mu);
+        if (!heads.empty() && heads.back().first >= t) return;
+        if (heads.size() >= kHeads) heads.pop_front();
+        heads.emplace_back(t, lsn);
+    }
+    // The latest sample time whose position `replay` has passed.
+    Clock::time_point replayed_to(uint64_t replay) {
+        std::lock_guard<std::mutex> lk(heads_mu);
+        for (auto it = heads.rbegin(); it != heads.rend(); ++it)
+            if (it->second <= replay) return it->first;
+        return Clock::time_point::min();
+    }
+};
+
+} // namespace
+
+// Rows are spread over shards: weibos and follows by the owning user (through
+// the ring), likes and comments with their weibo, whose id names its shard.
+// users is small and each shard keeps a full copy (followers and following
+// join it); shard 0 holds the authoritative one (unique constraints,
+// passwords). Feed and comment queries fetch only their own rows and take
+// authors from the profile cache.
 struct Database::Impl {
-    PGconn *conn = nullptr;
+    DatabaseOptions opt;
+    std::vector<std::unique_ptr<Shard>> shards;
+    YUYU::ShardRing ring;
+    std::unique_ptr<YUYU::IdGenerator> ids;
+    std::unique_ptr<YUYU::UserCache> profiles;
+
+    std::thread checker;
+    std::mutex check_mu;
+    std::condition_variable check_cv;
+    bool stopping = false;
+
+    // watch_changes(): one LISTEN connection per shard primary.
+    std::thread listener;
+    std::function<void(const YUYU::RowChange &)> on_change;
+    void listen_loop(std::vector<PGconn *> conns);
+
+    size_t user_shard(long long user_id) const { return ring.locate(static_cast<uint64_t>(user_id)); }
+    size_t id_shard(long long id) const { return YUYU::shard_of_id(id, shards.size()); }
+
+    // One `user_id = ANY($1)` query; the profile cache's loader.
+    bool load_users(const std::vector<long long> &ids, std::vector<User> &out, std::string &err);
+    // Fills the username and avatar columns from the profile cache.
+    bool authors(WeiboList &list, std::string &err);
+
+    Lease acquire(Node &n, std::string &err);
+    Lease write(size_t shard, std::string &err) { return acquire(*shards[shard]->primary, err); }
+    // A replica of `shard` for read-only queries on behalf of t_read_as, else its primary.
+    Lease read(size_t shard, std::string &err);
+    // Records a read-your-writes token for `user_id` after a committed write on `c`.
+    void wrote(size_t shard, PGconn *c, long long user_id);
+    // Sends the same read to every shard at once and collects one result per
+    // shard (results[k] from shard k); all or nothing.
+    bool scatter(const char *sql, int n, const char *const *params, std::pmr::vector<PGresult *> &results,
+                 std::string &err);
+    // Runs a command on shards [from, N) in order, stopping at the first failure.
+    bool write_all(const char *sql, int n, const char *const *params, size_t from, std::string &err);
+    void check();
 };
 
+Lease Database::Impl::acquire(Node &n, std::string &err) {
+    n.outstanding.fetch_add(1, std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lk(n.mu);
+    if (!n.cv.wait_for(lk, std::chrono::milliseconds(opt.acquire_timeout_ms),
+                       [&] { return !n.idle.empty() || n.open < opt.pool_size; })) {
+        lk.unlock();
+        n.outstanding.fetch_sub(1, std::memory_order_relaxed);
+        err = "database busy";
+        return Lease();
+    }
+    if (!n.idle.empty()) {
+        PGconn *c = n.idle.back();
+        n.idle.pop_back();
+        return Lease(&n, c);
+    }
+    ++n.open;
+    lk.unlock();
+    PGconn *c = PQconnectdb(n.conninfo.c_str());
+    if (PQstatus(c) != CONNECTION_OK) {
+        err = PQerrorMessage(c);
+        PQfinish(c);
+        {
+            std::lock_guard<std::mutex> g(n.mu);
+            --n.open;
+        }
+        n.cv.notify_one();
+        n.outstanding.fetch_sub(1, std::memory_order_relaxed);
+        if (!n.primary) n.healthy = false;
+        return Lease();
+    }
+    // read by the change triggers, so other nodes can tell our writes apart
+    char tag[48];
+    std::snprintf(tag, sizeof(tag), "SET yuyu.node = '%u';", opt.node_id);
+    PQclear(PQexec(c, tag));
+    return Lease(&n, c);
+}
+
+Lease Database::Impl::read(size_t shard, std::string &err) {
+    Shard &sh = *shards[shard];
+    if (!sh.replicas.empty() && !t_read_primary) {
+        uint64_t need = 0;
+        if (long long uid = t_read_as) {
+            TokenStripe &st = sh.stripes[static_cast<size_t>(uid) % Shard::kStripes];
+            std::lock_guard<std::mutex> lk(st.mu);
+            auto it = st.tokens.find(uid);
+            if (it != st.tokens.end()) {
+                if (it->second.expires > Clock::now()) need = it->second.lsn;
+                else st.tokens.erase(it);
+            }
+        }
+        // least outstanding requests; the rotating start spreads ties
+        Node *best = nullptr;
+        int best_load = 0;
+        size_t n = sh.replicas.size(), start = static_cast<size_t>(sh.rr.fetch_add(1, std::memory_order_relaxed));
+        for (size_t k = 0; k < n; ++k) {
+            Node *r = sh.replicas[(start + k) % n].get();
+            if (!r->healthy.load() || r->replay_lsn.load() < need) continue;
+            if (Clock::time_point(Clock::duration(r->caught_up.load())) < t_read_since) continue;
+            int load = r->outstanding.load(std::memory_order_relaxed);
+            if (!best || load < best_load) { best = r; best_load = load; }
+        }
+        if (best) {
+            std::string ignored;
+            Lease l = acquire(*best, ignored);
+            if (l) return l;
+        }
+    }
+    return acquire(*sh.primary, err);
+}
+
+void Database::Impl::wrote(size_t shard, PGconn *c, long long user_id) {
+    Shard &sh = *shards[shard];
+    if (sh.replicas.empty() || user_id <= 0) return;
+    std::string v;
+    // Where the WAL function is missing (openGauss names it differently) the
+    // token pins the user to the primary for the whole window instead.
+    auto asked = Clock::now();
+    uint64_t lsn = query_value(c, "SELECT pg_current_wal_insert_lsn()::text;", v) ? parse_lsn(v.c_str()) : 0;
+    if (lsn) sh.sampled(asked, lsn);
+    else lsn = UINT64_MAX;
+    auto now = Clock::now();
+    TokenStripe &st = sh.stripes[static_cast<size_t>(user_id) % Shard::kStripes];
+    std::lock_guard<std::mutex> lk(st.mu);
+    if (st.tokens.size() >= 4096) {
+        for (auto it = st.tokens.begin(); it != st.tokens.end();) {
+            if (it->second.expires <= now) it = st.tokens.erase(it);
+            else ++it;
+        }
+    }
+    st.tokens[user_id] = Token{lsn, now + std::chrono::milliseconds(opt.sticky_ms)};
+}
+
+bool Database::Impl::scatter(const char *sql, int n, const char *const *params,
+                             std::pmr::vector<PGresult *> &results, std::string &err) {
+    std::pmr::vector<Lease> conns(YUYU::RequestArena::resource());
+    conns.reserve(shards.size());
+    for (size_t k = 0; k < shards.size(); ++k) {
+        conns.push_back(read(k, err));
+        if (!conns.back()) return false;
+    }
+    bool ok = true;
+    std::pmr::vector<char> sent(conns.size(), 0, YUYU::RequestArena::resource());
+    for (size_t k = 0; k < conns.size() && ok; ++k) {
+        sent[k] = PQsendQueryParams(conns[k], sql, n, nullptr, params, nullptr, nullptr, 0) == 1;
+        if (!sent[k]) { err = PQerrorMessage(conns[k]); ok = false; }
+    }
+    results.assign(conns.size(), nullptr);
+    // every sent query is drained, even after a failure, so the connections go back idle
+    for (size_t k = 0; k < conns.size(); ++k) {
+        if (!sent[k]) continue;
+        while (PGresult *r = PQgetResult(conns[k])) {
+            if (!results[k] && PQresultStatus(r) == PGRES_TUPLES_OK) { results[k] = r; continue; }
+            if (PQresultStatus(r) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(r); ok = false; }
+            PQclear(r);
+        }
+        if (!results[k]) ok = false;
+    }
+    if (!ok) {
+        for (PGresult *r : results) if (r) PQclear(r);
+        results.clear();
+        if (err.empty()) err = "no result";
+    }
+    return ok;
+}
+
+bool Database::Impl::write_all(const char *sql, int n, const char *const *params, size_t from, std::string &err) {
+    for (size_t k = from; k < shards.size(); ++k) {
+        Lease c = write(k, err);
+        if (!c) return false;
+        PGresult *res = PQexecParams(c, sql, n, nullptr, params, nullptr, nullptr, 0);
+        if (!res) { err = "no result"; return false; }
+        ExecStatusType st = PQresultStatus(res);
+        if (st != PGRES_COMMAND_OK && st != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+        PQclear(res);
+    }
+    return true;
+}
+
+// A replica serves reads while its probe connection answers and it is no
+// more than max_replica_lag_bytes behind its primary.
+void Database::Impl::check() {
+    std::string v, ignored;
+    for (auto &sh : shards) {
+        if (sh->replicas.empty()) continue;
+        uint64_t head = 0;
+        {
+            auto asked = Clock::now();
+            Lease c = acquire(*sh->primary, ignored);
+            if (c && query_value(c, "SELECT pg_current_wal_lsn()::text;", v)) head = parse_lsn(v.c_str());
+            if (head) sh->sampled(asked, head);
+        }
+        for (auto &r : sh->replicas) {
+            if (r->probe && PQstatus(r->probe) != CONNECTION_OK) {
+                PQfinish(r->probe);
+                r->probe = nullptr;
+            }
+            if (!r->probe) {
+                r->probe = PQconnectdb(r->conninfo.c_str());
+                if (PQstatus(r->probe) != CONNECTION_OK) {
+                    PQfinish(r->probe);
+                    r->probe = nullptr;
+                    r->healthy = false;
+                    continue;
+                }
+            }
+            if (!query_value(r->probe, "SELECT 1;", v)) {
+                r->healthy = false;
+                continue;
+            }
+            uint64_t replay = query_value(r->probe, "SELECT pg_last_wal_replay_lsn()::text;", v) ? parse_lsn(v.c_str()) : 0;
+            r->replay_lsn = replay;
+            r->caught_up = sh->replayed_to(replay).time_since_epoch().count();
+            bool lagging = head && replay && head > replay &&
+                           head - replay > static_cast<uint64_t>(opt.max_replica_lag_bytes);
+            r->healthy = !lagging;
+        }
+    }
+}
+
 Database::Database() : pimpl(new Impl()) {}
 
 Database::~Database() {
     if (pimpl) {
-        if (pimpl->conn) PQfinish(pimpl->conn);
+        {
+            std::lock_guard<std::mutex> lk(pimpl->check_mu);
+            pimpl->stopping = true;
+        }
+        pimpl->check_cv.notify_all();
+        if (pimpl->checker.joinable()) pimpl->checker.join();
+        if (pimpl->listener.joinable()) pimpl->listener.join();
         delete pimpl;
         pimpl = nullptr;
     }
 }
 
+void Database::read_as(long long user_id) { t_read_as = user_id; }
+
+bool Database::read_primary(bool on) {
+    bool was = t_read_primary;
+    t_read_primary = on;
+    return was;
+}
+
+Clock::time_point Database::read_since(Clock::time_point t) {
+    Clock::time_point was = t_read_since;
+    t_read_since = t;
+    return was;
+}
+
 bool Database::init(const std::string &conninfo, std::string &err) {
-    pimpl->conn = PQconnectdb(conninfo.c_str());
-    if (PQstatus(pimpl->conn) != CONNECTION_OK) {
-        err = PQerrorMessage(pimpl->conn);
-        PQfinish(pimpl->conn);
-        pimpl->conn = nullptr;
+    return init(conninfo, DatabaseOptions(), err);
+}
+
+bool Database::init(const std::string &conninfo, const DatabaseOptions &opt, std::string &err) {
+    pimpl->opt = opt;
+    if (!pimpl->opt.pool_size) pimpl->opt.pool_size = 1;
+    std::vector<DatabaseOptions::Shard> layout;
+    layout.push_back({conninfo, opt.replicas});
+    layout.insert(layout.end(), opt.shards.begin(), opt.shards.end());
+    if (layout.size() > YUYU::kMaxShards) {
+        err = "at most " + std::to_string(YUYU::kMaxShards) + " shards";
+        return false;
+    }
+    if (opt.node_id >= YUYU::IdGenerator::kBulkNode) {
+        err = "node id out of range (0-" + std::to_string(YUYU::IdGenerator::kBulkNode - 1) + ")";
         return false;
     }
+    pimpl->ids.reset(new YUYU::IdGenerator(opt.node_id));
+    YUYU::UserCache::Options cache_opt;
+    cache_opt.capacity_bytes = opt.user_cache_bytes;
+    cache_opt.ttl_ms = opt.user_cache_ttl_ms;
+    Impl *impl = pimpl;
+    pimpl->profiles.reset(new YUYU::UserCache(cache_opt,
+        [impl](const std::vector<long long> &ids, std::vector<User> &out, std::string &e) { return impl->load_users(ids, out, e); }));
+    for (const auto &l : layout) {
+        std::unique_ptr<Shard> sh(new Shard());
+        sh->primary.reset(new Node());
+        sh->primary->conninfo = l.primary;
+        sh->primary->primary = true;
+        for (const auto &r : l.replicas) {
+            sh->replicas.emplace_back(new Node());
+            sh->replicas.back()->conninfo = r;
+        }
+        pimpl->shards.push_back(std::move(sh));
+    }
+    pimpl->ring = YUYU::ShardRing(pimpl->shards.size());
 
     // Try to apply schema SQL if available in repository (support several relative paths)
+    std::string schema;
     const char *candidates[] = {"db/schema.sql", "./db/schema.sql", "../db/schema.sql", "../../db/schema.sql"};
     for (auto &p : candidates) {
         std::ifstream ifs(p);
         if (!ifs) continue;
         std::stringstream ss; ss << ifs.rdbuf();
-        std::string sql = ss.str();
+        schema = ss.str();
+        if (!schema.empty()) break;
+    }
+    for (size_t k = 0; k < pimpl->shards.size(); ++k) {
+        Lease conn = pimpl->write(k, err);
+        if (!conn) return false;
+        std::string sql = schema;
+        if (pimpl->shards.size() > 1) {
+            // ids drawn on shard k end in k (see shard_of_id)
+            std::string tail = " * " + std::to_string(YUYU::kMaxShards) + " + " + std::to_string(k) + ";\n";
+            sql += "ALTER TABLE weibos ALTER COLUMN weibo_id SET DEFAULT nextval('weibos_weibo_id_seq')" + tail;
+            sql += "ALTER TABLE comments ALTER COLUMN comment_id SET DEFAULT nextval('comments_comment_id_seq')" + tail;
+            sql += "ALTER TABLE likes ALTER COLUMN like_id SET DEFAULT nextval('likes_like_id_seq')" + tail;
+            sql += "ALTER TABLE follows ALTER COLUMN follow_id SET DEFAULT nextval('follows_follow_id_seq')" + tail;
+        }
+        // every write would pg_notify (which serializes commits) with no one
+        // listening: the change triggers exist only while CDC is on
+        static const struct { const char *table, *events; } triggers[] = {
+            {"weibos", "INSERT OR DELETE"}, {"likes", "INSERT OR DELETE"}, {"comments", "INSERT OR DELETE"},
+            {"follows", "INSERT OR DELETE"}, {"users", "UPDATE OF username, avatar"},
+        };
+        if (!schema.empty()) {
+            for (const auto &t : triggers) {
+                sql += std::string("DROP TRIGGER IF EXISTS yuyu_") + t.table + "_changed ON " + t.table + ";\n";
+                if (opt.cdc)
+                    sql += std::string("CREATE TRIGGER yuyu_") + t.table + "_changed AFTER " + t.events + " ON " + t.table
+                        + " FOR EACH ROW EXECUTE PROCEDURE yuyu_notify_change();\n";
+            }
+        }
         if (sql.empty()) continue;
-        PGresult *r = PQexec(pimpl->conn, sql.c_str());
+        PGresult *r = PQexec(conn, sql.c_str());
         if (!r) {
-            err = PQerrorMessage(pimpl->conn);
+            err = PQerrorMessage(conn);
             // don't treat missing/empty schema as fatal if DB already initialized
-            break;
+            continue;
         }
         ExecStatusType st = PQresultStatus(r);
-        if (st != PGRES_COMMAND_OK && st != PGRES_TUPLES_OK) {
-            err = PQresultErrorMessage(r);
-            PQclear(r);
-            break;
-        }
+        if (st != PGRES_COMMAND_OK && st != PGRES_TUPLES_OK) err = PQresultErrorMessage(r);
         PQclear(r);
         // applied (or no-op because of IF NOT EXISTS)
-        break;
+    }
+
+    bool any_replicas = false;
+    for (auto &sh : pimpl->shards) any_replicas = any_replicas || !sh->replicas.empty();
+    if (any_replicas) {
+        pimpl->check();
+        Impl *m = pimpl;
+        pimpl->checker = std::thread([m] {
+            std::unique_lock<std::mutex> lk(m->check_mu);
+            while (!m->check_cv.wait_for(lk, std::chrono::milliseconds(m->opt.health_interval_ms),
+                                         [m] { return m->stopping; })) {
+                lk.unlock();
+                m->check();
+                lk.lock();
+            }
+        });
     }
     return true;
 }
 
-bool Database::create_user(const std::string &username, const std::string &email, const std::string &password_hash, long &out_user_id, std::string &err) {
+bool Database::create_user(const std::string &username, const std::string &email, const std::string &password_hash, long long &out_user_id, std::string &err) {
+    Lease c = pimpl->write(0, err);
+    if (!c) return false;
     const char *paramValues[3] = {username.c_str(), email.c_str(), password_hash.c_str()};
-    PGresult *res = PQexecParams(pimpl->conn,
+    PGresult *res = PQexecParams(c,
         "INSERT INTO users(username,email,password_hash) VALUES($1,$2,$3) RETURNING user_id;",
         3, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
@@ -70,298 +541,882 @@ bool Database::create_user(const std::string &username, const std::string &email
         return false;
     }
     char *val = PQgetvalue(res, 0, 0);
-    out_user_id = atol(val);
+    out_user_id = atoll(val);
     PQclear(res);
+    pimpl->wrote(0, c, out_user_id);
+    if (pimpl->shards.size() > 1) {
+        // copies on the other shards, for their feed joins; no password there
+        IntText s_user(out_user_id);
+        const char *copyValues[3] = {s_user.c_str(), username.c_str(), email.c_str()};
+        if (!pimpl->write_all("INSERT INTO users(user_id,username,email,password_hash) VALUES($1::bigint,$2,$3,'');",
+                              3, copyValues, 1, err)) {
+            std::string ignored;
+            pimpl->write_all("DELETE FROM users WHERE user_id=$1::bigint;", 1, copyValues, 0, ignored);
+            return false;
+        }
+    }
     return true;
 }
 
-bool Database::check_user(const std::string &email, const std::string &password_hash, long &out_user_id) {
-    const char *paramValues[2] = {email.c_str(), password_hash.c_str()};
-    PGresult *res = PQexecParams(pimpl->conn,
-        "SELECT user_id FROM users WHERE email=$1 AND password_hash=$2;",
-        2, nullptr, paramValues, nullptr, nullptr, 0);
-    if (!res) return false;
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) { PQclear(res); return false; }
+bool Database::find_login(const std::string &email, long long &out_user_id, std::string &out_password_hash, std::string &err) {
+    // primary: the account may have been created a moment ago
+    Lease c = pimpl->write(0, err);
+    if (!c) return false;
+    const char *paramValues[1] = {email.c_str()};
+    PGresult *res = PQexecParams(c,
+        "SELECT user_id, password_hash FROM users WHERE email=$1;",
+        1, nullptr, paramValues, nullptr, nullptr, 0);
+    if (!res) { err = "no result"; return false; }
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        err = PQresultErrorMessage(res);
+        PQclear(res);
+        return false;
+    }
     if (PQntuples(res) == 0) { PQclear(res); return false; }
-    char *val = PQgetvalue(res, 0, 0);
-    out_user_id = atol(val);
+    out_user_id = atoll(PQgetvalue(res, 0, 0));
+    out_password_hash = PQgetvalue(res, 0, 1);
     PQclear(res);
     return true;
 }
 
-bool Database::create_weibo(long user_id, const std::string &content, const std::string &media, long &out_weibo_id, std::string &err) {
-    const char *paramValues[3];
-    std::string s_user = std::to_string(user_id);
-    paramValues[0] = s_user.c_str();
-    paramValues[1] = content.c_str();
-    paramValues[2] = media.c_str();
-    PGresult *res = PQexecParams(pimpl->conn,
-        "INSERT INTO weibos(user_id,content,media) VALUES($1::bigint,$2,$3) RETURNING weibo_id;",
-        3, nullptr, paramValues, nullptr, nullptr, 0);
+bool Database::set_password_hash(long long user_id, const std::string &password_hash, std::string &err) {
+    Lease c = pimpl->write(0, err);
+    if (!c) return false;
+    IntText s_user(user_id);
+    const char *paramValues[2] = {s_user.c_str(), password_hash.c_str()};
+    PGresult *res = PQexecParams(c,
+        "UPDATE users SET password_hash=$2 WHERE user_id=$1;",
+        2, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
         err = PQresultErrorMessage(res);
         PQclear(res);
         return false;
     }
-    char *val = PQgetvalue(res, 0, 0);
-    out_weibo_id = atol(val);
     PQclear(res);
     return true;
 }
 
-bool Database::get_weibos(int limit, std::string &json_out, std::string &err) {
-    if (!pimpl->conn) { err = "no connection"; return false; }
-    std::string s_limit = std::to_string(limit);
-    const char *paramValues[1] = { s_limit.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
-        "SELECT w.weibo_id, w.user_id, u.username, COALESCE(u.avatar,'') AS avatar, w.content, COALESCE(w.media,'') AS media, EXTRACT(EPOCH FROM w.created_at)*1000::bigint AS created_ms, "
-        "(SELECT COUNT(*) FROM likes l WHERE l.weibo_id = w.weibo_id) AS like_count, "
-        "(SELECT COUNT(*) FROM comments c WHERE c.weibo_id = w.weibo_id) AS comment_count "
-        "FROM weibos w JOIN users u ON w.user_id = u.user_id "
-        "ORDER BY w.created_at DESC LIMIT $1;",
-        1, nullptr, paramValues, nullptr, nullptr, 0);
+bool Database::create_weibo(long long user_id, const std::string &content, const std::string &media, long long &out_weibo_id, std::string &err) {
+    size_t shard = pimpl->user_shard(user_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    long long weibo_id = pimpl->ids->next(shard);
+    const char *paramValues[4];
+    IntText s_weibo(weibo_id);
+    IntText s_user(user_id);
+    paramValues[0] = s_weibo.c_str();
+    paramValues[1] = s_user.c_str();
+    paramValues[2] = content.c_str();
+    paramValues[3] = media.c_str();
+    PGresult *res = PQexecParams(c,
+        "INSERT INTO weibos(weibo_id,user_id,content,media) VALUES($1::bigint,$2::bigint,$3,$4);",
+        4, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) {
         err = PQresultErrorMessage(res);
         PQclear(res);
         return false;
     }
-    nlohmann::json arr = nlohmann::json::array();
-    int rows = PQntuples(res);
-    for (int i = 0; i < rows; ++i) {
-        nlohmann::json item;
-        item["weibo_id"] = std::stol(PQgetvalue(res, i, 0));
-        item["user_id"] = std::stol(PQgetvalue(res, i, 1));
-        item["username"] = std::string(PQgetvalue(res, i, 2));
-        item["avatar"] = std::string(PQgetvalue(res, i, 3));
-        item["content"] = std::string(PQgetvalue(res, i, 4));
-        item["media"] = std::string(PQgetvalue(res, i, 5));
-        // created_ms is numeric string
-        try { item["created_at"] = std::stoll(PQgetvalue(res, i, 6)); } catch(...) { item["created_at"] = 0; }
-        try { item["like_count"] = std::stoi(PQgetvalue(res, i, 7)); } catch(...) { item["like_count"] = 0; }
-        try { item["comment_count"] = std::stoi(PQgetvalue(res, i, 8)); } catch(...) { item["comment_count"] = 0; }
-        arr.push_back(item);
-    }
     PQclear(res);
-    nlohmann::json out;
-    out["weibos"] = arr;
-    json_out = out.dump();
+    out_weibo_id = weibo_id;
+    pimpl->wrote(shard, c, user_id);
     return true;
 }
 
-bool Database::get_comments(long weibo_id, std::string &json_out, std::string &err) {
-    std::string s_weibo = std::to_string(weibo_id);
+// Select list shared by the feed-style queries; callers append WHERE/ORDER BY.
+static const char *WEIBO_COLUMNS =
+    "SELECT w.weibo_id, w.user_id, w.content, COALESCE(w.media_thumb, w.media, '') AS media, EXTRACT(EPOCH FROM w.created_at)*1000::bigint AS created_ms, "
+    "(SELECT COUNT(*) FROM likes l WHERE l.weibo_id = w.weibo_id) AS like_count, "
+    "(SELECT COUNT(*) FROM comments c WHERE c.weibo_id = w.weibo_id) AS comment_count, "
+    "COALESCE(w.media,'') AS media_full "
+    "FROM weibos w ";
+
+// Appends one row selected with WEIBO_COLUMNS; authors are filled afterwards.
+static void append_weibo(WeiboList &out, const PGresult *res, int i) {
+    out.weibo_id.push_back(int_at(res, i, 0));
+    out.user_id.push_back(int_at(res, i, 1));
+    out.content.push_back(text_at(res, i, 2));
+    out.media.push_back(text_at(res, i, 3));
+    out.created_ms.push_back(int_at(res, i, 4));
+    out.like_count.push_back(int_at(res, i, 5));
+    out.comment_count.push_back(int_at(res, i, 6));
+    out.media_full.push_back(text_at(res, i, 7));
+}
+
+bool Database::Impl::authors(WeiboList &list, std::string &err) {
+    std::vector<YUYU::UserCache::Entry> found;
+    if (!profiles->get(list.user_id, found, err)) return false;
+    list.username.clear();
+    list.avatar.clear();
+    list.username.reserve(found.size(), found.size() * 16);
+    list.avatar.reserve(found.size(), found.size() * 48);
+    for (const auto &u : found) {
+        // a deleted author's rows go with it; until then they show unnamed
+        list.username.push_back(u ? std::string_view(u->username) : std::string_view());
+        list.avatar.push_back(u ? std::string_view(u->avatar) : std::string_view());
+    }
+    return true;
+}
+
+// Formats ids as a Postgres array literal for `= ANY($1::bigint[])`.
+static std::pmr::string id_array(const std::pmr::vector<long long> &ids) {
+    std::pmr::string s(YUYU::RequestArena::resource());
+    s.reserve(ids.size() * 18 + 2);
+    s += '{';
+    char buf[24];
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i) s += ',';
+        s.append(buf, std::to_chars(buf, buf + sizeof(buf), ids[i]).ptr);
+    }
+    s += '}';
+    return s;
+}
+
+bool Database::get_weibos(int limit, long long before_id, WeiboList &out, std::string &err) {
+    IntText s_limit(limit);
+    IntText s_before(before_id);
+    const char *paramValues[2] = { s_limit.c_str(), s_before.c_str() };
+    // ids are time-ordered, so the primary key alone is the feed order and
+    // the keyset cursor: no sort on created_at, no OFFSET
+    static const std::string sql = std::string(WEIBO_COLUMNS) +
+        "WHERE $2::bigint = 0 OR w.weibo_id < $2::bigint ORDER BY w.weibo_id DESC LIMIT $1;";
+    std::pmr::memory_resource *arena = YUYU::RequestArena::resource();
+    std::pmr::vector<PGresult *> parts(arena);
+    if (!pimpl->scatter(sql.c_str(), 2, paramValues, parts, err)) return false;
+    // k-way merge of the per-shard newest-first pages
+    struct Head { long long id; size_t shard; int row; };
+    auto older = [](const Head &a, const Head &b) { return a.id < b.id; };
+    std::pmr::vector<Head> heap(arena);
+    heap.reserve(parts.size());
+    auto push = [&](size_t k, int row) {
+        if (row >= PQntuples(parts[k])) return;
+        heap.push_back({int_at(parts[k], row, 0), k, row});
+        std::push_heap(heap.begin(), heap.end(), older);
+    };
+    size_t rows = 0;
+    for (size_t k = 0; k < parts.size(); ++k) {
+        rows += static_cast<size_t>(PQntuples(parts[k]));
+        push(k, 0);
+    }
+    out.clear();
+    out.reserve(std::min(rows, static_cast<size_t>(std::max(limit, 0))));
+    for (int n = 0; !heap.empty() && n < limit; ++n) {
+        std::pop_heap(heap.begin(), heap.end(), older);
+        Head h = heap.back();
+        heap.pop_back();
+        append_weibo(out, parts[h.shard], h.row);
+        push(h.shard, h.row + 1);
+    }
+    for (PGresult *r : parts) PQclear(r);
+    return pimpl->authors(out, err);
+}
+
+bool Database::get_weibos_by_ids(const std::vector<long long> &ids, WeiboList &out, std::string &err) {
+    out.clear();
+    if (ids.empty()) return true;
+    std::pmr::memory_resource *arena = YUYU::RequestArena::resource();
+    std::pmr::vector<std::pmr::vector<long long>> by_shard(pimpl->shards.size(), arena);
+    for (long long id : ids) by_shard[pimpl->id_shard(id)].push_back(id);
+    // openGauss lacks WITH ORDINALITY, so the caller's order is restored client-side
+    static const std::string sql = std::string(WEIBO_COLUMNS) + "WHERE w.weibo_id = ANY($1::bigint[]);";
+    struct Row { const PGresult *res; int row; };
+    std::pmr::unordered_map<long long, Row> found(arena);
+    found.reserve(ids.size());
+    std::pmr::vector<PGresult *> results(arena);
+    auto clear = [&] { for (PGresult *r : results) PQclear(r); };
+    for (size_t k = 0; k < by_shard.size(); ++k) {
+        if (by_shard[k].empty()) continue;
+        Lease c = pimpl->read(k, err);
+        if (!c) { clear(); return false; }
+        std::pmr::string s_ids = id_array(by_shard[k]);
+        const char *paramValues[1] = { s_ids.c_str() };
+        PGresult *res = PQexecParams(c, sql.c_str(),
+            1, nullptr, paramValues, nullptr, nullptr, 0);
+        if (!res) { err = "no result"; clear(); return false; }
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); clear(); return false; }
+        results.push_back(res);
+        for (int i = 0; i < PQntuples(res); ++i) found.emplace(int_at(res, i, 0), Row{res, i});
+    }
+    out.reserve(found.size());
+    for (long long id : ids) {
+        auto it = found.find(id);
+        if (it != found.end()) append_weibo(out, it->second.res, it->second.row);
+    }
+    clear();
+    return pimpl->authors(out, err);
+}
+
+bool Database::scan_weibo_contents(long long after_id, const std::function<void(long long, const std::string &)> &fn, std::string &err) {
+    // keyset pagination keeps each round trip (and its result) bounded; the
+    // shards' pages are merged so ids still come out ascending
+    const int kBatch = 10000;
+    struct Cursor {
+        PGresult *res = nullptr;
+        int row = 0;
+        long long after = 0;
+        bool done = false;
+    };
+    std::vector<Cursor> cur(pimpl->shards.size());
+    for (Cursor &c : cur) c.after = after_id;
+    auto fill = [&](size_t k) {
+        Cursor &c = cur[k];
+        if (c.res) PQclear(c.res);
+        c.res = nullptr;
+        c.row = 0;
+        Lease conn = pimpl->read(k, err);
+        if (!conn) return false;
+        IntText s_after(c.after);
+        const char *paramValues[1] = { s_after.c_str() };
+        PGresult *res = PQexecParams(conn,
+            "SELECT weibo_id, content FROM weibos WHERE weibo_id > $1::bigint ORDER BY weibo_id LIMIT 10000;",
+            1, nullptr, paramValues, nullptr, nullptr, 0);
+        if (!res) { err = "no result"; return false; }
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+        c.res = res;
+        c.done = PQntuples(res) < kBatch;
+        return true;
+    };
+    bool ok = true;
+    for (size_t k = 0; k < cur.size() && ok; ++k) ok = fill(k);
+    while (ok) {
+        size_t best = cur.size();
+        long long best_id = 0;
+        for (size_t k = 0; k < cur.size(); ++k) {
+            if (!cur[k].res || cur[k].row >= PQntuples(cur[k].res)) continue;
+            long long id = std::stoll(PQgetvalue(cur[k].res, cur[k].row, 0));
+            if (best == cur.size() || id < best_id) { best = k; best_id = id; }
+        }
+        if (best == cur.size()) break;
+        Cursor &c = cur[best];
+        fn(best_id, std::string(PQgetvalue(c.res, c.row, 1), PQgetlength(c.res, c.row, 1)));
+        c.after = best_id;
+        if (++c.row >= PQntuples(c.res) && !c.done) ok = fill(best);
+    }
+    for (auto &c : cur) if (c.res) PQclear(c.res);
+    return ok;
+}
+
+bool Database::scan_engagement(long long since_ms, long long before_id, const std::function<void(long long, int, long long)> &fn, std::string &err) {
+    IntText s_since(since_ms);
+    IntText s_before(before_id);
+    const char *paramValues[2] = { s_since.c_str(), s_before.c_str() };
+    // kind: 0 = post, 1 = like, 2 = comment (matches HotRanker::Kind)
+    const char *sql =
+        "SELECT weibo_id, 0, (EXTRACT(EPOCH FROM created_at)*1000)::bigint FROM weibos "
+        "WHERE created_at >= to_timestamp($1::bigint / 1000.0) AND weibo_id < $2::bigint "
+        "UNION ALL SELECT weibo_id, 1, (EXTRACT(EPOCH FROM created_at)*1000)::bigint FROM likes "
+        "WHERE created_at >= to_timestamp($1::bigint / 1000.0) AND like_id < $2::bigint "
+        "UNION ALL SELECT weibo_id, 2, (EXTRACT(EPOCH FROM created_at)*1000)::bigint FROM comments "
+        "WHERE created_at >= to_timestamp($1::bigint / 1000.0) AND comment_id < $2::bigint;";
+    for (size_t k = 0; k < pimpl->shards.size(); ++k) {
+        Lease c = pimpl->read(k, err);
+        if (!c) return false;
+        if (!PQsendQueryParams(c, sql, 2, nullptr, paramValues, nullptr, nullptr, 0)) {
+            err = PQerrorMessage(c);
+            return false;
+        }
+        // single-row mode streams the union without materializing it client-side
+        PQsetSingleRowMode(c);
+        bool ok = true;
+        while (PGresult *res = PQgetResult(c)) {
+            ExecStatusType st = PQresultStatus(res);
+            if (st == PGRES_SINGLE_TUPLE) {
+                if (ok) {
+                    fn(std::stoll(PQgetvalue(res, 0, 0)), std::atoi(PQgetvalue(res, 0, 1)),
+                       std::stoll(PQgetvalue(res, 0, 2)));
+                }
+            } else if (st != PGRES_TUPLES_OK) {
+                err = PQresultErrorMessage(res);
+                ok = false;
+            }
+            PQclear(res);
+        }
+        if (!ok) return false;
+    }
+    return true;
+}
+
+bool Database::get_comments(long long weibo_id, std::vector<Comment> &out, std::string &err) {
+    Lease c = pimpl->read(pimpl->id_shard(weibo_id), err);
+    if (!c) return false;
+    IntText s_weibo(weibo_id);
     const char *paramValues[1] = { s_weibo.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
-        "SELECT c.comment_id, c.user_id, u.username, COALESCE(u.avatar,'') AS avatar, c.content, COALESCE(c.parent_id,0) AS parent_id, EXTRACT(EPOCH FROM c.created_at)*1000::bigint AS created_ms "
-        "FROM comments c JOIN users u ON c.user_id = u.user_id WHERE c.weibo_id = $1::bigint ORDER BY c.created_at ASC;",
+    PGresult *res = PQexecParams(c,
+        "SELECT c.comment_id, c.user_id, c.content, COALESCE(c.parent_id,0) AS parent_id, EXTRACT(EPOCH FROM c.created_at)*1000::bigint AS created_ms "
+        "FROM comments c WHERE c.weibo_id = $1::bigint ORDER BY c.created_at ASC;",
         1, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    json arr = json::array();
+    out.clear();
+    out.resize(static_cast<size_t>(PQntuples(res)));
+    std::vector<long long> user_ids(out.size());
     for (int i = 0; i < PQntuples(res); ++i) {
-        json it;
-        it["comment_id"] = std::stol(PQgetvalue(res,i,0));
-        it["user_id"] = std::stol(PQgetvalue(res,i,1));
-        it["username"] = std::string(PQgetvalue(res,i,2));
-        it["avatar"] = std::string(PQgetvalue(res,i,3));
-        it["content"] = std::string(PQgetvalue(res,i,4));
-        try{ it["parent_id"] = std::stol(PQgetvalue(res,i,5)); } catch(...) { it["parent_id"] = 0; }
-        try { it["created_at"] = std::stoll(PQgetvalue(res,i,6)); } catch(...) { it["created_at"] = 0; }
-        arr.push_back(it);
+        Comment &cm = out[static_cast<size_t>(i)];
+        cm.comment_id = int_at(res,i,0);
+        cm.weibo_id = weibo_id;
+        cm.user_id = int_at(res,i,1);
+        cm.content = text_at(res,i,2);
+        cm.parent_id = int_at(res,i,3);
+        cm.created_ms = int_at(res,i,4);
+        user_ids[static_cast<size_t>(i)] = cm.user_id;
     }
     PQclear(res);
-    json out; out["comments"] = arr; json_out = out.dump(); return true;
+    std::vector<YUYU::UserCache::Entry> found;
+    if (!pimpl->profiles->get(user_ids, found, err)) return false;
+    for (size_t i = 0; i < out.size(); ++i) {
+        if (!found[i]) continue;
+        out[i].username = found[i]->username;
+        out[i].avatar = found[i]->avatar;
+    }
+    return true;
 }
 
-bool Database::create_comment(long user_id, long weibo_id, const std::string &content, long parent_id, long &out_comment_id, std::string &err) {
-    std::string s_weibo = std::to_string(weibo_id);
-    std::string s_user = std::to_string(user_id);
-    std::string s_parent = std::to_string(parent_id);
-    const char *paramValues[4] = { s_weibo.c_str(), s_user.c_str(), content.c_str(), s_parent.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
-        "INSERT INTO comments(weibo_id,user_id,content,parent_id) VALUES($1::bigint,$2::bigint,$3,NULLIF($4::bigint,0)) RETURNING comment_id;",
-        4, nullptr, paramValues, nullptr, nullptr, 0);
+bool Database::create_comment(long long user_id, long long weibo_id, const std::string &content, long long parent_id, long long &out_comment_id, long long &out_author_id, std::string &err) {
+    size_t shard = pimpl->id_shard(weibo_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    long long comment_id = pimpl->ids->next(shard);
+    IntText s_comment(comment_id);
+    IntText s_weibo(weibo_id);
+    IntText s_user(user_id);
+    IntText s_parent(parent_id);
+    const char *paramValues[5] = { s_comment.c_str(), s_weibo.c_str(), s_user.c_str(), content.c_str(), s_parent.c_str() };
+    // the weibo lives on the same shard (its id names it)
+    PGresult *res = PQexecParams(c,
+        "INSERT INTO comments(comment_id,weibo_id,user_id,content,parent_id) VALUES($1::bigint,$2::bigint,$3::bigint,$4,NULLIF($5::bigint,0)) "
+        "RETURNING (SELECT user_id FROM weibos WHERE weibo_id=$2::bigint);",
+        5, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    out_comment_id = std::stol(PQgetvalue(res,0,0)); PQclear(res); return true;
+    out_author_id = PQntuples(res) > 0 ? int_at(res, 0, 0) : 0;
+    PQclear(res);
+    out_comment_id = comment_id;
+    pimpl->wrote(shard, c, user_id);
+    return true;
 }
 
-bool Database::delete_comment(long user_id, long comment_id, std::string &err) {
-    std::string s_comment = std::to_string(comment_id);
-    std::string s_user = std::to_string(user_id);
+bool Database::delete_comment(long long user_id, long long comment_id, long long &out_weibo_id, std::string &err) {
+    size_t shard = pimpl->id_shard(comment_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    IntText s_comment(comment_id);
+    IntText s_user(user_id);
     const char *paramValues[2] = { s_comment.c_str(), s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
-        "DELETE FROM comments WHERE comment_id=$1::bigint AND user_id=$2::bigint RETURNING comment_id;",
+    PGresult *res = PQexecParams(c,
+        "DELETE FROM comments WHERE comment_id=$1::bigint AND user_id=$2::bigint RETURNING weibo_id;",
         2, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    bool ok = PQntuples(res) > 0; PQclear(res); return ok;
+    bool ok = PQntuples(res) > 0;
+    if (ok) out_weibo_id = std::stoll(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    if (ok) pimpl->wrote(shard, c, user_id);
+    return ok;
 }
 
-bool Database::update_user_profile(long user_id, const std::string &username, const std::string &avatar, std::string &err) {
-    std::string s_user = std::to_string(user_id);
+bool Database::update_user_profile(long long user_id, const std::string &username, const std::string &avatar, std::string &err) {
+    Lease c = pimpl->write(0, err);
+    if (!c) return false;
+    IntText s_user(user_id);
     const char *paramValues[3] = { username.c_str(), avatar.c_str(), s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
+    PGresult *res = PQexecParams(c,
         "UPDATE users SET username=$1, avatar=$2 WHERE user_id=$3::bigint RETURNING user_id;",
         3, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    bool ok = PQntuples(res) > 0; PQclear(res); return ok;
+    bool ok = PQntuples(res) > 0; PQclear(res);
+    if (!ok) return false;
+    pimpl->wrote(0, c, user_id);
+    pimpl->profiles->put(User{user_id, username, avatar});
+    // shard 0 enforced the unique username; the copies follow
+    return pimpl->write_all("UPDATE users SET username=$1, avatar=$2 WHERE user_id=$3::bigint;",
+                            3, paramValues, 1, err);
 }
 
-bool Database::get_user_likes(long user_id, std::string &json_out, std::string &err) {
-    std::string s_user = std::to_string(user_id);
-    const char *paramValues[1] = { s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
-        "SELECT weibo_id FROM likes WHERE user_id = $1::bigint;",
-        1, nullptr, paramValues, nullptr, nullptr, 0);
+bool Database::set_weibo_media_thumb(long long weibo_id, const std::string &url, std::string &err) {
+    Lease c = pimpl->write(pimpl->id_shard(weibo_id), err);
+    if (!c) return false;
+    IntText s_weibo(weibo_id);
+    const char *paramValues[2] = { url.c_str(), s_weibo.c_str() };
+    PGresult *res = PQexecParams(c,
+        "UPDATE weibos SET media_thumb=$1 WHERE weibo_id=$2::bigint;",
+        2, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    json arr = json::array();
-    for (int i=0;i<PQntuples(res);++i){ arr.push_back(std::stol(PQgetvalue(res,i,0))); }
-    PQclear(res);
-    json out; out["weibo_ids"] = arr; json_out = out.dump(); return true;
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+    PQclear(res); return true;
 }
 
-bool Database::add_like(long user_id, long weibo_id, long &out_like_id, std::string &err) {
-    std::string s_weibo = std::to_string(weibo_id);
-    std::string s_user = std::to_string(user_id);
-    const char *paramValues[2] = { s_weibo.c_str(), s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
-        "INSERT INTO likes(weibo_id,user_id) VALUES($1::bigint,$2::bigint) RETURNING like_id;",
-        2, nullptr, paramValues, nullptr, nullptr, 0);
+bool Database::replace_user_avatar(long long user_id, const std::string &from, const std::string &to, std::string &err) {
+    IntText s_user(user_id);
+    const char *paramValues[3] = { to.c_str(), s_user.c_str(), from.c_str() };
+    bool ok = pimpl->write_all("UPDATE users SET avatar=$1 WHERE user_id=$2::bigint AND avatar=$3;",
+                               3, paramValues, 0, err);
+    pimpl->profiles->invalidate(user_id);
+    return ok;
+}
+
+bool Database::get_user_likes(long long user_id, std::vector<long long> &weibo_ids, std::string &err) {
+    IntText s_user(user_id);
+    const char *paramValues[1] = { s_user.c_str() };
+    // likes live with the weibo, so any shard may hold some of them
+    std::pmr::vector<PGresult *> parts(YUYU::RequestArena::resource());
+    if (!pimpl->scatter("SELECT weibo_id FROM likes WHERE user_id = $1::bigint;", 1, paramValues, parts, err)) return false;
+    weibo_ids.clear();
+    for (PGresult *res : parts) {
+        for (int i=0;i<PQntuples(res);++i){ weibo_ids.push_back(int_at(res,i,0)); }
+        PQclear(res);
+    }
+    return true;
+}
+
+bool Database::add_like(long long user_id, long long weibo_id, long long &out_like_id, long long &out_author_id, std::string &err) {
+    size_t shard = pimpl->id_shard(weibo_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    long long like_id = pimpl->ids->next(shard);
+    IntText s_like(like_id);
+    IntText s_weibo(weibo_id);
+    IntText s_user(user_id);
+    const char *paramValues[3] = { s_like.c_str(), s_weibo.c_str(), s_user.c_str() };
+    PGresult *res = PQexecParams(c,
+        "INSERT INTO likes(like_id,weibo_id,user_id) VALUES($1::bigint,$2::bigint,$3::bigint) "
+        "RETURNING (SELECT user_id FROM weibos WHERE weibo_id=$2::bigint);",
+        3, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    out_like_id = std::stol(PQgetvalue(res,0,0)); PQclear(res); return true;
+    out_author_id = PQntuples(res) > 0 ? int_at(res, 0, 0) : 0;
+    PQclear(res);
+    out_like_id = like_id;
+    pimpl->wrote(shard, c, user_id);
+    return true;
 }
 
-bool Database::remove_like(long user_id, long weibo_id, std::string &err) {
-    std::string s_weibo = std::to_string(weibo_id);
-    std::string s_user = std::to_string(user_id);
+bool Database::remove_like(long long user_id, long long weibo_id, std::string &err) {
+    size_t shard = pimpl->id_shard(weibo_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    IntText s_weibo(weibo_id);
+    IntText s_user(user_id);
     const char *paramValues[2] = { s_weibo.c_str(), s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
+    PGresult *res = PQexecParams(c,
         "DELETE FROM likes WHERE weibo_id=$1::bigint AND user_id=$2::bigint RETURNING like_id;",
         2, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    bool ok = PQntuples(res) > 0; PQclear(res); return ok;
+    bool ok = PQntuples(res) > 0; PQclear(res);
+    if (ok) pimpl->wrote(shard, c, user_id);
+    return ok;
 }
 
-bool Database::create_follow(long follower_id, long followee_id, long &out_follow_id, std::string &err) {
+bool Database::create_follow(long long follower_id, long long followee_id, long long &out_follow_id, std::string &err) {
+    size_t shard = pimpl->user_shard(follower_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
     if (follower_id == followee_id) { err = "cannot follow yourself"; return false; }
-    std::string s_follower = std::to_string(follower_id);
-    std::string s_followee = std::to_string(followee_id);
+    IntText s_follower(follower_id);
+    IntText s_followee(followee_id);
     const char *paramValues[2] = { s_follower.c_str(), s_followee.c_str() };
     // Try INSERT normally; some Postgres-compatible DBs (e.g. older versions or
     // some forks) may not support ON CONFLICT. If INSERT fails with unique
     // violation, fall back to selecting existing follow_id.
-    PGresult *res = PQexecParams(pimpl->conn,
-        "INSERT INTO follows(follower_id,followee_id) VALUES($1::bigint,$2::bigint) RETURNING follow_id;",
-        2, nullptr, paramValues, nullptr, nullptr, 0);
+    long long follow_id = pimpl->ids->next(shard);
+    IntText s_follow(follow_id);
+    const char *insertValues[3] = { s_follow.c_str(), s_follower.c_str(), s_followee.c_str() };
+    PGresult *res = PQexecParams(c,
+        "INSERT INTO follows(follow_id,follower_id,followee_id) VALUES($1::bigint,$2::bigint,$3::bigint);",
+        3, nullptr, insertValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     ExecStatusType st = PQresultStatus(res);
-    if (st == PGRES_TUPLES_OK && PQntuples(res) > 0) {
-        out_follow_id = std::stol(PQgetvalue(res,0,0)); PQclear(res); return true;
+    if (st == PGRES_COMMAND_OK) {
+        out_follow_id = follow_id; PQclear(res);
+        pimpl->wrote(shard, c, follower_id);
+        return true;
     }
     // If insert failed, check SQLSTATE for unique violation (23505)
-    if (st != PGRES_TUPLES_OK) {
-        const char *sqlstate = PQresultErrorField(res, PG_DIAG_SQLSTATE);
-        const char *errmsg = PQresultErrorMessage(res);
-        PQclear(res);
-        if (sqlstate && std::string(sqlstate) == "23505") {
-            // duplicate key -> select existing follow_id
-            PGresult *res2 = PQexecParams(pimpl->conn,
-                "SELECT follow_id FROM follows WHERE follower_id=$1::bigint AND followee_id=$2::bigint;",
-                2, nullptr, paramValues, nullptr, nullptr, 0);
-            if (!res2) { err = "no result"; return false; }
-            if (PQresultStatus(res2) == PGRES_TUPLES_OK && PQntuples(res2) > 0) {
-                out_follow_id = std::stol(PQgetvalue(res2,0,0)); PQclear(res2); return true;
-            }
-            const char *em = PQresultErrorMessage(res2);
-            if (em && em[0] != '\0') err = em; else err = "no follow_id found after duplicate";
-            PQclear(res2);
-            return false;
+    const char *state = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+    std::string sqlstate = state ? state : "";
+    std::string errmsg = PQresultErrorMessage(res);
+    PQclear(res);
+    if (sqlstate == "23505") {
+        // duplicate key -> select existing follow_id
+        PGresult *res2 = PQexecParams(c,
+            "SELECT follow_id FROM follows WHERE follower_id=$1::bigint AND followee_id=$2::bigint;",
+            2, nullptr, paramValues, nullptr, nullptr, 0);
+        if (!res2) { err = "no result"; return false; }
+        if (PQresultStatus(res2) == PGRES_TUPLES_OK && PQntuples(res2) > 0) {
+            out_follow_id = std::stoll(PQgetvalue(res2,0,0)); PQclear(res2); return true;
         }
-        // Not a duplicate-key error, return original error message
-        if (errmsg && errmsg[0] != '\0') err = errmsg; else err = "insert failed";
+        const char *em = PQresultErrorMessage(res2);
+        if (em && em[0] != '\0') err = em; else err = "no follow_id found after duplicate";
+        PQclear(res2);
         return false;
     }
-    // Should not reach here; treat as unexpected failure
-    err = "insert failed (unexpected)";
+    // Not a duplicate-key error, return original error message
+    if (!errmsg.empty()) err = errmsg; else err = "insert failed";
     return false;
 }
 
-bool Database::remove_follow(long follower_id, long followee_id, std::string &err) {
-    std::string s_follower = std::to_string(follower_id);
-    std::string s_followee = std::to_string(followee_id);
+bool Database::remove_follow(long long follower_id, long long followee_id, std::string &err) {
+    size_t shard = pimpl->user_shard(follower_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    IntText s_follower(follower_id);
+    IntText s_followee(followee_id);
     const char *paramValues[2] = { s_follower.c_str(), s_followee.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
+    PGresult *res = PQexecParams(c,
         "DELETE FROM follows WHERE follower_id=$1::bigint AND followee_id=$2::bigint RETURNING follow_id;",
         2, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
     // Treat deleting a non-existent follow as success (idempotent unfollow)
     PQclear(res);
+    pimpl->wrote(shard, c, follower_id);
     return true;
 }
 
-bool Database::delete_weibo(long user_id, long weibo_id, std::string &err) {
-    std::string s_weibo = std::to_string(weibo_id);
-    std::string s_user = std::to_string(user_id);
+bool Database::delete_weibo(long long user_id, long long weibo_id, std::string &err) {
+    size_t shard = pimpl->id_shard(weibo_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    IntText s_weibo(weibo_id);
+    IntText s_user(user_id);
     const char *paramValues[2] = { s_weibo.c_str(), s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
+    PGresult *res = PQexecParams(c,
         "DELETE FROM weibos WHERE weibo_id=$1::bigint AND user_id=$2::bigint RETURNING weibo_id;",
         2, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    bool ok = PQntuples(res) > 0; PQclear(res); return ok;
+    bool ok = PQntuples(res) > 0; PQclear(res);
+    if (ok) pimpl->wrote(shard, c, user_id);
+    return ok;
+}
+
+// Appends (user_id, username[, avatar]) rows.
+static void append_users(std::vector<User> &out, const PGresult *res) {
+    int cols = PQnfields(res);
+    for (int i = 0; i < PQntuples(res); ++i) {
+        out.emplace_back();
+        User &u = out.back();
+        u.user_id = int_at(res, i, 0);
+        u.username = text_at(res, i, 1);
+        if (cols > 2) u.avatar = text_at(res, i, 2);
+    }
 }
 
-bool Database::get_followers(long user_id, std::string &json_out, std::string &err) {
-    std::string s_user = std::to_string(user_id);
+bool Database::get_followers(long long user_id, std::vector<User> &out, std::string &err) {
+    IntText s_user(user_id);
     const char *paramValues[1] = { s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
-        "SELECT u.user_id,u.username FROM follows f JOIN users u ON f.follower_id = u.user_id WHERE f.followee_id = $1::bigint;",
-        1, nullptr, paramValues, nullptr, nullptr, 0);
-    if (!res) { err = "no result"; return false; }
-    if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    json arr = json::array();
-    for (int i=0;i<PQntuples(res);++i){ json it; it["user_id"] = std::stol(PQgetvalue(res,i,0)); it["username"] = std::string(PQgetvalue(res,i,1)); arr.push_back(it);} PQclear(res);
-    json out; out["users"] = arr; json_out = out.dump(); return true;
+    // follows are placed by follower, so every shard may hold followers
+    std::pmr::vector<PGresult *> parts(YUYU::RequestArena::resource());
+    if (!pimpl->scatter("SELECT u.user_id,u.username FROM follows f JOIN users u ON f.follower_id = u.user_id WHERE f.followee_id = $1::bigint;",
+                        1, paramValues, parts, err)) return false;
+    out.clear();
+    for (PGresult *res : parts) {
+        append_users(out, res);
+        PQclear(res);
+    }
+    return true;
 }
 
-bool Database::get_following(long user_id, std::string &json_out, std::string &err) {
-    std::string s_user = std::to_string(user_id);
+bool Database::get_following(long long user_id, std::vector<User> &out, std::string &err) {
+    Lease c = pimpl->read(pimpl->user_shard(user_id), err);
+    if (!c) return false;
+    IntText s_user(user_id);
     const char *paramValues[1] = { s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
+    PGresult *res = PQexecParams(c,
         "SELECT u.user_id,u.username FROM follows f JOIN users u ON f.followee_id = u.user_id WHERE f.follower_id = $1::bigint;",
         1, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    json arr = json::array();
-    for (int i=0;i<PQntuples(res);++i){ json it; it["user_id"] = std::stol(PQgetvalue(res,i,0)); it["username"] = std::string(PQgetvalue(res,i,1)); arr.push_back(it);} PQclear(res);
-    json out; out["users"] = arr; json_out = out.dump(); return true;
+    out.clear();
+    append_users(out, res);
+    PQclear(res);
+    return true;
 }
 
-bool Database::get_user_info(long user_id, std::string &json_out, std::string &err) {
-    std::string s_user = std::to_string(user_id);
-    const char *paramValues[1] = { s_user.c_str() };
-    PGresult *res = PQexecParams(pimpl->conn,
-        "SELECT user_id, username, COALESCE(avatar,'') AS avatar FROM users WHERE user_id = $1::bigint;",
+bool Database::get_user_info(long long user_id, User &out, std::string &err) {
+    std::vector<YUYU::UserCache::Entry> found;
+    if (!pimpl->profiles->get({user_id}, found, err)) return false;
+    if (!found[0]) { err = "user not found"; return false; }
+    out = *found[0];
+    return true;
+}
+
+bool Database::get_users(const std::vector<long long> &ids, std::vector<User> &out, std::string &err) {
+    out.clear();
+    std::vector<YUYU::UserCache::Entry> found;
+    if (!pimpl->profiles->get(ids, found, err)) return false;
+    for (const auto &u : found)
+        if (u) out.push_back(*u);
+    return true;
+}
+
+bool Database::Impl::load_users(const std::vector<long long> &ids, std::vector<User> &out, std::string &err) {
+    out.clear();
+    if (ids.empty()) return true;
+    // every shard has the users table; shard 0's copy is authoritative. The
+    // result is cached until the next put() or change notification, so it
+    // comes from the primary: a lagging replica would cache the old profile.
+    Lease c = write(0, err);
+    if (!c) return false;
+    std::pmr::vector<long long> list(ids.begin(), ids.end(), YUYU::RequestArena::resource());
+    std::pmr::string s_ids = id_array(list);
+    const char *paramValues[1] = { s_ids.c_str() };
+    PGresult *res = PQexecParams(c,
+        "SELECT user_id, username, COALESCE(avatar,'') AS avatar FROM users WHERE user_id = ANY($1::bigint[]);",
         1, nullptr, paramValues, nullptr, nullptr, 0);
     if (!res) { err = "no result"; return false; }
     if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
-    if (PQntuples(res) == 0) { err = "user not found"; PQclear(res); return false; }
-    json out;
-    out["user_id"] = std::stol(PQgetvalue(res, 0, 0));
-    out["username"] = std::string(PQgetvalue(res, 0, 1));
-    out["avatar"] = std::string(PQgetvalue(res, 0, 2));
+    out.reserve(static_cast<size_t>(PQntuples(res)));
+    append_users(out, res);
+    PQclear(res);
+    return true;
+}
+
+bool Database::save_notifications(const std::vector<Notification> &events, std::string &err) {
+    // kept with the recipient's weibos and follows
+    std::vector<std::vector<const Notification *>> by_shard(pimpl->shards.size());
+    for (const Notification &n : events) by_shard[pimpl->user_shard(n.user_id)].push_back(&n);
+    const size_t kRows = 500;
+    for (size_t k = 0; k < by_shard.size(); ++k) {
+        const auto &rows = by_shard[k];
+        if (rows.empty()) continue;
+        Lease c = pimpl->write(k, err);
+        if (!c) return false;
+        for (size_t from = 0; from < rows.size(); from += kRows) {
+            size_t n = std::min(kRows, rows.size() - from);
+            std::vector<std::string> text;
+            text.reserve(n * 5);
+            std::string sql = "INSERT INTO notifications(notification_id,user_id,kind,weibo_id,actor_id) "
+                              "SELECT v.i,v.u,v.k,v.w,v.a FROM (VALUES ";
+            for (size_t r = 0; r < n; ++r) {
+                const Notification &e = *rows[from + r];
+                for (long long v : {e.notification_id, e.user_id, static_cast<long long>(e.kind), e.weibo_id, e.actor_id})
+                    text.push_back(std::to_string(v));
+                size_t p = r * 5;
+                sql += r ? ",(" : "(";
+                sql += "$" + std::to_string(p + 1) + "::bigint,$" + std::to_string(p + 2) + "::bigint,$" +
+                       std::to_string(p + 3) + "::smallint,$" + std::to_string(p + 4) + "::bigint,$" +
+                       std::to_string(p + 5) + "::bigint)";
+            }
+            // saving again after a failed round must not fail on the rows that made it
+            sql += ") AS v(i,u,k,w,a) WHERE NOT EXISTS (SELECT 1 FROM notifications x WHERE x.notification_id = v.i);";
+            std::vector<const char *> params;
+            params.reserve(text.size());
+            for (const std::string &t : text) params.push_back(t.c_str());
+            PGresult *res = PQexecParams(c, sql.c_str(), static_cast<int>(params.size()), nullptr, params.data(),
+                                         nullptr, nullptr, 0);
+            if (!res) { err = "no result"; return false; }
+            if (PQresultStatus(res) != PGRES_COMMAND_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+            PQclear(res);
+        }
+    }
+    return true;
+}
+
+bool Database::load_notifications(long long user_id, size_t limit, std::vector<Notification> &out, long long &read_id, std::string &err) {
+    size_t shard = pimpl->user_shard(user_id);
+    // from the primary: an inbox is loaded once, and a replica may not have
+    // the events and watermark it was last evicted with
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    IntText s_user(user_id);
+    IntText s_limit(static_cast<long long>(limit));
+    const char *paramValues[2] = { s_user.c_str(), s_limit.c_str() };
+    PGresult *res = PQexecParams(c,
+        "SELECT notification_id, kind, weibo_id, actor_id FROM notifications WHERE user_id=$1::bigint "
+        "ORDER BY notification_id DESC LIMIT $2::bigint;",
+        2, nullptr, paramValues, nullptr, nullptr, 0);
+    if (!res) { err = "no result"; return false; }
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+    out.clear();
+    out.reserve(PQntuples(res));
+    for (int i = 0; i < PQntuples(res); ++i) {
+        Notification n;
+        n.notification_id = int_at(res, i, 0);
+        n.user_id = user_id;
+        n.kind = static_cast<int>(int_at(res, i, 1));
+        n.weibo_id = int_at(res, i, 2);
+        n.actor_id = int_at(res, i, 3);
+        out.push_back(n);
+    }
+    PQclear(res);
+    res = PQexecParams(c, "SELECT read_id FROM notification_reads WHERE user_id=$1::bigint;",
+                       1, nullptr, paramValues, nullptr, nullptr, 0);
+    if (!res) { err = "no result"; return false; }
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
+    read_id = PQntuples(res) > 0 ? int_at(res, 0, 0) : 0;
+    PQclear(res);
+    return true;
+}
+
+bool Database::set_notifications_read(long long user_id, long long read_id, std::string &err) {
+    size_t shard = pimpl->user_shard(user_id);
+    Lease c = pimpl->write(shard, err);
+    if (!c) return false;
+    IntText s_user(user_id);
+    IntText s_read(read_id);
+    const char *paramValues[2] = { s_user.c_str(), s_read.c_str() };
+    // no ON CONFLICT on some forks: update, else insert; the watermark only moves forward
+    PGresult *res = PQexecParams(c,
+        "WITH u AS (UPDATE notification_reads SET read_id=GREATEST(read_id,$2::bigint) WHERE user_id=$1::bigint RETURNING 1) "
+        "INSERT INTO notification_reads(user_id,read_id) SELECT $1::bigint,$2::bigint WHERE NOT EXISTS (SELECT 1 FROM u);",
+        2, nullptr, paramValues, nullptr, nullptr, 0);
+    if (!res) { err = "no result"; return false; }
+    if (PQresultStatus(res) != PGRES_COMMAND_OK) { err = PQresultErrorMessage(res); PQclear(res); return false; }
     PQclear(res);
-    json result;
-    result["ok"] = true;
-    result["data"] = out;
-    json_out = result.dump();
     return true;
 }
+
+// "I likes 123 456 789 3": op, table, id, a, b, writing node ('-' if unset),
+// as built by yuyu_notify_change() in db/schema.sql. yuyu_bulk sends
+// "R - 0 0 0 -" after loading rows with the triggers off.
+static bool parse_change(const char *payload, YUYU::RowChange &c) {
+    char op = 0, table[16], node[16];
+    long long id = 0, a = 0, b = 0;
+    if (std::sscanf(payload, "%c %15s %lld %lld %lld %15s", &op, table, &id, &a, &b, node) != 6) return false;
+    if (op == 'R') {
+        c = YUYU::RowChange();
+        return true;
+    }
+    switch (op) {
+    case 'I': c.op = YUYU::RowChange::Insert; break;
+    case 'U': c.op = YUYU::RowChange::Update; break;
+    case 'D': c.op = YUYU::RowChange::Delete; break;
+    default: return false;
+    }
+    static const struct { const char *name; YUYU::RowChange::Table table; } tables[] = {
+        {"weibos", YUYU::RowChange::Weibos}, {"likes", YUYU::RowChange::Likes},
+        {"comments", YUYU::RowChange::Comments}, {"follows", YUYU::RowChange::Follows},
+        {"users", YUYU::RowChange::Users},
+    };
+    c.table = YUYU::RowChange::None;
+    for (const auto &t : tables)
+        if (std::strcmp(table, t.name) == 0) c.table = t.table;
+    if (c.table == YUYU::RowChange::None) return false;
+    c.id = id;
+    c.a = a;
+    c.b = b;
+    c.node = node[0] == '-' ? -1 : std::atoi(node);
+    return true;
+}
+
+static PGconn *open_listener(const std::string &conninfo, std::string &err) {
+    PGconn *c = PQconnectdb(conninfo.c_str());
+    if (PQstatus(c) == CONNECTION_OK) {
+        PGresult *r = PQexec(c, "LISTEN yuyu_changes;");
+        bool ok = r && PQresultStatus(r) == PGRES_COMMAND_OK;
+        if (!ok) err = r ? PQresultErrorMessage(r) : PQerrorMessage(c);
+        PQclear(r);
+        if (ok) return c;
+    } else {
+        err = PQerrorMessage(c);
+    }
+    PQfinish(c);
+    return nullptr;
+}
+
+bool Database::watch_changes(const std::function<void(const YUYU::RowChange &)> &fn, std::string &err) {
+    if (pimpl->listener.joinable()) {
+        err = "already watching";
+        return false;
+    }
+    std::vector<PGconn *> conns;
+    for (const auto &sh : pimpl->shards) {
+        PGconn *c = open_listener(sh->primary->conninfo, err);
+        if (!c) {
+            for (PGconn *o : conns) PQfinish(o);
+            return false;
+        }
+        conns.push_back(c);
+    }
+    pimpl->on_change = fn;
+    pimpl->listener = std::thread([m = pimpl, conns] { m->listen_loop(conns); });
+    return true;
+}
+
+void Database::Impl::listen_loop(std::vector<PGconn *> initial) {
+    using YUYU::RowChange;
+    struct Conn {
+        PGconn *c = nullptr;
+        Clock::time_point retry;
+    };
+    std::vector<Conn> conns(initial.size());
+    for (size_t k = 0; k < initial.size(); ++k) conns[k].c = initial[k];
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lk(check_mu);
+            if (stopping) break;
+        }
+        auto now = Clock::now();
+        bool reopened = false;
+        for (size_t k = 0; k < conns.size(); ++k) {
+            if (conns[k].c || now < conns[k].retry) continue;
+            std::string why;
+            conns[k].c = open_listener(shards[k]->primary->conninfo, why);
+            if (conns[k].c) {
+                reopened = true;
+            } else {
+                std::fprintf(stderr, "change listener on shard %zu: %s\n", k, why.c_str());
+                conns[k].retry = now + std::chrono::seconds(1);
+            }
+        }
+        // whatever committed while a listener was down is lost: start over
+        if (reopened) {
+            profiles->clear();
+            on_change(RowChange());
+        }
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        int maxfd = -1;
+        for (const Conn &cn : conns) {
+            if (!cn.c) continue;
+            int sock = PQsocket(cn.c);
+            if (sock < 0) continue;
+#ifdef _WIN32
+            FD_SET(static_cast<SOCKET>(sock), &fds);
+#else
+            FD_SET(sock, &fds);
+#endif
+            maxfd = std::max(maxfd, sock);
+        }
+        if (maxfd < 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            continue;
+        }
+        timeval tv{0, 500000};
+        select(maxfd + 1, &fds, nullptr, nullptr, &tv);
+
+        for (size_t k = 0; k < conns.size(); ++k) {
+            PGconn *c = conns[k].c;
+            if (!c) continue;
+            if (!PQconsumeInput(c) || PQstatus(c) != CONNECTION_OK) {
+                PQfinish(c);
+                conns[k].c = nullptr;
+                conns[k].retry = Clock::now() + std::chrono::seconds(1);
+                continue;
+            }
+            while (PGnotify *n = PQnotifies(c)) {
+                RowChange ch;
+                bool ok = parse_change(n->extra, ch);
+                PQfreemem(n);
+                if (!ok) continue;
+                ch.shard = k;
+                // our own writes were applied when they were made
+                if (ch.node == static_cast<int>(opt.node_id)) continue;
+                if (ch.op == RowChange::Resync) {
+                    profiles->clear();
+                } else if (ch.table == RowChange::Users) {
+                    // every shard's copy is updated; shard 0 speaks for them
+                    if (k != 0) continue;
+                    profiles->invalidate(ch.id);
+                }
+                on_change(ch);
+            }
+        }
+    }
+    for (Conn &cn : conns)
+        if (cn.c) PQfinish(cn.c);
+}
@@ -0,0 +1,92 @@
+#include "event_hub.h"
+#include <iterator>
+
+namespace YUYU {
+
+EventHub::Subscription::Status EventHub::Subscription::wait(std::vector<Event> &out, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lk(mu);
+    cv.wait_for(lk, timeout, [this] { return !queue.empty() || overflow || closed; });
+    if (overflow) return Overflow;
+    if (closed) return Closed;
+    if (queue.empty()) return Timeout;
+    out.insert(out.end(), std::make_move_iterator(queue.begin()), std::make_move_iterator(queue.end()));
+    queue.clear();
+    return Ready;
+}
+
+EventHub::EventHub() : EventHub(Options()) {}
+
+EventHub::EventHub(const Options &opt) : opt_(opt) {}
+
+EventHub::~EventHub() { close_all(); }
+
+std::shared_ptr<EventHub::Subscription> EventHub::subscribe(uint64_t last_event_id) {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (subs_.size() >= opt_.max_subscribers) return nullptr;
+    auto sub = std::make_shared<Subscription>();
+    if (last_event_id > 0) {
+        uint64_t oldest = history_.empty() ? next_id_ : history_.front().id;
+        // ids restart with the process, so an id from the future also means "lost"
+        if (last_event_id + 1 < oldest || last_event_id >= next_id_) {
+            sub->overflow = true;
+        } else {
+            for (auto &e : history_) {
+                if (e.id > last_event_id) sub->queue.push_back(e);
+            }
+            if (sub->queue.size() > opt_.queue_capacity) { sub->queue.clear(); sub->overflow = true; }
+        }
+    }
+    subs_.push_back(sub);
+    return sub;
+}
+
+void EventHub::unsubscribe(const std::shared_ptr<Subscription> &sub) {
+    std::lock_guard<std::mutex> lk(mu_);
+    subs_.remove(sub);
+}
+
+uint64_t EventHub::publish(const std::string &type, const std::string &data) {
+    std::unique_lock<std::mutex> lk(mu_);
+    Event e{next_id_++, type, data};
+    history_.push_back(e);
+    if (history_.size() > opt_.history) history_.pop_front();
+    for (auto it = subs_.begin(); it != subs_.end();) {
+        auto &sub = *it;
+        bool dropped = false;
+        {
+            std::lock_guard<std::mutex> slk(sub->mu);
+            if (sub->queue.size() >= opt_.queue_capacity) {
+                // too far behind: free its backlog and let the client resync
+                sub->queue.clear();
+                sub->overflow = true;
+                dropped = true;
+            } else {
+                sub->queue.push_back(e);
+            }
+        }
+        sub->cv.notify_one();
+        if (dropped) it = subs_.erase(it); else ++it;
+    }
+    lk.unlock();
+    if (on_publish_) on_publish_();
+    return e.id;
+}
+
+void EventHub::close_all() {
+    std::lock_guard<std::mutex> lk(mu_);
+    for (auto &sub : subs_) {
+        {
+            std::lock_guard<std::mutex> slk(sub->mu);
+            sub->closed = true;
+        }
+        sub->cv.notify_all();
+    }
+    subs_.clear();
+}
+
+size_t EventHub::subscriber_count() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return subs_.size();
+}
+
+} // namespace YUYU
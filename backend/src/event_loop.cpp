@@ -0,0 +1,860 @@
+#include "event_loop.h"
+#include "mapped_file.h"
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+namespace YUYU {
+
+namespace {
+thread_local std::shared_ptr<const MappedFile> t_zero_copy;
+}
+
+ZeroCopyScope::ZeroCopyScope(std::shared_ptr<const MappedFile> file) : prev_(std::move(t_zero_copy)) {
+    t_zero_copy = std::move(file);
+}
+
+ZeroCopyScope::~ZeroCopyScope() { t_zero_copy = std::move(prev_); }
+
+const MappedFile *ZeroCopyScope::current() { return t_zero_copy.get(); }
+
+std::shared_ptr<const MappedFile> ZeroCopyScope::current_shared() { return t_zero_copy; }
+
+#ifdef __linux__
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+bool iequals_prefix(const std::string &s, size_t pos, const char *name) {
+    size_t n = std::strlen(name);
+    if (pos + n > s.size()) return false;
+    for (size_t i = 0; i < n; ++i) {
+        char c = s[pos + i];
+        if (c >= 'A' && c <= 'Z') c = static_cast<char>(c + 32);
+        if (c != name[i]) return false;
+    }
+    return true;
+}
+
+std::string header_value(const std::string &s, size_t begin, size_t end) {
+    while (begin < end && (s[begin] == ' ' || s[begin] == '\t')) ++begin;
+    while (end > begin && (s[end - 1] == ' ' || s[end - 1] == '\t')) --end;
+    return s.substr(begin, end - begin);
+}
+
+// How far request_length() got through the start of a connection's input,
+// so a request arriving over many reads is scanned once instead of from the
+// beginning on every read. Reset whenever the buffered bytes before `pos`
+// change.
+struct RequestScan {
+    size_t searched = 0;        // header terminator not before this offset
+    size_t header_end = 0;      // 0 until the header block is complete
+    unsigned long long content_length = 0;
+    bool chunked = false;
+    bool trailer = false;       // past the last chunk
+    size_t pos = 0;             // next chunk-size or trailer line
+};
+
+// Length of the first complete request in `buf`: 0 if more bytes are needed,
+// -1 if it is malformed or over the limits. `st.header_end` is set once the
+// header block is complete.
+long request_length(const std::string &buf, size_t max_header, size_t max_total, RequestScan &st) {
+    if (!st.header_end) {
+        size_t hdr = buf.find("\r\n\r\n", st.searched);
+        if (hdr == std::string::npos) {
+            st.searched = buf.size() > 3 ? buf.size() - 3 : 0;
+            return buf.size() > max_header ? -1 : 0;
+        }
+        if (hdr + 4 > max_header) return -1;
+
+        size_t line = buf.find("\r\n") + 2;
+        while (line < hdr + 2) {
+            size_t eol = buf.find("\r\n", line);
+            size_t colon = buf.find(':', line);
+            if (colon != std::string::npos && colon < eol) {
+                if (iequals_prefix(buf, line, "content-length:")) {
+                    std::string v = header_value(buf, colon + 1, eol);
+                    char *endp = nullptr;
+                    st.content_length = std::strtoull(v.c_str(), &endp, 10);
+                    if (v.empty() || *endp) return -1;
+                } else if (iequals_prefix(buf, line, "transfer-encoding:")) {
+                    st.chunked = header_value(buf, colon + 1, eol).find("chunked") != std::string::npos;
+                }
+            }
+            line = eol + 2;
+        }
+        st.header_end = hdr + 4;
+        st.pos = st.header_end;
+    }
+
+    if (!st.chunked) {
+        if (st.content_length > max_total) return -1;
+        size_t total = st.header_end + static_cast<size_t>(st.content_length);
+        return buf.size() >= total ? static_cast<long>(total) : 0;
+    }
+    // walk the chunk framing up to the terminating empty trailer line,
+    // resuming at the first chunk not yet complete
+    for (;;) {
+        if (st.pos > max_total) return -1;
+        size_t eol = buf.find("\r\n", st.pos);
+        if (eol == std::string::npos) return 0;
+        if (st.trailer) {
+            if (eol == st.pos) return static_cast<long>(st.pos + 2);
+            st.pos = eol + 2;
+            continue;
+        }
+        char *endp = nullptr;
+        unsigned long long size = std::strtoull(buf.c_str() + st.pos, &endp, 16);
+        if (endp == buf.c_str() + st.pos) return -1;
+        if (size == 0) {
+            st.trailer = true;
+            st.pos = eol + 2;
+            continue;
+        }
+        if (size > max_total) return -1;
+        if (buf.size() < eol + 2 + size + 2) return 0;
+        st.pos = eol + 2 + static_cast<size_t>(size) + 2;
+    }
+}
+
+// Removes an "Expect: 100-continue" header from the buffered request; the
+// front end answers it itself before the body has arrived.
+bool strip_expect(std::string &buf, size_t header_end) {
+    size_t line = buf.find("\r\n") + 2;
+    while (line < header_end - 2) {
+        size_t eol = buf.find("\r\n", line);
+        if (iequals_prefix(buf, line, "expect:")) {
+            buf.erase(line, eol + 2 - line);
+            return true;
+        }
+        line = eol + 2;
+    }
+    return false;
+}
+
+void addr_to_string(const sockaddr_storage &ss, std::string &ip, int &port) {
+    char host[INET6_ADDRSTRLEN] = {0};
+    if (ss.ss_family == AF_INET) {
+        auto *a = reinterpret_cast<const sockaddr_in *>(&ss);
+        inet_ntop(AF_INET, &a->sin_addr, host, sizeof(host));
+        port = ntohs(a->sin_port);
+    } else if (ss.ss_family == AF_INET6) {
+        auto *a = reinterpret_cast<const sockaddr_in6 *>(&ss);
+        inet_ntop(AF_INET6, &a->sin6_addr, host, sizeof(host));
+        port = ntohs(a->sin6_port);
+    }
+    ip = host;
+}
+
+} // namespace
+
+struct Loop;
+
+// Pending output: copied bytes (sent from `off`), or `len` bytes of a mapped
+// file starting at `off`, sent with sendfile().
+struct OutSeg {
+    std::string bytes;
+    std::shared_ptr<const MappedFile> file;
+    size_t off = 0, len = 0;
+};
+
+struct Conn {
+    int fd = -1;
+    Loop *loop = nullptr;
+    std::string remote_ip, local_ip;
+    int remote_port = 0, local_port = 0;
+
+    // reactor thread only
+    std::string in;
+    RequestScan scan;           // progress through the request at the front of `in`
+    bool busy = false;          // a request is with the compute pool
+    bool closing = false;       // close once output has drained
+    bool peer_closed = false;
+    Clock::time_point last_active;
+
+    // shared with the compute thread
+    std::mutex mu;
+    std::condition_variable drained;
+    std::deque<OutSeg> out;
+    size_t out_bytes = 0;       // copied bytes in `out`; file regions hold no memory
+    bool dead = false;
+    bool queued = false;        // already on the loop's ready list
+    bool finished = false;
+    bool close_after = false;
+    int holders = 0;            // the compute task, plus a detached body until close()
+    bool detached = false;      // the body comes from a DetachedResponse
+
+    // callers hold mu; the request is over once nobody holds it
+    bool release() {
+        if (--holders > 0) return false;
+        detached = false;
+        finished = true;
+        return true;
+    }
+
+    // callers hold mu
+    void push_bytes(const char *p, size_t n) {
+        if (out.empty() || out.back().file) out.emplace_back();
+        out.back().bytes.append(p, n);
+        out_bytes += n;
+    }
+    void push_bytes(const std::string &s) { push_bytes(s.data(), s.size()); }
+    void push_file(std::shared_ptr<const MappedFile> f, size_t off, size_t len) {
+        if (!out.empty() && out.back().file == f && out.back().off + out.back().len == off) {
+            out.back().len += len;
+            return;
+        }
+        out.emplace_back();
+        out.back().file = std::move(f);
+        out.back().off = off;
+        out.back().len = len;
+    }
+};
+
+// State the reactors share with the server object.
+struct Shared {
+    DispatchServer &svr;
+    EventLoopServer::Options opt;
+    std::unique_ptr<httplib::TaskQueue> pool;
+    std::atomic<bool> stopping{false};
+
+    Shared(DispatchServer &s, const EventLoopServer::Options &o) : svr(s), opt(o) {}
+};
+
+struct Loop {
+    Shared *owner = nullptr;
+    int epfd = -1, lfd = -1, wakefd = -1;
+    // A descriptor held in reserve: out of descriptors, accept_all() gives
+    // it up to take pending connections off the backlog and close them.
+    int spare = -1;
+    // Connections may be left pending with no edge to come; accept_all()
+    // runs again on every pass of the loop until the backlog is empty.
+    bool accept_again = false;
+    std::thread th;
+    std::unordered_map<int, std::shared_ptr<Conn>> conns;
+    std::mutex ready_mu;
+    std::vector<std::shared_ptr<Conn>> ready;
+
+    void wake(const std::shared_ptr<Conn> &c) {
+        {
+            std::lock_guard<std::mutex> lk(ready_mu);
+            ready.push_back(c);
+        }
+        uint64_t one = 1;
+        ssize_t r = ::write(wakefd, &one, sizeof(one));
+        (void)r;
+    }
+
+    void run();
+    void accept_all();
+    void on_readable(const std::shared_ptr<Conn> &c);
+    void on_ready(const std::shared_ptr<Conn> &c);
+    void flush(const std::shared_ptr<Conn> &c);
+    void try_dispatch(const std::shared_ptr<Conn> &c);
+    void respond_and_close(const std::shared_ptr<Conn> &c, const char *status_line);
+    void close_conn(const std::shared_ptr<Conn> &c);
+    void sweep();
+    void teardown();
+};
+
+namespace {
+
+// httplib::Stream over one buffered request; the response goes into the
+// connection's output buffer and is flushed by its reactor.
+class ConnStream final : public httplib::Stream {
+public:
+    ConnStream(std::shared_ptr<Conn> c, std::string req, const EventLoopServer::Options &opt)
+        : c_(std::move(c)), req_(std::move(req)), opt_(opt), started_(Clock::now()) {}
+
+    bool is_readable() const override { return pos_ < req_.size(); }
+    bool wait_readable() const override { return true; }
+    bool wait_writable() const override {
+        std::lock_guard<std::mutex> lk(c_->mu);
+        return !c_->dead;
+    }
+
+    ssize_t read(char *ptr, size_t size) override {
+        size_t n = std::min(size, req_.size() - pos_);
+        std::memcpy(ptr, req_.data() + pos_, n);
+        pos_ += n;
+        return static_cast<ssize_t>(n);
+    }
+
+    ssize_t write(const char *ptr, size_t size) override {
+        const MappedFile *f = ZeroCopyScope::current();
+        bool mapped = f && f->fd() >= 0 && ptr >= f->data() && size <= f->size() &&
+                      static_cast<size_t>(ptr - f->data()) <= f->size() - size;
+        std::unique_lock<std::mutex> lk(c_->mu);
+        if (!mapped && c_->out_bytes && c_->out_bytes >= opt_.max_pending_output) {
+            // slow reader: block this handler (not the reactor) for a bounded time
+            if (!c_->drained.wait_for(lk, std::chrono::seconds(opt_.write_timeout_sec),
+                    [this] { return c_->dead || c_->out_bytes < opt_.max_pending_output; })) {
+                return -1;
+            }
+        }
+        if (c_->dead) return -1;
+        // whatever httplib still writes for a detached response is dropped
+        if (c_->detached) return static_cast<ssize_t>(size);
+        if (mapped) c_->push_file(ZeroCopyScope::current_shared(), static_cast<size_t>(ptr - f->data()), size);
+        else c_->push_bytes(ptr, size);
+        bool need = !c_->queued;
+        c_->queued = true;
+        lk.unlock();
+        if (need) c_->loop->wake(c_);
+        return static_cast<ssize_t>(size);
+    }
+
+    void get_remote_ip_and_port(std::string &ip, int &port) const override { ip = c_->remote_ip; port = c_->remote_port; }
+    void get_local_ip_and_port(std::string &ip, int &port) const override { ip = c_->local_ip; port = c_->local_port; }
+    socket_t socket() const override { return c_->fd; }
+    time_t duration() const override {
+        return static_cast<time_t>(std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - started_).count());
+    }
+
+private:
+    std::shared_ptr<Conn> c_;
+    std::string req_;
+    size_t pos_ = 0;
+    const EventLoopServer::Options &opt_;
+    Clock::time_point started_;
+};
+
+// The connection whose request this compute thread is running, for detach().
+thread_local const std::shared_ptr<Conn> *t_conn = nullptr;
+
+// Chunk framing for DetachedResponse bodies.
+std::string chunk(const std::string &data) {
+    char size[20];
+    std::snprintf(size, sizeof(size), "%zx\r\n", data.size());
+    return size + data + "\r\n";
+}
+
+} // namespace
+
+// Marks an unattached response dead when httplib drops its provider
+// without calling it (HEAD, or an error handler replaced the response).
+struct DetachedResponse::Guard {
+    std::shared_ptr<DetachedResponse> d;
+    ~Guard() {
+        std::lock_guard<std::mutex> lk(d->conn_->mu);
+        if (!d->attached_) d->ended_ = true;
+    }
+};
+
+DetachedResponse::DetachedResponse(std::shared_ptr<Conn> conn) : conn_(std::move(conn)) {}
+
+std::shared_ptr<DetachedResponse> DetachedResponse::detach(httplib::Response &res, const char *content_type) {
+    if (!t_conn) return nullptr;
+    std::shared_ptr<DetachedResponse> d(new DetachedResponse(*t_conn));
+    auto guard = std::make_shared<Guard>();
+    guard->d = d;
+    res.set_chunked_content_provider(content_type,
+        [guard](size_t, httplib::DataSink &sink) { return guard->d->attach(sink); });
+    return d;
+}
+
+// Runs as the provider, right after httplib has queued the headers.
+bool DetachedResponse::attach(httplib::DataSink &sink) {
+    std::unique_lock<std::mutex> lk(conn_->mu);
+    if (ended_) {
+        // closed before the headers went out: finish it as a plain response
+        std::string body;
+        body.swap(early_);
+        lk.unlock();
+        if (!body.empty() && !sink.write(body.data(), body.size())) return false;
+        sink.done();
+        return true;
+    }
+    attached_ = true;
+    conn_->detached = true;
+    ++conn_->holders;
+    if (!early_.empty()) {
+        conn_->push_bytes(chunk(early_));
+        early_.clear();
+        wake_locked();
+    }
+    // httplib stops here; the rest of the body comes from write()
+    return false;
+}
+
+// The reactor may be gone once the server has stopped; the connection is
+// dead by then and nothing is woken.
+void DetachedResponse::wake_locked() {
+    if (conn_->queued || !conn_->loop) return;
+    conn_->queued = true;
+    conn_->loop->wake(conn_);
+}
+
+bool DetachedResponse::write(const std::string &data) {
+    if (data.empty()) return alive();
+    std::lock_guard<std::mutex> lk(conn_->mu);
+    if (ended_ || conn_->dead || !conn_->loop) return false;
+    const size_t limit = conn_->loop->owner->opt.max_pending_output;
+    if (!attached_) {
+        if (early_.size() + data.size() > limit) return false;
+        early_ += data;
+        return true;
+    }
+    if (conn_->out_bytes >= limit) {
+        // too far behind: drop the connection rather than block or buffer
+        conn_->dead = true;
+    } else {
+        conn_->push_bytes(chunk(data));
+    }
+    wake_locked();
+    return !conn_->dead;
+}
+
+void DetachedResponse::close() {
+    std::lock_guard<std::mutex> lk(conn_->mu);
+    if (ended_) return;
+    ended_ = true;
+    if (!attached_) return;
+    if (!conn_->dead) conn_->push_bytes("0\r\n\r\n");
+    conn_->release();
+    wake_locked();
+}
+
+bool DetachedResponse::alive() const {
+    std::lock_guard<std::mutex> lk(conn_->mu);
+    return !ended_ && !conn_->dead;
+}
+
+void Loop::run() {
+    epoll_event evs[256];
+    auto last_sweep = Clock::now();
+    while (!owner->stopping.load()) {
+        int n = epoll_wait(epfd, evs, 256, accept_again ? 100 : 1000);
+        if (n < 0 && errno != EINTR) break;
+        for (int i = 0; i < n; ++i) {
+            int fd = evs[i].data.fd;
+            if (fd == lfd) { accept_all(); continue; }
+            if (fd == wakefd) {
+                uint64_t v;
+                while (::read(wakefd, &v, sizeof(v)) > 0) {}
+                std::vector<std::shared_ptr<Conn>> batch;
+                {
+                    std::lock_guard<std::mutex> lk(ready_mu);
+                    batch.swap(ready);
+                }
+                for (auto &c : batch) on_ready(c);
+                continue;
+            }
+            auto it = conns.find(fd);
+            if (it == conns.end()) continue;
+            auto c = it->second;
+            if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) on_readable(c);
+            if ((evs[i].events & EPOLLOUT) && c->fd >= 0) flush(c);
+        }
+        if (accept_again) accept_all();
+        if (Clock::now() - last_sweep >= std::chrono::seconds(1)) {
+            sweep();
+            last_sweep = Clock::now();
+        }
+    }
+}
+
+void Loop::accept_all() {
+    accept_again = false;
+    for (;;) {
+        sockaddr_storage ss;
+        socklen_t len = sizeof(ss);
+        int fd = accept4(lfd, reinterpret_cast<sockaddr *>(&ss), &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EMFILE && errno != ENFILE) return;   // EAGAIN: the backlog is empty
+            // Under EPOLLET the connections still pending would not raise
+            // another edge. Refuse them through the spare descriptor; once
+            // it is gone too, keep retrying from run() until fds free up.
+            if (spare < 0) spare = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (spare < 0) {
+                accept_again = true;
+                return;
+            }
+            ::close(spare);
+            spare = -1;
+            int drop = accept4(lfd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (drop >= 0) ::close(drop);
+            spare = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            if (drop < 0 && errno != EMFILE && errno != ENFILE) return;
+            continue;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        auto c = std::make_shared<Conn>();
+        c->fd = fd;
+        c->loop = this;
+        c->last_active = Clock::now();
+        addr_to_string(ss, c->remote_ip, c->remote_port);
+        sockaddr_storage ls;
+        socklen_t llen = sizeof(ls);
+        if (getsockname(fd, reinterpret_cast<sockaddr *>(&ls), &llen) == 0) addr_to_string(ls, c->local_ip, c->local_port);
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) { ::close(fd); continue; }
+        conns.emplace(fd, c);
+    }
+}
+
+void Loop::on_readable(const std::shared_ptr<Conn> &c) {
+    char buf[16 * 1024];
+    for (;;) {
+        ssize_t n = ::recv(c->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            c->in.append(buf, static_cast<size_t>(n));
+            if (c->in.size() > owner->opt.max_request_bytes + owner->opt.max_header_bytes) {
+                respond_and_close(c, "HTTP/1.1 413 Payload Too Large");
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        c->peer_closed = true; // EOF or error
+        break;
+    }
+    c->last_active = Clock::now();
+    try_dispatch(c);
+    if (c->peer_closed) {
+        bool detached;
+        {
+            std::lock_guard<std::mutex> lk(c->mu);
+            detached = c->detached;
+        }
+        // a detached body's owner learns from write() that nobody is listening
+        if (!c->busy || detached) close_conn(c);
+    }
+}
+
+void Loop::on_ready(const std::shared_ptr<Conn> &c) {
+    if (c->fd < 0) return;
+    bool fin, close_after;
+    {
+        std::lock_guard<std::mutex> lk(c->mu);
+        c->queued = false;
+        fin = c->finished;
+        close_after = c->close_after;
+        c->finished = false;
+    }
+    if (fin) {
+        c->busy = false;
+        c->last_active = Clock::now();
+        if (close_after || c->peer_closed) c->closing = true;
+    }
+    flush(c);
+    if (c->fd >= 0 && fin && !c->closing) try_dispatch(c);
+}
+
+void Loop::flush(const std::shared_ptr<Conn> &c) {
+    bool dead, empty;
+    {
+        std::lock_guard<std::mutex> lk(c->mu);
+        while (!c->out.empty()) {
+            OutSeg &seg = c->out.front();
+            ssize_t n;
+            if (seg.file) {
+                off_t pos = static_cast<off_t>(seg.off);
+                n = ::sendfile(c->fd, seg.file->fd(), &pos, std::min<size_t>(seg.len, 1u << 30));
+                if (n == 0) { // the file shrank under us
+                    c->dead = true;
+                    break;
+                }
+            } else {
+                n = ::send(c->fd, seg.bytes.data() + seg.off, seg.bytes.size() - seg.off, MSG_NOSIGNAL);
+            }
+            if (n > 0) {
+                size_t sent = static_cast<size_t>(n);
+                seg.off += sent;
+                if (seg.file) {
+                    seg.len -= sent;
+                    if (!seg.len) c->out.pop_front();
+                } else {
+                    c->out_bytes -= sent;
+                    if (seg.off == seg.bytes.size()) c->out.pop_front();
+                }
+                continue;
+            }
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+            c->dead = true;
+            break;
+        }
+        dead = c->dead;
+        empty = c->out.empty();
+    }
+    c->drained.notify_all();
+    if (dead || (empty && c->closing && !c->busy)) close_conn(c);
+}
+
+void Loop::try_dispatch(const std::shared_ptr<Conn> &c) {
+    if (c->busy || c->closing || c->fd < 0) return;
+    const auto &opt = owner->opt;
+    long n = request_length(c->in, opt.max_header_bytes, opt.max_request_bytes, c->scan);
+    size_t header_end = c->scan.header_end;
+    if (header_end && strip_expect(c->in, header_end)) {
+        c->scan = RequestScan();
+        n = request_length(c->in, opt.max_header_bytes, opt.max_request_bytes, c->scan);
+        if (n == 0) {
+            {
+                std::lock_guard<std::mutex> lk(c->mu);
+                c->push_bytes("HTTP/1.1 100 Continue\r\n\r\n");
+            }
+            flush(c);
+        }
+    }
+    if (n < 0) { respond_and_close(c, header_end ? "HTTP/1.1 413 Payload Too Large" : "HTTP/1.1 400 Bad Request"); return; }
+    if (n == 0) return;
+
+    std::string req = c->in.substr(0, static_cast<size_t>(n));
+    c->in.erase(0, static_cast<size_t>(n));
+    c->scan = RequestScan();
+    c->busy = true;
+    {
+        std::lock_guard<std::mutex> lk(c->mu);
+        c->holders = 1;
+    }
+    Shared *o = owner;
+    bool queued = o->pool->enqueue([o, c, req]() {
+        ConnStream strm(c, req, o->opt);
+        bool closed = false;
+        t_conn = &c;
+        o->svr.dispatch(strm, c->remote_ip, c->remote_port, c->local_ip, c->local_port, closed);
+        t_conn = nullptr;
+        bool need;
+        {
+            std::lock_guard<std::mutex> lk(c->mu);
+            c->close_after = closed;
+            need = c->release() && !c->queued;
+            if (need) c->queued = true;
+        }
+        if (need) c->loop->wake(c);
+    });
+    if (!queued) {
+        c->busy = false;
+        respond_and_close(c, "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1");
+    }
+}
+
+void Loop::respond_and_close(const std::shared_ptr<Conn> &c, const char *status_line) {
+    {
+        std::lock_guard<std::mutex> lk(c->mu);
+        c->push_bytes(std::string(status_line) + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+    }
+    c->in.clear();
+    c->scan = RequestScan();
+    c->closing = true;
+    flush(c);
+}
+
+void Loop::close_conn(const std::shared_ptr<Conn> &c) {
+    if (c->fd < 0) return;
+    {
+        std::lock_guard<std::mutex> lk(c->mu);
+        c->dead = true;
+    }
+    c->drained.notify_all();
+    if (c->busy) {
+        // the handler still refers to the descriptor; finish closing afterwards
+        ::shutdown(c->fd, SHUT_RDWR);
+        c->closing = true;
+        return;
+    }
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, nullptr);
+    ::close(c->fd);
+    conns.erase(c->fd);
+    c->fd = -1;
+}
+
+void Loop::sweep() {
+    auto now = Clock::now();
+    auto idle = std::chrono::seconds(owner->opt.idle_timeout_sec);
+    std::vector<std::shared_ptr<Conn>> expired;
+    for (auto &kv : conns) {
+        auto &c = kv.second;
+        if (c->busy || now - c->last_active < idle) continue;
+        std::lock_guard<std::mutex> lk(c->mu);
+        if (c->out.empty()) expired.push_back(c);
+    }
+    for (auto &c : expired) close_conn(c);
+}
+
+void Loop::teardown() {
+    std::vector<std::shared_ptr<Conn>> all;
+    for (auto &kv : conns) all.push_back(kv.second);
+    for (auto &c : all) {
+        c->busy = false;
+        close_conn(c);
+        // detached responses may outlive the reactor
+        std::lock_guard<std::mutex> lk(c->mu);
+        c->loop = nullptr;
+    }
+    if (lfd >= 0) ::close(lfd);
+    if (epfd >= 0) ::close(epfd);
+    if (wakefd >= 0) ::close(wakefd);
+    if (spare >= 0) ::close(spare);
+    lfd = epfd = wakefd = spare = -1;
+}
+
+static int open_listener(const std::string &host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *res = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        // one listener per reactor; the kernel spreads new connections across them
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+        if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0) break;
+        ::close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+struct EventLoopServer::Impl : Shared {
+    std::vector<std::unique_ptr<Loop>> loops;
+    std::mutex stop_mu;
+    std::condition_variable stop_cv;
+
+    Impl(DispatchServer &s, const Options &o) : Shared(s, o) {}
+};
+
+EventLoopServer::EventLoopServer(DispatchServer &svr, const Options &opt) : pimpl(new Impl(svr, opt)) {}
+
+EventLoopServer::~EventLoopServer() {
+    stop();
+    delete pimpl;
+}
+
+bool EventLoopServer::supported() { return true; }
+
+bool EventLoopServer::listen(const std::string &host, int port) {
+    Impl &m = *pimpl;
+    int count = m.opt.loops > 0 ? m.opt.loops : static_cast<int>(std::thread::hardware_concurrency());
+    if (count <= 0) count = 1;
+
+    for (int i = 0; i < count; ++i) {
+        auto loop = std::make_unique<Loop>();
+        loop->owner = pimpl;
+        loop->lfd = open_listener(host, port);
+        loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+        loop->wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        loop->spare = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (loop->lfd < 0 || loop->epfd < 0 || loop->wakefd < 0) {
+            std::cerr << "event loop: cannot listen on " << host << ":" << port << ": " << std::strerror(errno) << "\n";
+            loop->teardown();
+            for (auto &l : m.loops) l->teardown();
+            m.loops.clear();
+            return false;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = loop->lfd;
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->lfd, &ev);
+        ev.events = EPOLLIN;
+        ev.data.fd = loop->wakefd;
+        epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev);
+        m.loops.push_back(std::move(loop));
+    }
+
+    m.pool.reset(m.svr.new_task_queue());
+    m.svr.set_listening(m.loops.front()->lfd);
+    m.stopping = false;
+    for (auto &l : m.loops) {
+        Loop *lp = l.get();
+        l->th = std::thread([lp] { lp->run(); });
+    }
+
+    {
+        std::unique_lock<std::mutex> lk(m.stop_mu);
+        m.stop_cv.wait(lk, [&m] { return m.stopping.load(); });
+    }
+    m.svr.set_listening(INVALID_SOCKET);
+    for (auto &l : m.loops) {
+        uint64_t one = 1;
+        ssize_t r = ::write(l->wakefd, &one, sizeof(one));
+        (void)r;
+        if (l->th.joinable()) l->th.join();
+    }
+    // Handlers still running write into connections marked dead and return;
+    // drain them before the descriptors go away.
+    for (auto &l : m.loops) {
+        for (auto &kv : l->conns) {
+            std::lock_guard<std::mutex> lk(kv.second->mu);
+            kv.second->dead = true;
+            kv.second->drained.notify_all();
+        }
+    }
+    m.pool->shutdown();
+    m.pool.reset();
+    for (auto &l : m.loops) l->teardown();
+    m.loops.clear();
+    return true;
+}
+
+void EventLoopServer::stop() {
+    {
+        std::lock_guard<std::mutex> lk(pimpl->stop_mu);
+        pimpl->stopping = true;
+    }
+    pimpl->stop_cv.notify_all();
+}
+
+#else
+
+struct DetachedResponse::Guard {};
+
+DetachedResponse::DetachedResponse(std::shared_ptr<Conn> conn) : conn_(std::move(conn)) {}
+std::shared_ptr<DetachedResponse> DetachedResponse::detach(httplib::Response &, const char *) { return nullptr; }
+bool DetachedResponse::attach(httplib::DataSink &) { return false; }
+void DetachedResponse::wake_locked() {}
+bool DetachedResponse::write(const std::string &) { return false; }
+void DetachedResponse::close() {}
+bool DetachedResponse::alive() const { return false; }
+
+struct EventLoopServer::Impl {};
+
+EventLoopServer::EventLoopServer(DispatchServer &, const Options &) : pimpl(new Impl()) {}
+EventLoopServer::~EventLoopServer() { delete pimpl; }
+bool EventLoopServer::supported() { return false; }
+bool EventLoopServer::listen(const std::string &, int) { return false; }
+void EventLoopServer::stop() {}
+
+#endif
+
+} // namespace YUYU
@@ -0,0 +1,234 @@
+#include "executor.h"
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <cstring>
+#elif defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#endif
+
+namespace YUYU {
+
+namespace {
+
+thread_local WorkStealingExecutor *t_executor = nullptr;
+thread_local size_t t_index = 0;
+
+struct Cpu {
+    int id;
+    int node;
+};
+
+// CPUs this process may run on, with their NUMA node.
+std::vector<Cpu> allowed_cpus() {
+    std::vector<Cpu> out;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return out;
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+        if (!CPU_ISSET(c, &set)) continue;
+        int node = 0;
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(c);
+        if (DIR *d = opendir(dir.c_str())) {
+            while (dirent *e = readdir(d)) {
+                if (std::strncmp(e->d_name, "node", 4) == 0 && e->d_name[4] >= '0' && e->d_name[4] <= '9') {
+                    node = std::atoi(e->d_name + 4);
+                    break;
+                }
+            }
+            closedir(d);
+        }
+        out.push_back({c, node});
+    }
+#elif defined(_WIN32)
+    DWORD_PTR proc = 0, sys = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &proc, &sys)) return out;
+    for (int c = 0; c < static_cast<int>(sizeof(DWORD_PTR) * 8); ++c) {
+        if (!(proc & (DWORD_PTR(1) << c))) continue;
+        UCHAR node = 0;
+        GetNumaProcessorNode(static_cast<UCHAR>(c), &node);
+        out.push_back({c, node == 0xFF ? 0 : static_cast<int>(node)});
+    }
+#endif
+    return out;
+}
+
+void pin_current_thread(int cpu) {
+    if (cpu < 0) return;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu);
+#endif
+}
+
+} // namespace
+
+WorkStealingExecutor::WorkStealingExecutor() : WorkStealingExecutor(Options()) {}
+
+WorkStealingExecutor::WorkStealingExecutor(const Options &opt) : opt_(opt) {
+    size_t n = opt_.threads ? opt_.threads : std::thread::hardware_concurrency();
+    if (n == 0) n = 1;
+    std::vector<Cpu> cpus = opt_.pin_threads ? allowed_cpus() : std::vector<Cpu>();
+
+    for (size_t i = 0; i < n; ++i) {
+        auto w = std::make_unique<Worker>();
+        if (!cpus.empty()) {
+            w->cpu = cpus[i % cpus.size()].id;
+            w->node = cpus[i % cpus.size()].node;
+        }
+        workers_.push_back(std::move(w));
+    }
+    // steal from workers on the same node first, starting after ourselves
+    for (size_t i = 0; i < n; ++i) {
+        auto &v = workers_[i]->victims;
+        for (int pass = 0; pass < 2; ++pass) {
+            for (size_t k = 1; k < n; ++k) {
+                size_t j = (i + k) % n;
+                bool same = workers_[j]->node == workers_[i]->node;
+                if ((pass == 0) == same) v.push_back(j);
+            }
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        workers_[i]->th = std::thread([this, i] { run(i); });
+    }
+    timer_ = std::thread([this] { timer_loop(); });
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() { shutdown(); }
+
+void WorkStealingExecutor::submit(std::function<void()> fn) {
+    if (stopping_.load() && t_executor != this) {
+        fn(); // workers are draining or gone
+        return;
+    }
+    Job *job = new Job{std::move(fn)};
+    pending_.fetch_add(1);
+    if (t_executor == this) {
+        workers_[t_index]->deque.push(job);
+    } else {
+        Worker &w = *workers_[next_inbox_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+        std::lock_guard<std::mutex> lk(w.inbox_mu);
+        w.inbox.push_back(job);
+    }
+    if (sleepers_.load() > 0) {
+        { std::lock_guard<std::mutex> lk(park_mu_); }
+        park_cv_.notify_one();
+    }
+}
+
+bool WorkStealingExecutor::find_job(size_t index, Job *&job) {
+    Worker &w = *workers_[index];
+    if (w.deque.pop(job)) return true;
+    {
+        std::lock_guard<std::mutex> lk(w.inbox_mu);
+        if (!w.inbox.empty()) {
+            job = w.inbox.front();
+            w.inbox.pop_front();
+            return true;
+        }
+    }
+    for (size_t v : w.victims) {
+        if (workers_[v]->deque.steal(job)) return true;
+    }
+    for (size_t v : w.victims) {
+        Worker &o = *workers_[v];
+        std::unique_lock<std::mutex> lk(o.inbox_mu, std::try_to_lock);
+        if (lk.owns_lock() && !o.inbox.empty()) {
+            job = o.inbox.front();
+            o.inbox.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingExecutor::run(size_t index) {
+    t_executor = this;
+    t_index = index;
+    pin_current_thread(workers_[index]->cpu);
+    int idle = 0;
+    for (;;) {
+        Job *job = nullptr;
+        if (find_job(index, job)) {
+            pending_.fetch_sub(1);
+            job->fn();
+            delete job;
+            idle = 0;
+            continue;
+        }
+        if (stopping_.load() && pending_.load() == 0) break;
+        if (++idle < 64) { std::this_thread::yield(); continue; }
+        std::unique_lock<std::mutex> lk(park_mu_);
+        sleepers_.fetch_add(1);
+        park_cv_.wait(lk, [this] { return pending_.load() > 0 || stopping_.load(); });
+        sleepers_.fetch_sub(1);
+        idle = 0;
+    }
+    t_executor = nullptr;
+}
+
+uint64_t WorkStealingExecutor::every(std::chrono::milliseconds interval, std::function<void()> fn) {
+    std::lock_guard<std::mutex> lk(timer_mu_);
+    uint64_t id = next_timer_id_++;
+    periodic_[id] = Periodic{interval, std::move(fn), std::make_shared<std::atomic<bool>>(false)};
+    due_.emplace(std::chrono::steady_clock::now() + interval, id);
+    timer_cv_.notify_one();
+    return id;
+}
+
+void WorkStealingExecutor::cancel(uint64_t id) {
+    std::lock_guard<std::mutex> lk(timer_mu_);
+    periodic_.erase(id);
+}
+
+void WorkStealingExecutor::timer_loop() {
+    std::unique_lock<std::mutex> lk(timer_mu_);
+    while (!timer_stop_) {
+        if (due_.empty()) { timer_cv_.wait(lk); continue; }
+        auto next = due_.begin()->first;
+        if (std::chrono::steady_clock::now() < next) { timer_cv_.wait_until(lk, next); continue; }
+        uint64_t id = due_.begin()->second;
+        due_.erase(due_.begin());
+        auto it = periodic_.find(id);
+        if (it == periodic_.end()) continue;
+        Periodic &p = it->second;
+        due_.emplace(std::chrono::steady_clock::now() + p.interval, id);
+        // skip this tick if the previous run is still going
+        if (p.running->exchange(true)) continue;
+        auto fn = p.fn;
+        auto running = p.running;
+        submit([fn, running] { fn(); running->store(false); });
+    }
+}
+
+void WorkStealingExecutor::shutdown() {
+    {
+        std::lock_guard<std::mutex> lk(timer_mu_);
+        if (timer_stop_) return;
+        timer_stop_ = true;
+    }
+    timer_cv_.notify_all();
+    if (timer_.joinable()) timer_.join();
+    {
+        std::lock_guard<std::mutex> lk(park_mu_);
+        stopping_ = true;
+    }
+    park_cv_.notify_all();
+    for (auto &w : workers_) {
+        if (w->th.joinable()) w->th.join();
+    }
+}
+
+} // namespace YUYU
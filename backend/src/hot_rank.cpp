@@ -0,0 +1,177 @@
+#include "hot_rank.h"
+#include "snapshot.h"
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+namespace YUYU {
+
+// Rescale once exp(lambda * (t - L)) would exceed e^50.
+static const double MAX_EXPONENT = 50.0;
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+HotRanker::HotRanker() : HotRanker(Options()) {}
+
+HotRanker::HotRanker(const Options &opt)
+    : opt_(opt),
+      lambda_(std::log(2.0) / (opt.half_life_hours * 3600.0 * 1000.0)),
+      published_(std::make_shared<const std::vector<long long>>()) {
+    landmark_ms_ = now_ms() - window_ms();
+}
+
+HotRanker::~HotRanker() { stop(); }
+
+int64_t HotRanker::window_ms() const {
+    // 10 half-lives: 2^-10 < 1/1000
+    return static_cast<int64_t>(opt_.half_life_hours * 10 * 3600.0 * 1000.0);
+}
+
+double HotRanker::weight(Kind kind) const {
+    switch (kind) {
+    case Post: return opt_.post_weight;
+    case Like: return opt_.like_weight;
+    case Comment: return opt_.comment_weight;
+    }
+    return 0;
+}
+
+void HotRanker::rebase_locked(int64_t t) {
+    double scale = std::exp(-lambda_ * static_cast<double>(t - landmark_ms_));
+    landmark_ms_ = t;
+    order_.clear();
+    for (auto &kv : scores_) {
+        kv.second *= scale;
+        order_.emplace(kv.second, kv.first);
+    }
+}
+
+void HotRanker::record(long long weibo_id, Kind kind, int64_t at_ms, int sign) {
+    int64_t t = sign < 0 ? now_ms() : at_ms;
+    std::lock_guard<std::mutex> lk(mu_);
+    if (lambda_ * static_cast<double>(t - landmark_ms_) > MAX_EXPONENT) rebase_locked(t);
+    double delta = sign * weight(kind) * std::exp(lambda_ * static_cast<double>(t - landmark_ms_));
+
+    auto it = scores_.find(weibo_id);
+    if (it == scores_.end()) {
+        if (delta <= 0) return;
+        // full and colder than the coldest tracked entry: not worth tracking
+        if (scores_.size() >= opt_.capacity && !order_.empty() && delta <= order_.begin()->first) return;
+        it = scores_.emplace(weibo_id, 0.0).first;
+    } else {
+        order_.erase({it->second, weibo_id});
+    }
+    it->second += delta;
+    if (it->second <= 0) {
+        scores_.erase(it);
+    } else {
+        order_.emplace(it->second, weibo_id);
+    }
+    while (scores_.size() > opt_.capacity) {
+        auto low = order_.begin();
+        scores_.erase(low->second);
+        order_.erase(low);
+    }
+    dirty_ = true;
+}
+
+void HotRanker::remove(long long weibo_id) {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = scores_.find(weibo_id);
+    if (it == scores_.end()) return;
+    order_.erase({it->second, weibo_id});
+    scores_.erase(it);
+    dirty_ = true;
+}
+
+void HotRanker::refresh() {
+    auto snap = std::make_shared<std::vector<long long>>();
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!dirty_) return;
+        dirty_ = false;
+        snap->reserve(std::min(opt_.published, order_.size()));
+        for (auto it = order_.rbegin(); it != order_.rend() && snap->size() < opt_.published; ++it) {
+            snap->push_back(it->second);
+        }
+    }
+    std::atomic_store(&published_, std::shared_ptr<const std::vector<long long>>(std::move(snap)));
+}
+
+std::vector<long long> HotRanker::top(size_t k) const {
+    auto snap = std::atomic_load(&published_);
+    size_t n = std::min(k, snap->size());
+    return std::vector<long long>(snap->begin(), snap->begin() + n);
+}
+
+size_t HotRanker::tracked() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return scores_.size();
+}
+
+void HotRanker::save(std::string &out) const {
+    std::lock_guard<std::mutex> lk(mu_);
+    SnapshotOut w(out);
+    w.i64(landmark_ms_);
+    w.u64(scores_.size());
+    for (const auto &kv : scores_) {
+        w.i64(kv.first);
+        w.f64(kv.second);
+    }
+}
+
+bool HotRanker::load(const char *data, size_t size) {
+    SnapshotIn r(data, size);
+    int64_t landmark = r.i64();
+    uint64_t n = r.u64();
+    if (!r.ok() || n > size / 16) return false;
+    std::unordered_map<long long, double> scores;
+    scores.reserve(static_cast<size_t>(n));
+    for (uint64_t i = 0; i < n; ++i) {
+        long long id = r.i64();
+        double score = r.f64();
+        if (score > 0 && std::isfinite(score)) scores[id] = score;
+    }
+    if (!r.done()) return false;
+    std::lock_guard<std::mutex> lk(mu_);
+    landmark_ms_ = landmark;
+    scores_.swap(scores);
+    order_.clear();
+    for (const auto &kv : scores_) order_.emplace(kv.second, kv.first);
+    while (scores_.size() > opt_.capacity) {
+        auto low = order_.begin();
+        scores_.erase(low->second);
+        order_.erase(low);
+    }
+    dirty_ = true;
+    return true;
+}
+
+void HotRanker::start() {
+    if (refresher_.joinable()) return;
+    stopping_ = false;
+    refresher_ = std::thread([this] {
+        std::unique_lock<std::mutex> lk(stop_mu_);
+        while (!stopping_) {
+            stop_cv_.wait_for(lk, std::chrono::milliseconds(opt_.refresh_ms), [this] { return stopping_; });
+            if (stopping_) break;
+            lk.unlock();
+            refresh();
+            lk.lock();
+        }
+    });
+}
+
+void HotRanker::stop() {
+    {
+        std::lock_guard<std::mutex> lk(stop_mu_);
+        stopping_ = true;
+    }
+    stop_cv_.notify_all();
+    if (refresher_.joinable()) refresher_.join();
+}
+
+} // namespace YUYU
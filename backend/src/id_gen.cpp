@@ -0,0 +1,42 @@
+#include "id_gen.h"
+#include "shard_ring.h"
+#include <algorithm>
+#include <chrono>
+
+namespace YUYU {
+
+long long IdGenerator::next(size_t shard) {
+    long long now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t floor = static_cast<uint64_t>(std::max(0LL, now - kEpochMs) / kTickMs) << kSeqBits;
+    uint64_t cur = last_.load(std::memory_order_relaxed);
+    uint64_t id;
+    do {
+        // a full sequence carries into the tick
+        id = std::max(floor, cur + 1);
+    } while (!last_.compare_exchange_weak(cur, id, std::memory_order_relaxed));
+    uint64_t tick = id >> kSeqBits, seq = id & ((1u << kSeqBits) - 1);
+    return static_cast<long long>((tick << (kNodeBits + kSeqBits + kShardBits)) |
+                             (static_cast<uint64_t>(node_) << (kSeqBits + kShardBits)) |
+                             (seq << kShardBits) | (shard & (kMaxShards - 1)));
+}
+
+long long IdGenerator::time_ms(long long id) {
+    return static_cast<long long>(static_cast<uint64_t>(id) >> (kNodeBits + kSeqBits + kShardBits)) * kTickMs +
+           kEpochMs;
+}
+
+long long IdGenerator::first_at(long long ms) {
+    if (ms <= kEpochMs) return 0;
+    return static_cast<long long>(static_cast<uint64_t>((ms - kEpochMs) / kTickMs) << (kNodeBits + kSeqBits + kShardBits));
+}
+
+long long IdGenerator::compose(long long ms, unsigned node, unsigned seq, size_t shard) {
+    uint64_t tick = static_cast<uint64_t>(std::max(0LL, ms - kEpochMs) / kTickMs);
+    return static_cast<long long>((tick << (kNodeBits + kSeqBits + kShardBits)) |
+                                  (static_cast<uint64_t>(node & ((1u << kNodeBits) - 1)) << (kSeqBits + kShardBits)) |
+                                  (static_cast<uint64_t>(seq & ((1u << kSeqBits) - 1)) << kShardBits) |
+                                  (shard & (kMaxShards - 1)));
+}
+
+} // namespace YUYU
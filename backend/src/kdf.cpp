@@ -0,0 +1,188 @@
+#include "kdf.h"
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace YUYU {
+
+namespace {
+
+const size_t kSaltBytes = 16;
+const size_t kHashBytes = 32;
+
+std::string to_hex(const unsigned char *p, size_t n) {
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(n * 2);
+    for (size_t i = 0; i < n; ++i) {
+        out.push_back(hex[p[i] >> 4]);
+        out.push_back(hex[p[i] & 0xF]);
+    }
+    return out;
+}
+
+bool from_hex(const std::string &s, size_t pos, size_t n, unsigned char *out) {
+    if (pos + n * 2 > s.size()) return false;
+    auto nib = [](char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    };
+    for (size_t i = 0; i < n; ++i) {
+        int hi = nib(s[pos + 2 * i]), lo = nib(s[pos + 2 * i + 1]);
+        if (hi < 0 || lo < 0) return false;
+        out[i] = static_cast<unsigned char>(hi << 4 | lo);
+    }
+    return true;
+}
+
+// Stored parameters come from the database; refuse anything that would make
+// a single verification absurdly expensive.
+bool sane(const KdfParams &p) {
+    return p.log_n >= 1 && p.log_n <= 22 && p.r >= 1 && p.r <= 32 && p.p >= 1 && p.p <= 16;
+}
+
+bool scrypt(const std::string &password, const unsigned char *salt, const KdfParams &p, unsigned char *out) {
+    uint64_t n = uint64_t(1) << p.log_n;
+    uint64_t maxmem = 128ull * p.r * (n + p.p + 2) + (1u << 20);
+    return EVP_PBE_scrypt(password.data(), password.size(), salt, kSaltBytes, n, p.r, p.p, maxmem,
+                          out, kHashBytes) == 1;
+}
+
+} // namespace
+
+bool hash_password(const std::string &password, const KdfParams &params, std::string &out) {
+    unsigned char salt[kSaltBytes], hash[kHashBytes];
+    if (!sane(params) || RAND_bytes(salt, sizeof(salt)) != 1 || !scrypt(password, salt, params, hash)) return false;
+    char head[64];
+    std::snprintf(head, sizeof(head), "$scrypt$ln=%d,r=%u,p=%u$", params.log_n, params.r, params.p);
+    out = head + to_hex(salt, sizeof(salt)) + "$" + to_hex(hash, sizeof(hash));
+    return true;
+}
+
+bool verify_password(const std::string &password, const std::string &stored, const KdfParams &current,
+                     bool &needs_rehash) {
+    needs_rehash = false;
+    unsigned char want[kHashBytes], got[kHashBytes];
+    if (stored.size() == SHA256_DIGEST_LENGTH * 2 && stored.find('$') == std::string::npos) {
+        // accounts created before salted hashes
+        if (!from_hex(stored, 0, SHA256_DIGEST_LENGTH, want)) return false;
+        SHA256(reinterpret_cast<const unsigned char *>(password.data()), password.size(), got);
+        if (CRYPTO_memcmp(want, got, SHA256_DIGEST_LENGTH) != 0) return false;
+        needs_rehash = true;
+        return true;
+    }
+
+    KdfParams p;
+    int consumed = 0;
+    if (std::sscanf(stored.c_str(), "$scrypt$ln=%d,r=%u,p=%u$%n", &p.log_n, &p.r, &p.p, &consumed) != 3 ||
+        consumed == 0 || !sane(p)) {
+        return false;
+    }
+    size_t salt_at = static_cast<size_t>(consumed);
+    size_t hash_at = salt_at + kSaltBytes * 2 + 1;
+    unsigned char salt[kSaltBytes];
+    if (stored.size() != hash_at + kHashBytes * 2 || stored[hash_at - 1] != '$' ||
+        !from_hex(stored, salt_at, kSaltBytes, salt) || !from_hex(stored, hash_at, kHashBytes, want)) {
+        return false;
+    }
+    if (!scrypt(password, salt, p, got) || CRYPTO_memcmp(want, got, kHashBytes) != 0) return false;
+    needs_rehash = p.log_n != current.log_n || p.r != current.r || p.p != current.p;
+    return true;
+}
+
+KdfPool::KdfPool(const Options &opt) : opt_(opt) {
+    if (!opt_.threads) opt_.threads = std::max(1u, std::thread::hardware_concurrency() / 4);
+    if (!hash_password("", opt_.params, decoy_)) decoy_.clear();
+    threads_.reserve(opt_.threads);
+    for (size_t i = 0; i < opt_.threads; ++i) threads_.emplace_back([this] { work(); });
+}
+
+KdfPool::~KdfPool() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : threads_) t.join();
+}
+
+KdfPool::Status KdfPool::hash(const std::string &password, std::string &out) {
+    bool ok = false;
+    if (!run([&] { ok = hash_password(password, opt_.params, out); })) return Busy;
+    return ok ? Ok : Failed;
+}
+
+KdfPool::Status KdfPool::verify(const std::string &password, const std::string &stored, bool &match,
+                                std::string &upgraded) {
+    match = false;
+    upgraded.clear();
+    bool ok = true;
+    bool admitted = run([&] {
+        bool rehash = false;
+        if (stored.empty()) {
+            verify_password(password, decoy_, opt_.params, rehash);
+            return;
+        }
+        match = verify_password(password, stored, opt_.params, rehash);
+        if (match && rehash) ok = hash_password(password, opt_.params, upgraded);
+    });
+    if (!admitted) return Busy;
+    if (!ok) upgraded.clear();
+    return Ok;
+}
+
+KdfPool::Stats KdfPool::stats() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return Stats{jobs_.size(), hashed_.load(), rejected_.load(), expired_.load()};
+}
+
+bool KdfPool::run(std::function<void()> fn) {
+    Waiter w;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (stopping_ || jobs_.size() >= opt_.capacity) {
+            ++rejected_;
+            return false;
+        }
+        jobs_.push_back({std::move(fn), std::chrono::steady_clock::now(), &w});
+    }
+    cv_.notify_one();
+    std::unique_lock<std::mutex> lk(w.mu);
+    w.cv.wait(lk, [&w] { return w.state != 0; });
+    return w.state == 1;
+}
+
+void KdfPool::work() {
+    const auto max_wait = std::chrono::milliseconds(opt_.max_wait_ms);
+    for (;;) {
+        Job job;
+        bool stop;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait(lk, [this] { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty()) return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            stop = stopping_;
+        }
+        bool expired = stop || std::chrono::steady_clock::now() - job.enqueued > max_wait;
+        if (expired) {
+            ++expired_;
+        } else {
+            job.fn();
+            ++hashed_;
+        }
+        // notify under the lock: the waiter owns `w` and may return as soon
+        // as it sees the state change
+        std::lock_guard<std::mutex> lk(job.waiter->mu);
+        job.waiter->state = expired ? 2 : 1;
+        job.waiter->cv.notify_one();
+    }
+}
+
+} // namespace YUYU
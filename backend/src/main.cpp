@@ -1,9 +1,91 @@
 #include "server.h"
+#include <csignal>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef _WIN32
+static YUYU::Server *g_app = nullptr;
+#endif
 
 int main() {
     YUYU::Server app;
     const std::string DB_CONN_STR = "host=127.0.0.1 port=5432 dbname=yuyu user=yuyu_user password=Gin001A@JCGF";
-    if (!app.init(DB_CONN_STR)) {
+    DatabaseOptions db;
+    auto split = [](const std::string &list) {
+        std::vector<std::string> out;
+        size_t pos = 0;
+        while (pos <= list.size()) {
+            size_t end = list.find(';', pos);
+            if (end == std::string::npos) end = list.size();
+            if (end > pos) out.push_back(list.substr(pos, end - pos));
+            pos = end + 1;
+        }
+        return out;
+    };
+    // YUYU_DB_REPLICAS="<conninfo>;<conninfo>": read replicas of DB_CONN_STR
+    if (const char *v = std::getenv("YUYU_DB_REPLICAS")) db.replicas = split(v);
+    // YUYU_DB_SHARDS="<conninfo>;<conninfo>": primaries of shards 1..n
+    if (const char *v = std::getenv("YUYU_DB_SHARDS")) {
+        for (const std::string &primary : split(v)) db.shards.push_back({primary, {}});
+    }
+    // YUYU_NODE_ID=<0-14>: distinct per backend process sharing the database
+    if (const char *v = std::getenv("YUYU_NODE_ID")) db.node_id = static_cast<unsigned>(std::atoi(v));
+    if (const char *v = std::getenv("YUYU_DB_POOL")) db.pool_size = static_cast<size_t>(std::atoi(v));
+    // YUYU_USER_CACHE_MB=<n>: profile cache size, 0 to keep none
+    if (const char *v = std::getenv("YUYU_USER_CACHE_MB")) db.user_cache_bytes = static_cast<size_t>(std::atoi(v)) << 20;
+    YUYU::ServerOptions opt;
+    // YUYU_EVENT_LOOP=<n>: epoll front end with n reactors (0 = one per core)
+    if (const char *v = std::getenv("YUYU_EVENT_LOOP")) opt.event_loops = std::atoi(v);
+    if (const char *v = std::getenv("YUYU_WORKERS")) opt.worker_threads = static_cast<size_t>(std::atoi(v));
+    if (const char *v = std::getenv("YUYU_QUEUE")) opt.queue_capacity = static_cast<size_t>(std::atoi(v));
+    if (const char *v = std::getenv("YUYU_QUEUE_DEADLINE_MS")) opt.queue_deadline_ms = std::atoi(v);
+    if (const char *v = std::getenv("YUYU_RETRY_AFTER")) opt.retry_after_sec = std::atoi(v);
+    if (const char *v = std::getenv("YUYU_WORK_STEALING")) opt.work_stealing = std::atoi(v) != 0;
+    if (const char *v = std::getenv("YUYU_PIN_THREADS")) opt.pin_threads = std::atoi(v) != 0;
+    if (const char *v = std::getenv("YUYU_RATE_LIMIT")) opt.rate_limit = std::atoi(v) != 0;
+    if (const char *v = std::getenv("YUYU_COMPRESS_MIN")) opt.compress_min_bytes = static_cast<size_t>(std::atoi(v));
+    if (const char *v = std::getenv("YUYU_KDF_THREADS")) opt.kdf_threads = static_cast<size_t>(std::atoi(v));
+    if (const char *v = std::getenv("YUYU_KDF_QUEUE")) opt.kdf_queue = static_cast<size_t>(std::atoi(v));
+    if (const char *v = std::getenv("YUYU_SCRYPT_LOG_N")) opt.kdf_params.log_n = std::atoi(v);
+    if (const char *v = std::getenv("YUYU_SCRYPT_R")) opt.kdf_params.r = static_cast<uint32_t>(std::atoi(v));
+    if (const char *v = std::getenv("YUYU_SCRYPT_P")) opt.kdf_params.p = static_cast<uint32_t>(std::atoi(v));
+    // YUYU_SNAPSHOT=<file>: warm-restart snapshot, rewritten every
+    // YUYU_SNAPSHOT_INTERVAL seconds (default 300) and on SIGINT/SIGTERM
+    if (const char *v = std::getenv("YUYU_SNAPSHOT")) opt.snapshot_path = v;
+    if (const char *v = std::getenv("YUYU_SNAPSHOT_INTERVAL")) opt.snapshot_interval_s = std::atoi(v);
+    // YUYU_CDC=1: several backends share the database; follow each other's
+    // writes through the change triggers in db/schema.sql
+    if (const char *v = std::getenv("YUYU_CDC")) opt.cdc = db.cdc = std::atoi(v) != 0;
+    if (const char *v = std::getenv("YUYU_NOTIFY_USERS")) opt.notification_users = static_cast<size_t>(std::atoll(v));
+    // YUYU_MESSAGES_DIR=<dir>: turns private messages on, logged under <dir>
+    if (const char *v = std::getenv("YUYU_MESSAGES_DIR")) opt.messages_dir = v;
+    if (const char *v = std::getenv("YUYU_MESSAGES_FSYNC")) opt.messages_fsync = std::atoi(v) != 0;
+    app.configure(opt);
+#ifdef _WIN32
+    // the console control handler runs on a thread of its own
+    g_app = &app;
+    std::signal(SIGINT, [](int) { g_app->stop(); });
+    std::signal(SIGTERM, [](int) { g_app->stop(); });
+#else
+    // blocked before init() starts any thread, so every thread inherits the
+    // mask and one thread takes the signal synchronously and stops the server
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, nullptr);
+    std::thread([&app, stop_signals] {
+        int sig = 0;
+        sigwait(&stop_signals, &sig);
+        app.stop();
+    }).detach();
+#endif
+    if (!app.init(DB_CONN_STR, db)) {
         return 1;
     }
     app.run(8080);
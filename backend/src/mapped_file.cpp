@@ -0,0 +1,64 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace YUYU {
+
+std::shared_ptr<const MappedFile> MappedFile::open(const std::string &path) {
+    std::shared_ptr<MappedFile> f(new MappedFile());
+#ifdef _WIN32
+    HANDLE h = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return nullptr;
+    f->file_ = h;
+    LARGE_INTEGER size;
+    FILETIME ft;
+    if (!GetFileSizeEx(h, &size) || !GetFileTime(h, nullptr, nullptr, &ft)) return nullptr;
+    ULARGE_INTEGER t;
+    t.LowPart = ft.dwLowDateTime;
+    t.HighPart = ft.dwHighDateTime;
+    f->mtime_ = static_cast<time_t>((t.QuadPart - 116444736000000000ULL) / 10000000ULL);
+    f->size_ = static_cast<size_t>(size.QuadPart);
+    if (f->size_ == 0) return f;
+    f->mapping_ = CreateFileMappingA(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!f->mapping_) return nullptr;
+    f->data_ = static_cast<const char *>(MapViewOfFile(f->mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!f->data_) return nullptr;
+#else
+    f->fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (f->fd_ < 0) return nullptr;
+    struct stat st;
+    if (::fstat(f->fd_, &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+    f->size_ = static_cast<size_t>(st.st_size);
+    f->mtime_ = st.st_mtime;
+    if (f->size_ == 0) return f;
+    void *p = ::mmap(nullptr, f->size_, PROT_READ, MAP_SHARED, f->fd_, 0);
+    if (p == MAP_FAILED) return nullptr;
+    ::madvise(p, f->size_, MADV_SEQUENTIAL);
+    f->data_ = static_cast<const char *>(p);
+#endif
+    return f;
+}
+
+MappedFile::~MappedFile() {
+#ifdef _WIN32
+    if (data_) UnmapViewOfFile(data_);
+    if (mapping_) CloseHandle(mapping_);
+    if (file_) CloseHandle(file_);
+#else
+    if (data_) ::munmap(const_cast<char *>(data_), size_);
+    if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+} // namespace YUYU
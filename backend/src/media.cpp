@@ -0,0 +1,531 @@
+#include "media.h"
+#include "mapped_file.h"
+#include <openssl/sha.h>
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <jpeglib.h>
+#include <png.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define YUYU_MEDIA_SSE2 1
+#endif
+
+namespace fs = std::filesystem;
+
+namespace YUYU {
+
+namespace {
+
+constexpr int kShift = 14;               // filter weights are in 1/16384
+constexpr int kOne = 1 << kShift;
+
+// ---- codecs ----
+
+struct JpegError {
+    jpeg_error_mgr mgr;
+    jmp_buf jump;
+    char msg[JMSG_LENGTH_MAX];
+};
+
+void jpeg_fail(j_common_ptr cinfo) {
+    JpegError *e = reinterpret_cast<JpegError *>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, e->msg);
+    longjmp(e->jump, 1);
+}
+
+// Only POD locals between setjmp and longjmp; `out` belongs to the caller.
+bool decode_jpeg(const std::string &bytes, Image &out, std::string &err, size_t max_pixels, int min_long, int min_short) {
+    jpeg_decompress_struct cinfo;
+    JpegError jerr;
+    cinfo.err = jpeg_std_error(&jerr.mgr);
+    jerr.mgr.error_exit = jpeg_fail;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        err = jerr.msg;
+        return false;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, reinterpret_cast<unsigned char *>(const_cast<char *>(bytes.data())),
+                 static_cast<unsigned long>(bytes.size()));
+    jpeg_read_header(&cinfo, TRUE);
+    if (static_cast<size_t>(cinfo.image_width) * cinfo.image_height > max_pixels) {
+        jpeg_destroy_decompress(&cinfo);
+        err = "image too large";
+        return false;
+    }
+    // Let the decoder downscale in the DCT domain (1/2, 1/4, 1/8) as far as
+    // the requested output still has enough pixels to filter from.
+    int lo = static_cast<int>(std::min(cinfo.image_width, cinfo.image_height));
+    int hi = static_cast<int>(std::max(cinfo.image_width, cinfo.image_height));
+    int denom = 1;
+    while (denom < 8 && hi / (denom * 2) >= min_long && lo / (denom * 2) >= min_short &&
+           (min_long > 0 || min_short > 0)) {
+        denom *= 2;
+    }
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = static_cast<unsigned int>(denom);
+    cinfo.out_color_space = JCS_RGB;
+    jpeg_start_decompress(&cinfo);
+    out.width = static_cast<int>(cinfo.output_width);
+    out.height = static_cast<int>(cinfo.output_height);
+    out.rgb.resize(static_cast<size_t>(out.width) * out.height * 3);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = &out.rgb[static_cast<size_t>(cinfo.output_scanline) * out.width * 3];
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+bool decode_png(const std::string &bytes, Image &out, std::string &err, size_t max_pixels) {
+    png_image img;
+    std::memset(&img, 0, sizeof(img));
+    img.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&img, bytes.data(), bytes.size())) {
+        err = img.message;
+        return false;
+    }
+    if (static_cast<size_t>(img.width) * img.height > max_pixels) {
+        png_image_free(&img);
+        err = "image too large";
+        return false;
+    }
+    img.format = PNG_FORMAT_RGB;
+    out.width = static_cast<int>(img.width);
+    out.height = static_cast<int>(img.height);
+    out.rgb.resize(PNG_IMAGE_SIZE(img));
+    png_color white = {255, 255, 255};
+    if (!png_image_finish_read(&img, &white, out.rgb.data(), 0, nullptr)) {
+        err = img.message;
+        png_image_free(&img);
+        return false;
+    }
+    return true;
+}
+
+// ---- resize ----
+
+// Per output pixel: the source range it covers and one weight per source
+// pixel, proportional to the overlap and summing to kOne.
+struct Taps {
+    std::vector<int> first, count, offset;
+    std::vector<int16_t> weight;
+};
+
+Taps area_taps(int src, int dst) {
+    Taps t;
+    t.first.resize(dst);
+    t.count.resize(dst);
+    t.offset.resize(dst);
+    double scale = static_cast<double>(src) / dst;
+    for (int i = 0; i < dst; ++i) {
+        double a = i * scale, b = (i + 1) * scale;
+        int j0 = static_cast<int>(std::floor(a));
+        int j1 = std::min(src, static_cast<int>(std::ceil(b)));
+        t.first[i] = j0;
+        t.count[i] = j1 - j0;
+        t.offset[i] = static_cast<int>(t.weight.size());
+        int sum = 0, best = 0, best_q = -1;
+        for (int j = j0; j < j1; ++j) {
+            double overlap = std::min(b, j + 1.0) - std::max(a, static_cast<double>(j));
+            int q = static_cast<int>(std::lround(overlap / scale * kOne));
+            if (q > best_q) { best_q = q; best = j - j0; }
+            t.weight.push_back(static_cast<int16_t>(q));
+            sum += q;
+        }
+        // put the rounding error on the largest weight
+        t.weight[t.offset[i] + best] = static_cast<int16_t>(t.weight[t.offset[i] + best] + kOne - sum);
+    }
+    return t;
+}
+
+// out[x] = sum_k rows[k][x] * w[k] over `bytes` bytes.
+void vertical_pass(const uint8_t *const *rows, const int16_t *w, int n, int bytes, uint8_t *out) {
+    int x = 0;
+#ifdef YUYU_MEDIA_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i half = _mm_set1_epi32(kOne / 2);
+    for (; x + 8 <= bytes; x += 8) {
+        __m128i lo = half, hi = half;
+        int k = 0;
+        // two source rows per step: interleave their pixels and let madd
+        // compute w0 * a + w1 * b in 32 bits
+        for (; k + 1 < n; k += 2) {
+            __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(rows[k] + x)), zero);
+            __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(rows[k + 1] + x)), zero);
+            __m128i ww = _mm_set1_epi32(static_cast<int>(static_cast<uint16_t>(w[k]) | (static_cast<uint32_t>(static_cast<uint16_t>(w[k + 1])) << 16)));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), ww));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), ww));
+        }
+        if (k < n) {
+            __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(rows[k] + x)), zero);
+            __m128i ww = _mm_set1_epi32(static_cast<int>(static_cast<uint16_t>(w[k])));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, zero), ww));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, zero), ww));
+        }
+        lo = _mm_srai_epi32(lo, kShift);
+        hi = _mm_srai_epi32(hi, kShift);
+        __m128i p = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + x), _mm_packus_epi16(p, p));
+    }
+#endif
+    for (; x < bytes; ++x) {
+        int acc = kOne / 2;
+        for (int k = 0; k < n; ++k) acc += rows[k][x] * w[k];
+        acc >>= kShift;
+        out[x] = static_cast<uint8_t>(acc > 255 ? 255 : acc);
+    }
+}
+
+void horizontal_pass(const uint8_t *row, const Taps &t, int dst_w, uint8_t *out) {
+    for (int i = 0; i < dst_w; ++i) {
+        const uint8_t *p = row + t.first[i] * 3;
+        const int16_t *w = &t.weight[t.offset[i]];
+        int r = kOne / 2, g = kOne / 2, b = kOne / 2;
+        for (int k = 0; k < t.count[i]; ++k, p += 3) {
+            r += p[0] * w[k];
+            g += p[1] * w[k];
+            b += p[2] * w[k];
+        }
+        out[i * 3] = static_cast<uint8_t>(std::min(255, r >> kShift));
+        out[i * 3 + 1] = static_cast<uint8_t>(std::min(255, g >> kShift));
+        out[i * 3 + 2] = static_cast<uint8_t>(std::min(255, b >> kShift));
+    }
+}
+
+// Resizes the (x0, y0, w, h) region of src to dst_w x dst_h. The vertical
+// pass runs first, over full source rows, so the pass that touches every
+// source pixel is the vectorised one; the horizontal pass then only sees
+// dst_h rows.
+Image resize_region(const Image &src, int x0, int y0, int w, int h, int dst_w, int dst_h) {
+    Image out;
+    out.width = dst_w;
+    out.height = dst_h;
+    out.rgb.resize(static_cast<size_t>(dst_w) * dst_h * 3);
+    Taps tx = area_taps(w, dst_w);
+    Taps ty = area_taps(h, dst_h);
+    std::vector<uint8_t> line(static_cast<size_t>(w) * 3);
+    std::vector<const uint8_t *> rows;
+    const size_t stride = static_cast<size_t>(src.width) * 3;
+    for (int y = 0; y < dst_h; ++y) {
+        rows.clear();
+        for (int k = 0; k < ty.count[y]; ++k) {
+            rows.push_back(src.rgb.data() + (y0 + ty.first[y] + k) * stride + x0 * 3);
+        }
+        vertical_pass(rows.data(), &ty.weight[ty.offset[y]], ty.count[y], w * 3, line.data());
+        horizontal_pass(line.data(), tx, dst_w, &out.rgb[static_cast<size_t>(y) * dst_w * 3]);
+    }
+    return out;
+}
+
+// ---- storage helpers ----
+
+bool base64_decode(const std::string &in, size_t from, std::string &out) {
+    static int8_t table[256];
+    static bool init = [] {
+        std::memset(table, -1, sizeof(table));
+        const char *a = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (int i = 0; i < 64; ++i) table[static_cast<uint8_t>(a[i])] = static_cast<int8_t>(i);
+        return true;
+    }();
+    (void)init;
+    out.clear();
+    out.reserve((in.size() - from) / 4 * 3);
+    uint32_t acc = 0;
+    int bits = 0;
+    for (size_t i = from; i < in.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(in[i]);
+        if (c == '=') break;
+        if (c == '\r' || c == '\n' || c == ' ') continue;
+        int v = table[c];
+        if (v < 0) return false;
+        acc = (acc << 6) | static_cast<uint32_t>(v);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back(static_cast<char>((acc >> bits) & 0xFF));
+        }
+    }
+    return true;
+}
+
+// File type from magic bytes; "" if not an accepted image.
+const char *sniff(const std::string &b) {
+    auto starts = [&](const char *m, size_t n) { return b.size() >= n && std::memcmp(b.data(), m, n) == 0; };
+    if (starts("\xFF\xD8\xFF", 3)) return "jpg";
+    if (starts("\x89PNG\r\n\x1A\n", 8)) return "png";
+    if (starts("GIF87a", 6) || starts("GIF89a", 6)) return "gif";
+    if (b.size() >= 12 && std::memcmp(b.data(), "RIFF", 4) == 0 && std::memcmp(b.data() + 8, "WEBP", 4) == 0) return "webp";
+    return "";
+}
+
+std::string sha256_hex(const std::string &data) {
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const unsigned char *>(data.data()), data.size(), hash);
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    for (unsigned char c : hash) {
+        out.push_back(hex[c >> 4]);
+        out.push_back(hex[c & 0xF]);
+    }
+    return out;
+}
+
+bool read_file(const std::string &path, std::string &out) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) return false;
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+// Write to a temporary name and rename, so readers never see a partial file.
+bool write_file(const std::string &path, const std::string &data) {
+    std::string tmp = path + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if (!ofs) return false;
+        ofs.write(data.data(), static_cast<std::streamsize>(data.size()));
+        if (!ofs) return false;
+    }
+    std::error_code ec;
+    fs::rename(tmp, path, ec);
+    if (ec) { fs::remove(tmp, ec); return false; }
+    return true;
+}
+
+} // namespace
+
+bool decode_image(const std::string &bytes, Image &out, std::string &err, size_t max_pixels) {
+    std::string type = sniff(bytes);
+    if (type == "jpg") return decode_jpeg(bytes, out, err, max_pixels, 0, 0);
+    if (type == "png") return decode_png(bytes, out, err, max_pixels);
+    err = "unsupported image format";
+    return false;
+}
+
+bool encode_jpeg(const Image &img, int quality, std::string &out, std::string &err) {
+    jpeg_compress_struct cinfo;
+    JpegError jerr;
+    unsigned char *buf = nullptr;
+    unsigned long size = 0;
+    cinfo.err = jpeg_std_error(&jerr.mgr);
+    jerr.mgr.error_exit = jpeg_fail;
+    if (setjmp(jerr.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        std::free(buf);
+        err = jerr.msg;
+        return false;
+    }
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &buf, &size);
+    cinfo.image_width = static_cast<JDIMENSION>(img.width);
+    cinfo.image_height = static_cast<JDIMENSION>(img.height);
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    cinfo.optimize_coding = TRUE;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = const_cast<JSAMPROW>(&img.rgb[static_cast<size_t>(cinfo.next_scanline) * img.width * 3]);
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    out.assign(reinterpret_cast<const char *>(buf), size);
+    jpeg_destroy_compress(&cinfo);
+    std::free(buf);
+    return true;
+}
+
+Image fit_within(const Image &src, int max_w, int max_h) {
+    if (src.width <= max_w && src.height <= max_h) return src;
+    double s = std::min(static_cast<double>(max_w) / src.width, static_cast<double>(max_h) / src.height);
+    int w = std::max(1, static_cast<int>(std::lround(src.width * s)));
+    int h = std::max(1, static_cast<int>(std::lround(src.height * s)));
+    return resize_region(src, 0, 0, src.width, src.height, w, h);
+}
+
+Image square_thumbnail(const Image &src, int size) {
+    int side = std::min(src.width, src.height);
+    int x0 = (src.width - side) / 2, y0 = (src.height - side) / 2;
+    int dst = std::min(size, side);
+    return resize_region(src, x0, y0, side, side, dst, dst);
+}
+
+// ---- pipeline ----
+
+MediaPipeline::MediaPipeline() : MediaPipeline(Options()) {}
+MediaPipeline::MediaPipeline(const Options &opt) : opt_(opt) {}
+MediaPipeline::~MediaPipeline() { stop(); }
+
+bool MediaPipeline::start(Done done, std::string &err) {
+    std::error_code ec;
+    fs::create_directories(opt_.dir, ec);
+    if (ec) { err = ec.message(); return false; }
+    done_ = std::move(done);
+    stopping_ = false;
+    size_t n = opt_.threads ? opt_.threads : 1;
+    for (size_t i = 0; i < n; ++i) workers_.emplace_back([this] { work(); });
+    return true;
+}
+
+void MediaPipeline::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto &t : workers_) t.join();
+    workers_.clear();
+}
+
+bool MediaPipeline::owns(const std::string &url) const {
+    const std::string pre = opt_.url_prefix + "/";
+    return url.compare(0, pre.size(), pre) == 0 && url.find("..") == std::string::npos;
+}
+
+std::shared_ptr<const MappedFile> MediaPipeline::open(const std::string &url) const {
+    if (!owns(url)) return nullptr;
+    return MappedFile::open(path_of(url));
+}
+
+const char *MediaPipeline::content_type(const std::string &url) {
+    static const struct { const char *ext, *type; } types[] = {
+        {".jpg", "image/jpeg"}, {".png", "image/png"}, {".gif", "image/gif"}, {".webp", "image/webp"},
+    };
+    for (const auto &t : types) {
+        size_t n = std::strlen(t.ext);
+        if (url.size() > n && url.compare(url.size() - n, n, t.ext) == 0) return t.type;
+    }
+    return "application/octet-stream";
+}
+
+std::string MediaPipeline::path_of(const std::string &url) const {
+    return opt_.dir + url.substr(opt_.url_prefix.size());
+}
+
+bool MediaPipeline::store(const std::string &data_url, std::string &url, bool &resizable, std::string &err) {
+    // data:image/png;base64,....
+    size_t comma = data_url.find(',');
+    if (data_url.compare(0, 5, "data:") != 0 || comma == std::string::npos ||
+        data_url.rfind(";base64", comma) == std::string::npos) {
+        err = "invalid media";
+        return false;
+    }
+    if ((data_url.size() - comma) / 4 * 3 > opt_.max_upload_bytes) {
+        err = "media too large";
+        return false;
+    }
+    std::string bytes;
+    if (!base64_decode(data_url, comma + 1, bytes)) {
+        err = "invalid media";
+        return false;
+    }
+    std::string ext = sniff(bytes);
+    if (ext.empty()) {
+        err = "unsupported media type";
+        return false;
+    }
+    std::string hash = sha256_hex(bytes);
+    std::string rel = "/" + hash.substr(0, 2) + "/" + hash + "." + ext;
+    std::string path = opt_.dir + rel;
+    std::error_code ec;
+    if (!fs::exists(path, ec)) {   // content-addressed: same bytes, same file
+        fs::create_directories(opt_.dir + "/" + hash.substr(0, 2), ec);
+        if (!write_file(path, bytes)) {
+            err = "media write failed";
+            return false;
+        }
+    }
+    url = opt_.url_prefix + rel;
+    resizable = ext == "jpg" || ext == "png";
+    return true;
+}
+
+bool MediaPipeline::submit(Job job) {
+    if (!owns(job.url)) return false;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (stopping_ || workers_.empty() || jobs_.size() >= opt_.queue_capacity) return false;
+        jobs_.push_back(std::move(job));
+    }
+    cv_.notify_one();
+    return true;
+}
+
+void MediaPipeline::work() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait(lk, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        try {
+            process(job);
+        } catch (const std::exception &e) {
+            std::cerr << "media job " << job.url << ": " << e.what() << "\n";
+        }
+    }
+}
+
+void MediaPipeline::process(const Job &job) {
+    const char *suffix = job.variant == Feed ? "_feed.jpg" : "_avatar.jpg";
+    std::string base = job.url.substr(0, job.url.rfind('.'));
+    std::string variant_url = base + suffix;
+    std::string variant_path = path_of(variant_url);
+    std::error_code ec;
+    if (fs::exists(variant_path, ec)) {   // same upload seen before
+        if (done_) done_(job, variant_url);
+        return;
+    }
+
+    std::string bytes, err;
+    if (!read_file(path_of(job.url), bytes)) {
+        std::cerr << "media job " << job.url << ": cannot read original\n";
+        return;
+    }
+    Image img;
+    bool ok = std::strcmp(sniff(bytes), "jpg") == 0
+        ? decode_jpeg(bytes, img, err, 40u * 1000 * 1000,
+                      job.variant == Feed ? opt_.feed_max : 0, job.variant == Avatar ? opt_.avatar_size : 0)
+        : decode_image(bytes, img, err);
+    if (!ok) {
+        std::cerr << "media job " << job.url << ": " << err << "\n";
+        return;
+    }
+    Image small = job.variant == Feed ? fit_within(img, opt_.feed_max, opt_.feed_max)
+                                      : square_thumbnail(img, opt_.avatar_size);
+    std::string encoded;
+    if (!encode_jpeg(small, opt_.quality, encoded, err)) {
+        std::cerr << "media job " << job.url << ": " << err << "\n";
+        return;
+    }
+    // An image already within feed size may not shrink by re-encoding; then
+    // the original is the feed variant.
+    if (job.variant == Feed && small.width == img.width && small.height == img.height && encoded.size() >= bytes.size()) {
+        if (done_) done_(job, job.url);
+        return;
+    }
+    if (!write_file(variant_path, encoded)) {
+        std::cerr << "media job " << job.url << ": cannot write variant\n";
+        return;
+    }
+    if (done_) done_(job, variant_url);
+}
+
+} // namespace YUYU
@@ -0,0 +1,538 @@
+#include "message_store.h"
+#include "mapped_file.h"
+#include "snapshot.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace YUYU {
+
+namespace {
+
+const size_t kHeader = 8;                   // u32 size, u32 crc32
+const size_t kFixed = 1 + 4 * 8;            // kind and the four integers
+const size_t kMaxText = 64 << 10;           // longest text send() takes
+const long long kEpochMs = 1704067200000LL; // 2024-01-01, as in IdGenerator
+const size_t kMailShards = 64;
+
+long long now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+uint32_t checksum(const char *p, size_t n) {
+    return static_cast<uint32_t>(crc32(crc32(0L, Z_NULL, 0), reinterpret_cast<const Bytef *>(p), static_cast<uInt>(n)));
+}
+
+std::string segment_name(uint64_t number) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020llu.log", static_cast<unsigned long long>(number));
+    return name;
+}
+
+} // namespace
+
+MessageStore::Segment::~Segment() {
+    if (reader) std::fclose(reader);
+}
+
+bool MessageStore::Segment::read(uint64_t offset, uint32_t size, std::string &out) {
+    std::lock_guard<std::mutex> lk(read_mu);
+    if (!reader) {
+        reader = std::fopen(path.c_str(), "rb");
+        if (!reader) return false;
+        // records are read whole; stdio buffering would only copy them twice
+        std::setvbuf(reader, nullptr, _IONBF, 0);
+    }
+    out.resize(size);
+    return std::fseek(reader, static_cast<long>(offset), SEEK_SET) == 0 &&
+           std::fread(&out[0], 1, size, reader) == size;
+}
+
+MessageStore::MessageStore(const Options &opt) : opt_(opt), mail_(kMailShards) {
+    if (opt_.partitions == 0) opt_.partitions = 1;
+    if (opt_.max_batch == 0) opt_.max_batch = 1;
+    if (opt_.recent == 0) opt_.recent = 1;
+    for (size_t i = 0; i < opt_.partitions; ++i) {
+        parts_.emplace_back(new Partition());
+        char name[24];
+        std::snprintf(name, sizeof(name), "p%02zu", i);
+        parts_.back()->dir = (std::filesystem::path(opt_.dir) / name).string();
+    }
+}
+
+MessageStore::~MessageStore() { close(); }
+
+MessageStore::Partition &MessageStore::partition_of(long long a, long long b) {
+    ConvKey k = conversation_key(a, b);
+    return *parts_[ConvHash()(k) % parts_.size()];
+}
+
+MessageStore::Mailbox &MessageStore::box_locked(MailShard &sh, long long user_id) {
+    auto r = sh.boxes.try_emplace(user_id);
+    if (r.second) r.first->second.seq = base_seq_;
+    return r.first->second;
+}
+
+long long MessageStore::next_id(long long now) {
+    // time-ordered like the other ids, and strictly increasing
+    long long cand = (now - kEpochMs) << 12;
+    long long last = last_id_.load(std::memory_order_relaxed);
+    long long id;
+    do {
+        id = std::max(cand, last + 1);
+    } while (!last_id_.compare_exchange_weak(last, id, std::memory_order_relaxed));
+    return id;
+}
+
+static void encode(uint8_t kind, const Message &m, std::string &buf) {
+    size_t start = buf.size();
+    buf.resize(start + kHeader);
+    SnapshotOut out(buf);
+    out.bytes(&kind, 1);
+    out.i64(m.message_id);
+    out.i64(m.sender_id);
+    out.i64(m.recipient_id);
+    out.i64(m.created_ms);
+    out.bytes(m.text.data(), m.text.size());
+    uint32_t size = static_cast<uint32_t>(buf.size() - start - kHeader);
+    uint32_t crc = checksum(buf.data() + start + kHeader, size);
+    std::memcpy(&buf[start], &size, 4);
+    std::memcpy(&buf[start + 4], &crc, 4);
+}
+
+static bool decode(const char *payload, size_t size, uint8_t &kind, Message &m) {
+    if (size < kFixed) return false;
+    SnapshotIn in(payload, size);
+    kind = static_cast<uint8_t>(*in.bytes(1));
+    m.message_id = in.i64();
+    m.sender_id = in.i64();
+    m.recipient_id = in.i64();
+    m.created_ms = in.i64();
+    m.text.assign(payload + kFixed, size - kFixed);
+    return in.ok();
+}
+
+bool MessageStore::replay(Partition &p, std::string &err) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::create_directories(p.dir, ec);
+    if (ec) {
+        err = "cannot create " + p.dir + ": " + ec.message();
+        return false;
+    }
+    std::vector<std::pair<uint64_t, std::string>> files;
+    for (const auto &e : fs::directory_iterator(p.dir, ec)) {
+        if (!e.is_regular_file() || e.path().extension() != ".log") continue;
+        files.emplace_back(std::strtoull(e.path().stem().string().c_str(), nullptr, 10), e.path().string());
+    }
+    if (ec) {
+        err = "cannot list " + p.dir + ": " + ec.message();
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+
+    for (size_t n = 0; n < files.size(); ++n) {
+        const auto &file = files[n];
+        const bool last = n + 1 == files.size();
+        std::unique_ptr<Segment> seg(new Segment());
+        seg->number = file.first;
+        seg->path = file.second;
+        uint64_t good = 0, size = 0, skipped = 0;
+        {
+            std::shared_ptr<const MappedFile> f = MappedFile::open(seg->path);
+            if (!f) {
+                err = "cannot read " + seg->path;
+                return false;
+            }
+            size = f->size();
+            // the length and checksum of a whole record at `at`, or 0
+            auto record_at = [&](uint64_t at) -> uint32_t {
+                if (size - at < kHeader) return 0;
+                SnapshotIn head(f->data() + at, kHeader);
+                uint32_t len = head.u32();
+                uint32_t crc = head.u32();
+                if (len < kFixed || len > kFixed + kMaxText || len > size - at - kHeader) return 0;
+                return checksum(f->data() + at + kHeader, len) == crc ? len : 0;
+            };
+            while (size - good >= kHeader) {
+                uint32_t len = record_at(good);
+                if (len == 0) {
+                    // Skip to the next record that checks out, which keeps
+                    // the messages behind damage done to the file after it
+                    // was written. With none left this is the tail.
+                    uint64_t next = good + 1;
+                    while (size - next >= kHeader && record_at(next) == 0) ++next;
+                    if (size - next < kHeader) break;
+                    skipped += next - good;
+                    good = next;
+                    continue;
+                }
+                const char *payload = f->data() + good + kHeader;
+                Record rec;
+                uint8_t kind = 0;
+                if (decode(payload, len, kind, rec.m) && (kind == kMessage || kind == kRead)) {
+                    rec.kind = static_cast<Kind>(kind);
+                    if (rec.kind == kMessage) {
+                        p.index[conversation_key(rec.m.sender_id, rec.m.recipient_id)].push_back(
+                            Ref{rec.m.message_id, seg.get(), static_cast<uint32_t>(good),
+                                static_cast<uint32_t>(kHeader + len)});
+                        if (rec.m.message_id > last_id_.load(std::memory_order_relaxed))
+                            last_id_.store(rec.m.message_id, std::memory_order_relaxed);
+                        messages_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    deliver(rec, false);
+                }
+                good += kHeader + len;
+            }
+        }
+        if (skipped > 0 || (!last && good < size))
+            std::cerr << "message log: " << seg->path << " is damaged, skipped "
+                      << skipped + (last ? 0 : size - good) << " of " << size << " bytes\n";
+        if (last && good < size) {
+            // A write that did not finish before a crash, which can only be
+            // the end of the newest segment; nothing was acknowledged past it.
+            // A sealed segment keeps its bytes.
+            std::cerr << "message log: " << seg->path << " cut at byte " << good << " of " << size << "\n";
+            fs::resize_file(seg->path, good, ec);
+            if (ec) {
+                err = "cannot truncate " + seg->path + ": " + ec.message();
+                return false;
+            }
+        }
+        p.next_segment = seg->number + 1;
+        p.active_size = good;
+        p.segments.push_back(std::move(seg));
+    }
+    if (!p.segments.empty()) {
+        p.active = std::fopen(p.segments.back()->path.c_str(), "ab");
+        if (!p.active) {
+            err = "cannot append to " + p.segments.back()->path;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MessageStore::open(std::string &err) {
+    // Ref::offset is 32 bits; a batch may run past segment_bytes by its own size
+    if (opt_.segment_bytes + opt_.max_batch * (kHeader + kFixed + kMaxText) >= (uint64_t(1) << 32)) {
+        err = "message segments must stay below 4 GiB";
+        return false;
+    }
+    closing_ = false;
+    interrupted_ = false;
+    base_seq_ = static_cast<uint64_t>(now_ms()) * 1000;
+    for (auto &p : parts_)
+        if (!replay(*p, err)) return false;
+    for (auto &p : parts_) {
+        Partition *part = p.get();
+        p->writer = std::thread([this, part] { run(*part); });
+    }
+    return true;
+}
+
+void MessageStore::close() {
+    closing_ = true;
+    for (auto &p : parts_) {
+        {
+            std::lock_guard<std::mutex> lk(p->mu);
+        }
+        p->wake.notify_all();
+        if (p->writer.joinable()) p->writer.join();
+        if (p->active) {
+            std::fclose(p->active);
+            p->active = nullptr;
+        }
+    }
+    interrupt();
+}
+
+void MessageStore::interrupt() {
+    interrupted_ = true;
+    for (MailShard &sh : mail_) {
+        {
+            std::lock_guard<std::mutex> lk(sh.mu);
+        }
+        sh.cv.notify_all();
+    }
+}
+
+bool MessageStore::roll(Partition &p, std::string &err) {
+    if (p.active) std::fclose(p.active);
+    std::unique_ptr<Segment> seg(new Segment());
+    seg->number = p.next_segment++;
+    seg->path = (std::filesystem::path(p.dir) / segment_name(seg->number)).string();
+    p.active = std::fopen(seg->path.c_str(), "ab");
+    p.active_size = 0;
+    if (!p.active) {
+        err = "cannot create " + seg->path;
+        return false;
+    }
+    std::lock_guard<std::mutex> lk(p.mu);
+    p.segments.push_back(std::move(seg));
+    return true;
+}
+
+bool MessageStore::write(Partition &p, const std::vector<Pending> &batch, std::vector<Ref> &refs, std::string &err) {
+    std::string buf;
+    std::vector<size_t> ends;
+    ends.reserve(batch.size());
+    for (const Pending &e : batch) {
+        encode(e.rec.kind, e.rec.m, buf);
+        ends.push_back(buf.size());
+    }
+    if (!p.active || (p.active_size > 0 && p.active_size + buf.size() > opt_.segment_bytes)) {
+        if (!roll(p, err)) return false;
+    }
+    Segment *seg = p.segments.back().get();
+    bool ok = std::fwrite(buf.data(), 1, buf.size(), p.active) == buf.size() && std::fflush(p.active) == 0;
+#ifdef _WIN32
+    if (ok && opt_.fsync) ok = _commit(_fileno(p.active)) == 0;
+#else
+    if (ok && opt_.fsync) ok = fsync(fileno(p.active)) == 0;
+#endif
+    if (!ok) {
+        err = "cannot write " + seg->path;
+        // drop whatever part of the batch made it, so later appends follow whole records
+        std::fclose(p.active);
+        std::error_code ec;
+        std::filesystem::resize_file(seg->path, p.active_size, ec);
+        p.active = std::fopen(seg->path.c_str(), "ab");
+        return false;
+    }
+    refs.clear();
+    size_t begin = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        refs.push_back(Ref{batch[i].rec.m.message_id, seg, static_cast<uint32_t>(p.active_size + begin),
+                           static_cast<uint32_t>(ends[i] - begin)});
+        begin = ends[i];
+    }
+    p.active_size += buf.size();
+    commits_.fetch_add(1, std::memory_order_relaxed);
+    bytes_.fetch_add(buf.size(), std::memory_order_relaxed);
+    return true;
+}
+
+void MessageStore::run(Partition &p) {
+    std::vector<Pending> batch;
+    std::vector<Ref> refs;
+    std::unique_lock<std::mutex> lk(p.mu);
+    for (;;) {
+        p.wake.wait(lk, [&] { return closing_ || !p.queue.empty(); });
+        if (p.queue.empty()) return;
+        // group commit: senders arriving meanwhile share this write and fsync
+        if (opt_.commit_window_us > 0 && !closing_ && p.queue.size() < opt_.max_batch)
+            p.wake.wait_for(lk, std::chrono::microseconds(opt_.commit_window_us),
+                            [&] { return closing_ || p.queue.size() >= opt_.max_batch; });
+        batch.swap(p.queue);
+        lk.unlock();
+
+        std::string err;
+        bool ok = write(p, batch, refs, err);
+        if (ok) {
+            {
+                std::lock_guard<std::mutex> g(p.mu);
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    const Record &rec = batch[i].rec;
+                    if (rec.kind == kMessage)
+                        p.index[conversation_key(rec.m.sender_id, rec.m.recipient_id)].push_back(refs[i]);
+                }
+            }
+            // history can serve them before anyone is told about them
+            for (const Pending &e : batch) {
+                if (e.rec.kind == kMessage) messages_.fetch_add(1, std::memory_order_relaxed);
+                deliver(e.rec, true);
+            }
+        } else {
+            std::cerr << "message log: " << err << "\n";
+        }
+
+        lk.lock();
+        for (Pending &e : batch) {
+            e.waiter->done = true;
+            e.waiter->ok = ok;
+            if (!ok) e.waiter->err = err;
+        }
+        p.done.notify_all();
+        batch.clear();
+    }
+}
+
+bool MessageStore::commit(Record &rec, std::string &err) {
+    Partition &p = partition_of(rec.m.sender_id, rec.m.recipient_id);
+    Waiter w;
+    std::unique_lock<std::mutex> lk(p.mu);
+    if (closing_) {
+        err = "message store closed";
+        return false;
+    }
+    // taken in queue order, so ids grow along the log
+    long long now = now_ms();
+    if (rec.kind == kMessage) rec.m.message_id = next_id(now);
+    rec.m.created_ms = now;
+    p.queue.push_back(Pending{rec, &w});
+    if (p.queue.size() == 1 || p.queue.size() >= opt_.max_batch) p.wake.notify_one();
+    p.done.wait(lk, [&] { return w.done; });
+    if (!w.ok) err = w.err;
+    return w.ok;
+}
+
+void MessageStore::deliver(const Record &rec, bool live) {
+    const Message &m = rec.m;
+    if (rec.kind == kRead) {
+        MailShard &sh = mail_of(m.sender_id);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        Mailbox &mb = box_locked(sh, m.sender_id);
+        auto it = mb.conversations.find(m.recipient_id);
+        auto ids = mb.unread_ids.find(m.recipient_id);
+        if (it == mb.conversations.end() || ids == mb.unread_ids.end()) return;
+        // what arrived after the reader looked stays unread
+        std::vector<long long> &v = ids->second;
+        v.erase(std::remove_if(v.begin(), v.end(), [&](long long id) { return id <= m.message_id; }), v.end());
+        mb.unread -= std::min(mb.unread, it->second.unread - static_cast<uint32_t>(v.size()));
+        it->second.unread = static_cast<uint32_t>(v.size());
+        if (v.empty()) mb.unread_ids.erase(ids);
+        return;
+    }
+    std::shared_ptr<const Message> msg = live ? std::make_shared<const Message>(m) : nullptr;
+    // the recipient's side counts as unread; the sender's other sessions see it too
+    const long long sides[2][2] = {{m.recipient_id, m.sender_id}, {m.sender_id, m.recipient_id}};
+    for (int s = 0; s < 2; ++s) {
+        long long user = sides[s][0], peer = sides[s][1];
+        MailShard &sh = mail_of(user);
+        {
+            std::lock_guard<std::mutex> lk(sh.mu);
+            Mailbox &mb = box_locked(sh, user);
+            Conversation &c = mb.conversations[peer];
+            c.peer_id = peer;
+            c.last_message_id = std::max(c.last_message_id, m.message_id);
+            if (s == 0) {
+                mb.unread_ids[peer].push_back(m.message_id);
+                ++c.unread;
+                ++mb.unread;
+            }
+            if (live) {
+                mb.recent.push_back(Delivery{++mb.seq, msg});
+                if (mb.recent.size() > opt_.recent) mb.recent.pop_front();
+            }
+        }
+        if (live) sh.cv.notify_all();
+    }
+    if (live && opt_.on_delivery) {
+        opt_.on_delivery(m.recipient_id);
+        if (m.sender_id != m.recipient_id) opt_.on_delivery(m.sender_id);
+    }
+}
+
+bool MessageStore::send(long long from, long long to, const std::string &text, Message &out, std::string &err) {
+    if (text.size() > kMaxText) {
+        err = "message too long";
+        return false;
+    }
+    Record rec;
+    rec.kind = kMessage;
+    rec.m.sender_id = from;
+    rec.m.recipient_id = to;
+    rec.m.text = text;
+    if (!commit(rec, err)) return false;
+    out = std::move(rec.m);
+    return true;
+}
+
+bool MessageStore::history(long long a, long long b, long long before, size_t limit, std::vector<Message> &out,
+                           std::string &err) {
+    out.clear();
+    std::vector<Ref> refs;
+    {
+        Partition &p = partition_of(a, b);
+        std::lock_guard<std::mutex> lk(p.mu);
+        auto it = p.index.find(conversation_key(a, b));
+        if (it == p.index.end()) return true;
+        const std::vector<Ref> &all = it->second;
+        auto end = all.end();
+        if (before > 0)
+            end = std::lower_bound(all.begin(), all.end(), before,
+                                   [](const Ref &r, long long id) { return r.message_id < id; });
+        while (end != all.begin() && refs.size() < limit) refs.push_back(*--end);
+    }
+    std::string buf;
+    out.reserve(refs.size());
+    for (const Ref &r : refs) {
+        uint8_t kind = 0;
+        Message m;
+        if (!r.segment->read(r.offset, r.size, buf) || !decode(buf.data() + kHeader, buf.size() - kHeader, kind, m)) {
+            err = "cannot read message " + std::to_string(r.message_id);
+            return false;
+        }
+        out.push_back(std::move(m));
+    }
+    return true;
+}
+
+void MessageStore::conversations(long long user_id, std::vector<Conversation> &out, uint32_t &unread) {
+    out.clear();
+    unread = 0;
+    MailShard &sh = mail_of(user_id);
+    {
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.boxes.find(user_id);
+        if (it == sh.boxes.end()) return;
+        unread = it->second.unread;
+        out.reserve(it->second.conversations.size());
+        for (const auto &kv : it->second.conversations) out.push_back(kv.second);
+    }
+    std::sort(out.begin(), out.end(),
+              [](const Conversation &x, const Conversation &y) { return x.last_message_id > y.last_message_id; });
+}
+
+bool MessageStore::mark_read(long long user_id, long long peer_id, std::string &err) {
+    Record rec;
+    rec.kind = kRead;
+    rec.m.sender_id = user_id;
+    rec.m.recipient_id = peer_id;
+    {
+        MailShard &sh = mail_of(user_id);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto box = sh.boxes.find(user_id);
+        if (box == sh.boxes.end()) return true;
+        auto it = box->second.conversations.find(peer_id);
+        if (it == box->second.conversations.end() || it->second.unread == 0) return true;
+        rec.m.message_id = it->second.last_message_id;
+    }
+    return commit(rec, err);
+}
+
+MessageStore::PollStatus MessageStore::poll(long long user_id, uint64_t since, std::chrono::milliseconds timeout,
+                                            std::vector<Delivery> &out, uint64_t &seq) {
+    out.clear();
+    MailShard &sh = mail_of(user_id);
+    std::unique_lock<std::mutex> lk(sh.mu);
+    Mailbox &mb = box_locked(sh, user_id);
+    seq = mb.seq;
+    if (since == 0) return Ready;
+    if (since < base_seq_ || since > mb.seq || (!mb.recent.empty() && since + 1 < mb.recent.front().seq)) return Resync;
+    if (!sh.cv.wait_for(lk, timeout, [&] { return interrupted_ || mb.seq > since; })) return Timeout;
+    seq = mb.seq;
+    if (mb.seq <= since) return Closed;
+    // recent is in seq order; take the tail after `since`
+    auto from = std::upper_bound(mb.recent.begin(), mb.recent.end(), since,
+                                 [](uint64_t s, const Delivery &d) { return s < d.seq; });
+    out.assign(from, mb.recent.end());
+    return Ready;
+}
+
+MessageStore::Stats MessageStore::stats() const {
+    return Stats{messages_.load(std::memory_order_relaxed), commits_.load(std::memory_order_relaxed),
+                 bytes_.load(std::memory_order_relaxed)};
+}
+
+} // namespace YUYU
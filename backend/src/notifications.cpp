@@ -0,0 +1,269 @@
+#include "notifications.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+namespace YUYU {
+
+namespace {
+
+// Items fold by kind and weibo; follows share weibo 0.
+long long group_key(const Notification &n) { return n.weibo_id * 4 + n.kind; }
+long long group_key(const Notifications::Item &i) { return i.weibo_id * 4 + i.kind; }
+
+} // namespace
+
+Notifications::Notifications(const Options &opt, Loader loader, Saver saver)
+    : opt_(opt), loader_(std::move(loader)), saver_(std::move(saver)), shards_(std::max<size_t>(opt.shards, 1)) {
+    if (opt_.per_user == 0) opt_.per_user = 1;
+    if (opt_.max_batch == 0) opt_.max_batch = 1;
+    shard_users_ = std::max<size_t>(opt_.max_users / shards_.size(), 1);
+}
+
+Notifications::~Notifications() { stop(); }
+
+void Notifications::start() {
+    std::lock_guard<std::mutex> lk(pending_mu_);
+    stopping_ = false;
+    if (!flusher_.joinable()) flusher_ = std::thread([this] { run(); });
+}
+
+void Notifications::stop() {
+    {
+        std::lock_guard<std::mutex> lk(pending_mu_);
+        stopping_ = true;
+    }
+    pending_cv_.notify_all();
+    if (flusher_.joinable()) flusher_.join();
+}
+
+Notifications::Inbox &Notifications::inbox_locked(Shard &sh, long long user_id) {
+    auto r = sh.inboxes.try_emplace(user_id);
+    Inbox &in = r.first->second;
+    if (r.second) {
+        sh.lru.push_front(user_id);
+        in.lru = sh.lru.begin();
+    } else {
+        sh.lru.splice(sh.lru.begin(), sh.lru, in.lru);
+    }
+    return in;
+}
+
+void Notifications::evict_locked(Shard &sh) {
+    // a few of the least recently used; inboxes with unsaved events stay
+    auto it = sh.lru.end();
+    for (int tries = 0; sh.inboxes.size() > shard_users_ && it != sh.lru.begin() && tries < 8; ++tries) {
+        --it;
+        auto found = sh.inboxes.find(*it);
+        if (found->second.unsaved) continue;
+        sh.inboxes.erase(found);
+        it = sh.lru.erase(it);
+    }
+}
+
+void Notifications::fold(Inbox &in, const Notification &n) {
+    const bool unread = n.notification_id > in.read_id;
+    in.newest = std::max(in.newest, n.notification_id);
+    auto open = in.open.find(group_key(n));
+    if (open != in.open.end() && (open->second->id > in.read_id) == unread) {
+        Item &item = *open->second;
+        size_t shown = std::min<size_t>(item.actor_count, kActors);
+        if (std::find(item.actors, item.actors + shown, n.actor_id) != item.actors + shown) return;
+        std::copy_backward(item.actors, item.actors + kActors - 1, item.actors + kActors);
+        item.actors[0] = n.actor_id;
+        ++item.actor_count;
+        item.id = std::max(item.id, n.notification_id);
+        in.items.splice(in.items.begin(), in.items, open->second);
+        return;
+    }
+    Item item;
+    item.id = n.notification_id;
+    item.kind = n.kind;
+    item.weibo_id = n.weibo_id;
+    item.actors[0] = n.actor_id;
+    item.actor_count = 1;
+    in.items.push_front(item);
+    in.open[group_key(n)] = in.items.begin();
+    if (unread) ++in.unread;
+    if (in.items.size() > opt_.per_user) {
+        auto last = std::prev(in.items.end());
+        auto o = in.open.find(group_key(*last));
+        if (o != in.open.end() && o->second == last) in.open.erase(o);
+        if (last->id > in.read_id && in.unread) --in.unread;
+        in.items.pop_back();
+    }
+}
+
+void Notifications::push(const Notification &n, bool persist) {
+    if (n.user_id <= 0 || n.actor_id == n.user_id) return;
+    Shard &sh = shard_of(n.user_id);
+    {
+        std::lock_guard<std::mutex> lk(sh.mu);
+        Inbox &in = inbox_locked(sh, n.user_id);
+        if (in.loaded) {
+            fold(in, n);
+        } else {
+            in.early.push_back(n);
+            if (in.early.size() > opt_.load_events) in.early.erase(in.early.begin());
+        }
+        if (persist) ++in.unsaved;
+        evict_locked(sh);
+    }
+    if (!persist) return;
+
+    bool queued = false;
+    {
+        std::lock_guard<std::mutex> lk(pending_mu_);
+        if (pending_.size() < opt_.max_pending) {
+            pending_.push_back(n);
+            queued = true;
+            if (pending_.size() >= opt_.max_batch) pending_cv_.notify_one();
+        }
+    }
+    if (!queued) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.inboxes.find(n.user_id);
+        if (it != sh.inboxes.end() && it->second.unsaved) --it->second.unsaved;
+    }
+}
+
+bool Notifications::with_inbox(long long user_id, const std::function<void(Inbox &)> &f, std::string &err) {
+    Shard &sh = shard_of(user_id);
+    {
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.inboxes.find(user_id);
+        if (it != sh.inboxes.end() && it->second.loaded) {
+            sh.lru.splice(sh.lru.begin(), sh.lru, it->second.lru);
+            f(it->second);
+            return true;
+        }
+    }
+
+    std::vector<Notification> events;
+    long long read_id = 0;
+    if (!loader_(user_id, opt_.load_events, events, read_id, err)) return false;
+    loads_.fetch_add(1, std::memory_order_relaxed);
+
+    std::lock_guard<std::mutex> lk(sh.mu);
+    Inbox &in = inbox_locked(sh, user_id);
+    if (!in.loaded) {
+        // events pushed meanwhile may or may not have been saved before the query
+        events.insert(events.end(), in.early.begin(), in.early.end());
+        std::sort(events.begin(), events.end(),
+                  [](const Notification &x, const Notification &y) { return x.notification_id < y.notification_id; });
+        events.erase(std::unique(events.begin(), events.end(),
+                                 [](const Notification &x, const Notification &y) {
+                                     return x.notification_id == y.notification_id;
+                                 }),
+                     events.end());
+        in.read_id = std::max(in.read_id, read_id);
+        for (const Notification &n : events) fold(in, n);
+        in.early.clear();
+        in.early.shrink_to_fit();
+        in.loaded = true;
+    }
+    f(in);
+    evict_locked(sh);
+    return true;
+}
+
+bool Notifications::page(long long user_id, long long before, size_t limit, Page &out, std::string &err) {
+    out = Page();
+    return with_inbox(user_id, [&](Inbox &in) {
+        out.unread = in.unread;
+        for (const Item &item : in.items) {
+            if (before > 0 && item.id >= before) continue;
+            if (out.items.size() == limit) {
+                out.next_before = out.items.back().id;
+                break;
+            }
+            out.items.push_back(item);
+            out.items.back().unread = item.id > in.read_id;
+        }
+    }, err);
+}
+
+bool Notifications::unread(long long user_id, uint32_t &count, std::string &err) {
+    return with_inbox(user_id, [&](Inbox &in) { count = in.unread; }, err);
+}
+
+bool Notifications::mark_read(long long user_id, long long &read_id, std::string &err) {
+    return with_inbox(user_id, [&](Inbox &in) {
+        in.read_id = std::max(in.read_id, in.newest);
+        in.unread = 0;
+        read_id = in.read_id;
+    }, err);
+}
+
+void Notifications::run() {
+    std::unique_lock<std::mutex> lk(pending_mu_);
+    for (;;) {
+        pending_cv_.wait_for(lk, std::chrono::milliseconds(opt_.flush_interval_ms),
+                             [&] { return stopping_ || pending_.size() >= opt_.max_batch; });
+        if (pending_.empty()) {
+            if (stopping_) return;
+            continue;
+        }
+        std::vector<Notification> batch;
+        if (pending_.size() <= opt_.max_batch) {
+            batch.swap(pending_);
+        } else {
+            batch.assign(pending_.begin(), pending_.begin() + opt_.max_batch);
+            pending_.erase(pending_.begin(), pending_.begin() + opt_.max_batch);
+        }
+        lk.unlock();
+        flush(batch);
+        lk.lock();
+        // a failed batch went back to the front; wait before retrying it
+        if (!batch.empty()) pending_cv_.wait_for(lk, std::chrono::milliseconds(opt_.flush_interval_ms),
+                                                  [&] { return stopping_; });
+    }
+}
+
+void Notifications::flush(std::vector<Notification> &batch) {
+    // a repeated follow reports the existing row's id again
+    std::vector<Notification> rows(batch);
+    std::sort(rows.begin(), rows.end(),
+              [](const Notification &x, const Notification &y) { return x.notification_id < y.notification_id; });
+    rows.erase(std::unique(rows.begin(), rows.end(),
+                           [](const Notification &x, const Notification &y) {
+                               return x.notification_id == y.notification_id;
+                           }),
+               rows.end());
+    std::string err;
+    if (saver_(rows, err)) {
+        saved_.fetch_add(rows.size(), std::memory_order_relaxed);
+    } else {
+        std::cerr << "notification save error: " << err << "\n";
+        {
+            std::lock_guard<std::mutex> lk(pending_mu_);
+            if (!stopping_ && pending_.size() + batch.size() <= opt_.max_pending) {
+                pending_.insert(pending_.begin(), batch.begin(), batch.end());
+                return;   // batch stays non-empty: retry later
+            }
+        }
+        dropped_.fetch_add(batch.size(), std::memory_order_relaxed);
+    }
+    for (const Notification &n : batch) {
+        Shard &sh = shard_of(n.user_id);
+        std::lock_guard<std::mutex> lk(sh.mu);
+        auto it = sh.inboxes.find(n.user_id);
+        if (it != sh.inboxes.end() && it->second.unsaved) --it->second.unsaved;
+    }
+    batch.clear();
+}
+
+Notifications::Stats Notifications::stats() const {
+    Stats st{};
+    for (const Shard &sh : shards_) {
+        std::lock_guard<std::mutex> lk(sh.mu);
+        st.users += sh.inboxes.size();
+    }
+    st.loads = loads_.load(std::memory_order_relaxed);
+    st.saved = saved_.load(std::memory_order_relaxed);
+    st.dropped = dropped_.load(std::memory_order_relaxed);
+    return st;
+}
+
+} // namespace YUYU
@@ -0,0 +1,103 @@
+#include "rate_limit.h"
+#include <algorithm>
+#include <cmath>
+
+namespace YUYU {
+
+namespace {
+
+constexpr int kProbe = 8;
+constexpr int kTokenBits = 24;
+constexpr uint64_t kTokenMask = (uint64_t(1) << kTokenBits) - 1;
+constexpr uint64_t kOne = 1000;   // one token, in thousandths
+
+uint64_t mix(uint64_t x) {
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+uint64_t pack(uint64_t ms, uint64_t tokens) { return (ms << kTokenBits) | (tokens & kTokenMask); }
+uint64_t time_of(uint64_t s) { return s >> kTokenBits; }
+uint64_t tokens_of(uint64_t s) { return s & kTokenMask; }
+
+} // namespace
+
+RateLimiter::RateLimiter(size_t slots) : epoch_(std::chrono::steady_clock::now()) {
+    size_t n = 1024;
+    while (n < slots) n <<= 1;
+    mask_ = n - 1;
+    slots_.reset(new Slot[n]);
+}
+
+uint64_t RateLimiter::now_ms() const {
+    // +1 so that a refill time of 0 never occurs for a live bucket
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - epoch_).count()) + 1;
+}
+
+uint64_t RateLimiter::subject_of(long long user_id) {
+    return mix(static_cast<uint64_t>(user_id) ^ 0x7573657200000000ULL);   // "user"
+}
+
+uint64_t RateLimiter::subject_of(const std::string &remote_addr) {
+    uint64_t h = 0xcbf29ce484222325ULL;   // FNV-1a
+    for (unsigned char c : remote_addr) { h ^= c; h *= 0x100000001b3ULL; }
+    return mix(h);
+}
+
+int RateLimiter::acquire(const Policy &p, uint64_t subject) {
+    const uint64_t burst = static_cast<uint64_t>(p.burst) * kOne;
+    const uint64_t key = mix(subject ^ (uint64_t(p.id) * 0x9e3779b97f4a7c15ULL)) | 1;
+    const uint64_t now = now_ms();
+    const size_t home = static_cast<size_t>(key) & mask_;
+
+    Slot *slot = nullptr;
+    Slot *oldest = nullptr;
+    uint64_t oldest_key = 0, oldest_time = ~uint64_t(0);
+    for (int i = 0; i < kProbe && !slot; ++i) {
+        Slot &s = slots_[(home + i) & mask_];
+        uint64_t k = s.key.load(std::memory_order_acquire);
+        if (k == key) {
+            slot = &s;
+        } else if (k == 0) {
+            if (s.key.compare_exchange_strong(k, key, std::memory_order_acq_rel)) {
+                s.state.store(pack(now, burst), std::memory_order_release);
+                slot = &s;
+            } else if (k == key) {
+                slot = &s;   // another request for the same subject claimed it
+            }
+        } else {
+            uint64_t t = time_of(s.state.load(std::memory_order_relaxed));
+            if (t < oldest_time) { oldest_time = t; oldest = &s; oldest_key = k; }
+        }
+    }
+    if (!slot) {
+        if (!oldest || !oldest->key.compare_exchange_strong(oldest_key, key, std::memory_order_acq_rel)) {
+            return 0;
+        }
+        oldest->state.store(pack(now, burst), std::memory_order_release);
+        slot = oldest;
+    }
+
+    uint64_t cur = slot->state.load(std::memory_order_acquire);
+    for (;;) {
+        uint64_t t = time_of(cur);
+        uint64_t tokens = tokens_of(cur);
+        if (now > t) {
+            double add = static_cast<double>(now - t) * p.per_sec;   // thousandths per ms == tokens per s
+            tokens = add >= static_cast<double>(burst - std::min(tokens, burst))
+                ? burst : tokens + static_cast<uint64_t>(add);
+        }
+        if (tokens < kOne) {
+            double wait_ms = p.per_sec > 0 ? static_cast<double>(kOne - tokens) / p.per_sec : 3600000.0;
+            return std::max(1, static_cast<int>(std::ceil(wait_ms / 1000.0)));
+        }
+        uint64_t next = pack(now > t ? now : t, tokens - kOne);
+        if (slot->state.compare_exchange_weak(cur, next, std::memory_order_acq_rel, std::memory_order_acquire)) return 0;
+    }
+}
+
+} // namespace YUYU
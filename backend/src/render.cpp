@@ -0,0 +1,193 @@
+#include "render.h"
+#include "json_writer.h"
+#include <algorithm>
+#include <unordered_map>
+
+namespace YUYU {
+
+namespace {
+
+void write_message(JsonWriter &w, const Message &m) {
+    w.begin_object();
+    w.key("message_id").value(m.message_id);
+    w.key("from").value(m.sender_id);
+    w.key("to").value(m.recipient_id);
+    w.key("text").value(m.text);
+    w.key("created_ms").value(m.created_ms);
+    w.end_object();
+}
+
+} // namespace
+
+void render_weibos(const WeiboList &list, std::string &out) {
+    out.clear();
+    out.reserve(list.size() * 200 + list.content.bytes() + list.media.bytes() + list.media_full.bytes() +
+                list.username.bytes() + list.avatar.bytes() + 16);
+    JsonWriter w(out);
+    w.begin_object().key("weibos").begin_array();
+    for (size_t i = 0; i < list.size(); ++i) {
+        w.begin_object();
+        w.key("weibo_id").value(list.weibo_id[i]);
+        w.key("user_id").value(list.user_id[i]);
+        w.key("username").value(list.username[i]);
+        w.key("avatar").value(list.avatar[i]);
+        w.key("content").value(list.content[i]);
+        w.key("media").value(list.media[i]);
+        w.key("created_at").value(list.created_ms[i]);
+        w.key("like_count").value(list.like_count[i]);
+        w.key("comment_count").value(list.comment_count[i]);
+        w.key("media_full").value(list.media_full[i]);
+        w.end_object();
+    }
+    w.end_array().end_object();
+}
+
+void render_comments(const std::vector<Comment> &comments, std::string &out) {
+    out.clear();
+    out.reserve(comments.size() * 200 + 16);
+    JsonWriter w(out);
+    w.begin_object().key("comments").begin_array();
+    for (const Comment &c : comments) {
+        w.begin_object();
+        w.key("comment_id").value(c.comment_id);
+        w.key("user_id").value(c.user_id);
+        w.key("username").value(c.username);
+        w.key("avatar").value(c.avatar);
+        w.key("content").value(c.content);
+        w.key("parent_id").value(c.parent_id);
+        w.key("created_at").value(c.created_ms);
+        w.end_object();
+    }
+    w.end_array().end_object();
+}
+
+void render_users(const std::vector<User> &users, std::string &out) {
+    out.clear();
+    out.reserve(users.size() * 48 + 16);
+    JsonWriter w(out);
+    w.begin_object().key("users").begin_array();
+    for (const User &u : users) {
+        w.begin_object();
+        w.key("user_id").value(u.user_id);
+        w.key("username").value(u.username);
+        w.end_object();
+    }
+    w.end_array().end_object();
+}
+
+void render_user_info(const User &user, std::string &out) {
+    out.clear();
+    JsonWriter w(out);
+    w.begin_object().key("ok").value(true);
+    w.key("data").begin_object();
+    w.key("user_id").value(user.user_id);
+    w.key("username").value(user.username);
+    w.key("avatar").value(user.avatar);
+    w.end_object().end_object();
+}
+
+void render_weibo_ids(const std::vector<long long> &ids, std::string &out) {
+    out.clear();
+    out.reserve(ids.size() * 18 + 16);
+    JsonWriter w(out);
+    w.begin_object().key("weibo_ids").begin_array();
+    for (long long id : ids) w.value(id);
+    w.end_array().end_object();
+}
+
+void render_notifications(const Notifications::Page &page, const std::vector<User> &users, std::string &out) {
+    static const char *const kTypes[] = {"", "like", "comment", "follow"};
+    std::unordered_map<long long, const User *> by_id;
+    by_id.reserve(users.size());
+    for (const User &u : users) by_id.emplace(u.user_id, &u);
+    out.clear();
+    out.reserve(page.items.size() * 240 + 64);
+    JsonWriter w(out);
+    w.begin_object().key("ok").value(true);
+    w.key("unread").value(static_cast<long long>(page.unread));
+    w.key("next_before").value(page.next_before);
+    w.key("notifications").begin_array();
+    for (const Notifications::Item &item : page.items) {
+        w.begin_object();
+        w.key("id").value(item.id);
+        w.key("type").value(item.kind >= 1 && item.kind <= 3 ? kTypes[item.kind] : "");
+        w.key("weibo_id").value(item.weibo_id);
+        w.key("count").value(static_cast<long long>(item.actor_count));
+        w.key("unread").value(item.unread);
+        w.key("actors").begin_array();
+        for (size_t i = 0; i < std::min<size_t>(item.actor_count, Notifications::kActors); ++i) {
+            auto it = by_id.find(item.actors[i]);
+            if (it == by_id.end()) continue;
+            w.begin_object();
+            w.key("user_id").value(it->second->user_id);
+            w.key("username").value(it->second->username);
+            w.key("avatar").value(it->second->avatar);
+            w.end_object();
+        }
+        w.end_array();
+        w.end_object();
+    }
+    w.end_array().end_object();
+}
+
+void render_message(const Message &m, std::string &out) {
+    out.clear();
+    out.reserve(m.text.size() + 128);
+    JsonWriter w(out);
+    write_message(w, m);
+}
+
+void render_messages(const std::vector<Message> &messages, long long next_before, std::string &out) {
+    size_t bytes = 64;
+    for (const Message &m : messages) bytes += m.text.size() + 120;
+    out.clear();
+    out.reserve(bytes);
+    JsonWriter w(out);
+    w.begin_object().key("ok").value(true);
+    w.key("next_before").value(next_before);
+    w.key("messages").begin_array();
+    for (const Message &m : messages) write_message(w, m);
+    w.end_array().end_object();
+}
+
+void render_conversations(const std::vector<MessageStore::Conversation> &convs, uint32_t unread,
+                          const std::vector<User> &users, std::string &out) {
+    std::unordered_map<long long, const User *> by_id;
+    by_id.reserve(users.size());
+    for (const User &u : users) by_id.emplace(u.user_id, &u);
+    out.clear();
+    out.reserve(convs.size() * 160 + 64);
+    JsonWriter w(out);
+    w.begin_object().key("ok").value(true);
+    w.key("unread").value(static_cast<long long>(unread));
+    w.key("conversations").begin_array();
+    for (const MessageStore::Conversation &c : convs) {
+        auto it = by_id.find(c.peer_id);
+        if (it == by_id.end()) continue;
+        w.begin_object();
+        w.key("user_id").value(c.peer_id);
+        w.key("username").value(it->second->username);
+        w.key("avatar").value(it->second->avatar);
+        w.key("last_message_id").value(c.last_message_id);
+        w.key("unread").value(static_cast<long long>(c.unread));
+        w.end_object();
+    }
+    w.end_array().end_object();
+}
+
+void render_deliveries(const std::vector<MessageStore::Delivery> &deliveries, uint64_t seq, bool resync,
+                       std::string &out) {
+    size_t bytes = 64;
+    for (const MessageStore::Delivery &d : deliveries) bytes += d.message->text.size() + 120;
+    out.clear();
+    out.reserve(bytes);
+    JsonWriter w(out);
+    w.begin_object().key("ok").value(true);
+    w.key("seq").value(static_cast<long long>(seq));
+    w.key("resync").value(resync);
+    w.key("messages").begin_array();
+    for (const MessageStore::Delivery &d : deliveries) write_message(w, *d.message);
+    w.end_array().end_object();
+}
+
+} // namespace YUYU
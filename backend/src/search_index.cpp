@@ -0,0 +1,386 @@
+#include "search_index.h"
+#include "snapshot.h"
+#include <algorithm>
+#include <climits>
+#include <mutex>
+
+namespace YUYU {
+
+namespace {
+
+const uint32_t UNIGRAM = 0xFFFFFFFFu;
+// Never produced by tokenize(): the list of every indexed id, which tells a
+// first add from a repeated one and a real removal from an unknown id.
+const uint64_t ALL_DOCS = 0;
+
+void put_varint(std::vector<uint8_t> &out, uint64_t v) {
+    while (v >= 0x80) { out.push_back(static_cast<uint8_t>(v | 0x80)); v >>= 7; }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+uint64_t get_varint(const uint8_t *&p) {
+    uint64_t v = 0;
+    int shift = 0;
+    while (*p & 0x80) { v |= uint64_t(*p++ & 0x7F) << shift; shift += 7; }
+    v |= uint64_t(*p++) << shift;
+    return v;
+}
+
+// Decodes one UTF-8 sequence; invalid bytes come back as U+FFFD.
+uint32_t next_codepoint(const std::string &s, size_t &i) {
+    unsigned char c = static_cast<unsigned char>(s[i++]);
+    if (c < 0x80) return c;
+    int extra = c >= 0xF0 ? 3 : c >= 0xE0 ? 2 : c >= 0xC0 ? 1 : -1;
+    if (extra < 0 || i + extra > s.size()) return 0xFFFD;
+    uint32_t cp = c & (0x3F >> extra);
+    for (int k = 0; k < extra; ++k) {
+        unsigned char cc = static_cast<unsigned char>(s[i]);
+        if ((cc & 0xC0) != 0x80) return 0xFFFD;
+        cp = (cp << 6) | (cc & 0x3F);
+        ++i;
+    }
+    return cp;
+}
+
+// Folds case and full-width ASCII; returns 0 for separators.
+uint32_t normalize(uint32_t cp) {
+    if (cp >= 0xFF01 && cp <= 0xFF5E) cp -= 0xFEE0; // full-width ASCII
+    if (cp < 0x80) {
+        if (cp >= 'A' && cp <= 'Z') return cp + 32;
+        if ((cp >= 'a' && cp <= 'z') || (cp >= '0' && cp <= '9')) return cp;
+        return 0;
+    }
+    if ((cp >= 0x2000 && cp <= 0x206F) ||   // general punctuation
+        (cp >= 0x3000 && cp <= 0x303F) ||   // CJK symbols and punctuation
+        (cp >= 0xFE30 && cp <= 0xFE4F) ||   // CJK compatibility forms
+        (cp >= 0xFF5F && cp <= 0xFF65) ||   // half-width CJK punctuation
+        cp == 0xFFFD || cp == 0x00A0) return 0;
+    return cp;
+}
+
+// Cursor over one posting list walking ids in descending order.
+class Cursor {
+public:
+    explicit Cursor(const SearchIndex::PostingList &pl)
+        : pl_(pl), block_(static_cast<long long>(pl.skips.size()) - 1) {}
+
+    // Largest id <= target, or 0 when there is none.
+    long long seek_leq(long long target) {
+        long long best = 0;
+        const auto &p = pl_.pending;
+        if (!p.empty()) {
+            auto it = std::upper_bound(p.begin(), p.end(), target);
+            if (it != p.begin()) best = *(it - 1);
+        }
+        return std::max(best, seek_blocks(target));
+    }
+
+private:
+    long long seek_blocks(long long target) {
+        const auto &sk = pl_.skips;
+        if (block_ < 0) return 0;
+        if (sk[block_].first > target) {
+            // gallop towards the front, then binary search the bracket
+            long long hi = block_, step = 1, lo = block_ - step;
+            while (lo >= 0 && sk[lo].first > target) { hi = lo; step <<= 1; lo = block_ - step; }
+            if (lo < 0) lo = -1;
+            while (hi - lo > 1) {
+                long long mid = lo + (hi - lo) / 2;
+                if (sk[mid].first > target) hi = mid; else lo = mid;
+            }
+            block_ = lo;
+            if (block_ < 0) return 0;
+        }
+        const SearchIndex::Skip &s = sk[block_];
+        if (target >= s.last) return s.last;
+        if (decoded_ != block_) {
+            pl_.decode_block(static_cast<size_t>(block_), buf_);
+            decoded_ = block_;
+        }
+        auto it = std::upper_bound(buf_.begin(), buf_.end(), target);
+        return *(it - 1); // target >= s.first, so it != begin
+    }
+
+    const SearchIndex::PostingList &pl_;
+    long long block_;
+    long long decoded_ = -1;
+    std::vector<long long> buf_;
+};
+
+} // namespace
+
+// ---------------- PostingList ----------------
+
+void SearchIndex::PostingList::append(long long id) {
+    if (skips.empty() || skips.back().count == static_cast<uint32_t>(BLOCK)) {
+        skips.push_back({id, id, static_cast<uint32_t>(data.size()), 1});
+        put_varint(data, static_cast<uint64_t>(id));
+    } else {
+        Skip &s = skips.back();
+        put_varint(data, static_cast<uint64_t>(id - s.last));
+        s.last = id;
+        ++s.count;
+    }
+    ++count;
+}
+
+bool SearchIndex::PostingList::insert(long long id) {
+    if (!skips.empty() && id == skips.back().last) return false;
+    if (skips.empty() || id > skips.back().last) {
+        if (pending.empty() || id > pending.back()) { append(id); return true; }
+    }
+    if (contains(id)) return false;
+    auto it = std::lower_bound(pending.begin(), pending.end(), id);
+    pending.insert(it, id);
+    ++count;
+    if (pending.size() > static_cast<size_t>(BLOCK)) {
+        std::vector<long long> ids;
+        all(ids);
+        rebuild(ids);
+    }
+    return true;
+}
+
+bool SearchIndex::PostingList::contains(long long id) const {
+    if (std::binary_search(pending.begin(), pending.end(), id)) return true;
+    auto it = std::upper_bound(skips.begin(), skips.end(), id, [](long long v, const Skip &s) { return v < s.first; });
+    if (it == skips.begin()) return false;
+    size_t b = static_cast<size_t>(it - skips.begin()) - 1;
+    if (id > skips[b].last) return false;
+    std::vector<long long> block;
+    decode_block(b, block);
+    return std::binary_search(block.begin(), block.end(), id);
+}
+
+void SearchIndex::PostingList::decode_block(size_t b, std::vector<long long> &out) const {
+    const Skip &s = skips[b];
+    out.resize(s.count);
+    const uint8_t *p = data.data() + s.offset;
+    long long v = static_cast<long long>(get_varint(p));
+    out[0] = v;
+    for (uint32_t i = 1; i < s.count; ++i) {
+        v += static_cast<long long>(get_varint(p));
+        out[i] = v;
+    }
+}
+
+void SearchIndex::PostingList::all(std::vector<long long> &out) const {
+    out.clear();
+    out.reserve(count);
+    std::vector<long long> block;
+    for (size_t b = 0; b < skips.size(); ++b) {
+        decode_block(b, block);
+        out.insert(out.end(), block.begin(), block.end());
+    }
+    if (!pending.empty()) {
+        size_t mid = out.size();
+        out.insert(out.end(), pending.begin(), pending.end());
+        std::inplace_merge(out.begin(), out.begin() + mid, out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+}
+
+void SearchIndex::PostingList::rebuild(const std::vector<long long> &ids) {
+    data.clear();
+    skips.clear();
+    pending.clear();
+    count = 0;
+    for (long long id : ids) append(id);
+    data.shrink_to_fit();
+}
+
+// ---------------- SearchIndex ----------------
+
+void SearchIndex::tokenize(const std::string &text, bool query, std::vector<uint64_t> &keys) {
+    keys.clear();
+    uint32_t prev = 0;
+    size_t run = 0;
+    uint32_t first = 0;
+    auto end_run = [&] {
+        if (query && run == 1) keys.push_back((uint64_t(first) << 32) | UNIGRAM);
+        run = 0;
+        prev = 0;
+    };
+    for (size_t i = 0; i < text.size();) {
+        uint32_t cp = normalize(next_codepoint(text, i));
+        if (!cp) { end_run(); continue; }
+        if (!query) keys.push_back((uint64_t(cp) << 32) | UNIGRAM);
+        if (run == 0) first = cp;
+        else keys.push_back((uint64_t(prev) << 32) | cp);
+        prev = cp;
+        ++run;
+    }
+    end_run();
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+void SearchIndex::add(long long weibo_id, const std::string &content) {
+    std::vector<uint64_t> keys;
+    tokenize(content, false, keys);
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    deleted_.erase(weibo_id);
+    for (uint64_t k : keys) lists_[k].insert(weibo_id);
+    if (lists_[ALL_DOCS].insert(weibo_id)) ++docs_;
+    last_id_ = std::max(last_id_, weibo_id);
+}
+
+void SearchIndex::remove(long long weibo_id) {
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    auto all = lists_.find(ALL_DOCS);
+    if (all == lists_.end() || !all->second.contains(weibo_id)) return;
+    if (!deleted_.insert(weibo_id).second) return;
+    if (deleted_.size() > std::max<size_t>(1024, docs_ / 8)) compact_locked();
+}
+
+void SearchIndex::compact_locked() {
+    std::vector<long long> ids, kept;
+    for (auto it = lists_.begin(); it != lists_.end();) {
+        it->second.all(ids);
+        kept.clear();
+        for (long long id : ids) if (!deleted_.count(id)) kept.push_back(id);
+        if (kept.empty()) { it = lists_.erase(it); continue; }
+        if (kept.size() != ids.size() || !it->second.pending.empty()) it->second.rebuild(kept);
+        ++it;
+    }
+    // only indexed ids are tombstoned
+    docs_ -= std::min(docs_, deleted_.size());
+    deleted_.clear();
+}
+
+std::vector<long long> SearchIndex::search(const std::string &query, size_t limit) const {
+    std::vector<long long> out;
+    std::vector<uint64_t> keys;
+    tokenize(query, true, keys);
+    if (keys.empty() || limit == 0) return out;
+
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    std::vector<const PostingList*> lists;
+    for (uint64_t k : keys) {
+        auto it = lists_.find(k);
+        if (it == lists_.end()) return out;
+        lists.push_back(&it->second);
+    }
+    // drive the intersection from the rarest term
+    std::sort(lists.begin(), lists.end(), [](const PostingList *a, const PostingList *b) { return a->count < b->count; });
+    std::vector<Cursor> cursors;
+    cursors.reserve(lists.size());
+    for (auto *pl : lists) cursors.emplace_back(*pl);
+
+    long long target = LLONG_MAX;
+    while (out.size() < limit && target > 0) {
+        long long cand = cursors[0].seek_leq(target);
+        if (cand <= 0) break;
+        bool match = true;
+        for (size_t i = 1; i < cursors.size(); ++i) {
+            long long v = cursors[i].seek_leq(cand);
+            if (v != cand) { match = false; target = v; break; }
+        }
+        if (!match) continue;
+        if (!deleted_.count(cand)) out.push_back(cand);
+        target = cand - 1;
+    }
+    return out;
+}
+
+size_t SearchIndex::doc_count() const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    return docs_ - std::min(docs_, deleted_.size());
+}
+
+size_t SearchIndex::token_count() const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    return lists_.size() - lists_.count(ALL_DOCS);
+}
+
+size_t SearchIndex::memory_bytes() const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    size_t n = 0;
+    for (auto &kv : lists_) {
+        n += sizeof(kv) + kv.second.data.capacity() + kv.second.skips.capacity() * sizeof(Skip)
+           + kv.second.pending.capacity() * sizeof(kv.second.pending[0]);
+    }
+    return n;
+}
+
+long long SearchIndex::last_id() const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    return last_id_;
+}
+
+void SearchIndex::save(std::string &out) const {
+    std::shared_lock<std::shared_mutex> lk(mu_);
+    SnapshotOut w(out);
+    w.u64(docs_);
+    w.i64(last_id_);
+    w.u64(deleted_.size());
+    for (long long id : deleted_) w.i64(id);
+    w.u64(lists_.size());
+    for (const auto &kv : lists_) {
+        const PostingList &pl = kv.second;
+        w.u64(kv.first);
+        w.u32(pl.count);
+        w.u64(pl.skips.size());
+        for (const Skip &sk : pl.skips) {
+            w.i64(sk.first);
+            w.i64(sk.last);
+            w.u32(sk.offset);
+            w.u32(sk.count);
+        }
+        w.u64(pl.pending.size());
+        for (long long id : pl.pending) w.i64(id);
+        w.u64(pl.data.size());
+        w.bytes(pl.data.data(), pl.data.size());
+    }
+}
+
+bool SearchIndex::load(const char *data, size_t size) {
+    // every count is checked against the bytes left before anything is sized by it
+    SnapshotIn r(data, size);
+    auto fits = [&](uint64_t n, size_t each) { return r.ok() && n <= size / each; };
+    std::unordered_map<uint64_t, PostingList> lists;
+    std::unordered_set<long long> deleted;
+    size_t docs = static_cast<size_t>(r.u64());
+    long long last_id = r.i64();
+    uint64_t n = r.u64();
+    if (!fits(n, 8)) return false;
+    deleted.reserve(static_cast<size_t>(n));
+    for (uint64_t i = 0; i < n; ++i) deleted.insert(r.i64());
+    n = r.u64();
+    if (!fits(n, 32)) return false;
+    lists.reserve(static_cast<size_t>(n));
+    for (uint64_t i = 0; i < n && r.ok(); ++i) {
+        PostingList &pl = lists[r.u64()];
+        pl.count = r.u32();
+        uint64_t m = r.u64();
+        if (!fits(m, 24)) return false;
+        pl.skips.resize(static_cast<size_t>(m));
+        for (Skip &sk : pl.skips) {
+            sk.first = r.i64();
+            sk.last = r.i64();
+            sk.offset = r.u32();
+            sk.count = r.u32();
+        }
+        m = r.u64();
+        if (!fits(m, 8)) return false;
+        pl.pending.resize(static_cast<size_t>(m));
+        for (long long &id : pl.pending) id = r.i64();
+        m = r.u64();
+        const char *bytes = r.bytes(static_cast<size_t>(m));
+        if (!bytes) return false;
+        pl.data.assign(bytes, bytes + m);
+        for (const Skip &sk : pl.skips) {
+            if (sk.offset >= pl.data.size() || sk.count == 0 || sk.count > static_cast<uint32_t>(BLOCK)) return false;
+        }
+    }
+    if (!r.done()) return false;
+    if (docs > 0 && !lists.count(ALL_DOCS)) return false;
+    std::unique_lock<std::shared_mutex> lk(mu_);
+    lists_.swap(lists);
+    deleted_.swap(deleted);
+    docs_ = docs;
+    last_id_ = last_id;
+    return true;
+}
+
+} // namespace YUYU
@@ -1,5 +1,25 @@
 #include "server.h"
 #include "db.h"
+#include "search_index.h"
+#include "hot_rank.h"
+#include "event_hub.h"
+#include "event_loop.h"
+#include "task_queue.h"
+#include "executor.h"
+#include "rate_limit.h"
+#include "compress.h"
+#include "versions.h"
+#include "media.h"
+#include "mapped_file.h"
+#include "kdf.h"
+#include "arena.h"
+#include "render.h"
+#include "single_flight.h"
+#include "snapshot.h"
+#include "id_gen.h"
+#include "notifications.h"
+#include "message_store.h"
+#include "stream_pump.h"
 #include <httplib.h>
 #include <nlohmann/json.hpp>
 #include <openssl/sha.h>
@@ -7,19 +27,234 @@
 #include <fstream>
 #include <sstream>
 #include <chrono>
+#include <mutex>
+#include <atomic>
 #include <cstdlib>
 #include <filesystem>
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <limits>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_set>
 
 using json = nlohmann::json;
 
 namespace YUYU {
 
+// Session tokens (token -> user_id): read on every request by the rate
+// limits and read-your-writes routing, written at register and login.
+class TokenTable {
+public:
+    long long find(const std::string &token) const {
+        std::shared_lock<std::shared_mutex> lk(mu_);
+        auto it = tokens_.find(token);
+        return it != tokens_.end() ? it->second : 0;
+    }
+    void put(const std::string &token, long long user_id) {
+        std::unique_lock<std::shared_mutex> lk(mu_);
+        tokens_[token] = user_id;
+    }
+
+private:
+    mutable std::shared_mutex mu_;
+    std::unordered_map<std::string,long long> tokens_;
+};
+
 struct Server::Impl {
+    // Other nodes' writes, per key in commit order; declared before db so it
+    // outlives the listener thread that feeds it.
+    ChangeBus changes;
     Database db;
-    httplib::Server svr;
-    std::unordered_map<std::string,long> tokens; // token -> user_id
+    DispatchServer svr;
+    TokenTable tokens;
+    SearchIndex search;
+    HotRanker hot;
+    EventHub hub;
+    // Feeds the streams and long-polls handed back to the epoll front end,
+    // keyed 0 for /api/stream and by user for messages. run() stops it once
+    // the listener is down; it outlives the message store, whose writers
+    // kick it until they stop.
+    StreamPump pump;
+    ServerOptions opt;
+    RateLimiter limiter;
+
+    // Per-resource versions bumped by writes; they drive ETags and the page
+    // cache below.
+    VersionTable versions;
+    MediaPipeline media;
+    // Inboxes for likes, comments and follows; made by init() once db is up,
+    // and destroyed before it (pending events are saved on the way out).
+    std::unique_ptr<Notifications> notifications;
+    // Private messages (ServerOptions::messages_dir); null when turned off.
+    std::unique_ptr<MessageStore> messages;
+    // Streams and long-polls that hold a worker instead (httplib's own
+    // listener), capped at a quarter of the workers by run().
+    std::atomic<int> blocking_streams{0};
+    int max_blocking_streams = 1;
+
+    // Feed pages (latest / hot), kept precompressed. Any write that can
+    // change a feed row bumps the Feed version; hot pages also expire because
+    // the ranking moves on its own.
+    struct CachedPage {
+        uint64_t version;
+        std::chrono::steady_clock::time_point expires;
+        std::shared_ptr<const PrecompressedBody> body;
+    };
+    std::mutex page_mu;
+    std::unordered_map<std::string, CachedPage> pages;
+
+    // Serves pages[key] if still current, otherwise builds it with fill()
+    // (outside the lock) and caches it.
+    bool send_page(const std::string &key, std::chrono::milliseconds ttl,
+                   const std::function<bool(std::string &out, std::string &err)> &fill,
+                   const httplib::Request &req, httplib::Response &res, std::string &err);
+
+    // A read body as built once for all the concurrent requests asking for
+    // the same thing: a hot weibo's comments, a page being rebuilt.
+    struct SharedRead {
+        bool ok = false;
+        std::string err;
+        std::shared_ptr<const PrecompressedBody> body;
+    };
+    SingleFlight<std::shared_ptr<const SharedRead>> flights;
+    // fill() for `key`, or the result of the identical call already running.
+    // Keys carry the resource versions, so a request made after a write never
+    // joins a build that started before it. `since` is when those versions
+    // last changed (VersionTable::changed): fill() reads from replicas that
+    // have replayed that far, or the primaries.
+    using Clock = std::chrono::steady_clock;
+    std::shared_ptr<const SharedRead> build(const std::string &key, Clock::time_point since,
+                                            const std::function<bool(std::string &out, std::string &err)> &fill);
+    bool send_shared(const std::string &key, Clock::time_point since,
+                     const std::function<bool(std::string &out, std::string &err)> &fill,
+                     const httplib::Request &req, httplib::Response &res, std::string &err);
+    // Snapshot of search and hot ranking (ServerOptions::snapshot_path),
+    // rewritten by `snapshotter` and at shutdown.
+    std::mutex snapshot_mu;
+    std::condition_variable snapshot_cv;
+    bool snapshot_stop = false;
+    std::thread snapshotter;
+    std::mutex snapshot_write_mu;
+    bool save_snapshot(std::string &err);
+
+    // Runs on ChangeBus lanes (ServerOptions::cdc).
+    void apply_changes(const std::vector<RowChange> &batch);
+    // Posts, likes and comments with ids below this were counted into the
+    // hot ranking by the startup replay; the change feed only ranks newer ones.
+    long long replay_before = 0;
+
+    // The front end run() is listening with, for stop().
+    std::mutex front_mu;
+    EventLoopServer *front = nullptr;
+    bool stopping = false;
+
+    // Password hashing threads, started by run().
+    std::unique_ptr<KdfPool> kdf;
+    std::unique_ptr<WorkStealingExecutor> exec;   // declared last: its jobs use the members above
 };
 
+bool Server::Impl::send_page(const std::string &key, std::chrono::milliseconds ttl,
+                             const std::function<bool(std::string &out, std::string &err)> &fill,
+                             const httplib::Request &req, httplib::Response &res, std::string &err) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t version = versions.get(VersionTable::Feed);
+    Clock::time_point since = versions.changed(VersionTable::Feed);
+    std::shared_ptr<const PrecompressedBody> body;
+    {
+        std::lock_guard<std::mutex> lk(page_mu);
+        auto it = pages.find(key);
+        if (it != pages.end() && it->second.version == version && it->second.expires > now) body = it->second.body;
+    }
+    if (!body) {
+        std::shared_ptr<const SharedRead> built = build("page:" + key + ":" + std::to_string(version), since, fill);
+        if (!built->ok) {
+            err = built->err;
+            return false;
+        }
+        body = built->body;
+        std::lock_guard<std::mutex> lk(page_mu);
+        if (pages.size() >= 256) pages.clear();
+        pages[key] = CachedPage{version, now + ttl, body};
+    }
+    PrecompressedBody::send(body, req, res, "application/json");
+    return true;
+}
+
+std::shared_ptr<const Server::Impl::SharedRead> Server::Impl::build(
+        const std::string &key, Clock::time_point since,
+        const std::function<bool(std::string &out, std::string &err)> &fill) {
+    return flights.run(key, [&] {
+        auto r = std::make_shared<SharedRead>();
+        std::string out;
+        // The result is kept under the current versions until the next bump,
+        // so it must not come from a replica still behind the write that
+        // caused the last one.
+        struct Since {
+            Clock::time_point was;
+            ~Since() { Database::read_since(was); }
+        } restore{Database::read_since(since)};
+        r->ok = fill(out, r->err);
+        if (r->ok) r->body = std::make_shared<const PrecompressedBody>(std::move(out), opt.compress_min_bytes);
+        return std::shared_ptr<const SharedRead>(std::move(r));
+    });
+}
+
+bool Server::Impl::send_shared(const std::string &key, Clock::time_point since,
+                               const std::function<bool(std::string &out, std::string &err)> &fill,
+                               const httplib::Request &req, httplib::Response &res, std::string &err) {
+    std::shared_ptr<const SharedRead> r = build(key, since, fill);
+    if (!r->ok) {
+        err = r->err;
+        return false;
+    }
+    PrecompressedBody::send(r->body, req, res, "application/json");
+    return true;
+}
+
+// The page sizes the feed routes build and cache: a requested limit is
+// rounded up to one of them, so clients cannot spread the page cache and
+// the flight keys over every possible limit.
+static int page_size(int limit) {
+    for (int n : {10, 20, 50}) if (limit <= n) return n;
+    return 100;
+}
+
+// Sets the ETag; true (with status 304) when If-None-Match already names it.
+static bool not_modified(const httplib::Request &req, httplib::Response &res, const std::string &etag,
+                         const char *cache_control = "no-cache") {
+    res.set_header("ETag", etag);
+    res.set_header("Cache-Control", cache_control);
+    if (!req.has_header("If-None-Match")) return false;
+    auto opaque = [](const std::string &t) { return t.compare(0, 2, "W/") == 0 ? t.substr(2) : t; };
+    const std::string want = opaque(etag);
+    std::stringstream ss(req.get_header_value("If-None-Match"));
+    std::string tag;
+    while (std::getline(ss, tag, ',')) {
+        size_t b = tag.find_first_not_of(" \t"), e = tag.find_last_not_of(" \t");
+        if (b == std::string::npos) continue;
+        tag = tag.substr(b, e - b + 1);
+        if (tag == "*" || opaque(tag) == want) {
+            res.status = 304;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Hashing pool full: same answer as a shed request.
+static void kdf_busy(httplib::Response &res, int retry_after_sec) {
+    res.status = 503;
+    res.set_header("Retry-After", std::to_string(retry_after_sec));
+    res.set_content(R"({"ok":false,"error":"server busy"})","application/json");
+}
+
+static long long now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
 static std::string sha256_hex(const std::string &input) {
     unsigned char hash[SHA256_DIGEST_LENGTH];
     SHA256(reinterpret_cast<const unsigned char*>(input.data()), input.size(), hash);
@@ -39,36 +274,382 @@ static std::string gen_token(){
     return sha256_hex(now + ":" + r);
 }
 
-long Server::auth_user(const httplib::Request &req) const {
+static long long bearer_user(const TokenTable &tokens, const httplib::Request &req) {
     // Authorization: Bearer <token>
     if (req.has_header("Authorization")){
         auto v = req.get_header_value("Authorization");
         const std::string pref = "Bearer ";
-        if (v.rfind(pref,0)==0){
-            auto t = v.substr(pref.size());
-            auto it = pimpl->tokens.find(t);
-            if (it!=pimpl->tokens.end()) return it->second;
-        }
+        if (v.rfind(pref,0)==0) return tokens.find(v.substr(pref.size()));
+    }
+    return 0;
+}
+
+// SSE frames for hub events.
+static void append_events(const std::vector<EventHub::Event> &events, std::string &buf) {
+    for (const auto &e : events) {
+        buf += "id: " + std::to_string(e.id) + "\nevent: " + e.type + "\ndata: " + e.data + "\n\n";
     }
+}
+
+// Write endpoints that cost a hash or a DB write. Login and register are
+// limited per client address; posting and liking per signed-in user (per
+// address when the request carries no valid token, so the legacy user_id
+// parameter cannot be used to rotate buckets).
+struct RoutePolicy {
+    const char *path;
+    bool per_user;
+    RateLimiter::Policy policy;
+};
+
+static const RoutePolicy route_policies[] = {
+    {"/api/register", false, {1, 5.0 / 60, 5}},
+    {"/api/login",    false, {2, 10.0 / 60, 10}},
+    {"/api/weibo",    true,  {3, 10.0 / 60, 10}},
+    {"/api/like",     true,  {4, 2.0, 30}},
+    {"/api/messages", true,  {5, 1.0, 20}},
+};
+
+long long Server::auth_user(const httplib::Request &req) const {
+    if (long long uid = bearer_user(pimpl->tokens, req)) return uid;
     // fallback: allow user_id in body/query (legacy)
     if (req.has_param("user_id")){
-        try{ return std::stol(req.get_param_value("user_id")); } catch(...){}
+        try{ return std::stoll(req.get_param_value("user_id")); } catch(...){}
     }
     return 0;
 }
 
+bool Server::Impl::save_snapshot(std::string &err) {
+    std::lock_guard<std::mutex> lk(snapshot_write_mu);
+    auto t0 = std::chrono::steady_clock::now();
+    // read before the state: whatever lands in between is replayed again,
+    // which the index ignores and the ranking barely notices
+    SnapshotWatermark mark;
+    mark.taken_ms = now_ms();
+    mark.last_weibo_id = search.last_id();
+    SnapshotWriter w;
+    search.save(w.section(SnapshotSearch));
+    hot.save(w.section(SnapshotHot));
+    if (!w.write(opt.snapshot_path, mark, err)) return false;
+    std::cout << "snapshot written in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count() << " ms\n";
+    return true;
+}
+
+void Server::Impl::apply_changes(const std::vector<RowChange> &batch) {
+    Database::read_primary(true);
+    bool feed = false, profiles = false;
+    std::vector<long long> posted;
+    std::vector<RowChange> engaged;   // likes and comments, for their authors' inboxes
+    for (const RowChange &c : batch) {
+        switch (c.table) {
+        case RowChange::None: {
+            // changes were missed: nothing cached can be trusted, and posts
+            // since the newest one indexed are read back
+            versions.bump_all();
+            std::string err;
+            long long after = std::min(search.last_id(), IdGenerator::first_at(now_ms() - 60000));
+            if (!db.scan_weibo_contents(after, [this](long long id, const std::string &content) { search.add(id, content); }, err))
+                std::cerr << "change resync error: " << err << "\n";
+            break;
+        }
+        case RowChange::Weibos:
+            if (c.op == RowChange::Insert) {
+                posted.push_back(c.id);
+            } else if (c.op == RowChange::Delete) {
+                search.remove(c.id);
+                hot.remove(c.id);
+                hub.publish("weibo_deleted", json({{"weibo_id",c.id}}).dump());
+            }
+            feed = true;
+            break;
+        case RowChange::Likes: {
+            if (c.op == RowChange::Update) break;
+            if (c.op == RowChange::Insert) engaged.push_back(c);
+            int delta = c.op == RowChange::Insert ? 1 : -1;
+            if (delta < 0 || c.id >= replay_before) hot.record(c.a, HotRanker::Like, now_ms(), delta);
+            hub.publish("like", json({{"weibo_id",c.a},{"user_id",c.b},{"delta",delta}}).dump());
+            feed = true;
+            break;
+        }
+        case RowChange::Comments:
+            if (c.op == RowChange::Insert) {
+                engaged.push_back(c);
+                if (c.id >= replay_before) hot.record(c.a, HotRanker::Comment, now_ms());
+                hub.publish("comment", json({{"weibo_id",c.a},{"user_id",c.b},{"delta",1}}).dump());
+            }
+            versions.bump(VersionTable::Comments, c.a);
+            feed = true;
+            break;
+        case RowChange::Follows:
+            // saved to the inbox table by the node that made the follow
+            if (c.op == RowChange::Insert)
+                notifications->push(Notification{c.id, c.b, c.a, 0, Notification::Follow}, false);
+            versions.bump(VersionTable::Followers, c.b);
+            versions.bump(VersionTable::Following, c.a);
+            break;
+        case RowChange::Users:
+            // the profile cache already dropped the user
+            versions.bump(VersionTable::User, c.id);
+            profiles = feed = true;
+            break;
+        }
+    }
+    // new posts' text and the authors of liked and commented weibos, one
+    // query for the batch
+    std::vector<long long> fetch = posted;
+    for (const RowChange &c : engaged) fetch.push_back(c.a);
+    if (!fetch.empty()) {
+        WeiboList list;
+        std::string err;
+        if (db.get_weibos_by_ids(fetch, list, err)) {
+            std::unordered_set<long long> fresh(posted.begin(), posted.end());
+            std::unordered_map<long long, long long> author;
+            for (size_t i = 0; i < list.size(); ++i) {
+                author.emplace(list.weibo_id[i], list.user_id[i]);
+                if (!fresh.erase(list.weibo_id[i])) continue;
+                search.add(list.weibo_id[i], std::string(list.content[i]));
+                if (list.weibo_id[i] >= replay_before) hot.record(list.weibo_id[i], HotRanker::Post, list.created_ms[i]);
+                hub.publish("weibo", json({{"weibo_id",list.weibo_id[i]},{"user_id",list.user_id[i]}}).dump());
+            }
+            for (const RowChange &c : engaged) {
+                auto it = author.find(c.a);
+                if (it == author.end()) continue;
+                int kind = c.table == RowChange::Likes ? Notification::Like : Notification::Comment;
+                notifications->push(Notification{c.id, it->second, c.b, c.a, kind}, false);
+            }
+        } else {
+            std::cerr << "change apply error: " << err << "\n";
+        }
+    }
+    if (profiles) versions.bump(VersionTable::Profiles);
+    if (feed) versions.bump(VersionTable::Feed);
+}
+
 Server::Server() : pimpl(new Impl()) {}
-Server::~Server(){ if(pimpl) delete pimpl; }
+Server::~Server(){
+    if (pimpl) pimpl->changes.stop();
+    if (pimpl && pimpl->snapshotter.joinable()) {
+        {
+            std::lock_guard<std::mutex> lk(pimpl->snapshot_mu);
+            pimpl->snapshot_stop = true;
+        }
+        pimpl->snapshot_cv.notify_all();
+        pimpl->snapshotter.join();
+    }
+    if(pimpl) delete pimpl;
+}
 
-bool Server::init(const std::string &conninfo) {
+bool Server::init(const std::string &conninfo, const DatabaseOptions &dbopt) {
     std::string err;
-    if (!pimpl->db.init(conninfo, err)) {
+    if (!pimpl->db.init(conninfo, dbopt, err)) {
         std::cerr << "DB init error: " << err << std::endl;
         return false;
     }
+    {
+        Notifications::Options no;
+        no.max_users = pimpl->opt.notification_users;
+        Database &db = pimpl->db;
+        pimpl->notifications.reset(new Notifications(no,
+            [&db](long long user_id, size_t limit, std::vector<Notification> &events, long long &read_id, std::string &e) {
+                return db.load_notifications(user_id, limit, events, read_id, e);
+            },
+            [&db](const std::vector<Notification> &events, std::string &e) { return db.save_notifications(events, e); }));
+        pimpl->notifications->start();
+    }
+    if (!pimpl->opt.messages_dir.empty()) {
+        MessageStore::Options mo;
+        mo.dir = pimpl->opt.messages_dir;
+        mo.fsync = pimpl->opt.messages_fsync;
+        mo.on_delivery = [this](long long user_id) { pimpl->pump.kick(static_cast<uint64_t>(user_id)); };
+        pimpl->messages.reset(new MessageStore(mo));
+        auto t0 = std::chrono::steady_clock::now();
+        if (!pimpl->messages->open(err)) {
+            std::cerr << "message log error: " << err << std::endl;
+            return false;
+        }
+        std::cout << "message log: " << pimpl->messages->stats().messages << " messages replayed in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count()
+                  << " ms\n";
+    }
+
+    // Start from the snapshot when there is an intact one; each structure
+    // that loads from it only reads back what came after the watermark.
+    auto t0 = std::chrono::steady_clock::now();
+    bool warm_search = false, warm_hot = false;
+    SnapshotWatermark mark;
+    if (!pimpl->opt.snapshot_path.empty()) {
+        std::string why;
+        std::unique_ptr<Snapshot> snap = Snapshot::open(pimpl->opt.snapshot_path, why);
+        const char *data = nullptr;
+        size_t size = 0;
+        if (snap) {
+            mark = snap->watermark();
+            warm_search = snap->section(SnapshotSearch, data, size) && pimpl->search.load(data, size);
+            warm_hot = snap->section(SnapshotHot, data, size) && pimpl->hot.load(data, size);
+            std::cout << "snapshot: " << (snap->size() >> 20) << " MiB from " << (now_ms() - mark.taken_ms) / 1000
+                      << " s ago, search " << (warm_search ? "loaded" : "unreadable") << ", hot ranking "
+                      << (warm_hot ? "loaded" : "unreadable") << " in "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count() << " ms\n";
+        } else {
+            std::cout << "snapshot not used: " << why << "\n";
+        }
+    }
+
+    // /api/stream subscribers on the epoll front end are polled by the pump
+    // (key 0) rather than waited on.
+    pimpl->hub.set_on_publish([this] { pimpl->pump.kick(0); });
+
+    // Listen before reading back, so nothing committed meanwhile is missed;
+    // what both deliver is applied twice, which search ignores. The hot
+    // ranking would count it twice, so it is split at an id taken now: the
+    // replay below ranks older rows and the change feed newer ones. Only rows
+    // still uncommitted at this moment (or from a node whose clock is behind)
+    // can fall on the wrong side and go unranked.
+    pimpl->replay_before = pimpl->opt.cdc ? IdGenerator::first_at(now_ms()) : std::numeric_limits<long long>::max();
+    if (pimpl->opt.cdc) {
+        pimpl->changes.subscribe([this](const std::vector<RowChange> &batch) { pimpl->apply_changes(batch); });
+        pimpl->changes.start();
+        if (!pimpl->db.watch_changes([this](const RowChange &c) { pimpl->changes.publish(c); }, err)) {
+            std::cerr << "change feed error: " << err << std::endl;
+            return false;
+        }
+    }
+
+    // Build the in-memory search index; /api/search never scans weibos in SQL.
+    // After a snapshot, ids from slightly before it are read again too:
+    // another node's rows may commit late, and re-adding one is a no-op.
+    // Weibos deleted meanwhile stay indexed but are dropped when the results
+    // are fetched by id.
+    t0 = std::chrono::steady_clock::now();
+    long long after_id = 0;
+    if (warm_search) after_id = std::min(mark.last_weibo_id, IdGenerator::first_at(mark.taken_ms - 30000));
+    if (!pimpl->db.scan_weibo_contents(after_id, [this](long long id, const std::string &content){ pimpl->search.add(id, content); }, err)) {
+        std::cerr << "search index build error: " << err << std::endl;
+        return false;
+    }
+    std::cout << "search index: " << pimpl->search.doc_count() << " weibos, " << pimpl->search.token_count() << " terms in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count() << " ms\n";
+
+    // Replay recent engagement into the hot ranking; older events have decayed away.
+    t0 = std::chrono::steady_clock::now();
+    size_t events = 0;
+    long long since = now_ms() - pimpl->hot.window_ms();
+    if (warm_hot) since = std::max(since, mark.taken_ms);
+    if (!pimpl->db.scan_engagement(since, pimpl->replay_before, [this, &events](long long id, int kind, long long at){
+            pimpl->hot.record(id, static_cast<HotRanker::Kind>(kind), at);
+            ++events;
+        }, err)) {
+        std::cerr << "hot ranking build error: " << err << std::endl;
+        return false;
+    }
+    pimpl->hot.refresh();
+    std::cout << "hot ranking: " << events << " events, " << pimpl->hot.tracked() << " weibos in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count() << " ms\n";
+
+    // Thumbnails are made off the request path; once a variant exists the
+    // row is pointed at it and the cached lists are invalidated.
+    if (!pimpl->media.start([this](const MediaPipeline::Job &job, const std::string &variant){
+            std::string err;
+            if (job.variant == MediaPipeline::Feed) {
+                if (!pimpl->db.set_weibo_media_thumb(job.owner_id, variant, err)) std::cerr << "media thumb error: " << err << "\n";
+            } else {
+                if (!pimpl->db.replace_user_avatar(job.owner_id, job.url, variant, err)) std::cerr << "avatar thumb error: " << err << "\n";
+                pimpl->versions.bump(VersionTable::User, job.owner_id);
+                pimpl->versions.bump(VersionTable::Profiles);
+            }
+            pimpl->versions.bump(VersionTable::Feed);
+        }, err)) {
+        std::cerr << "media storage error: " << err << std::endl;
+        return false;
+    }
 
     auto &s = pimpl->svr;
 
+    // Uploaded images and their variants are content-addressed, so they
+    // never change under a URL and the hash in the name is a strong ETag.
+    // Bodies are written straight out of a shared mapping in bounded
+    // chunks (as sendfile() regions on the epoll front end); httplib turns
+    // Range into 206 / multipart/byteranges and rejects bad ranges with 416.
+    s.Get(pimpl->media.options().url_prefix + "/.+", [this](const httplib::Request &req, httplib::Response &res){
+        auto file = pimpl->media.open(req.path);
+        if (!file) {
+            res.status = 404;
+            res.set_content(R"({"ok":false,"error":"not found"})","application/json");
+            return;
+        }
+        std::string name = req.path.substr(req.path.rfind('/') + 1);
+        std::string etag = "\"" + name.substr(0, name.find('.')) + "\"";
+        res.set_header("Accept-Ranges", "bytes");
+        if (not_modified(req, res, etag, "public, max-age=31536000, immutable")) return;
+        // A resumed download whose validator no longer matches (or is not a
+        // strong ETag) gets the whole file. httplib cuts a content provider's
+        // output to req.ranges whatever the status, but leaves a body alone
+        // unless the status is 206; uploads are at most a few MiB and this
+        // only happens for validators that never named this file.
+        if (!req.ranges.empty() && req.has_header("If-Range") && req.get_header_value("If-Range") != etag) {
+            res.status = 200;
+            res.set_content(file->data(), file->size(), MediaPipeline::content_type(req.path));
+            return;
+        }
+        if (file->size() == 0) {
+            res.set_content("", MediaPipeline::content_type(req.path));
+            return;
+        }
+        res.set_content_provider(file->size(), MediaPipeline::content_type(req.path),
+            [file](size_t offset, size_t length, httplib::DataSink &sink){
+                ZeroCopyScope scope(file);
+                const size_t chunk = 256 * 1024;
+                while (length) {
+                    size_t n = std::min(length, chunk);
+                    if (!sink.write(file->data() + offset, n)) return false;
+                    offset += n;
+                    length -= n;
+                }
+                return true;
+            });
+    });
+
+    // Requests the worker pool decided to shed (backlog full or queued past
+    // the deadline) are answered here, before any route or database work.
+    // Requests over their route's rate limit get 429 the same way.
+    s.set_pre_routing_handler([this](const httplib::Request &req, httplib::Response &res){
+        // scratch memory for this request's temporaries; given back in post-routing
+        RequestArena::begin();
+        auto verdict = BoundedTaskQueue::admit();
+        // keep-alive connection on httplib's listener while others wait for a worker
+        if (verdict == BoundedTaskQueue::Verdict::ServeAndClose) res.set_header("Connection", "close");
+        if (verdict == BoundedTaskQueue::Verdict::Shed) {
+            res.status = 503;
+            res.set_header("Retry-After", std::to_string(pimpl->opt.retry_after_sec));
+            res.set_content(R"({"ok":false,"error":"server busy"})","application/json");
+            return httplib::Server::HandlerResponse::Handled;
+        }
+        if (pimpl->opt.rate_limit && req.method == "POST") {
+            for (const auto &rp : route_policies) {
+                if (req.path != rp.path) continue;
+                long long uid = rp.per_user ? bearer_user(pimpl->tokens, req) : 0;
+                uint64_t subject = uid > 0 ? RateLimiter::subject_of(uid) : RateLimiter::subject_of(req.remote_addr);
+                if (int wait = pimpl->limiter.acquire(rp.policy, subject)) {
+                    res.status = 429;
+                    res.set_header("Retry-After", std::to_string(wait));
+                    res.set_content(R"({"ok":false,"error":"too many requests"})","application/json");
+                    return httplib::Server::HandlerResponse::Handled;
+                }
+                break;
+            }
+        }
+        // the handler runs on this thread; its reads follow this user's writes
+        Database::read_as(bearer_user(pimpl->tokens, req));
+        return httplib::Server::HandlerResponse::Unhandled;
+    });
+
+    // gzip/zstd for JSON bodies over the threshold (precompressed pages and
+    // streams are left alone).
+    s.set_post_routing_handler([this](const httplib::Request &req, httplib::Response &res){
+        RequestArena::end();
+        compress_response(req, res, pimpl->opt.compress_min_bytes);
+    });
+
     s.Post("/api/register", [this](const httplib::Request &req, httplib::Response &res){
         try {
             auto j = json::parse(req.body);
@@ -78,13 +659,16 @@ bool Server::init(const std::string &conninfo) {
             if(username.empty()||email.empty()||password.empty()){
                 res.status = 400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return;
             }
-            std::string pass_hash = sha256_hex(password);
-            long user_id=0; std::string err;
+            std::string pass_hash;
+            auto st = pimpl->kdf->hash(password, pass_hash);
+            if (st == KdfPool::Busy) { kdf_busy(res, pimpl->opt.retry_after_sec); return; }
+            if (st != KdfPool::Ok) { res.status = 500; res.set_content(R"({"ok":false,"error":"hash failed"})","application/json"); return; }
+            long long user_id=0; std::string err;
             if (!pimpl->db.create_user(username,email,pass_hash,user_id,err)){
                 res.status = 500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
             }
             auto token = gen_token();
-            pimpl->tokens[token] = user_id;
+            pimpl->tokens.put(token, user_id);
             res.set_content(json({{"ok",true},{"user_id",user_id},{"token",token}}).dump(),"application/json");
         } catch(...) { res.status=400; res.set_content(R"({"ok":false})","application/json"); }
     });
@@ -95,38 +679,62 @@ bool Server::init(const std::string &conninfo) {
             std::string email = j.value("email","");
             std::string password = j.value("password","");
             if(email.empty()||password.empty()){ res.status=400; res.set_content(R"({"ok":false})","application/json"); return; }
-            std::string pass_hash = sha256_hex(password);
-            long user_id=0;
-            if (!pimpl->db.check_user(email,pass_hash,user_id)){
+            long long user_id=0; std::string stored, err;
+            if (!pimpl->db.find_login(email,user_id,stored,err) && !err.empty()){
+                res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+            }
+            bool match=false; std::string upgraded;
+            if (pimpl->kdf->verify(password, stored, match, upgraded) == KdfPool::Busy) {
+                kdf_busy(res, pimpl->opt.retry_after_sec); return;
+            }
+            if (!match){
                 res.status=401; res.set_content(R"({"ok":false,"error":"invalid credentials"})","application/json"); return;
             }
+            // legacy sha256 or outdated scrypt parameters: store the new hash
+            if (!upgraded.empty() && !pimpl->db.set_password_hash(user_id, upgraded, err)) {
+                std::cerr << "password rehash error: " << err << "\n";
+            }
             auto token = gen_token();
-            pimpl->tokens[token] = user_id;
+            pimpl->tokens.put(token, user_id);
             res.set_content(json({{"ok",true},{"user_id",user_id},{"token",token}}).dump(),"application/json");
         }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
     });
 
     s.Get("/api/user/info", [this](const httplib::Request &req, httplib::Response &res){
-        long user_id = auth_user(req);
+        long long user_id = auth_user(req);
         if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+        auto &v = pimpl->versions;
+        if (not_modified(req, res, v.etag(VersionTable::User, user_id, v.get(VersionTable::User, user_id)))) return;
+        User user;
         std::string out, err;
-        if(!pimpl->db.get_user_info(user_id, out, err)){ 
+        if(!pimpl->db.get_user_info(user_id, user, err)){ 
             res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; 
         }
-        res.set_content(out, "application/json");
+        render_user_info(user, out);
+        res.set_content(std::move(out), "application/json");
     });
 
     s.Post("/api/weibo", [this](const httplib::Request &req, httplib::Response &res){
         try{
             auto j = json::parse(req.body);
-            long user_id = j.value("user_id", 0);
+            long long user_id = j.value("user_id", 0LL);
             std::string content = j.value("content", "");
             std::string media = j.value("media", "");
             if(user_id<=0||content.empty()){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
-            long weibo_id=0; std::string err;
+            long long weibo_id=0; std::string err;
+            // uploads are stored as files; the row keeps only their URL
+            bool resizable = false;
+            if(media.rfind("data:",0)==0 && !pimpl->media.store(media, media, resizable, err)){
+                res.status=400; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+            }
             if(!pimpl->db.create_weibo(user_id,content,media,weibo_id,err)){
                 res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
             }
+            if(resizable) pimpl->media.submit({MediaPipeline::Feed, weibo_id, media});
+            pimpl->search.add(weibo_id, content);
+            pimpl->hot.record(weibo_id, HotRanker::Post, now_ms());
+            pimpl->hub.publish("weibo", json({{"weibo_id",weibo_id},{"user_id",user_id}}).dump());
+            pimpl->versions.bump(VersionTable::Feed);
             res.set_content(json({{"ok",true},{"weibo_id",weibo_id}}).dump(),"application/json");
         }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
     });
@@ -134,14 +742,19 @@ bool Server::init(const std::string &conninfo) {
     s.Post("/api/comment", [this](const httplib::Request &req, httplib::Response &res){
         try{
             auto j = json::parse(req.body);
-            long user_id = auth_user(req);
+            long long user_id = auth_user(req);
             if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
-            long weibo_id = j.value("weibo_id", 0);
+            long long weibo_id = j.value("weibo_id", 0LL);
             std::string content = j.value("content", "");
-            long parent_id = j.value("parent_id", 0);
+            long long parent_id = j.value("parent_id", 0LL);
             if(weibo_id<=0 || content.empty()){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
-            long comment_id=0; std::string err;
-            if(!pimpl->db.create_comment(user_id,weibo_id,content,parent_id,comment_id,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+            long long comment_id=0, author_id=0; std::string err;
+            if(!pimpl->db.create_comment(user_id,weibo_id,content,parent_id,comment_id,author_id,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+            pimpl->notifications->push(Notification{comment_id, author_id, user_id, weibo_id, Notification::Comment});
+            pimpl->hot.record(weibo_id, HotRanker::Comment, now_ms());
+            pimpl->hub.publish("comment", json({{"weibo_id",weibo_id},{"user_id",user_id},{"delta",1}}).dump());
+            pimpl->versions.bump(VersionTable::Comments, weibo_id);
+            pimpl->versions.bump(VersionTable::Feed);
             res.set_content(json({{"ok",true},{"comment_id",comment_id}}).dump(),"application/json");
         }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
     });
@@ -150,12 +763,14 @@ bool Server::init(const std::string &conninfo) {
     s.Post("/api/comment/delete", [this](const httplib::Request &req, httplib::Response &res){
         try{
             auto j = json::parse(req.body);
-            long user_id = auth_user(req);
+            long long user_id = auth_user(req);
             if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
-            long comment_id = j.value("comment_id", 0);
+            long long comment_id = j.value("comment_id", 0LL);
             if(comment_id<=0){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
-            std::string err;
-            if(!pimpl->db.delete_comment(user_id, comment_id, err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+            std::string err; long long weibo_id=0;
+            if(!pimpl->db.delete_comment(user_id, comment_id, weibo_id, err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+            pimpl->versions.bump(VersionTable::Comments, weibo_id);
+            pimpl->versions.bump(VersionTable::Feed);
             res.set_content(json({{"ok",true}}).dump(),"application/json");
         }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
     });
@@ -164,13 +779,22 @@ bool Server::init(const std::string &conninfo) {
     s.Post("/api/user/update", [this](const httplib::Request &req, httplib::Response &res){
         try{
             auto j = json::parse(req.body);
-            long user_id = auth_user(req);
+            long long user_id = auth_user(req);
             if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
             std::string username = j.value("username", "");
             std::string avatar = j.value("avatar", "");
             if(username.empty() && avatar.empty()){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
             std::string err;
+            bool resizable = false;
+            if(avatar.rfind("data:",0)==0 && !pimpl->media.store(avatar, avatar, resizable, err)){
+                res.status=400; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+            }
             if(!pimpl->db.update_user_profile(user_id, username, avatar, err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+            if(resizable) pimpl->media.submit({MediaPipeline::Avatar, user_id, avatar});
+            // names and avatars are embedded in feed, comment and follower lists
+            pimpl->versions.bump(VersionTable::User, user_id);
+            pimpl->versions.bump(VersionTable::Profiles);
+            pimpl->versions.bump(VersionTable::Feed);
             res.set_content(json({{"ok",true}}).dump(),"application/json");
         }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
     });
@@ -178,17 +802,25 @@ bool Server::init(const std::string &conninfo) {
     s.Post("/api/like", [this](const httplib::Request &req, httplib::Response &res){
         try{
             auto j = json::parse(req.body);
-            long user_id = auth_user(req);
+            long long user_id = auth_user(req);
             if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
-            long weibo_id = j.value("weibo_id",0);
+            long long weibo_id = j.value("weibo_id",0LL);
             std::string action = j.value("action","like");
             if(weibo_id<=0){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
-            std::string err; long id=0;
+            std::string err; long long id=0;
             if(action=="like"){
-                if(!pimpl->db.add_like(user_id,weibo_id,id,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+                long long author_id=0;
+                if(!pimpl->db.add_like(user_id,weibo_id,id,author_id,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+                pimpl->notifications->push(Notification{id, author_id, user_id, weibo_id, Notification::Like});
+                pimpl->hot.record(weibo_id, HotRanker::Like, now_ms());
+                pimpl->hub.publish("like", json({{"weibo_id",weibo_id},{"user_id",user_id},{"delta",1}}).dump());
+                pimpl->versions.bump(VersionTable::Feed);
                 res.set_content(json({{"ok",true},{"like_id",id}}).dump(),"application/json");
             } else {
                 if(!pimpl->db.remove_like(user_id,weibo_id,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+                pimpl->hot.record(weibo_id, HotRanker::Like, now_ms(), -1);
+                pimpl->hub.publish("like", json({{"weibo_id",weibo_id},{"user_id",user_id},{"delta",-1}}).dump());
+                pimpl->versions.bump(VersionTable::Feed);
                 res.set_content(json({{"ok",true}}).dump(),"application/json");
             }
         }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
@@ -197,18 +829,19 @@ bool Server::init(const std::string &conninfo) {
     s.Post("/api/follow", [this](const httplib::Request &req, httplib::Response &res){
         try{
             auto j = json::parse(req.body);
-            long user_id = auth_user(req);
+            long long user_id = auth_user(req);
             if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
-            long followee = j.value("followee_id",0);
+            long long followee = j.value("followee_id",0LL);
             std::string action = j.value("action","follow");
             if(followee<=0){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
             if(followee == user_id){ res.status=400; res.set_content(R"({"ok":false,"error":"cannot follow yourself"})","application/json"); return; }
-            std::string err; long id=0;
+            std::string err; long long id=0;
             if(action=="follow"){
                 if(!pimpl->db.create_follow(user_id,followee,id,err)){
                     std::cerr << "follow create error: " << err << " follower=" << user_id << " followee=" << followee << "\n";
                     res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
                 }
+                pimpl->notifications->push(Notification{id, followee, user_id, 0, Notification::Follow});
                 res.set_content(json({{"ok",true},{"follow_id",id}}).dump(),"application/json");
             } else {
                 if(!pimpl->db.remove_follow(user_id,followee,err)){
@@ -217,70 +850,547 @@ bool Server::init(const std::string &conninfo) {
                 }
                 res.set_content(json({{"ok",true}}).dump(),"application/json");
             }
+            pimpl->versions.bump(VersionTable::Followers, followee);
+            pimpl->versions.bump(VersionTable::Following, user_id);
         }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
     });
 
     s.Post("/api/weibo/delete", [this](const httplib::Request &req, httplib::Response &res){
         try{
             auto j = json::parse(req.body);
-            long user_id = auth_user(req);
+            long long user_id = auth_user(req);
             if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
-            long weibo_id = j.value("weibo_id",0);
+            long long weibo_id = j.value("weibo_id",0LL);
             if(weibo_id<=0){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
             std::string err;
             if(!pimpl->db.delete_weibo(user_id,weibo_id,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+            pimpl->search.remove(weibo_id);
+            pimpl->hot.remove(weibo_id);
+            pimpl->hub.publish("weibo_deleted", json({{"weibo_id",weibo_id}}).dump());
+            pimpl->versions.bump(VersionTable::Comments, weibo_id);
+            pimpl->versions.bump(VersionTable::Feed);
             res.set_content(json({{"ok",true}}).dump(),"application/json");
         }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
     });
 
     s.Get("/api/followers", [this](const httplib::Request &req, httplib::Response &res){
-        long user_id = 0;
-        if (req.has_param("user_id")) try{ user_id = std::stol(req.get_param_value("user_id")); } catch(...){}
+        long long user_id = 0;
+        if (req.has_param("user_id")) try{ user_id = std::stoll(req.get_param_value("user_id")); } catch(...){}
         if(user_id<=0){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid user_id"})","application/json"); return; }
-        std::string out, err;
-        if(!pimpl->db.get_followers(user_id,out,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
-        res.set_content(out, "application/json");
+        auto &v = pimpl->versions;
+        const std::string etag = v.etag(VersionTable::Followers, user_id, v.get(VersionTable::Followers, user_id),
+                                        v.get(VersionTable::Profiles));
+        if (not_modified(req, res, etag)) return;
+        const auto since = std::max(v.changed(VersionTable::Followers, user_id), v.changed(VersionTable::Profiles));
+        std::string err;
+        if (!pimpl->send_shared("followers:" + etag, since,
+                [this, user_id](std::string &out, std::string &e) {
+                    std::vector<User> users;
+                    if (!pimpl->db.get_followers(user_id,users,e)) return false;
+                    render_users(users, out);
+                    return true;
+                },
+                req, res, err)) {
+            res.status = 500;
+            res.set_content(json({{"ok",false},{"error",err}}).dump(), "application/json");
+            return;
+        }
     });
 
     s.Get("/api/comments", [this](const httplib::Request &req, httplib::Response &res){
-        long weibo_id = 0;
-        if (req.has_param("weibo_id")) try{ weibo_id = std::stol(req.get_param_value("weibo_id")); } catch(...){}
+        long long weibo_id = 0;
+        if (req.has_param("weibo_id")) try{ weibo_id = std::stoll(req.get_param_value("weibo_id")); } catch(...){}
         if (weibo_id<=0){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid weibo_id"})","application/json"); return; }
+        auto &v = pimpl->versions;
+        const std::string etag = v.etag(VersionTable::Comments, weibo_id, v.get(VersionTable::Comments, weibo_id),
+                                        v.get(VersionTable::Profiles));
+        if (not_modified(req, res, etag)) return;
+        const auto since = std::max(v.changed(VersionTable::Comments, weibo_id), v.changed(VersionTable::Profiles));
+        std::string err;
+        if (!pimpl->send_shared("comments:" + etag, since,
+                [this, weibo_id](std::string &out, std::string &e) {
+                    std::vector<Comment> comments;
+                    if (!pimpl->db.get_comments(weibo_id,comments,e)) return false;
+                    render_comments(comments, out);
+                    return true;
+                },
+                req, res, err)) {
+            res.status = 500;
+            res.set_content(json({{"ok",false},{"error",err}}).dump(), "application/json");
+            return;
+        }
+    });
+
+    // Inbox, newest first; ?before=<next_before of the previous page>.
+    s.Get("/api/notifications", [this](const httplib::Request &req, httplib::Response &res){
+        long long user_id = bearer_user(pimpl->tokens, req);
+        if (user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+        long long before = 0;
+        int limit = 20;
+        if (req.has_param("before")) try{ before = std::stoll(req.get_param_value("before")); } catch(...){}
+        if (req.has_param("limit")) {
+            try { limit = std::stoi(req.get_param_value("limit")); } catch(...) { limit = 20; }
+        }
+        if (limit <= 0 || limit > 100) limit = 20;
+        Notifications::Page page;
         std::string out, err;
-        if(!pimpl->db.get_comments(weibo_id,out,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
-        res.set_content(out, "application/json");
+        if (!pimpl->notifications->page(user_id, before, static_cast<size_t>(limit), page, err)) {
+            res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+        }
+        std::vector<long long> actor_ids;
+        for (const auto &item : page.items)
+            for (size_t i = 0; i < std::min<size_t>(item.actor_count, Notifications::kActors); ++i) actor_ids.push_back(item.actors[i]);
+        std::sort(actor_ids.begin(), actor_ids.end());
+        actor_ids.erase(std::unique(actor_ids.begin(), actor_ids.end()), actor_ids.end());
+        std::vector<User> actors;
+        if (!pimpl->db.get_users(actor_ids, actors, err)) {
+            res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+        }
+        render_notifications(page, actors, out);
+        res.set_content(std::move(out), "application/json");
     });
 
+    // Badge count, from memory once the inbox is loaded.
+    s.Get("/api/notifications/unread", [this](const httplib::Request &req, httplib::Response &res){
+        long long user_id = bearer_user(pimpl->tokens, req);
+        if (user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+        uint32_t unread = 0;
+        std::string err;
+        if (!pimpl->notifications->unread(user_id, unread, err)) {
+            res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+        }
+        res.set_content(json({{"ok",true},{"unread",unread}}).dump(),"application/json");
+    });
+
+    s.Post("/api/notifications/read", [this](const httplib::Request &req, httplib::Response &res){
+        long long user_id = bearer_user(pimpl->tokens, req);
+        if (user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+        long long read_id = 0;
+        std::string err;
+        if (!pimpl->notifications->mark_read(user_id, read_id, err) ||
+            !pimpl->db.set_notifications_read(user_id, read_id, err)) {
+            res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+        }
+        res.set_content(json({{"ok",true}}).dump(),"application/json");
+    });
+
+    // Private messages; the routes exist only when the message log is on.
+    if (pimpl->messages) {
+        s.Post("/api/messages", [this](const httplib::Request &req, httplib::Response &res){
+            try{
+                auto j = json::parse(req.body);
+                long long user_id = bearer_user(pimpl->tokens, req);
+                if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+                long long to = j.value("to", 0LL);
+                std::string text = j.value("text", "");
+                if(to<=0 || to==user_id || text.empty() || text.size()>2000){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
+                std::vector<User> found;
+                std::string err;
+                if(!pimpl->db.get_users({to}, found, err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+                if(found.empty()){ res.status=404; res.set_content(R"({"ok":false,"error":"no such user"})","application/json"); return; }
+                Message m;
+                if(!pimpl->messages->send(user_id, to, text, m, err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+                res.set_content(json({{"ok",true},{"message_id",m.message_id},{"created_ms",m.created_ms}}).dump(),"application/json");
+            }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
+        });
+
+        // One conversation, newest first; ?with=<user>&before=<next_before>.
+        s.Get("/api/messages", [this](const httplib::Request &req, httplib::Response &res){
+            long long user_id = bearer_user(pimpl->tokens, req);
+            if (user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+            long long with = 0, before = 0;
+            int limit = 20;
+            if (req.has_param("with")) try{ with = std::stoll(req.get_param_value("with")); } catch(...){}
+            if (req.has_param("before")) try{ before = std::stoll(req.get_param_value("before")); } catch(...){}
+            if (req.has_param("limit")) {
+                try { limit = std::stoi(req.get_param_value("limit")); } catch(...) { limit = 20; }
+            }
+            if (limit <= 0 || limit > 100) limit = 20;
+            if (with <= 0) { res.status=400; res.set_content(R"({"ok":false,"error":"invalid with"})","application/json"); return; }
+            std::vector<Message> list;
+            std::string out, err;
+            if (!pimpl->messages->history(user_id, with, before, static_cast<size_t>(limit), list, err)) {
+                res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+            }
+            render_messages(list, list.size() == static_cast<size_t>(limit) ? list.back().message_id : 0, out);
+            res.set_content(std::move(out), "application/json");
+        });
+
+        // Conversation list with unread counts, from memory.
+        s.Get("/api/conversations", [this](const httplib::Request &req, httplib::Response &res){
+            long long user_id = bearer_user(pimpl->tokens, req);
+            if (user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+            std::vector<MessageStore::Conversation> convs;
+            uint32_t unread = 0;
+            pimpl->messages->conversations(user_id, convs, unread);
+            std::vector<long long> peer_ids;
+            peer_ids.reserve(convs.size());
+            for (const auto &c : convs) peer_ids.push_back(c.peer_id);
+            std::vector<User> peers;
+            std::string out, err;
+            if (!pimpl->db.get_users(peer_ids, peers, err)) {
+                res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+            }
+            render_conversations(convs, unread, peers, out);
+            res.set_content(std::move(out), "application/json");
+        });
+
+        s.Post("/api/messages/read", [this](const httplib::Request &req, httplib::Response &res){
+            try{
+                auto j = json::parse(req.body);
+                long long user_id = bearer_user(pimpl->tokens, req);
+                if(user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+                long long with = j.value("with", 0LL);
+                if(with<=0){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid input"})","application/json"); return; }
+                std::string err;
+                if(!pimpl->messages->mark_read(user_id, with, err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+                res.set_content(json({{"ok",true}}).dump(),"application/json");
+            }catch(...){ res.status=400; res.set_content(R"({"ok":false})","application/json"); }
+        });
+
+        // Long-poll: ?since=<seq of the previous answer> (none = just the
+        // current seq) waits up to ?timeout= seconds for messages to or from
+        // the user. Answered from the store's memory; resync means reload
+        // the conversations. Under the epoll front end the wait is handed
+        // back to the reactor and answered by the pump (kicked per user by
+        // the store); otherwise it holds a worker and shares the stream cap.
+        s.Get("/api/messages/poll", [this](const httplib::Request &req, httplib::Response &res){
+            long long user_id = bearer_user(pimpl->tokens, req);
+            if (user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+            uint64_t since = 0;
+            int timeout = 25;
+            if (req.has_param("since")) try{ since = std::stoull(req.get_param_value("since")); } catch(...){}
+            if (req.has_param("timeout")) try{ timeout = std::stoi(req.get_param_value("timeout")); } catch(...){}
+            timeout = std::max(0, std::min(timeout, 30));
+            res.set_header("Cache-Control", "no-cache");
+            if (auto out = DetachedResponse::detach(res, "application/json")) {
+                MessageStore *store = pimpl->messages.get();
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+                pimpl->pump.add(static_cast<uint64_t>(user_id), [store, out, user_id, since, deadline](
+                                                                    StreamPump::Clock::time_point now, bool final) {
+                    std::vector<MessageStore::Delivery> got;
+                    uint64_t seq = 0;
+                    auto st = store->poll(user_id, since, std::chrono::milliseconds(0), got, seq);
+                    if (st == MessageStore::Timeout && !final && now < deadline && out->alive()) return true;
+                    std::string body;
+                    render_deliveries(got, seq, st == MessageStore::Resync, body);
+                    out->write(body);
+                    out->close();
+                    return false;
+                });
+                return;
+            }
+            if (pimpl->blocking_streams.fetch_add(1) >= pimpl->max_blocking_streams) {
+                pimpl->blocking_streams.fetch_sub(1);
+                res.status = 503;
+                res.set_header("Retry-After", "10");
+                res.set_content(R"({"ok":false,"error":"too many waiters"})","application/json");
+                return;
+            }
+            std::vector<MessageStore::Delivery> got;
+            uint64_t seq = 0;
+            auto st = pimpl->messages->poll(user_id, since, std::chrono::seconds(timeout), got, seq);
+            pimpl->blocking_streams.fetch_sub(1);
+            std::string out;
+            render_deliveries(got, seq, st == MessageStore::Resync, out);
+            res.set_content(std::move(out), "application/json");
+        });
+
+        // The same as server-sent events; the event id is the seq, so
+        // EventSource resumes with Last-Event-ID. EventSource cannot send an
+        // Authorization header, so the session token may come as ?token=.
+        s.Get("/api/messages/stream", [this](const httplib::Request &req, httplib::Response &res){
+            long long user_id = bearer_user(pimpl->tokens, req);
+            if (user_id<=0 && req.has_param("token")) user_id = pimpl->tokens.find(req.get_param_value("token"));
+            if (user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+            uint64_t since = 0;
+            if (req.has_header("Last-Event-ID")) {
+                try { since = std::stoull(req.get_header_value("Last-Event-ID")); } catch(...) {}
+            }
+            static const auto STREAM_MAX_AGE = std::chrono::minutes(10);
+            static const auto KEEPALIVE = std::chrono::seconds(15);
+            // one step of the stream: what arrived after `since`, as SSE frames
+            auto frames = [](MessageStore::PollStatus st, const std::vector<MessageStore::Delivery> &got, uint64_t seq,
+                             std::string &buf) {
+                std::string data;
+                for (const auto &d : got) {
+                    render_message(*d.message, data);
+                    buf += "id: " + std::to_string(d.seq) + "\nevent: message\ndata: " + data + "\n\n";
+                }
+                if (st == MessageStore::Resync) buf += "id: " + std::to_string(seq) + "\nevent: resync\ndata: {}\n\n";
+            };
+            auto started = std::chrono::steady_clock::now();
+            bool first = true;
+            res.set_header("Cache-Control", "no-cache");
+            res.set_header("X-Accel-Buffering", "no");
+            if (auto out = DetachedResponse::detach(res, "text/event-stream")) {
+                MessageStore *store = pimpl->messages.get();
+                auto last_write = started;
+                pimpl->pump.add(static_cast<uint64_t>(user_id), [store, out, user_id, since, started, last_write, first,
+                                                                 frames](StreamPump::Clock::time_point now, bool final) mutable {
+                    std::string buf;
+                    if (first) { buf = "retry: 3000\n\n"; first = false; }
+                    std::vector<MessageStore::Delivery> got;
+                    uint64_t seq = 0;
+                    auto st = store->poll(user_id, since, std::chrono::milliseconds(0), got, seq);
+                    frames(st, got, seq, buf);
+                    since = seq;
+                    if (st == MessageStore::Timeout && now - last_write >= KEEPALIVE) buf += ": keepalive\n\n";
+                    if (!buf.empty()) last_write = now;
+                    bool ok = buf.empty() ? out->alive() : out->write(buf);
+                    if (ok && !final && st != MessageStore::Closed && now - started <= STREAM_MAX_AGE) return true;
+                    out->close();
+                    return false;
+                });
+                return;
+            }
+            if (pimpl->blocking_streams.fetch_add(1) >= pimpl->max_blocking_streams) {
+                pimpl->blocking_streams.fetch_sub(1);
+                res.status = 503;
+                res.set_header("Retry-After", "10");
+                res.set_content(R"({"ok":false,"error":"too many streams"})","application/json");
+                return;
+            }
+            res.set_chunked_content_provider("text/event-stream",
+                [this, user_id, since, started, first, frames](size_t, httplib::DataSink &sink) mutable {
+                    std::string buf;
+                    if (first) { buf = "retry: 3000\n\n"; first = false; }
+                    std::vector<MessageStore::Delivery> got;
+                    uint64_t seq = 0;
+                    auto st = pimpl->messages->poll(user_id, since, since ? std::chrono::milliseconds(KEEPALIVE)
+                                                                          : std::chrono::milliseconds(0), got, seq);
+                    frames(st, got, seq, buf);
+                    if (st == MessageStore::Timeout) buf += ": keepalive\n\n";
+                    since = seq;
+                    if (!buf.empty() && !sink.write(buf.data(), buf.size())) return false;
+                    if (st == MessageStore::Closed || std::chrono::steady_clock::now() - started > STREAM_MAX_AGE) {
+                        sink.done();
+                    }
+                    return true;
+                },
+                [this](bool) { pimpl->blocking_streams.fetch_sub(1); });
+        });
+    }
+
     s.Get("/api/user_likes", [this](const httplib::Request &req, httplib::Response &res){
-        long user_id = auth_user(req);
+        long long user_id = auth_user(req);
         if (user_id<=0){ res.status=401; res.set_content(R"({"ok":false,"error":"unauthorized"})","application/json"); return; }
+        std::vector<long long> weibo_ids;
         std::string out, err;
-        if(!pimpl->db.get_user_likes(user_id,out,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
-        res.set_content(out, "application/json");
+        if(!pimpl->db.get_user_likes(user_id,weibo_ids,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+        render_weibo_ids(weibo_ids, out);
+        res.set_content(std::move(out), "application/json");
     });
 
     s.Get("/api/following", [this](const httplib::Request &req, httplib::Response &res){
-        long user_id = 0;
-        if (req.has_param("user_id")) try{ user_id = std::stol(req.get_param_value("user_id")); } catch(...){}
+        long long user_id = 0;
+        if (req.has_param("user_id")) try{ user_id = std::stoll(req.get_param_value("user_id")); } catch(...){}
         if(user_id<=0){ res.status=400; res.set_content(R"({"ok":false,"error":"invalid user_id"})","application/json"); return; }
-        std::string out, err;
-        if(!pimpl->db.get_following(user_id,out,err)){ res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
-        res.set_content(out, "application/json");
+        auto &v = pimpl->versions;
+        const std::string etag = v.etag(VersionTable::Following, user_id, v.get(VersionTable::Following, user_id),
+                                        v.get(VersionTable::Profiles));
+        if (not_modified(req, res, etag)) return;
+        const auto since = std::max(v.changed(VersionTable::Following, user_id), v.changed(VersionTable::Profiles));
+        std::string err;
+        if (!pimpl->send_shared("following:" + etag, since,
+                [this, user_id](std::string &out, std::string &e) {
+                    std::vector<User> users;
+                    if (!pimpl->db.get_following(user_id,users,e)) return false;
+                    render_users(users, out);
+                    return true;
+                },
+                req, res, err)) {
+            res.status = 500;
+            res.set_content(json({{"ok",false},{"error",err}}).dump(), "application/json");
+            return;
+        }
     });
 
     s.Get("/api/weibos", [this](const httplib::Request &req, httplib::Response &res){
+        // ?ids=1,2,3 fetches just the posts announced on /api/stream
+        if (req.has_param("ids")) {
+            std::vector<long long> ids;
+            ids.reserve(16);
+            const std::string &param = req.get_param_value("ids");
+            for (const char *p = param.c_str(), *end = p + param.size(); p < end && ids.size() < 100; ++p) {
+                long long id = 0;
+                auto r = std::from_chars(p, end, id);
+                if (r.ec == std::errc() && id > 0) ids.push_back(id);
+                p = std::find(r.ptr, end, ',');
+            }
+            // every client of /api/stream asks for the same new ids at once
+            std::string key = "ids:" + std::to_string(pimpl->versions.get(VersionTable::Feed));
+            for (long long id : ids) key.append(1, ',').append(std::to_string(id));
+            std::string err;
+            if (!pimpl->send_shared(key, pimpl->versions.changed(VersionTable::Feed),
+                    [this, &ids](std::string &out, std::string &e) {
+                        WeiboList list;
+                        if (!pimpl->db.get_weibos_by_ids(ids, list, e)) return false;
+                        render_weibos(list, out);
+                        return true;
+                    },
+                    req, res, err)) {
+                res.status = 500;
+                res.set_content(json({{"ok",false},{"error",err}}).dump(), "application/json");
+            }
+            return;
+        }
         int limit = 50;
         if (req.has_param("limit")) {
             try { limit = std::stoi(req.get_param_value("limit")); }
             catch(...) { limit = 50; }
         }
-        std::string json_out, err;
-        if (!pimpl->db.get_weibos(limit, json_out, err)) {
+        limit = limit <= 0 || limit > 100 ? 50 : page_size(limit);
+        // ?before=<weibo_id>: the next page, older than the last one shown
+        long long before = 0;
+        if (req.has_param("before")) try { before = std::stoll(req.get_param_value("before")); } catch(...) {}
+        if (before > 0) {
+            std::string key = "before:" + std::to_string(pimpl->versions.get(VersionTable::Feed)) + ":" +
+                              std::to_string(limit) + ":" + std::to_string(before);
+            std::string err;
+            if (!pimpl->send_shared(key, pimpl->versions.changed(VersionTable::Feed),
+                    [this, limit, before](std::string &out, std::string &e) {
+                        WeiboList list;
+                        if (!pimpl->db.get_weibos(limit, before, list, e)) return false;
+                        render_weibos(list, out);
+                        return true;
+                    },
+                    req, res, err)) {
+                res.status = 500;
+                res.set_content(json({{"ok",false},{"error",err}}).dump(), "application/json");
+            }
+            return;
+        }
+        if (not_modified(req, res, pimpl->versions.etag(VersionTable::Feed, limit, pimpl->versions.get(VersionTable::Feed)))) return;
+        std::string err;
+        if (!pimpl->send_page("latest:" + std::to_string(limit), std::chrono::seconds(60),
+                [this, limit](std::string &out, std::string &e) {
+                    WeiboList list;
+                    if (!pimpl->db.get_weibos(limit, 0, list, e)) return false;
+                    render_weibos(list, out);
+                    return true;
+                },
+                req, res, err)) {
             res.status = 500;
             res.set_content(json({{"ok",false},{"error",err}}).dump(), "application/json");
             return;
         }
-        res.set_content(json_out, "application/json");
+    });
+
+    // Server-sent events: compact deltas (new post ids, like/comment count
+    // changes) from the in-process hub. Under the epoll front end the stream
+    // is handed back to the reactor and fed by the pump, so it costs a
+    // connection rather than a worker; under httplib's listener each stream
+    // holds a worker and they are capped well below the worker count. A slow
+    // reader is dropped once its queue overflows, and streams are recycled
+    // after STREAM_MAX_AGE; EventSource reconnects with Last-Event-ID and
+    // resumes from the hub's history.
+    s.Get("/api/stream", [this](const httplib::Request &req, httplib::Response &res){
+        uint64_t last_id = 0;
+        if (req.has_header("Last-Event-ID")) {
+            try { last_id = std::stoull(req.get_header_value("Last-Event-ID")); } catch(...) {}
+        }
+        static const auto STREAM_MAX_AGE = std::chrono::minutes(10);
+        static const auto KEEPALIVE = std::chrono::seconds(15);
+        auto too_many = [&res] {
+            res.status = 503;
+            res.set_header("Retry-After", "10");
+            res.set_content(R"({"ok":false,"error":"too many streams"})","application/json");
+        };
+        auto sub = pimpl->hub.subscribe(last_id);
+        if (!sub) { too_many(); return; }
+        auto out = DetachedResponse::detach(res, "text/event-stream");
+        if (!out && pimpl->blocking_streams.fetch_add(1) >= pimpl->max_blocking_streams) {
+            pimpl->blocking_streams.fetch_sub(1);
+            pimpl->hub.unsubscribe(sub);
+            too_many();
+            return;
+        }
+        auto started = std::chrono::steady_clock::now();
+        res.set_header("Cache-Control", "no-cache");
+        res.set_header("X-Accel-Buffering", "no");
+        if (out) {
+            Impl *impl = pimpl;
+            auto last_write = started;
+            bool first = true;
+            pimpl->pump.add(0, [impl, sub, out, started, last_write, first](StreamPump::Clock::time_point now,
+                                                                            bool final) mutable {
+                std::string buf;
+                if (first) { buf = "retry: 3000\n\n"; first = false; }
+                std::vector<EventHub::Event> events;
+                auto st = final ? EventHub::Subscription::Closed : sub->wait(events, std::chrono::milliseconds(0));
+                append_events(events, buf);
+                if (st == EventHub::Subscription::Overflow) buf += "event: resync\ndata: {}\n\n";
+                else if (st == EventHub::Subscription::Timeout && now - last_write >= KEEPALIVE) buf += ": keepalive\n\n";
+                if (!buf.empty()) last_write = now;
+                bool ok = buf.empty() ? out->alive() : out->write(buf);
+                if (ok && st != EventHub::Subscription::Overflow && st != EventHub::Subscription::Closed &&
+                    now - started <= STREAM_MAX_AGE) {
+                    return true;
+                }
+                out->close();
+                impl->hub.unsubscribe(sub);
+                return false;
+            });
+            return;
+        }
+        bool first = true;
+        res.set_chunked_content_provider("text/event-stream",
+            [sub, started, first](size_t, httplib::DataSink &sink) mutable {
+                std::string buf;
+                if (first) { buf = "retry: 3000\n\n"; first = false; }
+                std::vector<EventHub::Event> events;
+                auto st = sub->wait(events, std::chrono::duration_cast<std::chrono::milliseconds>(KEEPALIVE));
+                append_events(events, buf);
+                if (st == EventHub::Subscription::Overflow) buf += "event: resync\ndata: {}\n\n";
+                else if (st == EventHub::Subscription::Timeout) buf += ": keepalive\n\n";
+                if (!buf.empty() && !sink.write(buf.data(), buf.size())) return false;
+                if (st == EventHub::Subscription::Overflow || st == EventHub::Subscription::Closed ||
+                    std::chrono::steady_clock::now() - started > STREAM_MAX_AGE) {
+                    sink.done();
+                }
+                return true;
+            },
+            [this, sub](bool) {
+                pimpl->hub.unsubscribe(sub);
+                pimpl->blocking_streams.fetch_sub(1);
+            });
+    });
+
+    // hot feed: ids come from the in-memory ranking, rows from one ANY($1) query
+    s.Get("/api/weibos/hot", [this](const httplib::Request &req, httplib::Response &res){
+        int limit = 20;
+        if (req.has_param("limit")) {
+            try { limit = std::stoi(req.get_param_value("limit")); } catch(...) { limit = 20; }
+        }
+        limit = limit <= 0 || limit > 100 ? 20 : page_size(limit);
+        std::string err;
+        if (!pimpl->send_page("hot:" + std::to_string(limit), std::chrono::seconds(1),
+                [this, limit](std::string &out, std::string &e) {
+                    WeiboList list;
+                    if (!pimpl->db.get_weibos_by_ids(pimpl->hot.top(static_cast<size_t>(limit)), list, e)) return false;
+                    render_weibos(list, out);
+                    return true;
+                }, req, res, err)) {
+            res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return;
+        }
+    });
+
+    // full-text search over weibo content, newest first
+    s.Get("/api/search", [this](const httplib::Request &req, httplib::Response &res){
+        std::string q = req.has_param("q") ? req.get_param_value("q") : "";
+        if (q.empty() || q.size() > 256) { res.status=400; res.set_content(R"({"ok":false,"error":"invalid query"})","application/json"); return; }
+        int limit = 20;
+        if (req.has_param("limit")) {
+            try { limit = std::stoi(req.get_param_value("limit")); } catch(...) { limit = 20; }
+        }
+        if (limit <= 0 || limit > 100) limit = 20;
+        auto ids = pimpl->search.search(q, static_cast<size_t>(limit));
+        WeiboList list;
+        std::string out, err;
+        if (!pimpl->db.get_weibos_by_ids(ids, list, err)) { res.status=500; res.set_content(json({{"ok",false},{"error",err}}).dump(),"application/json"); return; }
+        render_weibos(list, out);
+        res.set_content(std::move(out), "application/json");
     });
 
     // Try to serve frontend static files. Pick the first existing relative
@@ -320,9 +1430,94 @@ bool Server::init(const std::string &conninfo) {
     return true;
 }
 
+void Server::configure(const ServerOptions &opt) {
+    pimpl->opt = opt;
+}
+
+void Server::stop() {
+    std::lock_guard<std::mutex> lk(pimpl->front_mu);
+    pimpl->stopping = true;
+    if (pimpl->messages) pimpl->messages->interrupt();
+    if (pimpl->front) pimpl->front->stop();
+    pimpl->svr.stop();
+}
+
 void Server::run(int port) {
     std::cout << "Starting YUYU server on port " << port << "\n";
-    pimpl->svr.listen("0.0.0.0", port);
+    const ServerOptions &so = pimpl->opt;
+    if (!so.snapshot_path.empty() && so.snapshot_interval_s > 0) {
+        pimpl->snapshotter = std::thread([this] {
+            std::unique_lock<std::mutex> lk(pimpl->snapshot_mu);
+            const auto every = std::chrono::seconds(pimpl->opt.snapshot_interval_s);
+            while (!pimpl->snapshot_cv.wait_for(lk, every, [this] { return pimpl->snapshot_stop; })) {
+                lk.unlock();
+                std::string err;
+                if (!pimpl->save_snapshot(err)) std::cerr << "snapshot error: " << err << "\n";
+                lk.lock();
+            }
+        });
+    }
+    if (so.work_stealing) {
+        WorkStealingExecutor::Options eo;
+        eo.threads = so.worker_threads ? so.worker_threads : CPPHTTPLIB_THREAD_POOL_COUNT;
+        eo.pin_threads = so.pin_threads;
+        pimpl->exec.reset(new WorkStealingExecutor(eo));
+        std::cout << "work-stealing executor: " << pimpl->exec->size() << " workers\n";
+        pimpl->exec->every(std::chrono::milliseconds(1000), [this] { pimpl->hot.refresh(); });
+    } else {
+        pimpl->hot.start();
+    }
+    KdfPool::Options ko;
+    ko.threads = so.kdf_threads;
+    ko.capacity = so.kdf_queue;
+    ko.max_wait_ms = so.kdf_max_wait_ms;
+    ko.params = so.kdf_params;
+    pimpl->kdf.reset(new KdfPool(ko));
+    std::cout << "password hashing: " << pimpl->kdf->options().threads << " threads, scrypt N=2^"
+              << ko.params.log_n << " r=" << ko.params.r << " p=" << ko.params.p << "\n";
+    size_t workers = pimpl->exec ? pimpl->exec->size() : so.worker_threads ? so.worker_threads : CPPHTTPLIB_THREAD_POOL_COUNT;
+    pimpl->max_blocking_streams = static_cast<int>(std::max<size_t>(1, workers / 4));
+    pimpl->pump.start();
+    WorkStealingExecutor *exec = pimpl->exec.get();
+    pimpl->svr.new_task_queue = [so, exec] {
+        BoundedTaskQueue::Options q;
+        q.threads = so.worker_threads;
+        q.capacity = so.queue_capacity;
+        q.deadline_ms = so.queue_deadline_ms;
+        q.executor = exec;
+        return new BoundedTaskQueue(q);
+    };
+    auto listen = [&] {
+        if (so.event_loops >= 0 && EventLoopServer::supported()) {
+            EventLoopServer::Options opt;
+            opt.loops = so.event_loops;
+            EventLoopServer front(pimpl->svr, opt);
+            {
+                std::lock_guard<std::mutex> lk(pimpl->front_mu);
+                if (pimpl->stopping) return;
+                pimpl->front = &front;
+            }
+            std::cout << "using epoll front end\n";
+            bool ok = front.listen("0.0.0.0", port);
+            {
+                std::lock_guard<std::mutex> lk(pimpl->front_mu);
+                pimpl->front = nullptr;
+            }
+            if (ok) return;
+            std::cerr << "epoll front end failed, falling back to httplib listener\n";
+        }
+        {
+            std::lock_guard<std::mutex> lk(pimpl->front_mu);
+            if (pimpl->stopping) return;
+        }
+        pimpl->svr.listen("0.0.0.0", port);
+    };
+    listen();
+    pimpl->pump.stop();
+    if (!so.snapshot_path.empty()) {
+        std::string err;
+        if (!pimpl->save_snapshot(err)) std::cerr << "snapshot error: " << err << "\n";
+    }
 }
 
 } // namespace YUYU
\ No newline at end of file
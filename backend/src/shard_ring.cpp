@@ -0,0 +1,36 @@
+#include "shard_ring.h"
+#include <algorithm>
+
+namespace YUYU {
+
+namespace {
+
+uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+} // namespace
+
+ShardRing::ShardRing(size_t shards, size_t vnodes) : shards_(shards ? shards : 1) {
+    if (shards_ == 1) return;
+    points_.reserve(shards_ * vnodes);
+    for (size_t s = 0; s < shards_; ++s) {
+        for (size_t v = 0; v < vnodes; ++v) {
+            points_.emplace_back(mix((static_cast<uint64_t>(s) << 32) | v), static_cast<uint32_t>(s));
+        }
+    }
+    std::sort(points_.begin(), points_.end());
+}
+
+size_t ShardRing::locate(uint64_t key) const {
+    if (points_.empty()) return 0;
+    uint64_t h = mix(key ^ 0x5bd1e9955bd1e995ULL);
+    auto it = std::lower_bound(points_.begin(), points_.end(), std::make_pair(h, uint32_t(0)));
+    if (it == points_.end()) it = points_.begin();
+    return it->second;
+}
+
+} // namespace YUYU
@@ -0,0 +1,158 @@
+#include "snapshot.h"
+#include <zlib.h>
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace YUYU {
+
+namespace {
+
+const char kMagic[8] = {'Y', 'U', 'Y', 'U', 'S', 'N', 'A', 'P'};
+const uint32_t kVersion = 1;
+const size_t kHeaderBytes = 8 + 4 + 4 + 8 + 8 + 4;
+const size_t kEntryBytes = 4 + 4 + 8 + 8;
+
+uint32_t checksum(const char *p, size_t n) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    // crc32 takes a uInt length
+    while (n > 0) {
+        uInt chunk = static_cast<uInt>(std::min<size_t>(n, 1u << 30));
+        crc = crc32(crc, reinterpret_cast<const Bytef *>(p), chunk);
+        p += chunk;
+        n -= chunk;
+    }
+    return static_cast<uint32_t>(crc);
+}
+
+size_t align8(size_t n) { return (n + 7) & ~static_cast<size_t>(7); }
+
+} // namespace
+
+std::string &SnapshotWriter::section(uint32_t tag) {
+    sections_.emplace_back(tag, std::string());
+    return sections_.back().second;
+}
+
+bool SnapshotWriter::write(const std::string &path, const SnapshotWatermark &mark, std::string &err) const {
+    std::string head;
+    SnapshotOut out(head);
+    out.bytes(kMagic, sizeof(kMagic));
+    out.u32(kVersion);
+    out.u32(static_cast<uint32_t>(sections_.size()));
+    out.i64(mark.taken_ms);
+    out.i64(mark.last_weibo_id);
+    out.u32(checksum(head.data(), head.size()));
+
+    size_t offset = align8(kHeaderBytes + sections_.size() * kEntryBytes);
+    for (const auto &s : sections_) {
+        out.u32(s.first);
+        out.u32(checksum(s.second.data(), s.second.size()));
+        out.u64(offset);
+        out.u64(s.second.size());
+        offset = align8(offset + s.second.size());
+    }
+    head.resize(align8(head.size()), '\0');
+
+    const std::string tmp = path + ".tmp";
+    FILE *f = std::fopen(tmp.c_str(), "wb");
+    if (!f) {
+        err = "cannot create " + tmp;
+        return false;
+    }
+    static const char pad[8] = {};
+    bool ok = std::fwrite(head.data(), 1, head.size(), f) == head.size();
+    for (const auto &s : sections_) {
+        if (!ok) break;
+        ok = std::fwrite(s.second.data(), 1, s.second.size(), f) == s.second.size();
+        size_t gap = align8(s.second.size()) - s.second.size();
+        if (ok && gap) ok = std::fwrite(pad, 1, gap, f) == gap;
+    }
+    ok = ok && std::fflush(f) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(f)) == 0;
+#else
+    ok = ok && fsync(fileno(f)) == 0;
+#endif
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok) {
+        err = "cannot write " + tmp;
+        std::remove(tmp.c_str());
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmp, path, ec);
+    if (ec) {
+        err = "cannot replace " + path + ": " + ec.message();
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+std::unique_ptr<Snapshot> Snapshot::open(const std::string &path, std::string &err) {
+    std::shared_ptr<const MappedFile> file = MappedFile::open(path);
+    if (!file) {
+        err = "no snapshot at " + path;
+        return nullptr;
+    }
+    if (file->size() < kHeaderBytes) {
+        err = "snapshot truncated";
+        return nullptr;
+    }
+    SnapshotIn in(file->data(), file->size());
+    const char *magic = in.bytes(sizeof(kMagic));
+    uint32_t version = in.u32();
+    uint32_t count = in.u32();
+    std::unique_ptr<Snapshot> snap(new Snapshot());
+    snap->mark_.taken_ms = in.i64();
+    snap->mark_.last_weibo_id = in.i64();
+    uint32_t crc = in.u32();
+    if (std::memcmp(magic, kMagic, sizeof(kMagic)) != 0) {
+        err = "not a snapshot";
+        return nullptr;
+    }
+    if (version != kVersion) {
+        err = "snapshot format " + std::to_string(version) + ", expected " + std::to_string(kVersion);
+        return nullptr;
+    }
+    if (crc != checksum(file->data(), kHeaderBytes - 4)) {
+        err = "snapshot header checksum mismatch";
+        return nullptr;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t tag = in.u32();
+        uint32_t sum = in.u32();
+        uint64_t offset = in.u64();
+        uint64_t size = in.u64();
+        if (!in.ok() || offset > file->size() || size > file->size() - offset) {
+            err = "snapshot truncated";
+            return nullptr;
+        }
+        const char *data = file->data() + offset;
+        if (checksum(data, static_cast<size_t>(size)) != sum) {
+            err = "snapshot section " + std::to_string(tag) + " checksum mismatch";
+            return nullptr;
+        }
+        snap->sections_.push_back(Entry{tag, data, static_cast<size_t>(size)});
+    }
+    snap->file_ = std::move(file);
+    return snap;
+}
+
+bool Snapshot::section(uint32_t tag, const char *&data, size_t &size) const {
+    for (const Entry &e : sections_) {
+        if (e.tag != tag) continue;
+        data = e.data;
+        size = e.size;
+        return true;
+    }
+    return false;
+}
+
+} // namespace YUYU
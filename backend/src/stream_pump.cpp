@@ -0,0 +1,117 @@
+#include "stream_pump.h"
+#include <iterator>
+
+namespace YUYU {
+
+StreamPump::StreamPump() : StreamPump(Options()) {}
+
+StreamPump::StreamPump(const Options &opt) : opt_(opt) {}
+
+StreamPump::~StreamPump() { stop(); }
+
+void StreamPump::start() {
+    std::lock_guard<std::mutex> lk(mu_);
+    if (th_.joinable() || stop_) return;
+    th_ = std::thread([this] { run(); });
+}
+
+void StreamPump::stop() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (stop_) return;
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (th_.joinable()) th_.join();
+    // never started, or added while the thread was finishing
+    std::vector<std::pair<uint64_t, Step>> left;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        left.swap(added_);
+    }
+    auto now = Clock::now();
+    for (auto &kv : steps_)
+        for (auto &s : kv.second) s(now, true);
+    steps_.clear();
+    for (auto &a : left) a.second(now, true);
+    std::lock_guard<std::mutex> lk(mu_);
+    count_ = 0;
+}
+
+void StreamPump::add(uint64_t key, Step step) {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!stop_) {
+            added_.emplace_back(key, std::move(step));
+            ++count_;
+            cv_.notify_one();
+            return;
+        }
+    }
+    step(Clock::now(), true);
+}
+
+void StreamPump::kick(uint64_t key) {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (!kicked_.insert(key).second) return;
+    }
+    cv_.notify_one();
+}
+
+size_t StreamPump::size() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    return count_;
+}
+
+void StreamPump::run() {
+    auto next_tick = Clock::now() + opt_.tick;
+    std::vector<std::pair<uint64_t, Step>> added;
+    std::unordered_set<uint64_t> kicked;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait_until(lk, next_tick, [this] { return stop_ || !added_.empty() || !kicked_.empty(); });
+            if (stop_) return;
+            added.swap(added_);
+            kicked.swap(kicked_);
+        }
+        auto now = Clock::now();
+        size_t ended = 0;
+        // runs a key's steps, dropping the finished ones
+        auto run_key = [&](std::vector<Step> &list) {
+            for (size_t i = 0; i < list.size();) {
+                if (list[i](now, false)) { ++i; continue; }
+                list[i] = std::move(list.back());
+                list.pop_back();
+                ++ended;
+            }
+        };
+        for (auto &a : added) {
+            if (a.second(now, false)) steps_[a.first].push_back(std::move(a.second));
+            else ++ended;
+        }
+        added.clear();
+        if (now >= next_tick) {
+            for (auto it = steps_.begin(); it != steps_.end();) {
+                run_key(it->second);
+                it = it->second.empty() ? steps_.erase(it) : std::next(it);
+            }
+            next_tick = now + opt_.tick;
+        } else {
+            for (uint64_t key : kicked) {
+                auto it = steps_.find(key);
+                if (it == steps_.end()) continue;
+                run_key(it->second);
+                if (it->second.empty()) steps_.erase(it);
+            }
+        }
+        kicked.clear();
+        if (ended) {
+            std::lock_guard<std::mutex> lk(mu_);
+            count_ -= ended;
+        }
+    }
+}
+
+} // namespace YUYU
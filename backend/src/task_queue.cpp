@@ -0,0 +1,148 @@
+#include "task_queue.h"
+#include "executor.h"
+#include <memory>
+#include <algorithm>
+
+namespace YUYU {
+
+static thread_local bool t_shedding = false;
+// the queue running the calling thread's task, and requests seen in that task
+static thread_local const BoundedTaskQueue *t_queue = nullptr;
+static thread_local size_t t_requests = 0;
+
+BoundedTaskQueue::Verdict BoundedTaskQueue::admit() {
+    if (t_shedding) return Verdict::Shed;
+    if (!t_queue || t_requests++ == 0) return Verdict::Serve;
+    // a later request on a keep-alive connection that still holds its worker
+    size_t waiting = t_queue->waiting_.load(std::memory_order_relaxed);
+    if (waiting >= t_queue->opt_.capacity) {
+        t_shedding = true;      // and any request the client sends after it
+        return Verdict::Shed;
+    }
+    return waiting ? Verdict::ServeAndClose : Verdict::Serve;
+}
+
+BoundedTaskQueue::BoundedTaskQueue(const Options &opt) : opt_(opt) {
+    size_t pool = opt_.threads ? opt_.threads : CPPHTTPLIB_THREAD_POOL_COUNT;
+    size_t n = opt_.executor ? 0 : pool;
+    // a shed task still reads one request from its client, so one slow client
+    // must not hold up the whole lane
+    size_t s = opt_.shed_threads ? opt_.shed_threads : std::max<size_t>(2, pool / 4);
+    threads_.reserve(n + s);
+    for (size_t i = 0; i < n; ++i) threads_.emplace_back([this] { work(); });
+    for (size_t i = 0; i < s; ++i) threads_.emplace_back([this] { shed_work(); });
+}
+
+BoundedTaskQueue::~BoundedTaskQueue() { shutdown(); }
+
+bool BoundedTaskQueue::enqueue(std::function<void()> fn) {
+    std::shared_ptr<Task> task;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (shutdown_) return false;
+        if (opt_.executor && submitted_ < opt_.capacity) {
+            ++submitted_;
+            ++outstanding_;
+            ++waiting_;
+            task = std::make_shared<Task>(Task{std::move(fn), std::chrono::steady_clock::now()});
+        } else if (!opt_.executor && jobs_.size() < opt_.capacity) {
+            jobs_.push_back({std::move(fn), std::chrono::steady_clock::now()});
+            ++waiting_;
+            cv_.notify_one();
+            return true;
+        } else if (shed_jobs_.size() >= opt_.shed_capacity) {
+            ++rejected_;
+            return false;
+        } else {
+            shed_jobs_.push_back(std::move(fn));
+            ++shed_full_;
+        }
+    }
+    if (!task) {
+        shed_cv_.notify_one();
+        return true;
+    }
+    opt_.executor->submit([this, task] {
+        {
+            std::lock_guard<std::mutex> lk(mu_);
+            --submitted_;
+            --waiting_;
+        }
+        run_task(*task);
+        std::lock_guard<std::mutex> lk(mu_);
+        if (--outstanding_ == 0) idle_cv_.notify_all();
+    });
+    return true;
+}
+
+void BoundedTaskQueue::shutdown() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (shutdown_) return;
+        shutdown_ = true;
+    }
+    cv_.notify_all();
+    shed_cv_.notify_all();
+    for (auto &t : threads_) t.join();
+    threads_.clear();
+    std::unique_lock<std::mutex> lk(mu_);
+    idle_cv_.wait(lk, [this] { return outstanding_ == 0; });
+}
+
+void BoundedTaskQueue::run_task(Task &task) {
+    bool late = opt_.deadline_ms > 0 &&
+        std::chrono::steady_clock::now() - task.enqueued > std::chrono::milliseconds(opt_.deadline_ms);
+    if (late) ++shed_deadline_;
+    t_shedding = late;
+    t_queue = this;
+    t_requests = 0;
+    task.fn();
+    t_shedding = false;
+    t_queue = nullptr;
+    ++completed_;
+}
+
+void BoundedTaskQueue::work() {
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            cv_.wait(lk, [this] { return !jobs_.empty() || shutdown_; });
+            if (jobs_.empty()) return;
+            task = std::move(jobs_.front());
+            jobs_.pop_front();
+            --waiting_;
+        }
+        run_task(task);
+    }
+}
+
+void BoundedTaskQueue::shed_work() {
+    t_shedding = true;
+    for (;;) {
+        std::function<void()> fn;
+        {
+            std::unique_lock<std::mutex> lk(mu_);
+            shed_cv_.wait(lk, [this] { return !shed_jobs_.empty() || shutdown_; });
+            if (shed_jobs_.empty()) return;
+            fn = std::move(shed_jobs_.front());
+            shed_jobs_.pop_front();
+        }
+        fn();
+    }
+}
+
+BoundedTaskQueue::Stats BoundedTaskQueue::stats() const {
+    Stats s;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        s.queued = jobs_.size() + submitted_;
+    }
+    s.completed = completed_.load();
+    s.shed_full = shed_full_.load();
+    s.shed_deadline = shed_deadline_.load();
+    s.rejected = rejected_.load();
+    return s;
+}
+
+} // namespace YUYU
@@ -0,0 +1,252 @@
+#include "user_cache.h"
+#include <algorithm>
+#include <thread>
+
+namespace YUYU {
+
+namespace {
+
+// Rough heap footprint of a cached profile, with the map node and control
+// block.
+size_t cost(const User &u) {
+    return sizeof(User) + u.username.capacity() + u.avatar.capacity() + 96;
+}
+
+} // namespace
+
+UserCache::UserCache(const Options &opt, Loader loader)
+    : opt_(opt), loader_(std::move(loader)), shards_(std::max<size_t>(opt.shards, 1)),
+      shard_capacity_(opt.capacity_bytes / shards_.size()) {
+    if (opt_.max_batch == 0) opt_.max_batch = 1;
+}
+
+UserCache::Entry UserCache::lookup(long long id, TimePoint now) {
+    Shard &sh = shard_of(id);
+    std::lock_guard<std::mutex> lk(sh.mu);
+    auto it = sh.index.find(id);
+    if (it == sh.index.end()) return nullptr;
+    Slot &s = sh.slots[it->second];
+    if (s.expires <= now) {
+        sh.bytes -= s.bytes;
+        sh.free.push_back(it->second);
+        s = Slot{};
+        sh.index.erase(it);
+        return nullptr;
+    }
+    s.ref = true;
+    return s.user;
+}
+
+void UserCache::evict_locked(Shard &sh, size_t need) {
+    // At most two sweeps: the first may only clear reference bits.
+    size_t steps = sh.slots.size() * 2;
+    while (sh.bytes + need > shard_capacity_ && !sh.index.empty() && steps--) {
+        if (sh.hand >= sh.slots.size()) sh.hand = 0;
+        Slot &s = sh.slots[sh.hand];
+        if (s.user) {
+            if (s.ref) {
+                s.ref = false;
+            } else {
+                sh.bytes -= s.bytes;
+                sh.index.erase(s.id);
+                sh.free.push_back(sh.hand);
+                s = Slot{};
+            }
+        }
+        ++sh.hand;
+    }
+}
+
+void UserCache::store(const Entry &user, const uint64_t *gen) {
+    size_t bytes = cost(*user);
+    if (bytes > opt_.max_entry_bytes || bytes > shard_capacity_) return;
+    Shard &sh = shard_of(user->user_id);
+    std::lock_guard<std::mutex> lk(sh.mu);
+    if (gen && sh.gen != *gen) return;   // changed while it was being loaded
+
+    auto it = sh.index.find(user->user_id);
+    if (it != sh.index.end()) {
+        Slot &s = sh.slots[it->second];
+        sh.bytes -= s.bytes;
+        sh.free.push_back(it->second);
+        s = Slot{};
+        sh.index.erase(it);
+    }
+    evict_locked(sh, bytes);
+    if (sh.bytes + bytes > shard_capacity_) return;
+
+    size_t at;
+    if (!sh.free.empty()) {
+        at = sh.free.back();
+        sh.free.pop_back();
+    } else {
+        at = sh.slots.size();
+        sh.slots.emplace_back();
+    }
+    Slot &s = sh.slots[at];
+    s.id = user->user_id;
+    s.user = user;
+    s.bytes = bytes;
+    s.expires = std::chrono::steady_clock::now() + std::chrono::milliseconds(opt_.ttl_ms);
+    s.ref = false;
+    sh.bytes += bytes;
+    sh.index.emplace(s.id, at);
+}
+
+void UserCache::put(const User &user) {
+    Shard &sh = shard_of(user.user_id);
+    {
+        std::lock_guard<std::mutex> lk(sh.mu);
+        ++sh.gen;   // a load already running must not overwrite this
+    }
+    store(std::make_shared<const User>(user), nullptr);
+}
+
+void UserCache::invalidate(long long user_id) {
+    Shard &sh = shard_of(user_id);
+    std::lock_guard<std::mutex> lk(sh.mu);
+    ++sh.gen;
+    auto it = sh.index.find(user_id);
+    if (it == sh.index.end()) return;
+    Slot &s = sh.slots[it->second];
+    sh.bytes -= s.bytes;
+    sh.free.push_back(it->second);
+    s = Slot{};
+    sh.index.erase(it);
+}
+
+void UserCache::clear() {
+    for (Shard &sh : shards_) {
+        std::lock_guard<std::mutex> lk(sh.mu);
+        ++sh.gen;
+        sh.slots.clear();
+        sh.free.clear();
+        sh.index.clear();
+        sh.hand = 0;
+        sh.bytes = 0;
+    }
+}
+
+void UserCache::run(const std::shared_ptr<Flight> &f, bool gather) {
+    if (gather && opt_.batch_window_us > 0) std::this_thread::sleep_for(std::chrono::microseconds(opt_.batch_window_us));
+
+    std::vector<long long> ids;
+    {
+        std::lock_guard<std::mutex> lk(flight_mu_);
+        if (open_ == f) open_.reset();
+        ids = f->ids;
+    }
+    // Generations as of before the query; a shard invalidated since then
+    // does not get the loaded value.
+    std::vector<uint64_t> gens(shards_.size());
+    for (size_t i = 0; i < shards_.size(); ++i) {
+        std::lock_guard<std::mutex> lk(shards_[i].mu);
+        gens[i] = shards_[i].gen;
+    }
+
+    std::vector<User> users;
+    std::string err;
+    bool ok = loader_(ids, users, err);
+    {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        ++loads_;
+    }
+
+    std::unordered_map<long long, Entry> found;
+    if (ok) {
+        found.reserve(users.size());
+        for (User &u : users) {
+            Entry e = std::make_shared<const User>(std::move(u));
+            store(e, &gens[static_cast<uint64_t>(e->user_id) % shards_.size()]);
+            found.emplace(e->user_id, std::move(e));
+        }
+    }
+
+    std::lock_guard<std::mutex> lk(flight_mu_);
+    f->ok = ok;
+    f->err = std::move(err);
+    f->found = std::move(found);
+    f->done = true;
+    for (long long id : ids) {
+        auto it = inflight_.find(id);
+        if (it != inflight_.end() && it->second == f) inflight_.erase(it);
+    }
+    flight_cv_.notify_all();
+}
+
+bool UserCache::get(const std::vector<long long> &ids, std::vector<Entry> &out, std::string &err) {
+    out.assign(ids.size(), nullptr);
+    TimePoint now = std::chrono::steady_clock::now();
+    std::vector<size_t> missed;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        out[i] = lookup(ids[i], now);
+        if (!out[i]) missed.push_back(i);
+    }
+    {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        hits_ += ids.size() - missed.size();
+        misses_ += missed.size();
+    }
+    if (missed.empty()) return true;
+
+    // Join running loads and the open batch, or open batches and lead them;
+    // no batch, ours included, grows past max_batch ids.
+    std::unordered_map<long long, std::shared_ptr<Flight>> from;
+    std::vector<std::shared_ptr<Flight>> mine;
+    {
+        std::lock_guard<std::mutex> lk(flight_mu_);
+        for (size_t i : missed) {
+            long long id = ids[i];
+            if (from.count(id)) continue;
+            auto it = inflight_.find(id);
+            if (it != inflight_.end()) {
+                from.emplace(id, it->second);
+                continue;
+            }
+            if (!open_ || open_->ids.size() >= opt_.max_batch) {
+                mine.push_back(std::make_shared<Flight>());
+                open_ = mine.back();
+            }
+            open_->ids.push_back(id);
+            inflight_.emplace(id, open_);
+            from.emplace(id, open_);
+        }
+    }
+    // the full ones go at once; only the last can still take other misses
+    for (size_t i = 0; i < mine.size(); ++i) run(mine[i], i + 1 == mine.size());
+
+    std::unique_lock<std::mutex> lk(flight_mu_);
+    flight_cv_.wait(lk, [&] {
+        for (const auto &kv : from)
+            if (!kv.second->done) return false;
+        return true;
+    });
+    for (size_t i : missed) {
+        const Flight &f = *from[ids[i]];
+        if (!f.ok) {
+            err = f.err;
+            return false;
+        }
+        auto it = f.found.find(ids[i]);
+        if (it != f.found.end()) out[i] = it->second;
+    }
+    return true;
+}
+
+UserCache::Stats UserCache::stats() const {
+    Stats st{};
+    {
+        std::lock_guard<std::mutex> lk(stats_mu_);
+        st.hits = hits_;
+        st.misses = misses_;
+        st.loads = loads_;
+    }
+    for (const Shard &sh : shards_) {
+        std::lock_guard<std::mutex> lk(sh.mu);
+        st.entries += sh.index.size();
+        st.bytes += sh.bytes;
+    }
+    return st;
+}
+
+} // namespace YUYU
@@ -0,0 +1,69 @@
+#include "versions.h"
+#include <chrono>
+#include <cstdio>
+
+namespace YUYU {
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// Concurrent bumps may store out of order; the latest time must win.
+void raise_to(std::atomic<Clock::rep> &at, Clock::rep t) {
+    Clock::rep cur = at.load(std::memory_order_relaxed);
+    while (cur < t && !at.compare_exchange_weak(cur, t, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+} // namespace
+
+VersionTable::VersionTable()
+    : counters_(new std::atomic<uint64_t>[KindCount * kStripes]),
+      changed_(new std::atomic<Clock::rep>[KindCount * kStripes]) {
+    for (size_t i = 0; i < KindCount * kStripes; ++i) {
+        counters_[i].store(0, std::memory_order_relaxed);
+        changed_[i].store(Clock::time_point::min().time_since_epoch().count(), std::memory_order_relaxed);
+    }
+    char buf[24];
+    auto start = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    std::snprintf(buf, sizeof(buf), "%llx", static_cast<unsigned long long>(start));
+    epoch_ = buf;
+}
+
+size_t VersionTable::slot(long long id) const {
+    uint64_t x = static_cast<uint64_t>(id) * 0x9e3779b97f4a7c15ULL;
+    return static_cast<size_t>(x >> 52) & (kStripes - 1);
+}
+
+uint64_t VersionTable::get(Kind kind, long long id) const {
+    return counters_[kind * kStripes + slot(id)].load(std::memory_order_acquire);
+}
+
+Clock::time_point VersionTable::changed(Kind kind, long long id) const {
+    return Clock::time_point(Clock::duration(changed_[kind * kStripes + slot(id)].load(std::memory_order_acquire)));
+}
+
+// The time goes in before the count, so whoever sees the new version sees
+// at least its time.
+void VersionTable::bump(Kind kind, long long id) {
+    size_t i = kind * kStripes + slot(id);
+    raise_to(changed_[i], Clock::now().time_since_epoch().count());
+    counters_[i].fetch_add(1, std::memory_order_acq_rel);
+}
+
+void VersionTable::bump_all() {
+    Clock::rep now = Clock::now().time_since_epoch().count();
+    for (size_t i = 0; i < KindCount * kStripes; ++i) {
+        raise_to(changed_[i], now);
+        counters_[i].fetch_add(1, std::memory_order_acq_rel);
+    }
+}
+
+std::string VersionTable::etag(Kind kind, long long id, uint64_t version, uint64_t extra) const {
+    char buf[96];
+    std::snprintf(buf, sizeof(buf), "W/\"%s-%d-%lld-%llu.%llu\"", epoch_.c_str(), static_cast<int>(kind), id,
+                  static_cast<unsigned long long>(version), static_cast<unsigned long long>(extra));
+    return buf;
+}
+
+} // namespace YUYU
@@ -14,6 +14,7 @@ CREATE TABLE IF NOT EXISTS weibos (
     user_id BIGINT NOT NULL REFERENCES users(user_id) ON DELETE CASCADE,
     content TEXT NOT NULL,
     media TEXT,
+    media_thumb TEXT,
     created_at TIMESTAMP WITH TIME ZONE DEFAULT CURRENT_TIMESTAMP
 );
 
@@ -42,9 +43,61 @@ CREATE TABLE IF NOT EXISTS follows (
     UNIQUE (follower_id, followee_id)
 );
 
+-- 通知收件箱：点赞、评论与关注事件（ID 即对应点赞/评论/关注行的 ID），
+-- 随接收者存放在其所在分片；notification_reads 记录每个用户的已读水位
+CREATE TABLE IF NOT EXISTS notifications (
+    notification_id BIGINT PRIMARY KEY,
+    user_id BIGINT NOT NULL,
+    kind SMALLINT NOT NULL,
+    weibo_id BIGINT NOT NULL DEFAULT 0,
+    actor_id BIGINT NOT NULL,
+    created_at TIMESTAMP WITH TIME ZONE DEFAULT CURRENT_TIMESTAMP
+);
+
+CREATE TABLE IF NOT EXISTS notification_reads (
+    user_id BIGINT PRIMARY KEY,
+    read_id BIGINT NOT NULL DEFAULT 0
+);
+
+-- 已有数据库升级：微博图片的列表尺寸缩略图（由后端图片处理线程生成）
+ALTER TABLE weibos ADD COLUMN IF NOT EXISTS media_thumb TEXT;
+
 -- 索引（按需添加）
 CREATE INDEX IF NOT EXISTS idx_weibos_user_id ON weibos(user_id);
 CREATE INDEX IF NOT EXISTS idx_comments_weibo_id ON comments(weibo_id);
+CREATE INDEX IF NOT EXISTS idx_notifications_user ON notifications(user_id, notification_id);
+
+-- 变更通知（YUYU_CDC）：提交后向 yuyu_changes 通道发送 "操作 表 id a b 节点"，
+-- 例如 "I likes 17 3 42 1"，多个后端据此同步搜索索引、热榜、ETag 与实时推送。
+-- 节点号来自连接上的 yuyu.node 设置，后端会跳过自己写入的变更。
+-- 触发器由后端启动时创建（YUYU_CDC=1）或删除（未启用），未启用时写入不调用 pg_notify；
+-- yuyu_bulk 导入时在事务内设置 yuyu.bulk = 'on'，触发器对这些行直接返回（不锁表、不关闭触发器），
+-- 导入完成后发送一条 "R - 0 0 0 -" 让各后端整体重新同步。
+CREATE OR REPLACE FUNCTION yuyu_notify_change() RETURNS trigger AS $$
+DECLARE
+    r RECORD;
+    id BIGINT;
+    a BIGINT := 0;
+    b BIGINT := 0;
+BEGIN
+    IF current_setting('yuyu.bulk', true) = 'on' THEN RETURN NULL; END IF;
+    IF TG_OP = 'DELETE' THEN r := OLD; ELSE r := NEW; END IF;
+    IF TG_TABLE_NAME = 'weibos' THEN
+        id := r.weibo_id; a := r.user_id;
+    ELSIF TG_TABLE_NAME = 'likes' THEN
+        id := r.like_id; a := r.weibo_id; b := r.user_id;
+    ELSIF TG_TABLE_NAME = 'comments' THEN
+        id := r.comment_id; a := r.weibo_id; b := r.user_id;
+    ELSIF TG_TABLE_NAME = 'follows' THEN
+        id := r.follow_id; a := r.follower_id; b := r.followee_id;
+    ELSE
+        id := r.user_id;
+    END IF;
+    PERFORM pg_notify('yuyu_changes', concat_ws(' ', left(TG_OP, 1), TG_TABLE_NAME, id, a, b,
+        COALESCE(NULLIF(current_setting('yuyu.node', true), ''), '-')));
+    RETURN NULL;
+END;
+$$ LANGUAGE plpgsql;
 
 -- 如果数据库管理员愿意，可以将序列权限授予应用使用的角色（例如 `yuyu_user`）。
 -- 这些语句需要由拥有足够权限的数据库用户（如 `postgres`）执行：
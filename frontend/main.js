@@ -9,6 +9,7 @@ const state = {
   following: new Set()
 };
 state.view = 'all';
+state.hot = false;
 
 function setUser(user){
   state.user = user;
@@ -265,6 +266,13 @@ function initHeaderNav(){
     updateBtn();
     renderWeiboList();
   });
+  const hotBtn = document.getElementById('hotFeedBtn');
+  if(!hotBtn) return;
+  hotBtn.addEventListener('click', async ()=>{
+    state.hot = !state.hot;
+    hotBtn.textContent = state.hot ? '最新' : '热门';
+    await loadFeed();
+  });
 }
 
 function initComposer(){
@@ -323,7 +331,7 @@ function initComposer(){
         if(charCount) charCount.textContent='0/140'; 
         mediaFileInput.value='';
         mediaPreview.style.display='none';
-        loadFeed(); 
+        await prependWeibos([Number(r.body.weibo_id)]);
         alert('发布成功'); 
       }
       else alert('发布失败：' + (r.body?.error || r.error || r.status));
@@ -331,12 +339,97 @@ function initComposer(){
   }
 }
 
+function initSearch(){
+  const form = document.getElementById('searchForm');
+  const input = document.getElementById('searchInput');
+  if(!form || !input) return;
+  form.addEventListener('submit', async (e)=>{
+    e.preventDefault();
+    const q = input.value.trim();
+    if(!q){ await loadFeed(); return; }
+    const r = await apiGet('/search?q='+encodeURIComponent(q)+'&limit=50');
+    state.feed = (r.ok && r.body && Array.isArray(r.body.weibos)) ? r.body.weibos : [];
+    renderWeiboList();
+  });
+}
+
+// 拉取指定 id 的微博并插到列表顶部（发布成功或收到 /stream 推送时使用）
+async function prependWeibos(ids){
+  const fresh = ids.filter(id => id && !state.feed.some(x => Number(x.weibo_id) === id));
+  if(fresh.length === 0 || state.hot) return;
+  const r = await apiGet('/weibos?ids=' + fresh.join(','));
+  if(!(r.ok && r.body && Array.isArray(r.body.weibos))) return;
+  const known = new Set(state.feed.map(x => Number(x.weibo_id)));
+  const add = r.body.weibos.filter(w => !known.has(Number(w.weibo_id)));
+  if(add.length === 0) return;
+  state.feed = add.concat(state.feed).sort((a, b) => Number(b.weibo_id) - Number(a.weibo_id));
+  renderWeiboList();
+}
+
+// 订阅服务端推送：新微博按 id 增量拉取，点赞/评论数直接在页面上更新。
+// 只在页面可见时保持连接：转到后台 30 秒后断开，回到前台时先刷新列表再重新订阅。
+let stream = null;
+let streamIdle = null;
+let streamDropped = false;
+function initStream(){
+  if(!window.EventSource) return;
+  document.addEventListener('visibilitychange', syncStream);
+  syncStream();
+}
+
+function syncStream(){
+  if(document.visibilityState !== 'hidden'){
+    clearTimeout(streamIdle);
+    streamIdle = null;
+    if(stream) return;
+    if(streamDropped){ streamDropped = false; loadFeed(); }
+    stream = openStream();
+  } else if(stream && !streamIdle){
+    streamIdle = setTimeout(() => { stream.close(); stream = null; streamIdle = null; streamDropped = true; }, 30000);
+  }
+}
+
+function openStream(){
+  const es = new EventSource(apiBase + '/stream');
+  const me = () => state.user ? Number(state.user.user_id) : 0;
+  let pending = [];
+  let timer = null;
+  es.addEventListener('weibo', e => {
+    const d = JSON.parse(e.data);
+    pending.push(Number(d.weibo_id));
+    // 合并短时间内的多条新微博，只发一次请求
+    if(!timer) timer = setTimeout(() => { const ids = pending; pending = []; timer = null; prependWeibos(ids); }, 300);
+  });
+  function bump(field, cls){
+    return e => {
+      const d = JSON.parse(e.data);
+      if(Number(d.user_id) === me()) return; // 自己的操作已在本地更新
+      const w = state.feed.find(x => Number(x.weibo_id) === Number(d.weibo_id));
+      if(!w) return;
+      w[field] = Math.max(0, Number(w[field] || 0) + Number(d.delta || 0));
+      const span = document.querySelector(`.weibo-item[data-id="${Number(d.weibo_id)}"] .${cls}`);
+      if(span) span.textContent = String(w[field]);
+    };
+  }
+  es.addEventListener('like', bump('like_count', 'like-count'));
+  es.addEventListener('comment', bump('comment_count', 'comment-count'));
+  es.addEventListener('weibo_deleted', e => {
+    const id = Number(JSON.parse(e.data).weibo_id);
+    if(!state.feed.some(x => Number(x.weibo_id) === id)) return;
+    state.feed = state.feed.filter(x => Number(x.weibo_id) !== id);
+    renderWeiboList();
+  });
+  // 落后太多被服务端丢弃时，整体刷新一次
+  es.addEventListener('resync', () => { loadFeed(); });
+  return es;
+}
+
 async function loadFeed(){
   // 显示加载指示器
   const weiboList = document.getElementById('weiboList');
   if(weiboList) weiboList.innerHTML = '<div class="card" style="text-align: center; padding: 20px;"><div class="loading"></div><p style="margin-top: 8px; color: var(--muted);">加载中...</p></div>';
   
-  const r = await apiGet('/weibos');
+  const r = await apiGet(state.hot ? '/weibos/hot?limit=50' : '/weibos');
   if(r.ok && r.body) state.feed = r.body.weibos || [];
   else state.feed = [];
   if(state.user){
@@ -365,6 +458,7 @@ function renderWeiboList(){
     const id = Number(w.weibo_id || 0);
     const liked = state.user && state.user_likes.has(id);
     const el = document.createElement('div'); el.className='weibo-item';
+    el.dataset.id = String(id);
     el.dataset.author = String(Number(w.user_id || 0));
     // 统一使用圆角方形头像
     const avatarHtml = w.avatar ? 
@@ -393,19 +487,19 @@ function renderWeiboList(){
       <div class="weibo-body">
         <div class="weibo-meta">${escapeHtml(w.username||('用户#'+(w.user_id||'')))} · ${formatTime(w.created_at||Date.now())}</div>
         <div class="weibo-content">${escapeHtml(w.content||'')}</div>
-        ${w.media?('<div style="margin-top:8px"><img src="'+escapeHtml(w.media)+'" style="max-width:100%;border-radius:8px"></div>'):''}
+        ${w.media?('<div style="margin-top:8px"><a href="'+escapeHtml(w.media_full||w.media)+'" target="_blank" rel="noopener"><img src="'+escapeHtml(w.media)+'" loading="lazy" decoding="async" style="max-width:100%;border-radius:8px"></a></div>'):''}
         <div class="weibo-actions" style="margin-top:8px">
           <button class="icon-btn like-btn ${liked ? 'liked' : ''}">
             <svg class="icon icon-like ${liked ? 'liked' : ''}" viewBox="0 0 24 24">
               <path d="${liked ? 'M1 21h4V9H1v12zm22-11c0-1.1-.9-2-2-2h-6.31l.95-4.57.03-.32c0-.41-.17-.79-.44-1.06L14.17 1 7.59 7.59C7.22 7.95 7 8.45 7 9v10c0 1.1.9 2 2 2h9c.83 0 1.54-.5 1.84-1.22l3.02-7.05c.09-.23.14-.47.14-.73v-2z' : 'M1 21h4V9H1v12zm22-11c0-1.1-.9-2-2-2h-6.31l.95-4.57.03-.32c0-.41-.17-.79-.44-1.06L14.17 1 7.59 7.59C7.22 7.95 7 8.45 7 9v10c0 1.1.9 2 2 2h9c.83 0 1.54-.5 1.84-1.22l3.02-7.05c.09-.23.14-.47.14-.73v-2z'}"/>
             </svg>
-            ${liked ? '已赞' : '点赞'} (${Number(w.like_count||0)})
+            ${liked ? '已赞' : '点赞'} (<span class="like-count">${Number(w.like_count||0)}</span>)
           </button>
           <button class="icon-btn comment-toggle comment">
             <svg class="icon icon-comment" viewBox="0 0 24 24">
               <path d="M21 6h-2v9H6v2c0 .55.45 1 1 1h11l4 4V7c0-.55-.45-1-1-1zm-4 6V3c0-.55-.45-1-1-1H3c-.55 0-1 .45-1 1v14l4-4h11c.55 0 1-.45 1-1z"/>
             </svg>
-            评论 (${Number(w.comment_count||0)})
+            评论 (<span class="comment-count">${Number(w.comment_count||0)}</span>)
           </button>
           ${state.user && Number(state.user.user_id) === Number(w.user_id) ? 
             `<button class="icon-btn delete-btn delete">
@@ -477,7 +571,7 @@ function renderWeiboList(){
           <svg class="icon icon-like ${liked ? 'liked' : ''}" viewBox="0 0 24 24">
             <path d="${liked ? 'M1 21h4V9H1v12zm22-11c0-1.1-.9-2-2-2h-6.31l.95-4.57.03-.32c0-.41-.17-.79-.44-1.06L14.17 1 7.59 7.59C7.22 7.95 7 8.45 7 9v10c0 1.1.9 2 2 2h9c.83 0 1.54-.5 1.84-1.22l3.02-7.05c.09-.23.14-.47.14-.73v-2z' : 'M1 21h4V9H1v12zm22-11c0-1.1-.9-2-2-2h-6.31l.95-4.57.03-.32c0-.41-.17-.79-.44-1.06L14.17 1 7.59 7.59C7.22 7.95 7 8.45 7 9v10c0 1.1.9 2 2 2h9c.83 0 1.54-.5 1.84-1.22l3.02-7.05c.09-.23.14-.47.14-.73v-2z'}"/>
           </svg>
-          ${liked ? '已赞' : '点赞'} (${count})
+          ${liked ? '已赞' : '点赞'} (<span class="like-count">${count}</span>)
         `;
         btn.className = `icon-btn like-btn ${liked ? 'liked' : ''}`;
       }
@@ -605,5 +699,7 @@ document.addEventListener('DOMContentLoaded', ()=>{
   initAuth();
   initComposer();
   initHeaderNav();
+  initSearch();
   loadFeed();
+  initStream();
 });
\ No newline at end of file